@@ -3,6 +3,13 @@
 #include "asset_types.h"
 #include "asset_descriptions.h"
 #include "format_obj.h"
+#include "format_mesh.h"
+#include "format_texture.h"
+#include "mip_chain.h"
+#include "texture_compress.h"
+#include "mesh_optimize.h"
+#include "mesh_lod.h"
+#include "parallel.h"
 #include "lib/file.h"
 #include "lib/profile.h"
 #include "image_loader.h"
@@ -56,19 +63,35 @@ INTERNAL const char* _resource_loading_translate_error(u32 code, void* context)
     }
 }
 
-EXTERNAL void process_obj_triangle_mesh(Shape_Assembly* shape_assembly, Triangle_Mesh_Group_Description_Array* descriptions, Format_Obj_Model model)
+typedef enum Obj_Vertex_Dedup {
+    OBJ_VERTEX_DEDUP_VERTEX = 0,            //Deduplicates by the vertex data. Parallel for large meshes.
+    OBJ_VERTEX_DEDUP_INDEX,                 //Deduplicates only by the (pos, uv, norm) index triplets. Fastest.
+    OBJ_VERTEX_DEDUP_INDEX_THEN_VERTEX,     //By triplets and then the new vertices by data. Same result as OBJ_VERTEX_DEDUP_VERTEX but always serial.
+} Obj_Vertex_Dedup;
+
+typedef struct _Obj_Corner_Range {
+    isize from; //index into Format_Obj_Model.indices
+    isize to;
+} _Obj_Corner_Range;
+
+typedef Array(_Obj_Corner_Range) _Obj_Corner_Range_Array;
+
+enum {
+    _OBJ_CORNER_ERROR_NONE = 0,
+    _OBJ_CORNER_ERROR_INVALID_NORM_INDEX,
+    _OBJ_CORNER_ERROR_INVALID_POS_INDEX,
+    _OBJ_CORNER_ERROR_INVALID_UV_INDEX,
+};
+
+//Merges all obj groups with the same name and object into one engine group. 
+//Fills descriptions and the ranges of corners in the order they should be added to the shape.
+INTERNAL void _process_obj_plan_groups(_Obj_Corner_Range_Array* ranges, Triangle_Mesh_Group_Description_Array* descriptions, Format_Obj_Model model, isize triangles_before_all)
 {
-    hash_reserve(&shape_assembly->vertices_hash, model.indices.len);
-    
-    //Try to guess the final needed size
-    array_reserve(&shape_assembly->triangles, shape_assembly->triangles.len + model.indices.len/3); //divided by three since are triangles
-    array_reserve(&shape_assembly->vertices, shape_assembly->vertices.len + model.indices.len/2); //divide by two since some vertices are shared
-
-    //Deduplicate groups
+    i32 triangles_after = (i32) triangles_before_all;
     for(isize parent_group_i = 0; parent_group_i < model.groups.len; parent_group_i++)
     {
         Format_Obj_Group* parent_group = &model.groups.data[parent_group_i];
-        i32 triangles_before = (i32) shape_assembly->triangles.len;
+        i32 triangles_before = triangles_after;
         
         //Skip empty groups
         if(parent_group->trinagles_count <= 0)
@@ -113,103 +136,936 @@ EXTERNAL void process_obj_triangle_mesh(Shape_Assembly* shape_assembly, Triangle
             if(!builder_is_equal(child_group->groups.data[0], parent_group->groups.data[0]))
                 continue;
 
-            isize i_min = (child_group->trinagles_from)*3;
-            isize i_max = (child_group->trinagles_from + child_group->trinagles_count)*3;
+            _Obj_Corner_Range range = {0};
+            range.from = (child_group->trinagles_from)*3;
+            range.to = (child_group->trinagles_from + child_group->trinagles_count)*3;
+            array_push(ranges, range);
+            triangles_after += child_group->trinagles_count;
+        }
+    
+        Triangle_Mesh_Group_Description group_desc = {0};
 
-            //Iterate all indices using a hash map to deduplicate vertex data
-            //and shape it into the vertex structure. 
-            //Discards all triangles that dont have a valid position
-            bool discard_triangle = false;
-            Triangle_Index triangle = {0};
-            for(isize i = i_min; i < i_max; i++)
-            {
-                enum {
-                    NONE = 0,
-                    INVALID_NORM_INDEX,
-                    INVALID_POS_INDEX,
-                    INVALID_UV_INDEX,
-                } error = NONE;
-                isize error_index = 0;
+        //No child or next
+        group_desc.next_i1 = 0;
+        group_desc.child_i1 = 0;
+
+        //Flat for now
+        group_desc.depth = 0;
+
+        //assign its range
+        group_desc.triangles_from = triangles_before;
+        group_desc.triangles_to = triangles_after;
+
+        group_desc.material_name = parent_group->material.string;
+        if(parent_group->groups.len > 0)
+            group_desc.name = parent_group->groups.data[0].string;
+
+        //link the previous group to this one
+        if(descriptions->len > 0)
+            array_last(*descriptions)->next_i1 = (i32) descriptions->len + 1;
+
+        array_push(descriptions, group_desc);
+    }
+}
+
+//Shapes the obj data at index i into the vertex structure. 
+//Invalid indices leave the given part zero and return an error.
+INTERNAL i32 _process_obj_compose_vertex(Vertex* composed_vertex, const Format_Obj_Model* model, isize i, isize* error_index)
+{
+    i32 error = _OBJ_CORNER_ERROR_NONE;
+    Vertex composed = {0};
+    Format_Obj_Vertex_Index index = model->indices.data[i];
+    if(index.norm_i1 < 0 || index.norm_i1 > model->normals.len)
+    {
+        error = _OBJ_CORNER_ERROR_INVALID_NORM_INDEX;
+        *error_index = index.norm_i1;
+    }
+    else if(index.norm_i1 > 0)
+        composed.norm = model->normals.data[index.norm_i1 - 1];
+
+    if(index.pos_i1 < 0 || index.pos_i1 > model->positions.len)
+    {
+        error = _OBJ_CORNER_ERROR_INVALID_POS_INDEX;
+        *error_index = index.pos_i1;
+    }
+    else if(index.pos_i1 > 0)
+        composed.pos = model->positions.data[index.pos_i1 - 1];
+
+    if(index.uv_i1 < 0 || index.uv_i1 > model->uvs.len)
+    {
+        error = _OBJ_CORNER_ERROR_INVALID_UV_INDEX;
+        *error_index = index.uv_i1;
+    }
+    else if(index.uv_i1 > 0)
+        composed.uv = model->uvs.data[index.uv_i1 - 1];
 
-                Vertex composed_vertex = {0};
-                Format_Obj_Vertex_Index index = model.indices.data[i];
-                if(index.norm_i1 < 0 || index.norm_i1 > model.normals.len)
+    *composed_vertex = composed;
+    return error;
+}
+
+INTERNAL void _process_obj_log_vertex_error(i32 error, isize error_index, isize i)
+{
+    const char* error_string = "";
+    switch(error)
+    {
+        default:
+        case _OBJ_CORNER_ERROR_NONE: error_string = "none"; break;
+
+        case _OBJ_CORNER_ERROR_INVALID_NORM_INDEX: error_string = "invalid normal index"; break;
+        case _OBJ_CORNER_ERROR_INVALID_POS_INDEX: error_string = "invalid position index"; break;
+        case _OBJ_CORNER_ERROR_INVALID_UV_INDEX: error_string = "invalid uv-coordinate index"; break;
+    }
+
+    LOG_ERROR("ASSET", "bool processing obj file: %s with index %lli on index number %lli ", error_string, (lli) error_index, (lli) i);
+}
+
+//Iterate all indices using a hash map to deduplicate vertex data and shape it into the vertex structure. 
+INTERNAL void _process_obj_corners_serial(Shape_Assembly* shape_assembly, const Format_Obj_Model* model, const _Obj_Corner_Range* ranges, isize ranges_count)
+{
+    for(isize range_i = 0; range_i < ranges_count; range_i++)
+    {
+        Triangle_Index triangle = {0};
+        for(isize i = ranges[range_i].from; i < ranges[range_i].to; i++)
+        {
+            Vertex composed_vertex = {0};
+            isize error_index = 0;
+            i32 error = _process_obj_compose_vertex(&composed_vertex, model, i, &error_index);
+            if(error != _OBJ_CORNER_ERROR_NONE)
+                _process_obj_log_vertex_error(error, error_index, i);
+
+            u32 final_index = shape_assembly_add_vertex_custom(&shape_assembly->vertices_hash, &shape_assembly->vertices, composed_vertex);
+            u32 mod = i%3;
+            triangle.vertex_i[mod] = final_index;
+            if(mod == 2)
+                array_push(&shape_assembly->triangles, triangle);
+        }
+    }
+}
+
+// Parallel deduplication. Produces the same vertices and triangles as the serial version:
+// 1) Compose all corners into vertices and hash them.
+// 2) Partition the corners by the top bits of their hash into shards keeping their relative order.
+// 3) Deduplicate each shard separately. Equal vertices always land in the same shard and 
+//    are visited in the original order so each corner finds the first corner equal to it.
+// 4) Number the first occurances in order and remap the rest onto them.
+#define PROCESS_OBJ_PARALLEL_MIN_CORNERS (64*1024)
+#define PROCESS_OBJ_SHARD_BITS 8
+#define PROCESS_OBJ_SHARDS (1 << PROCESS_OBJ_SHARD_BITS)
+
+typedef struct _Obj_Dedup_Context {
+    const Format_Obj_Model* model;
+    const i32* sources;         //corner -> index into model.indices
+    Vertex* vertices;           //corner -> composed vertex
+    u64* hashes;                //corner -> vertex_hash64
+    u8* errors;                 //corner -> _OBJ_CORNER_ERROR_XXX
+    i32* first;                 //corner -> first corner with equal vertex 
+    i32* remap;                 //corner -> final vertex index
+    i32* sharded;               //corners ordered by shard
+    i32* tables;                //open addressing tables of all shards
+
+    isize corner_count;
+    isize block_size;
+    isize block_count;
+    isize* block_shard_offsets; //[block_count][PROCESS_OBJ_SHARDS]
+    isize* shard_offsets;       //[PROCESS_OBJ_SHARDS + 1] into sharded
+    isize* table_offsets;       //[PROCESS_OBJ_SHARDS + 1] into tables
+    isize* block_first_offsets; //[block_count] number of first occurances before each block
+
+    Vertex* out_vertices;
+    Triangle_Index* out_triangles;
+    isize vertices_before;
+} _Obj_Dedup_Context;
+
+INTERNAL isize _obj_dedup_shard_of(u64 hash)
+{
+    return (isize) (hash >> (64 - PROCESS_OBJ_SHARD_BITS));
+}
+
+INTERNAL void _obj_dedup_compose_func(void* context, isize from, isize to, isize thread_index)
+{
+    (void) thread_index;
+    _Obj_Dedup_Context* c = (_Obj_Dedup_Context*) context;
+    for(isize k = from; k < to; k++)
+    {
+        isize error_index = 0;
+        c->errors[k] = (u8) _process_obj_compose_vertex(&c->vertices[k], c->model, c->sources[k], &error_index);
+        c->hashes[k] = vertex_hash64(c->vertices[k], 0);
+    }
+}
+
+INTERNAL void _obj_dedup_count_func(void* context, isize from, isize to, isize thread_index)
+{
+    (void) thread_index;
+    _Obj_Dedup_Context* c = (_Obj_Dedup_Context*) context;
+    for(isize block = from; block < to; block++)
+    {
+        isize* counts = c->block_shard_offsets + block*PROCESS_OBJ_SHARDS;
+        isize k_to = MIN((block + 1)*c->block_size, c->corner_count);
+        for(isize k = block*c->block_size; k < k_to; k++)
+            counts[_obj_dedup_shard_of(c->hashes[k])] += 1;
+    }
+}
+
+INTERNAL void _obj_dedup_scatter_func(void* context, isize from, isize to, isize thread_index)
+{
+    (void) thread_index;
+    _Obj_Dedup_Context* c = (_Obj_Dedup_Context*) context;
+    for(isize block = from; block < to; block++)
+    {
+        isize* offsets = c->block_shard_offsets + block*PROCESS_OBJ_SHARDS;
+        isize k_to = MIN((block + 1)*c->block_size, c->corner_count);
+        for(isize k = block*c->block_size; k < k_to; k++)
+            c->sharded[offsets[_obj_dedup_shard_of(c->hashes[k])]++] = (i32) k;
+    }
+}
+
+INTERNAL void _obj_dedup_shard_func(void* context, isize from, isize to, isize thread_index)
+{
+    (void) thread_index;
+    _Obj_Dedup_Context* c = (_Obj_Dedup_Context*) context;
+    for(isize shard = from; shard < to; shard++)
+    {
+        i32* table = c->tables + c->table_offsets[shard];
+        u64 mask = (u64) (c->table_offsets[shard + 1] - c->table_offsets[shard] - 1);
+        for(isize j = c->shard_offsets[shard]; j < c->shard_offsets[shard + 1]; j++)
+        {
+            i32 k = c->sharded[j];
+            u64 hash = c->hashes[k];
+            c->first[k] = k;
+            for(u64 slot = hash & mask;; slot = (slot + 1) & mask)
+            {
+                i32 other = table[slot];
+                if(other == -1)
                 {
-                    error = INVALID_NORM_INDEX;
-                    error_index = index.norm_i1;
+                    table[slot] = k;
+                    break;
                 }
-                else
-                    composed_vertex.norm = model.normals.data[index.norm_i1 - 1];
 
-                if(index.pos_i1 < 0 || index.pos_i1 > model.positions.len)
+                if(c->hashes[other] == hash && memcmp(&c->vertices[other], &c->vertices[k], sizeof(Vertex)) == 0)
                 {
-                    error = INVALID_POS_INDEX;
-                    error_index = index.pos_i1;
+                    c->first[k] = other;
+                    break;
                 }
-                else
-                    composed_vertex.pos = model.positions.data[index.pos_i1 - 1];
+            }
+        }
+    }
+}
+
+INTERNAL void _obj_dedup_count_firsts_func(void* context, isize from, isize to, isize thread_index)
+{
+    (void) thread_index;
+    _Obj_Dedup_Context* c = (_Obj_Dedup_Context*) context;
+    for(isize block = from; block < to; block++)
+    {
+        isize count = 0;
+        isize k_to = MIN((block + 1)*c->block_size, c->corner_count);
+        for(isize k = block*c->block_size; k < k_to; k++)
+            count += c->first[k] == k;
+        c->block_first_offsets[block] = count;
+    }
+}
+
+INTERNAL void _obj_dedup_number_firsts_func(void* context, isize from, isize to, isize thread_index)
+{
+    (void) thread_index;
+    _Obj_Dedup_Context* c = (_Obj_Dedup_Context*) context;
+    for(isize block = from; block < to; block++)
+    {
+        isize index = c->vertices_before + c->block_first_offsets[block];
+        isize k_to = MIN((block + 1)*c->block_size, c->corner_count);
+        for(isize k = block*c->block_size; k < k_to; k++)
+            if(c->first[k] == k)
+            {
+                c->out_vertices[index - c->vertices_before] = c->vertices[k];
+                c->remap[k] = (i32) index++;
+            }
+    }
+}
+
+INTERNAL void _obj_dedup_remap_func(void* context, isize from, isize to, isize thread_index)
+{
+    (void) thread_index;
+    _Obj_Dedup_Context* c = (_Obj_Dedup_Context*) context;
+    for(isize k = from; k < to; k++)
+    {
+        i32 final_index = c->remap[c->first[k]];
+        c->out_triangles[k/3].vertex_i[k%3] = (u32) final_index;
+    }
+}
+
+INTERNAL void _process_obj_corners_parallel(Shape_Assembly* shape_assembly, const Format_Obj_Model* model, const _Obj_Corner_Range* ranges, isize ranges_count, isize corner_count)
+{
+    PROFILE_SCOPE()
+    SCRATCH_ARENA(arena)
+    {
+        _Obj_Dedup_Context c = {0};
+        c.model = model;
+        c.corner_count = corner_count;
+        c.block_size = parallel_batch_size(corner_count, 4, 4096);
+        c.block_count = (corner_count + c.block_size - 1) / c.block_size;
+        c.vertices_before = shape_assembly->vertices.len;
+
+        //All memory is allocated upfront here so the workers dont need to allocate
+        i32_Array sources = {arena.alloc};
+        i32_Array first = {arena.alloc};
+        i32_Array remap = {arena.alloc};
+        i32_Array sharded = {arena.alloc};
+        i32_Array tables = {arena.alloc};
+        u8_Array errors = {arena.alloc};
+        Array(u64) hashes = {arena.alloc};
+        Vertex_Array vertices = {arena.alloc};
+        isize_Array offsets = {arena.alloc};
+
+        array_resize(&sources, corner_count);
+        array_resize(&first, corner_count);
+        array_resize(&remap, corner_count);
+        array_resize(&sharded, corner_count);
+        array_resize(&errors, corner_count);
+        array_resize(&hashes, corner_count);
+        array_resize(&vertices, corner_count);
+        array_resize(&offsets, c.block_count*PROCESS_OBJ_SHARDS + c.block_count + 2*(PROCESS_OBJ_SHARDS + 1));
+
+        c.first = first.data;
+        c.remap = remap.data;
+        c.sharded = sharded.data;
+        c.errors = errors.data;
+        c.hashes = hashes.data;
+        c.vertices = vertices.data;
+        c.block_shard_offsets = offsets.data;
+        c.block_first_offsets = c.block_shard_offsets + c.block_count*PROCESS_OBJ_SHARDS;
+        c.shard_offsets = c.block_first_offsets + c.block_count;
+        c.table_offsets = c.shard_offsets + PROCESS_OBJ_SHARDS + 1;
+
+        isize corner_i = 0;
+        for(isize range_i = 0; range_i < ranges_count; range_i++)
+            for(isize i = ranges[range_i].from; i < ranges[range_i].to; i++)
+                sources.data[corner_i++] = (i32) i;
+        c.sources = sources.data;
+
+        parallel_for(corner_count, c.block_size, _obj_dedup_compose_func, &c);
+
+        //The errors are very rare so we log them serially afterwards 
+        for(isize k = 0; k < corner_count; k++)
+            if(c.errors[k] != _OBJ_CORNER_ERROR_NONE)
+            {
+                isize error_index = 0;
+                Vertex dummy = {0};
+                i32 error = _process_obj_compose_vertex(&dummy, model, c.sources[k], &error_index);
+                _process_obj_log_vertex_error(error, error_index, c.sources[k]);
+            }
+
+        //Partition into shards (stable counting sort)
+        parallel_for(c.block_count, 1, _obj_dedup_count_func, &c);
+        isize offset = 0;
+        for(isize shard = 0; shard < PROCESS_OBJ_SHARDS; shard++)
+        {
+            c.shard_offsets[shard] = offset;
+            for(isize block = 0; block < c.block_count; block++)
+            {
+                isize* count = &c.block_shard_offsets[block*PROCESS_OBJ_SHARDS + shard];
+                isize block_count = *count;
+                *count = offset;
+                offset += block_count;
+            }
+        }
+        c.shard_offsets[PROCESS_OBJ_SHARDS] = offset;
+        parallel_for(c.block_count, 1, _obj_dedup_scatter_func, &c);
+
+        //Each shard gets a power of two sized table at most half full
+        isize table_size = 0;
+        for(isize shard = 0; shard < PROCESS_OBJ_SHARDS; shard++)
+        {
+            isize shard_size = c.shard_offsets[shard + 1] - c.shard_offsets[shard];
+            isize capacity = 16;
+            while(capacity < shard_size*2)
+                capacity *= 2;
+
+            c.table_offsets[shard] = table_size;
+            table_size += capacity;
+        }
+        c.table_offsets[PROCESS_OBJ_SHARDS] = table_size;
+        array_resize(&tables, table_size);
+        memset(tables.data, -1, (size_t) array_byte_size(tables));
+        c.tables = tables.data;
+
+        parallel_for(PROCESS_OBJ_SHARDS, 1, _obj_dedup_shard_func, &c);
+
+        //Number the unique vertices in order of first occurance
+        parallel_for(c.block_count, 1, _obj_dedup_count_firsts_func, &c);
+        isize unique_count = 0;
+        for(isize block = 0; block < c.block_count; block++)
+        {
+            isize count = c.block_first_offsets[block];
+            c.block_first_offsets[block] = unique_count;
+            unique_count += count;
+        }
+
+        isize triangles_before = shape_assembly->triangles.len;
+        array_resize(&shape_assembly->vertices, c.vertices_before + unique_count);
+        array_resize(&shape_assembly->triangles, triangles_before + corner_count/3);
+        c.out_vertices = shape_assembly->vertices.data + c.vertices_before;
+        c.out_triangles = shape_assembly->triangles.data + triangles_before;
+
+        parallel_for(c.block_count, 1, _obj_dedup_number_firsts_func, &c);
+        parallel_for(corner_count, c.block_size, _obj_dedup_remap_func, &c);
+
+        //Keep the hash in the same state as if the vertices were added serially
+        for(isize k = 0; k < corner_count; k++)
+            if(c.first[k] == k)
+                hash_insert(&shape_assembly->vertices_hash, c.hashes[k], (u64) c.remap[k]);
+    }
+}
+
+// Deduplication keyed only on the (pos_i1, uv_i1, norm_i1) triplet of each corner. In obj files
+// duplicate vertices are nearly always just the same triplet repeated so we can skip building 
+// and hashing the full Vertex for each corner. The Vertex is composed only when a triplet
+// is seen for the first time. 
+// 
+// When merge_equal_vertices is set the new vertices are additionally deduplicated by value 
+// (the same way as the serial vertex path) which catches the rare case of different triplets 
+// pointing to equal data. The result is then the same as with OBJ_VERTEX_DEDUP_VERTEX.
+typedef struct _Obj_Triplet_Entry {
+    Format_Obj_Vertex_Index key;
+    i32 vertex_index; //-1 if empty
+} _Obj_Triplet_Entry;
+
+typedef Array(_Obj_Triplet_Entry) _Obj_Triplet_Entry_Array;
+
+INTERNAL u64 _obj_triplet_hash(Format_Obj_Vertex_Index key)
+{
+    u64 hash = (u64) (u32) key.pos_i1 * 0x9E3779B97F4A7C15ULL;
+    hash ^= (u64) (u32) key.uv_i1 * 0xC2B2AE3D27D4EB4FULL;
+    hash ^= (u64) (u32) key.norm_i1 * 0x165667B19E3779F9ULL;
+    return hash ^ (hash >> 32);
+}
 
-                if(index.uv_i1 < 0 || index.uv_i1 > model.uvs.len)
+INTERNAL void _process_obj_corners_by_index(Shape_Assembly* shape_assembly, const Format_Obj_Model* model, const _Obj_Corner_Range* ranges, isize ranges_count, isize corner_count, bool merge_equal_vertices)
+{
+    PROFILE_SCOPE()
+    SCRATCH_ARENA(arena)
+    {
+        //At most 2/3 full even if all corners are unique
+        isize capacity = 16;
+        while(capacity < corner_count + corner_count/2)
+            capacity *= 2;
+
+        _Obj_Triplet_Entry_Array table = {arena.alloc};
+        array_resize(&table, capacity);
+        memset(table.data, -1, (size_t) array_byte_size(table));
+        u64 mask = (u64) capacity - 1;
+
+        for(isize range_i = 0; range_i < ranges_count; range_i++)
+        {
+            Triangle_Index triangle = {0};
+            for(isize i = ranges[range_i].from; i < ranges[range_i].to; i++)
+            {
+                Format_Obj_Vertex_Index key = model->indices.data[i];
+                _Obj_Triplet_Entry* entry = NULL;
+                for(u64 slot = _obj_triplet_hash(key) & mask;; slot = (slot + 1) & mask)
                 {
-                    error = INVALID_UV_INDEX;
-                    error_index = index.uv_i1;
+                    entry = &table.data[slot];
+                    if(entry->vertex_index == -1 
+                        || (entry->key.pos_i1 == key.pos_i1 && entry->key.uv_i1 == key.uv_i1 && entry->key.norm_i1 == key.norm_i1))
+                        break;
                 }
-                else
-                    composed_vertex.uv = model.uvs.data[index.uv_i1 - 1];
-        
-                
-                if(error != NONE)
+
+                //First time seeing this triplet
+                if(entry->vertex_index == -1)
                 {
-                    const char* error_string = "";
-                    switch(error)
+                    Vertex composed_vertex = {0};
+                    isize error_index = 0;
+                    i32 error = _process_obj_compose_vertex(&composed_vertex, model, i, &error_index);
+                    if(error != _OBJ_CORNER_ERROR_NONE)
+                        _process_obj_log_vertex_error(error, error_index, i);
+
+                    entry->key = key;
+                    if(merge_equal_vertices)
+                        entry->vertex_index = (i32) shape_assembly_add_vertex_custom(&shape_assembly->vertices_hash, &shape_assembly->vertices, composed_vertex);
+                    else
                     {
-                        default:
-                        case NONE: error_string = "none"; break;
-
-                        case INVALID_NORM_INDEX: error_string = "invalid normal index"; break;
-                        case INVALID_POS_INDEX: error_string = "invalid position index"; break;
-                        case INVALID_UV_INDEX: error_string = "invalid uv-coordinate index"; break;
+                        //Still keep the hash filled so that vertices added later can be merged against these
+                        entry->vertex_index = (i32) shape_assembly->vertices.len;
+                        array_push(&shape_assembly->vertices, composed_vertex);
+                        hash_find_or_insert(&shape_assembly->vertices_hash, vertex_hash64(composed_vertex, 0), (u64) entry->vertex_index);
                     }
-
-                    LOG_ERROR("ASSET", "bool processing obj file: %s with index %lli on index number %lli ", error_string, (lli) error_index, (lli) i);
                 }
 
-                u32 final_index = shape_assembly_add_vertex_custom(&shape_assembly->vertices_hash, &shape_assembly->vertices, composed_vertex);
                 u32 mod = i%3;
-                triangle.vertex_i[mod] = final_index;
+                triangle.vertex_i[mod] = (u32) entry->vertex_index;
                 if(mod == 2)
+                    array_push(&shape_assembly->triangles, triangle);
+            }
+        }
+    }
+}
+
+EXTERNAL void process_obj_triangle_mesh_custom(Shape_Assembly* shape_assembly, Triangle_Mesh_Group_Description_Array* descriptions, Format_Obj_Model model, Obj_Vertex_Dedup dedup)
+{
+    PROFILE_SCOPE()
+    SCRATCH_ARENA(arena)
+    {
+        _Obj_Corner_Range_Array ranges = {arena.alloc};
+        _process_obj_plan_groups(&ranges, descriptions, model, shape_assembly->triangles.len);
+
+        isize corner_count = 0;
+        for(isize i = 0; i < ranges.len; i++)
+            corner_count += ranges.data[i].to - ranges.data[i].from;
+
+        hash_reserve(&shape_assembly->vertices_hash, corner_count);
+    
+        //Try to guess the final needed size
+        array_reserve(&shape_assembly->triangles, shape_assembly->triangles.len + corner_count/3); //divided by three since are triangles
+        array_reserve(&shape_assembly->vertices, shape_assembly->vertices.len + corner_count/2); //divide by two since some vertices are shared
+
+        //The parallel version only deduplicates the newly added vertices among themselves.
+        //If there are some vertices already we need the serial version to match against them too.
+        bool go_parallel = parallel_thread_count() > 1
+            && corner_count >= PROCESS_OBJ_PARALLEL_MIN_CORNERS
+            && corner_count < INT32_MAX
+            && shape_assembly->vertices.len == 0;
+
+        //The triplet dedup composes and hashes a Vertex only once per unique triplet so it stays serial
+        // even for large meshes. Only the vertex dedup, which does that for every corner, goes parallel.
+        if(dedup == OBJ_VERTEX_DEDUP_INDEX || dedup == OBJ_VERTEX_DEDUP_INDEX_THEN_VERTEX)
+            _process_obj_corners_by_index(shape_assembly, &model, ranges.data, ranges.len, corner_count, dedup == OBJ_VERTEX_DEDUP_INDEX_THEN_VERTEX);
+        else if(go_parallel)
+            _process_obj_corners_parallel(shape_assembly, &model, ranges.data, ranges.len, corner_count);
+        else
+            _process_obj_corners_serial(shape_assembly, &model, ranges.data, ranges.len);
+    }
+}
+
+EXTERNAL void process_obj_triangle_mesh(Shape_Assembly* shape_assembly, Triangle_Mesh_Group_Description_Array* descriptions, Format_Obj_Model model)
+{
+    process_obj_triangle_mesh_custom(shape_assembly, descriptions, model, OBJ_VERTEX_DEDUP_VERTEX);
+}
+
+//Reorders the triangles (within each group) and the vertices of loaded meshes for better
+// vertex cache and vertex fetch locality. See mesh_optimize.h. Off by default.
+#ifndef ASSET_OPTIMIZE_MESHES
+    #define ASSET_OPTIMIZE_MESHES 0
+#endif
+
+EXTERNAL void process_obj_optimize_mesh(Shape_Assembly* shape_assembly, const Triangle_Mesh_Group_Description_Array* descriptions, String name)
+{
+    Mesh_Optimize_Stats stats = {0};
+    shape_assembly_optimize(shape_assembly, descriptions->data, descriptions->len, &stats);
+    LOG_INFO("ASSET", "Optimized mesh '%.*s': ACMR %.3f -> %.3f ATVR %.3f -> %.3f", STRING_PRINT(name), 
+        stats.before.acmr, stats.after.acmr, stats.before.atvr, stats.after.atvr);
+}
+
+//A mesh cooked into the format_mesh.h binary format and memory mapped. 
+//All pointers inside mesh point straight into the mapping.
+typedef struct Cooked_Mesh {
+    Platform_Memory_Mapping mapping;
+    Format_Mesh mesh;
+} Cooked_Mesh;
+
+//Fills the info of the source file of a cooked mesh or texture. The hash is left 0 if source_content is empty.
+INTERNAL bool _cooked_source_info(Format_Source_Info* info, String source_path, String source_content)
+{
+    Platform_File_Info file_info = {0};
+    Platform_Error error = platform_file_info(source_path, &file_info);
+    if(error)
+        return false;
+
+    info->size = file_info.size;
+    info->last_write_time = file_info.last_write_epoch_time;
+    info->hash = source_content.len > 0 ? xxhash64(source_content.data, source_content.len, 0) : 0;
+    return true;
+}
+
+//Parses the obj file at obj_path, deduplicates it and writes the result into mesh_path.
+EXTERNAL bool cooked_mesh_cook_obj(String obj_path, String mesh_path)
+{
+    bool state = true;
+    PROFILE_SCOPE()
+    SCRATCH_ARENA(arena)
+    {
+        LOG_INFO("ASSET", "Cooking mesh '%.*s' into '%.*s'", STRING_PRINT(obj_path), STRING_PRINT(mesh_path));
+
+        String_Builder file_content = {arena.alloc};
+        state = file_read_entire(obj_path, &file_content, log_error("ASSET"));
+        if(state == false)
+            LOG_ERROR("ASSET", "Failed to load triangle_mesh file '%.*s'", STRING_PRINT(obj_path));
+        else
+        {
+            Format_Source_Info source = {0};
+            _cooked_source_info(&source, obj_path, file_content.string);
+
+            Format_Obj_Model obj_model = {0};
+            format_obj_model_init(&obj_model, arena.alloc);
+
+            Array(Format_Obj_Mtl_Error) obj_errors = {arena.alloc};
+            array_resize(&obj_errors, 100);
+
+            isize had_obj_errors = 0;
+            format_obj_read_parallel(&obj_model, file_content.string, obj_errors.data, obj_errors.len, &had_obj_errors);
+            for(isize i = 0; i < MIN(had_obj_errors, obj_errors.len); i++)
+                LOG_ERROR("ASSET", "error parsing obj file %.*s: " OBJ_MTL_ERROR_FMT, STRING_PRINT(obj_path), OBJ_MTL_ERROR_PRINT(obj_errors.data[i]));
+
+            //Cooking happens only when the obj changes so we can afford the proper triangulation
+            format_obj_triangulate_concave_polygons(&obj_model);
+
+            Shape_Assembly assembly = {0};
+            shape_assembly_init(&assembly, arena.alloc);
+            Triangle_Mesh_Group_Description_Array groups = {arena.alloc};
+            process_obj_triangle_mesh_custom(&assembly, &groups, obj_model, OBJ_VERTEX_DEDUP_INDEX_THEN_VERTEX);
+            if(ASSET_OPTIMIZE_MESHES)
+                process_obj_optimize_mesh(&assembly, &groups, obj_path);
+
+            //The simplification is too slow to do on every load. The full mesh indices come first 
+            // in lod_indices and are already stored as the triangles so only the rest is written.
+            i32_Array lod_indices = {arena.alloc};
+            Mesh_Lod lods[MESH_LOD_MAX] = {0};
+            isize full_index_count = assembly.triangles.len*3;
+            isize lod_count = mesh_lod_build(&lod_indices, lods, (const i32*) (const void*) assembly.triangles.data, full_index_count, 
+                assembly.vertices.data, assembly.vertices.len);
+
+            Array(String) material_files = {arena.alloc};
+            for(isize i = 0; i < obj_model.material_files.len; i++)
+                array_push(&material_files, obj_model.material_files.data[i].string);
+
+            String_Builder cooked = {arena.alloc};
+            format_mesh_write(&cooked, source, 
+                assembly.vertices.data, assembly.vertices.len, 
+                assembly.triangles.data, assembly.triangles.len,
+                lod_indices.data + full_index_count, lod_indices.len - full_index_count,
+                lods, lod_count,
+                groups.data, groups.len,
+                material_files.data, material_files.len);
+
+            Platform_Error error = file_write_entire(mesh_path, cooked.string);
+            if(error)
+            {
+                LOG_ERROR("ASSET", "Error saving cooked mesh at path '%.*s' because of OS error '%s'", STRING_PRINT(mesh_path), translate_error(arena.alloc, error));
+                state = false;
+            }
+
+            shape_assembly_deinit(&assembly);
+            format_obj_model_deinit(&obj_model);
+        }
+    }
+    return state;
+}
+
+//Checks whether the cooked file was made from the current version of the source file.
+//Size and last write time are checked first. Only if they differ is the source hashed 
+// (so that just touching the file or copying it around does not trigger recook).
+//If the content is the same but the size or last write time is not sets was_touched and 
+// fills touched_info with the current info which should be stored back into the cooked file.
+INTERNAL bool _cooked_source_is_up_to_date(Format_Source_Info cooked, String source_path, bool* was_touched, Format_Source_Info* touched_info)
+{
+    *was_touched = false;
+    Format_Source_Info current = {0};
+    if(_cooked_source_info(&current, source_path, STRING("")) == false)
+    {
+        LOG_WARN("ASSET", "Source of cooked file '%.*s' not found. Using the cooked file as is.", STRING_PRINT(source_path));
+        return true;
+    }
+
+    if(cooked.size == current.size && cooked.last_write_time == current.last_write_time)
+        return true;
+
+    bool state = false;
+    SCRATCH_ARENA(arena)
+    {
+        String_Builder file_content = {arena.alloc};
+        if(file_read_entire(source_path, &file_content, log_error("ASSET")))
+            state = cooked.hash == xxhash64(file_content.data, file_content.len, 0);
+    }
+
+    if(state)
+    {
+        current.hash = cooked.hash;
+        *touched_info = current;
+        *was_touched = true;
+    }
+    return state;
+}
+
+//Overwrites the source info stored at source_offset inside the cooked file at cooked_path. 
+//The file must not be mapped.
+INTERNAL bool _cooked_file_refresh_source(String cooked_path, isize source_offset, Format_Source_Info source)
+{
+    bool state = false;
+    SCRATCH_ARENA(arena)
+    {
+        String_Builder cooked = {arena.alloc};
+        if(file_read_entire(cooked_path, &cooked, log_error("ASSET")) && source_offset + (isize) sizeof source <= cooked.len)
+        {
+            memcpy(cooked.data + source_offset, &source, sizeof source);
+            Platform_Error error = file_write_entire(cooked_path, cooked.string);
+            if(error)
+                LOG_WARN("ASSET", "Error refreshing cooked file '%.*s' because of OS error '%s'", STRING_PRINT(cooked_path), translate_error(arena.alloc, error));
+            else
+                state = true;
+        }
+    }
+    return state;
+}
+
+INTERNAL bool _cooked_mesh_map(Cooked_Mesh* out, String mesh_path)
+{
+    Platform_Error error = platform_file_memory_map(mesh_path, 0, &out->mapping);
+    if(error)
+        return false;
+
+    String data = string_make(out->mapping.address, out->mapping.size);
+    if(format_mesh_read(&out->mesh, data) == false)
+    {
+        LOG_WARN("ASSET", "Cooked mesh '%.*s' is invalid or of an old version", STRING_PRINT(mesh_path));
+        platform_file_memory_unmap(&out->mapping);
+        memset(out, 0, sizeof *out);
+        return false;
+    }
+
+    return true;
+}
+
+EXTERNAL void cooked_mesh_unload(Cooked_Mesh* mesh)
+{
+    if(mesh->mapping.address)
+        platform_file_memory_unmap(&mesh->mapping);
+    memset(mesh, 0, sizeof *mesh);
+}
+
+//Maps the cooked mesh at mesh_path. If it does not exist or was cooked from a different
+// version of obj_path recooks it first.
+EXTERNAL bool cooked_mesh_load(Cooked_Mesh* out, String obj_path, String mesh_path)
+{
+    bool state = false;
+    PROFILE_SCOPE()
+    {
+        cooked_mesh_unload(out);
+        if(_cooked_mesh_map(out, mesh_path))
+        {
+            bool was_touched = false;
+            Format_Source_Info touched_info = {0};
+            if(_cooked_source_is_up_to_date(out->mesh.header->source, obj_path, &was_touched, &touched_info))
+            {
+                state = true;
+                //Store the new last write time so that the next load does not have to hash the source again
+                if(was_touched)
                 {
-                    if(discard_triangle == false)
-                        array_push(&shape_assembly->triangles, triangle);
-                    discard_triangle = false;
+                    cooked_mesh_unload(out);
+                    _cooked_file_refresh_source(mesh_path, offsetof(Format_Mesh_Header, source), touched_info);
+                    state = _cooked_mesh_map(out, mesh_path);
                 }
             }
+            else
+            {
+                LOG_INFO("ASSET", "Cooked mesh '%.*s' is stale", STRING_PRINT(mesh_path));
+                cooked_mesh_unload(out);
+            }
         }
-    
-        Triangle_Mesh_Group_Description group_desc = {0};
-        i32 triangles_after = (i32) shape_assembly->triangles.len;
 
-        //No child or next
-        group_desc.next_i1 = 0;
-        group_desc.child_i1 = 0;
+        if(state == false && cooked_mesh_cook_obj(obj_path, mesh_path))
+            state = _cooked_mesh_map(out, mesh_path);
 
-        //Flat for now
-        group_desc.depth = 0;
+        if(state == false)
+            LOG_ERROR("ASSET", "Failed to load mesh '%.*s'", STRING_PRINT(obj_path));
+    }
+    return state;
+}
 
-        //assign its range
-        group_desc.triangles_from = triangles_before;
-        group_desc.triangles_to = triangles_after;
+//Block compresses cooked textures with the format chosen for their map type (see texture_compress.h). 
+#ifndef ASSET_COMPRESS_TEXTURES
+    #define ASSET_COMPRESS_TEXTURES 1
+#endif
 
-        group_desc.material_name = parent_group->material.string;
-        if(parent_group->groups.len > 0)
-            group_desc.name = parent_group->groups.data[0].string;
+//A texture cooked into the format_texture.h binary format and memory mapped.
+//The mips inside texture point straight into the mapping.
+typedef struct Cooked_Texture {
+    Platform_Memory_Mapping mapping;
+    Format_Texture texture;
+} Cooked_Texture;
 
-        //link the previous group to this one
-        if(descriptions->len > 0)
-            array_last(*descriptions)->next_i1 = (i32) descriptions->len + 1;
+INTERNAL Texture_Block_Format _cooked_texture_block_format(Map_Type map_type, i32 channel_count)
+{
+    if(ASSET_COMPRESS_TEXTURES)
+        return texture_block_format_from_map(map_type, channel_count);
+    return TEXTURE_BLOCK_NONE;
+}
 
-        array_push(descriptions, group_desc);
+//Decodes the image at image_path, generates its whole mip chain with the options of map_type
+// (see mip_options_from_map), block compresses it and writes the result into texture_path.
+//The image is decoded as U8 and flipped vertically the way opengl expects.
+EXTERNAL bool cooked_texture_cook(String image_path, String texture_path, Map_Type map_type, const Map_Info* info_or_null)
+{
+    bool state = true;
+    PROFILE_SCOPE()
+    SCRATCH_ARENA(arena)
+    {
+        LOG_INFO("ASSET", "Cooking texture '%.*s' into '%.*s'", STRING_PRINT(image_path), STRING_PRINT(texture_path));
+
+        String_Builder file_content = {arena.alloc};
+        Image image = {arena.alloc};
+        state = file_read_entire(image_path, &file_content, log_error("ASSET"))
+            && image_read_from_memory(&image, file_content.string, 0, PIXEL_TYPE_U8, IMAGE_LOAD_FLAG_FLIP_Y);
+
+        if(state == false)
+            LOG_ERROR("ASSET", "Failed to load texture file '%.*s'", STRING_PRINT(image_path));
+        else
+        {
+            Format_Source_Info source = {0};
+            _cooked_source_info(&source, image_path, file_content.string);
+
+            i32 channel_count = (i32) image_channel_count(image);
+            Mip_Options options = mip_options_from_map(map_type, info_or_null, channel_count);
+            i32 mip_count = MIN(mip_chain_count(image.width, image.height), MIP_CHAIN_MAX_MIPS);
+            Image mips[MIP_CHAIN_MAX_MIPS] = {0};
+            mip_chain_generate(mips, mip_count, subimage_of(image), &options, arena.alloc);
+
+            Texture_Block_Format block_format = _cooked_texture_block_format(map_type, channel_count);
+            if(block_format != TEXTURE_BLOCK_NONE)
+            {
+                for(i32 i = 0; i < mip_count; i++)
+                {
+                    Image blocks = {0};
+                    texture_compress(&blocks, subimage_of(mips[i]), block_format, arena.alloc);
+                    mips[i] = blocks;
+                }
+
+                //Only the first mip is checked. The rest compress about the same.
+                Image decompressed = {0};
+                texture_decompress(&decompressed, subimage_of(mips[0]), image.width, image.height, block_format, arena.alloc);
+                f64 psnr = texture_psnr(subimage_of(image), subimage_of(decompressed), MIN(channel_count, texture_block_channel_count(block_format)));
+                LOG_INFO(">ASSET", "Compressed as %s with PSNR %.2lf dB", texture_block_format_name(block_format), psnr);
+            }
+
+            String_Builder cooked = {arena.alloc};
+            format_texture_write(&cooked, source, format_texture_options_hash(&options, block_format), block_format, 
+                image.width, image.height, mips, mip_count, channel_count);
+
+            Platform_Error error = file_write_entire(texture_path, cooked.string);
+            if(error)
+            {
+                LOG_ERROR("ASSET", "Error saving cooked texture at path '%.*s' because of OS error '%s'", STRING_PRINT(texture_path), translate_error(arena.alloc, error));
+                state = false;
+            }
+        }
+    }
+    return state;
+}
+
+INTERNAL bool _cooked_texture_map(Cooked_Texture* out, String texture_path)
+{
+    Platform_Error error = platform_file_memory_map(texture_path, 0, &out->mapping);
+    if(error)
+        return false;
+
+    String data = string_make(out->mapping.address, out->mapping.size);
+    if(format_texture_read(&out->texture, data) == false)
+    {
+        LOG_WARN("ASSET", "Cooked texture '%.*s' is invalid or of an old version", STRING_PRINT(texture_path));
+        platform_file_memory_unmap(&out->mapping);
+        memset(out, 0, sizeof *out);
+        return false;
+    }
+
+    return true;
+}
+
+//The options depend on the channel count which the cooked file knows without decoding the source.
+INTERNAL bool _cooked_texture_is_up_to_date(Format_Texture texture, String image_path, Map_Type map_type, const Map_Info* info_or_null, bool* was_touched, Format_Source_Info* touched_info)
+{
+    i32 channel_count = texture.header->channel_count;
+    Mip_Options options = mip_options_from_map(map_type, info_or_null, channel_count);
+    Texture_Block_Format block_format = _cooked_texture_block_format(map_type, channel_count);
+    *was_touched = false;
+    return texture.header->options_hash == format_texture_options_hash(&options, block_format)
+        && _cooked_source_is_up_to_date(texture.header->source, image_path, was_touched, touched_info);
+}
+
+EXTERNAL void cooked_texture_unload(Cooked_Texture* texture)
+{
+    if(texture->mapping.address)
+        platform_file_memory_unmap(&texture->mapping);
+    memset(texture, 0, sizeof *texture);
+}
+
+//Maps the cooked texture at texture_path. If it does not exist, was cooked from a different
+// version of image_path or with different options recooks it first.
+EXTERNAL bool cooked_texture_load(Cooked_Texture* out, String image_path, String texture_path, Map_Type map_type, const Map_Info* info_or_null)
+{
+    bool state = false;
+    PROFILE_SCOPE()
+    {
+        cooked_texture_unload(out);
+        if(_cooked_texture_map(out, texture_path))
+        {
+            bool was_touched = false;
+            Format_Source_Info touched_info = {0};
+            if(_cooked_texture_is_up_to_date(out->texture, image_path, map_type, info_or_null, &was_touched, &touched_info))
+            {
+                state = true;
+                if(was_touched)
+                {
+                    cooked_texture_unload(out);
+                    _cooked_file_refresh_source(texture_path, offsetof(Format_Texture_Header, source), touched_info);
+                    state = _cooked_texture_map(out, texture_path);
+                }
+            }
+            else
+            {
+                LOG_INFO("ASSET", "Cooked texture '%.*s' is stale", STRING_PRINT(texture_path));
+                cooked_texture_unload(out);
+            }
+        }
+
+        if(state == false && cooked_texture_cook(image_path, texture_path, map_type, info_or_null))
+            state = _cooked_texture_map(out, texture_path);
+
+        if(state == false)
+            LOG_ERROR("ASSET", "Failed to load texture '%.*s'", STRING_PRINT(image_path));
+    }
+    return state;
+}
+
+//Returns the path of the cooked file of image_path next to it. The name contains a hash of everything
+// the mip options depend on besides the image itself (see mip_options_from_map) so that the same image
+// used as different map types does not overwrite (and recook) the same file on every load.
+EXTERNAL String cooked_texture_path(Allocator* alloc, String image_path, Map_Type map_type, const Map_Info* info_or_null)
+{
+    f32 gamma = info_or_null ? info_or_null->gamma : 0;
+    u64 hash = xxhash64(&gamma, sizeof gamma, (u64) map_type);
+    return format(alloc, "%.*s.%08x.cooked", STRING_PRINT(image_path), (u32) hash).string;
+}
+
+typedef struct _Cooked_Texture_Many_Context {
+    Cooked_Texture* outs;
+    const String* image_paths;
+    const String* texture_paths;
+    const Map_Type* map_types;
+    const Map_Info* infos_or_null;
+    PARALLEL_ATOMIC(isize) loaded;
+} _Cooked_Texture_Many_Context;
+
+INTERNAL void _cooked_texture_load_batch(void* context, isize from, isize to, isize thread_index)
+{
+    (void) thread_index;
+    _Cooked_Texture_Many_Context* c = (_Cooked_Texture_Many_Context*) context;
+    for(isize i = from; i < to; i++)
+    {
+        const Map_Info* info_or_null = c->infos_or_null ? &c->infos_or_null[i] : NULL;
+        if(cooked_texture_load(&c->outs[i], c->image_paths[i], c->texture_paths[i], c->map_types[i], info_or_null))
+            atomic_fetch_add(&c->loaded, 1);
+    }
+}
+
+//Loads count textures at once. The decoding, mip generation and compression of those which need to be 
+// (re)cooked is spread across the parallel.h threads. Returns the number of successfully loaded textures.
+//infos_or_null are the map infos of each texture (see cooked_texture_load) or NULL to use the defaults for all.
+EXTERNAL isize cooked_texture_load_many(Cooked_Texture* outs, const String* image_paths, const String* texture_paths, const Map_Type* map_types, const Map_Info* infos_or_null, isize count)
+{
+    _Cooked_Texture_Many_Context context = {outs, image_paths, texture_paths, map_types, infos_or_null};
+    PROFILE_SCOPE()
+    {
+        //One texture per batch. Most are already cooked and only a few take long.
+        parallel_for(count, 1, _cooked_texture_load_batch, &context);
     }
+    return atomic_load(&context.loaded);
 }
 
 INTERNAL void process_mtl_map(Map_Description* description, Format_Mtl_Map map, f32 expected_gamma, i8 channels)
@@ -650,7 +1506,7 @@ EXTERNAL bool model_read_entire(Model_Asset_Handle* out_handle, Asset_Handle_Arr
                 array_resize(&obj_errors, 100);
 
                 isize had_obj_errors = 0;
-                format_obj_read(&obj_model, file_content.string, obj_errors.data, obj_errors.len, &had_obj_errors);
+                format_obj_read_parallel(&obj_model, file_content.string, obj_errors.data, obj_errors.len, &had_obj_errors);
                 for(isize i = 0; i < had_obj_errors; i++)
                     LOG_ERROR("ASSET", "bool parsing obj file %s: " OBJ_MTL_ERROR_FMT, full_path.data, OBJ_MTL_ERROR_PRINT(obj_errors.data[i]));
 
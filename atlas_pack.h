@@ -0,0 +1,223 @@
+#ifndef LIB_ATLAS_PACK
+#define LIB_ATLAS_PACK
+
+// Packing of many small rectangles into a single bigger one (texture atlas).
+//
+// We use the skyline bottom-left algorithm (Jukka Jylänki "A Thousand Ways to Pack the Bin").
+// The packer keeps only the top outline of what was placed so far as a list of horizontal
+// segments sorted by x. A new rectangle is tried at the start of every segment, resting on the
+// highest segment below it, and is placed where its top edge ends lowest (then leftmost).
+// The space below the skyline that is not covered by any rectangle is lost for good - this
+// is the waste reported in the stats. For rectangles of similar sizes it stays small.
+//
+// Each rectangle is surrounded by padding pixels on all sides so that bilinear filtering and
+// the first few mips do not bleed neighbours into each other. The caller should fill the padding
+// by extending the edges of its image.
+//
+// Rectangles cannot be freed individually. An atlas is reset when all of its rectangles are gone.
+// Nothing here touches opengl so it can be used and tested without a context.
+
+#include "lib/array.h"
+
+typedef struct Atlas_Rect {
+    i32 x;
+    i32 y;
+    i32 width;
+    i32 height;
+} Atlas_Rect;
+
+typedef struct Atlas_Skyline_Node {
+    i32 x;
+    i32 y;
+    i32 width;
+} Atlas_Skyline_Node;
+
+typedef Array(Atlas_Skyline_Node) Atlas_Skyline;
+
+typedef struct Atlas_Stats {
+    isize total_area;
+    isize used_area;    //area of all rectangles without padding
+    isize padding_area; //area of the padding around them
+    isize wasted_area;  //area below the skyline not covered by anything
+    isize free_area;    //area above the skyline
+    f32 occupancy;      //used_area / total_area
+    f32 waste;          //wasted_area / total_area
+} Atlas_Stats;
+
+typedef struct Atlas_Packer {
+    Atlas_Skyline skyline;
+    i32 width;
+    i32 height;
+    i32 padding;
+    i32 rect_count;
+    isize used_area;
+    isize padded_area;
+    isize failed_count;
+} Atlas_Packer;
+
+EXTERNAL void atlas_packer_init(Atlas_Packer* packer, Allocator* allocator, i32 width, i32 height, i32 padding);
+EXTERNAL void atlas_packer_deinit(Atlas_Packer* packer);
+//Forgets all rectangles.
+EXTERNAL void atlas_packer_reset(Atlas_Packer* packer);
+
+//Places a width x height rectangle. Returns false if there is no space for it.
+//On success out is the rectangle itself (without the padding around it).
+EXTERNAL bool atlas_packer_add(Atlas_Packer* packer, i32 width, i32 height, Atlas_Rect* out);
+
+EXTERNAL Atlas_Stats atlas_packer_stats(const Atlas_Packer* packer);
+
+#endif
+
+#if (defined(LIB_ALL_IMPL) || defined(LIB_ATLAS_PACK_IMPL)) && !defined(LIB_ATLAS_PACK_HAS_IMPL)
+#define LIB_ATLAS_PACK_HAS_IMPL
+
+EXTERNAL void atlas_packer_init(Atlas_Packer* packer, Allocator* allocator, i32 width, i32 height, i32 padding)
+{
+    memset(packer, 0, sizeof *packer);
+    array_init(&packer->skyline, allocator);
+    packer->width = width;
+    packer->height = height;
+    packer->padding = padding;
+    atlas_packer_reset(packer);
+}
+
+EXTERNAL void atlas_packer_deinit(Atlas_Packer* packer)
+{
+    array_deinit(&packer->skyline);
+    memset(packer, 0, sizeof *packer);
+}
+
+EXTERNAL void atlas_packer_reset(Atlas_Packer* packer)
+{
+    array_clear(&packer->skyline);
+    Atlas_Skyline_Node ground = {0, 0, packer->width};
+    array_push(&packer->skyline, ground);
+    packer->rect_count = 0;
+    packer->used_area = 0;
+    packer->padded_area = 0;
+}
+
+INTERNAL void _atlas_skyline_insert(Atlas_Skyline* skyline, isize at, Atlas_Skyline_Node node)
+{
+    array_push(skyline, node);
+    memmove(skyline->data + at + 1, skyline->data + at, (size_t) (skyline->len - 1 - at) * sizeof *skyline->data);
+    skyline->data[at] = node;
+}
+
+INTERNAL void _atlas_skyline_remove(Atlas_Skyline* skyline, isize at)
+{
+    memmove(skyline->data + at, skyline->data + at + 1, (size_t) (skyline->len - 1 - at) * sizeof *skyline->data);
+    skyline->len -= 1;
+}
+
+//Returns the y at which a width x height rectangle starting at node i would rest or -1 if it does not fit.
+INTERNAL i32 _atlas_skyline_fit(const Atlas_Packer* packer, isize i, i32 width, i32 height)
+{
+    const Atlas_Skyline_Node* nodes = packer->skyline.data;
+    i32 x = nodes[i].x;
+    if(x + width > packer->width)
+        return -1;
+
+    i32 y = 0;
+    for(i32 remaining = width; remaining > 0; i++)
+    {
+        ASSERT(i < packer->skyline.len);
+        y = MAX(y, nodes[i].y);
+        if(y + height > packer->height)
+            return -1;
+        remaining -= nodes[i].width;
+    }
+
+    return y;
+}
+
+EXTERNAL bool atlas_packer_add(Atlas_Packer* packer, i32 width, i32 height, Atlas_Rect* out)
+{
+    ASSERT(width > 0 && height > 0);
+    i32 padded_width = width + 2*packer->padding;
+    i32 padded_height = height + 2*packer->padding;
+
+    isize best_index = -1;
+    i32 best_y = 0;
+    i32 best_top = INT32_MAX;
+    for(isize i = 0; i < packer->skyline.len; i++)
+    {
+        i32 y = _atlas_skyline_fit(packer, i, padded_width, padded_height);
+        //Strictly lower only so that ties go to the leftmost
+        if(y >= 0 && y + padded_height < best_top)
+        {
+            best_index = i;
+            best_y = y;
+            best_top = y + padded_height;
+        }
+    }
+
+    if(best_index == -1)
+    {
+        packer->failed_count += 1;
+        return false;
+    }
+
+    //Insert the new node and cut away the parts of the following nodes it covers
+    Atlas_Skyline* skyline = &packer->skyline;
+    i32 x = skyline->data[best_index].x;
+    Atlas_Skyline_Node node = {x, best_top, padded_width};
+    _atlas_skyline_insert(skyline, best_index, node);
+
+    isize i = best_index + 1;
+    while(i < skyline->len)
+    {
+        Atlas_Skyline_Node* curr = &skyline->data[i];
+        i32 covered = x + padded_width - curr->x;
+        if(covered <= 0)
+            break;
+
+        if(covered < curr->width)
+        {
+            curr->x += covered;
+            curr->width -= covered;
+            break;
+        }
+
+        _atlas_skyline_remove(skyline, i);
+    }
+
+    //Merge neighbours of the same height
+    for(isize k = 0; k + 1 < skyline->len; )
+    {
+        if(skyline->data[k].y == skyline->data[k + 1].y)
+        {
+            skyline->data[k].width += skyline->data[k + 1].width;
+            _atlas_skyline_remove(skyline, k + 1);
+        }
+        else
+            k += 1;
+    }
+
+    packer->rect_count += 1;
+    packer->used_area += (isize) width * height;
+    packer->padded_area += (isize) padded_width * padded_height;
+
+    Atlas_Rect rect = {x + packer->padding, best_y + packer->padding, width, height};
+    *out = rect;
+    return true;
+}
+
+EXTERNAL Atlas_Stats atlas_packer_stats(const Atlas_Packer* packer)
+{
+    Atlas_Stats stats = {0};
+    isize below_skyline = 0;
+    for(isize i = 0; i < packer->skyline.len; i++)
+        below_skyline += (isize) packer->skyline.data[i].width * packer->skyline.data[i].y;
+
+    stats.total_area = (isize) packer->width * packer->height;
+    stats.used_area = packer->used_area;
+    stats.padding_area = packer->padded_area - packer->used_area;
+    stats.wasted_area = below_skyline - packer->padded_area;
+    stats.free_area = stats.total_area - below_skyline;
+    stats.occupancy = (f32) stats.used_area / (f32) MAX(stats.total_area, 1);
+    stats.waste = (f32) stats.wasted_area / (f32) MAX(stats.total_area, 1);
+    return stats;
+}
+
+#endif
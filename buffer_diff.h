@@ -0,0 +1,113 @@
+#ifndef LIB_BUFFER_DIFF
+#define LIB_BUFFER_DIFF
+
+// Incremental updates of gpu buffers.
+//
+// We keep a cpu side shadow copy of exactly what the gpu buffer holds. Data written through
+// buffer_shadow_write is compared against the shadow in blocks of BUFFER_DIFF_BLOCK bytes.
+// Only the blocks that differ are copied into the shadow and recorded as upload ops.
+// Ops that are less than BUFFER_DIFF_MERGE_GAP bytes apart are merged into one since a single
+// bigger upload is cheaper than many small ones.
+//
+// The ops are then uploaded from the shadow (which by then holds the new data) and cleared.
+// When the same data is written each frame there are no ops at all.
+//
+// Nothing here touches opengl so the produced ops can be inspected and tested directly.
+// The gpu buffer must start with the same contents as the shadow (zeros), ie. it should be
+// created with the shadow data.
+
+#include "lib/array.h"
+
+#define BUFFER_DIFF_BLOCK 64
+#define BUFFER_DIFF_MERGE_GAP 256
+
+typedef struct Buffer_Upload_Op {
+    isize offset;
+    isize size;
+} Buffer_Upload_Op;
+
+typedef Array(Buffer_Upload_Op) Buffer_Upload_Op_Array;
+
+typedef struct Buffer_Shadow {
+    u8_Array data; //mirrors the gpu buffer
+    Buffer_Upload_Op_Array ops; //uploads needed to bring the gpu buffer up to date with data
+    isize pending_bytes; //sum of the sizes of ops
+} Buffer_Shadow;
+
+EXTERNAL void buffer_shadow_init(Buffer_Shadow* shadow, Allocator* allocator, isize byte_size);
+EXTERNAL void buffer_shadow_deinit(Buffer_Shadow* shadow);
+
+//Writes size bytes of data at offset and records ops for the bytes that changed.
+//Returns the number of bytes that need to be uploaded because of this write.
+EXTERNAL isize buffer_shadow_write(Buffer_Shadow* shadow, isize offset, const void* data, isize size);
+
+//Forgets all ops. Should be called once they were uploaded.
+EXTERNAL void buffer_shadow_clear_ops(Buffer_Shadow* shadow);
+
+#endif
+
+#if (defined(LIB_ALL_IMPL) || defined(LIB_BUFFER_DIFF_IMPL)) && !defined(LIB_BUFFER_DIFF_HAS_IMPL)
+#define LIB_BUFFER_DIFF_HAS_IMPL
+
+EXTERNAL void buffer_shadow_init(Buffer_Shadow* shadow, Allocator* allocator, isize byte_size)
+{
+    array_init(&shadow->data, allocator);
+    array_init(&shadow->ops, allocator);
+    array_resize(&shadow->data, byte_size);
+    shadow->pending_bytes = 0;
+}
+
+EXTERNAL void buffer_shadow_deinit(Buffer_Shadow* shadow)
+{
+    array_deinit(&shadow->data);
+    array_deinit(&shadow->ops);
+    shadow->pending_bytes = 0;
+}
+
+INTERNAL void _buffer_shadow_push_op(Buffer_Shadow* shadow, isize offset, isize size)
+{
+    if(shadow->ops.len > 0)
+    {
+        Buffer_Upload_Op* last = array_last(shadow->ops);
+        isize last_end = last->offset + last->size;
+        if(last->offset <= offset && offset <= last_end + BUFFER_DIFF_MERGE_GAP)
+        {
+            isize new_end = MAX(last_end, offset + size);
+            shadow->pending_bytes += new_end - last_end;
+            last->size = new_end - last->offset;
+            return;
+        }
+    }
+
+    Buffer_Upload_Op op = {offset, size};
+    array_push(&shadow->ops, op);
+    shadow->pending_bytes += size;
+}
+
+EXTERNAL isize buffer_shadow_write(Buffer_Shadow* shadow, isize offset, const void* data, isize size)
+{
+    ASSERT(0 <= offset && offset + size <= shadow->data.len, "write out of bounds %lli + %lli > %lli", (lli) offset, (lli) size, (lli) shadow->data.len);
+
+    isize pending_before = shadow->pending_bytes;
+    u8* old_data = shadow->data.data + offset;
+    const u8* new_data = (const u8*) data;
+    for(isize block = 0; block < size; block += BUFFER_DIFF_BLOCK)
+    {
+        isize block_size = MIN(BUFFER_DIFF_BLOCK, size - block);
+        if(memcmp(old_data + block, new_data + block, (size_t) block_size) != 0)
+        {
+            memcpy(old_data + block, new_data + block, (size_t) block_size);
+            _buffer_shadow_push_op(shadow, offset + block, block_size);
+        }
+    }
+
+    return shadow->pending_bytes - pending_before;
+}
+
+EXTERNAL void buffer_shadow_clear_ops(Buffer_Shadow* shadow)
+{
+    array_clear(&shadow->ops);
+    shadow->pending_bytes = 0;
+}
+
+#endif
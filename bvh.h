@@ -0,0 +1,546 @@
+#ifndef LIB_BVH
+#define LIB_BVH
+
+// Bounding volume hierarchy over a static set of axis aligned boxes (ie. world space bounds of instances).
+//
+// The tree is built top down using binned SAH (surface area heuristic). Each node is split
+// along the axis and bin boundary that minimizes area(left)*count(left) + area(right)*count(right).
+// Nodes with at most BVH_MAX_LEAF_SIZE items for which no split is cheaper become leaves.
+// The depth is capped at BVH_MAX_DEPTH so that the queries can use fixed size stacks. Nodes at 
+// the maximum depth become leaves regardless of their size (this only happens for pathological inputs).
+// The nodes are stored in a single flat array with both children of a node next to
+// each other so each node is 32 bytes and a traversal only touches a few cache lines.
+//
+// The items of each leaf are ordered by the keys given to bvh_build (ie. render sort keys)
+// so that the query results stay roughly in the order they will be sorted into.
+//
+// When boxes move but the set of items stays the same bvh_refit recomputes the node bounds
+// bottom up in O(n) without changing the tree. This is a lot faster than rebuilding but
+// the tree quality degrades as the items drift away from their original positions.
+// When only a few boxes moved bvh_refit_items walks up from their leaves instead and stops 
+// as soon as the bounds of a node did not change.
+//
+// bvh_query_frustum skips the planes a node is entirely in front of for all of its children
+// so fully visible subtrees are collected without any further tests.
+
+#include "frustum_cull.h"
+
+#define BVH_MAX_LEAF_SIZE 8
+#define BVH_NODE_COST 4 //the cost of visiting a node relative to testing a single item
+#define BVH_BINS 16
+#define BVH_MAX_DEPTH 64
+
+typedef struct Bvh_Node {
+    Vec3 min;
+    u32 first;  //index of the left child (the right is first + 1) or of the first item if leaf
+    Vec3 max;
+    u32 count;  //number of items if leaf or 0
+} Bvh_Node;
+
+typedef Array(Bvh_Node) Bvh_Node_Array;
+
+typedef struct Bvh {
+    Bvh_Node_Array nodes;
+    i32_Array items; //indices into the boxes given to bvh_build referenced by the leaves
+    i32_Array parents; //parent node of each node, -1 for the root
+    i32_Array leaf_of; //leaf node of each box given to bvh_build
+} Bvh;
+
+EXTERNAL void bvh_init(Bvh* bvh, Allocator* allocator);
+EXTERNAL void bvh_deinit(Bvh* bvh);
+
+//Builds the tree over boxes. If keys_or_null is not NULL orders the items of each leaf by them.
+EXTERNAL void bvh_build(Bvh* bvh, const AABB* boxes, const u64* keys_or_null, isize count);
+
+//Recomputes the node bounds from the boxes. The boxes must be the same items as given to bvh_build.
+EXTERNAL void bvh_refit(Bvh* bvh, const AABB* boxes);
+
+//Recomputes only the bounds of the nodes containing the changed boxes. 
+//Cheaper than bvh_refit when few boxes changed. changed can contain duplicates.
+EXTERNAL void bvh_refit_items(Bvh* bvh, const AABB* boxes, const i32* changed, isize changed_count);
+
+//Appends indices of all boxes intersecting the frustum to visible. Returns the number of appended.
+EXTERNAL isize bvh_query_frustum(const Bvh* bvh, const AABB* boxes, const Frustum* frustum, i32_Array* visible);
+
+//Returns the index of the box hit first by the ray or -1 if none is hit within max_distance.
+//dir does not have to be normalized, distance is measured in multiples of dir.
+EXTERNAL i32 bvh_ray_pick(const Bvh* bvh, const AABB* boxes, Vec3 origin, Vec3 dir, f32 max_distance, f32* distance_or_null);
+
+#endif
+
+#if (defined(LIB_ALL_IMPL) || defined(LIB_BVH_IMPL)) && !defined(LIB_BVH_HAS_IMPL)
+#define LIB_BVH_HAS_IMPL
+
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+EXTERNAL void bvh_init(Bvh* bvh, Allocator* allocator)
+{
+    array_init(&bvh->nodes, allocator);
+    array_init(&bvh->items, allocator);
+    array_init(&bvh->parents, allocator);
+    array_init(&bvh->leaf_of, allocator);
+}
+
+EXTERNAL void bvh_deinit(Bvh* bvh)
+{
+    array_deinit(&bvh->nodes);
+    array_deinit(&bvh->items);
+    array_deinit(&bvh->parents);
+    array_deinit(&bvh->leaf_of);
+}
+
+INTERNAL f32 _bvh_vec3_at(Vec3 v, isize axis)
+{
+    return axis == 0 ? v.x : axis == 1 ? v.y : v.z;
+}
+
+INTERNAL AABB _bvh_aabb_empty()
+{
+    AABB out = {vec3(FLT_MAX, FLT_MAX, FLT_MAX), vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX)};
+    return out;
+}
+
+INTERNAL void _bvh_aabb_grow(AABB* aabb, AABB by)
+{
+    aabb->min = vec3(MIN(aabb->min.x, by.min.x), MIN(aabb->min.y, by.min.y), MIN(aabb->min.z, by.min.z));
+    aabb->max = vec3(MAX(aabb->max.x, by.max.x), MAX(aabb->max.y, by.max.y), MAX(aabb->max.z, by.max.z));
+}
+
+//Half of the surface area which is all SAH needs
+INTERNAL f32 _bvh_aabb_area(AABB aabb)
+{
+    if(aabb.min.x > aabb.max.x)
+        return 0;
+
+    f32 x = aabb.max.x - aabb.min.x;
+    f32 y = aabb.max.y - aabb.min.y;
+    f32 z = aabb.max.z - aabb.min.z;
+    return x*y + y*z + z*x;
+}
+
+INTERNAL f32 _bvh_centroid(const AABB* box, isize axis)
+{
+    return _bvh_vec3_at(box->min, axis) + _bvh_vec3_at(box->max, axis);
+}
+
+INTERNAL AABB _bvh_node_bounds(const Bvh_Node* node)
+{
+    AABB out = {node->min, node->max};
+    return out;
+}
+
+INTERNAL void _bvh_node_set_bounds(Bvh_Node* node, AABB bounds)
+{
+    node->min = bounds.min;
+    node->max = bounds.max;
+}
+
+INTERNAL AABB _bvh_leaf_bounds(const Bvh* bvh, const Bvh_Node* node, const AABB* boxes)
+{
+    AABB bounds = _bvh_aabb_empty();
+    for(u32 i = 0; i < node->count; i++)
+        _bvh_aabb_grow(&bounds, boxes[bvh->items.data[node->first + i]]);
+    return bounds;
+}
+
+//Finds the best SAH split of the items of the node. Returns false if keeping the node as leaf is better.
+INTERNAL bool _bvh_find_split(const Bvh* bvh, const Bvh_Node* node, const AABB* boxes, isize* out_axis, f32* out_position)
+{
+    AABB centroid_bounds = _bvh_aabb_empty();
+    for(u32 i = 0; i < node->count; i++)
+    {
+        const AABB* box = &boxes[bvh->items.data[node->first + i]];
+        Vec3 centroid = vec3(_bvh_centroid(box, 0), _bvh_centroid(box, 1), _bvh_centroid(box, 2));
+        AABB point = {centroid, centroid};
+        _bvh_aabb_grow(&centroid_bounds, point);
+    }
+
+    f32 best_cost = FLT_MAX;
+    for(isize axis = 0; axis < 3; axis++)
+    {
+        f32 from = _bvh_vec3_at(centroid_bounds.min, axis);
+        f32 to = _bvh_vec3_at(centroid_bounds.max, axis);
+        if(from == to)
+            continue;
+
+        AABB bin_bounds[BVH_BINS];
+        u32 bin_counts[BVH_BINS] = {0};
+        for(isize b = 0; b < BVH_BINS; b++)
+            bin_bounds[b] = _bvh_aabb_empty();
+
+        f32 scale = BVH_BINS / (to - from);
+        for(u32 i = 0; i < node->count; i++)
+        {
+            const AABB* box = &boxes[bvh->items.data[node->first + i]];
+            isize bin = MIN((isize) ((_bvh_centroid(box, axis) - from)*scale), BVH_BINS - 1);
+            bin_counts[bin] += 1;
+            _bvh_aabb_grow(&bin_bounds[bin], *box);
+        }
+
+        //Sweep from the right to get the cost of all right sides then from the left
+        f32 right_costs[BVH_BINS] = {0};
+        AABB right_bounds = _bvh_aabb_empty();
+        u32 right_count = 0;
+        for(isize b = BVH_BINS - 1; b > 0; b--)
+        {
+            _bvh_aabb_grow(&right_bounds, bin_bounds[b]);
+            right_count += bin_counts[b];
+            right_costs[b] = _bvh_aabb_area(right_bounds) * (f32) right_count;
+        }
+
+        AABB left_bounds = _bvh_aabb_empty();
+        u32 left_count = 0;
+        for(isize b = 0; b < BVH_BINS - 1; b++)
+        {
+            _bvh_aabb_grow(&left_bounds, bin_bounds[b]);
+            left_count += bin_counts[b];
+            if(left_count == 0 || left_count == node->count)
+                continue;
+
+            f32 cost = _bvh_aabb_area(left_bounds) * (f32) left_count + right_costs[b + 1];
+            if(cost < best_cost)
+            {
+                best_cost = cost;
+                *out_axis = axis;
+                *out_position = from + (f32) (b + 1) / scale;
+            }
+        }
+    }
+
+    if(best_cost == FLT_MAX)
+        return false;
+
+    f32 area = _bvh_aabb_area(_bvh_node_bounds(node));
+    f32 leaf_cost = area * (f32) node->count;
+    return node->count > BVH_MAX_LEAF_SIZE || best_cost + area*BVH_NODE_COST < leaf_cost;
+}
+
+EXTERNAL void bvh_build(Bvh* bvh, const AABB* boxes, const u64* keys_or_null, isize count)
+{
+    array_clear(&bvh->nodes);
+    array_clear(&bvh->parents);
+    array_resize_for_overwrite(&bvh->items, count);
+    array_resize_for_overwrite(&bvh->leaf_of, count);
+    if(count == 0)
+        return;
+
+    PROFILE_SCOPE()
+    {
+        for(isize i = 0; i < count; i++)
+            bvh->items.data[i] = (i32) i;
+
+        Bvh_Node root = {0};
+        root.first = 0;
+        root.count = (u32) count;
+        _bvh_node_set_bounds(&root, _bvh_leaf_bounds(bvh, &root, boxes));
+        array_push(&bvh->nodes, root);
+
+        //Nodes waiting to be split. Children are always pushed after their parents
+        // which is what bvh_refit relies on.
+        typedef struct {
+            i32 node;
+            i32 depth;
+        } Entry;
+
+        Array(Entry) stack = {bvh->nodes.allocator};
+        Entry root_entry = {0, 0};
+        array_push(&stack, root_entry);
+        while(stack.len > 0)
+        {
+            Entry entry = stack.data[--stack.len];
+            i32 node_index = entry.node;
+            Bvh_Node node = bvh->nodes.data[node_index];
+
+            //The queries traverse using fixed size stacks so the depth is capped. 
+            //Only pathological inputs get this deep. The node simply stays a (bigger) leaf.
+            if(entry.depth + 1 >= BVH_MAX_DEPTH)
+                continue;
+
+            isize axis = 0;
+            f32 position = 0;
+            u32 left_count = 0;
+            if(node.count > 1 && _bvh_find_split(bvh, &node, boxes, &axis, &position))
+            {
+                //Partition the items in place
+                i32* items = bvh->items.data + node.first;
+                isize i = 0;
+                isize j = node.count;
+                while(i < j)
+                {
+                    if(_bvh_centroid(&boxes[items[i]], axis) < position)
+                        i++;
+                    else
+                    {
+                        j--;
+                        SWAP(&items[i], &items[j]);
+                    }
+                }
+                left_count = (u32) i;
+            }
+
+            //Too many items that cannot be separated spatially (all centroids equal). Split by index.
+            if((left_count == 0 || left_count == node.count) && node.count > BVH_MAX_LEAF_SIZE)
+                left_count = node.count / 2;
+
+            if(left_count == 0 || left_count == node.count)
+                continue;
+
+            Bvh_Node left = {0};
+            Bvh_Node right = {0};
+            left.first = node.first;
+            left.count = left_count;
+            right.first = node.first + left_count;
+            right.count = node.count - left_count;
+            _bvh_node_set_bounds(&left, _bvh_leaf_bounds(bvh, &left, boxes));
+            _bvh_node_set_bounds(&right, _bvh_leaf_bounds(bvh, &right, boxes));
+
+            u32 left_index = (u32) bvh->nodes.len;
+            array_push(&bvh->nodes, left);
+            array_push(&bvh->nodes, right);
+
+            bvh->nodes.data[node_index].first = left_index;
+            bvh->nodes.data[node_index].count = 0;
+            Entry left_entry = {(i32) left_index, entry.depth + 1};
+            Entry right_entry = {(i32) left_index + 1, entry.depth + 1};
+            array_push(&stack, left_entry);
+            array_push(&stack, right_entry);
+        }
+        array_deinit(&stack);
+
+        //Leaves are small so insertion sort is the fastest
+        if(keys_or_null)
+        {
+            for(isize n = 0; n < bvh->nodes.len; n++)
+            {
+                Bvh_Node* node = &bvh->nodes.data[n];
+                i32* items = bvh->items.data + node->first;
+                for(u32 i = 1; i < node->count; i++)
+                    for(u32 k = i; k > 0 && keys_or_null[items[k - 1]] > keys_or_null[items[k]]; k--)
+                        SWAP(&items[k - 1], &items[k]);
+            }
+        }
+
+        //Links back up used by bvh_refit_items
+        array_resize_for_overwrite(&bvh->parents, bvh->nodes.len);
+        bvh->parents.data[0] = -1;
+        for(isize n = 0; n < bvh->nodes.len; n++)
+        {
+            Bvh_Node* node = &bvh->nodes.data[n];
+            if(node->count > 0)
+            {
+                for(u32 i = 0; i < node->count; i++)
+                    bvh->leaf_of.data[bvh->items.data[node->first + i]] = (i32) n;
+            }
+            else
+            {
+                bvh->parents.data[node->first] = (i32) n;
+                bvh->parents.data[node->first + 1] = (i32) n;
+            }
+        }
+    }
+}
+
+EXTERNAL void bvh_refit(Bvh* bvh, const AABB* boxes)
+{
+    PROFILE_SCOPE()
+    {
+        //Children are always after their parents so going backwards visits them first
+        for(isize n = bvh->nodes.len; n-- > 0; )
+        {
+            Bvh_Node* node = &bvh->nodes.data[n];
+            if(node->count > 0)
+                _bvh_node_set_bounds(node, _bvh_leaf_bounds(bvh, node, boxes));
+            else
+            {
+                AABB bounds = _bvh_node_bounds(&bvh->nodes.data[node->first]);
+                _bvh_aabb_grow(&bounds, _bvh_node_bounds(&bvh->nodes.data[node->first + 1]));
+                _bvh_node_set_bounds(node, bounds);
+            }
+        }
+    }
+}
+
+EXTERNAL void bvh_refit_items(Bvh* bvh, const AABB* boxes, const i32* changed, isize changed_count)
+{
+    PROFILE_SCOPE()
+    {
+        for(isize c = 0; c < changed_count; c++)
+        {
+            i32 n = bvh->leaf_of.data[changed[c]];
+            _bvh_node_set_bounds(&bvh->nodes.data[n], _bvh_leaf_bounds(bvh, &bvh->nodes.data[n], boxes));
+
+            //The parents above an unchanged node are also unchanged
+            for(n = bvh->parents.data[n]; n >= 0; n = bvh->parents.data[n])
+            {
+                Bvh_Node* node = &bvh->nodes.data[n];
+                AABB bounds = _bvh_node_bounds(&bvh->nodes.data[node->first]);
+                _bvh_aabb_grow(&bounds, _bvh_node_bounds(&bvh->nodes.data[node->first + 1]));
+
+                AABB old_bounds = _bvh_node_bounds(node);
+                if(memcmp(&bounds, &old_bounds, sizeof bounds) == 0)
+                    break;
+                _bvh_node_set_bounds(node, bounds);
+            }
+        }
+    }
+}
+
+//Tests the box against the planes in plane_mask. Returns false if outside.
+//Otherwise clears the planes the box is entirely in front of from the mask.
+INTERNAL bool _bvh_frustum_test(const Frustum* frustum, Vec3 min, Vec3 max, u32* plane_mask)
+{
+    f32 cx = (min.x + max.x)*0.5f;
+    f32 cy = (min.y + max.y)*0.5f;
+    f32 cz = (min.z + max.z)*0.5f;
+    f32 ex = (max.x - min.x)*0.5f;
+    f32 ey = (max.y - min.y)*0.5f;
+    f32 ez = (max.z - min.z)*0.5f;
+
+    for(u32 i = 0; i < 6; i++)
+    {
+        if((*plane_mask & (1u << i)) == 0)
+            continue;
+
+        Vec4 p = frustum->planes[i];
+        f32 distance = p.x*cx + p.y*cy + p.z*cz + p.w;
+        f32 radius = fabsf(p.x)*ex + fabsf(p.y)*ey + fabsf(p.z)*ez;
+        if(distance + radius < 0)
+            return false;
+        if(distance - radius >= 0)
+            *plane_mask &= ~(1u << i);
+    }
+
+    return true;
+}
+
+EXTERNAL isize bvh_query_frustum(const Bvh* bvh, const AABB* boxes, const Frustum* frustum, i32_Array* visible)
+{
+    isize visible_before = visible->len;
+    if(bvh->nodes.len == 0)
+        return 0;
+
+    typedef struct {
+        u32 node;
+        u32 plane_mask;
+    } Entry;
+
+    Entry stack[BVH_MAX_DEPTH*2] = {0};
+    isize stack_len = 0;
+    stack[stack_len].node = 0;
+    stack[stack_len].plane_mask = 0x3F;
+    stack_len ++;
+
+    while(stack_len > 0)
+    {
+        Entry entry = stack[--stack_len];
+        const Bvh_Node* node = &bvh->nodes.data[entry.node];
+        if(entry.plane_mask != 0 && _bvh_frustum_test(frustum, node->min, node->max, &entry.plane_mask) == false)
+            continue;
+
+        if(node->count > 0)
+        {
+            for(u32 i = 0; i < node->count; i++)
+            {
+                i32 item = bvh->items.data[node->first + i];
+                u32 plane_mask = entry.plane_mask;
+                if(plane_mask == 0 || _bvh_frustum_test(frustum, boxes[item].min, boxes[item].max, &plane_mask))
+                    array_push(visible, item);
+            }
+        }
+        //bvh_build caps the depth to BVH_MAX_DEPTH so the stack never holds more than one
+        // sibling per level plus the two children pushed here.
+        else if(stack_len + 2 <= ARRAY_LEN(stack))
+        {
+            stack[stack_len].node = node->first + 1;
+            stack[stack_len].plane_mask = entry.plane_mask;
+            stack_len ++;
+            stack[stack_len].node = node->first;
+            stack[stack_len].plane_mask = entry.plane_mask;
+            stack_len ++;
+        }
+        else
+            ASSERT(false, "bvh too deep!");
+    }
+
+    return visible->len - visible_before;
+}
+
+//Slab test. Returns the distance at which the ray enters the box or FLT_MAX if it misses.
+INTERNAL f32 _bvh_ray_box(Vec3 origin, Vec3 inv_dir, Vec3 min, Vec3 max, f32 max_distance)
+{
+    f32 t_min = 0;
+    f32 t_max = max_distance;
+    for(isize axis = 0; axis < 3; axis++)
+    {
+        f32 o = _bvh_vec3_at(origin, axis);
+        f32 inv = _bvh_vec3_at(inv_dir, axis);
+        f32 t1 = (_bvh_vec3_at(min, axis) - o)*inv;
+        f32 t2 = (_bvh_vec3_at(max, axis) - o)*inv;
+        t_min = MAX(t_min, MIN(t1, t2));
+        t_max = MIN(t_max, MAX(t1, t2));
+    }
+
+    return t_min <= t_max ? t_min : FLT_MAX;
+}
+
+EXTERNAL i32 bvh_ray_pick(const Bvh* bvh, const AABB* boxes, Vec3 origin, Vec3 dir, f32 max_distance, f32* distance_or_null)
+{
+    i32 hit = -1;
+    f32 hit_distance = max_distance;
+    if(bvh->nodes.len > 0)
+    {
+        //Division by zero gives infinity which the slab test handles correctly
+        Vec3 inv_dir = vec3(1.0f/dir.x, 1.0f/dir.y, 1.0f/dir.z);
+
+        u32 stack[BVH_MAX_DEPTH*2] = {0};
+        isize stack_len = 0;
+        stack[stack_len++] = 0;
+        while(stack_len > 0)
+        {
+            const Bvh_Node* node = &bvh->nodes.data[stack[--stack_len]];
+            if(node->count > 0)
+            {
+                for(u32 i = 0; i < node->count; i++)
+                {
+                    i32 item = bvh->items.data[node->first + i];
+                    f32 t = _bvh_ray_box(origin, inv_dir, boxes[item].min, boxes[item].max, hit_distance);
+                    if(t != FLT_MAX && (hit == -1 || t < hit_distance))
+                    {
+                        hit = item;
+                        hit_distance = t;
+                    }
+                }
+                continue;
+            }
+
+            const Bvh_Node* left = &bvh->nodes.data[node->first];
+            const Bvh_Node* right = &bvh->nodes.data[node->first + 1];
+            f32 t_left = _bvh_ray_box(origin, inv_dir, left->min, left->max, hit_distance);
+            f32 t_right = _bvh_ray_box(origin, inv_dir, right->min, right->max, hit_distance);
+
+            //Push the further child first so the closer one is visited first
+            //and the hit distance shrinks as fast as possible.
+            u32 near_child = node->first;
+            u32 far_child = node->first + 1;
+            if(t_right < t_left)
+            {
+                SWAP(&near_child, &far_child);
+                SWAP(&t_left, &t_right);
+            }
+
+            ASSERT(stack_len + 2 <= ARRAY_LEN(stack), "bvh too deep!");
+            if(t_right != FLT_MAX && stack_len < ARRAY_LEN(stack))
+                stack[stack_len++] = far_child;
+            if(t_left != FLT_MAX && stack_len < ARRAY_LEN(stack))
+                stack[stack_len++] = near_child;
+        }
+    }
+
+    if(distance_or_null)
+        *distance_or_null = hit_distance;
+    return hit;
+}
+
+#endif
@@ -0,0 +1,339 @@
+#ifndef LIB_FORMAT_MESH
+#define LIB_FORMAT_MESH
+
+// A binary "cooked" mesh file containing the final deduplicated vertices, triangles,
+// level of detail chain, groups and material references exactly in the form the engine uses them.
+//
+// The file is designed to be memory mapped and used in place. All sections are
+// aligned to FORMAT_MESH_ALIGN and stored in native (little endian) byte order so
+// format_mesh_read only validates the header, lod and group ranges and strings and points 
+// the arrays into the data. Nothing is parsed or copied.
+//
+// Layout:
+//  [Format_Mesh_Header]
+//  [Vertex vertices[vertex_count]]
+//  [Triangle_Index triangles[triangle_count]]
+//  [i32 lod_indices[lod_index_count]] - indices of the coarser lods (see mesh_lod.h)
+//  [Mesh_Lod lods[lod_count]] - lods[0] is the full mesh. The index ranges are into the indices of
+//                               triangles followed by lod_indices (as made by mesh_lod_build).
+//  [Format_Mesh_Group groups[group_count]]
+//  [Format_Mesh_String material_files[material_file_count]]
+//  [char strings[]] - all names are offsets into this block. Each is null terminated.
+//
+// The header also stores size, last write time and hash of the source file the
+// mesh was cooked from so that stale files can be detected and recooked.
+
+#include "lib/string.h"
+#include "engine_types.h"
+#include "asset_descriptions.h"
+#include "mesh_lod.h"
+
+#define FORMAT_MESH_MAGIC   0x6873656d6b6f6f63ULL //"cookmesh" in little endian
+#define FORMAT_MESH_VERSION 2
+#define FORMAT_MESH_ALIGN   64
+
+typedef struct Format_Mesh_Section {
+    i64 offset; //from the start of the file
+    i64 count;  //number of items
+} Format_Mesh_Section;
+
+typedef struct Format_Mesh_String {
+    i64 offset; //from the start of the strings section
+    i64 len;    //without the null terminator
+} Format_Mesh_String;
+
+//The source file a cooked file was made from. Shared by all cooked formats (see format_texture.h).
+typedef struct Format_Source_Info {
+    u64 hash;               //xxhash64 of the entire source file
+    i64 size;
+    i64 last_write_time;
+} Format_Source_Info;
+
+typedef struct Format_Mesh_Header {
+    u64 magic;
+    u32 version;
+    u32 header_size;
+    i64 file_size;
+    u32 vertex_size;
+    u32 triangle_size;
+    u32 lod_size;
+    u32 _;
+
+    Format_Source_Info source;
+
+    Format_Mesh_Section vertices;
+    Format_Mesh_Section triangles;
+    Format_Mesh_Section lod_indices;
+    Format_Mesh_Section lods;
+    Format_Mesh_Section groups;
+    Format_Mesh_Section material_files;
+    Format_Mesh_Section strings;
+} Format_Mesh_Header;
+
+typedef struct Format_Mesh_Group {
+    Format_Mesh_String name;
+    Format_Mesh_String material_name;
+    Format_Mesh_String material_path;
+
+    i32 next_i1;
+    i32 child_i1;
+    i32 depth;
+
+    i32 triangles_from;
+    i32 triangles_to;
+    u32 _;
+} Format_Mesh_Group;
+
+//View into the read file. Is only valid while the data passed to format_mesh_read is.
+typedef struct Format_Mesh {
+    const Format_Mesh_Header* header;
+    const Vertex* vertices;
+    const Triangle_Index* triangles;
+    const i32* lod_indices;
+    const Mesh_Lod* lods;
+    const Format_Mesh_Group* groups;
+    const Format_Mesh_String* material_files;
+    String strings;
+
+    isize vertices_count;
+    isize triangles_count;
+    isize lod_indices_count;
+    isize lods_count;
+    isize groups_count;
+    isize material_files_count;
+} Format_Mesh;
+
+//lods[0] has to be the full mesh and lods_count at least 1 and at most MESH_LOD_MAX.
+EXTERNAL void format_mesh_write(String_Builder* into, Format_Source_Info source,
+    const Vertex* vertices, isize vertices_count,
+    const Triangle_Index* triangles, isize triangles_count,
+    const i32* lod_indices, isize lod_indices_count,
+    const Mesh_Lod* lods, isize lods_count,
+    const Triangle_Mesh_Group_Description* groups, isize groups_count,
+    const String* material_files, isize material_files_count);
+
+//Validates the data and fills out with pointers into it. Returns false if the data is not
+// a valid mesh file of the current version.
+EXTERNAL bool format_mesh_read(Format_Mesh* out, String data);
+EXTERNAL String format_mesh_get_string(Format_Mesh mesh, Format_Mesh_String string);
+
+#endif
+
+#if (defined(LIB_ALL_IMPL) || defined(LIB_FORMAT_MESH_IMPL)) && !defined(LIB_FORMAT_MESH_HAS_IMPL)
+#define LIB_FORMAT_MESH_HAS_IMPL
+
+INTERNAL i64 _format_mesh_align(i64 offset)
+{
+    return (offset + FORMAT_MESH_ALIGN - 1) / FORMAT_MESH_ALIGN * FORMAT_MESH_ALIGN;
+}
+
+INTERNAL Format_Mesh_String _format_mesh_push_string(String_Builder* strings, String string)
+{
+    Format_Mesh_String out = {strings->len, string.len};
+    builder_append(strings, string);
+    builder_push(strings, '\0');
+    return out;
+}
+
+EXTERNAL void format_mesh_write(String_Builder* into, Format_Source_Info source,
+    const Vertex* vertices, isize vertices_count,
+    const Triangle_Index* triangles, isize triangles_count,
+    const i32* lod_indices, isize lod_indices_count,
+    const Mesh_Lod* lods, isize lods_count,
+    const Triangle_Mesh_Group_Description* groups, isize groups_count,
+    const String* material_files, isize material_files_count)
+{
+    ASSERT(1 <= lods_count && lods_count <= MESH_LOD_MAX);
+    PROFILE_SCOPE()
+    SCRATCH_ARENA(arena)
+    {
+        String_Builder strings = builder_make(arena.alloc, 0);
+        Array(Format_Mesh_Group) out_groups = {arena.alloc};
+        Array(Format_Mesh_String) out_material_files = {arena.alloc};
+
+        for(isize i = 0; i < groups_count; i++)
+        {
+            const Triangle_Mesh_Group_Description* group = &groups[i];
+            Format_Mesh_Group out_group = {0};
+            out_group.name = _format_mesh_push_string(&strings, group->name);
+            out_group.material_name = _format_mesh_push_string(&strings, group->material_name);
+            out_group.material_path = _format_mesh_push_string(&strings, group->material_path);
+            out_group.next_i1 = group->next_i1;
+            out_group.child_i1 = group->child_i1;
+            out_group.depth = group->depth;
+            out_group.triangles_from = group->triangles_from;
+            out_group.triangles_to = group->triangles_to;
+            array_push(&out_groups, out_group);
+        }
+
+        for(isize i = 0; i < material_files_count; i++)
+            array_push(&out_material_files, _format_mesh_push_string(&strings, material_files[i]));
+
+        Format_Mesh_Header header = {0};
+        header.magic = FORMAT_MESH_MAGIC;
+        header.version = FORMAT_MESH_VERSION;
+        header.header_size = sizeof(Format_Mesh_Header);
+        header.vertex_size = sizeof(Vertex);
+        header.triangle_size = sizeof(Triangle_Index);
+        header.lod_size = sizeof(Mesh_Lod);
+        header.source = source;
+
+        i64 offset = _format_mesh_align(sizeof(Format_Mesh_Header));
+        header.vertices.offset = offset;
+        header.vertices.count = vertices_count;
+        offset = _format_mesh_align(offset + vertices_count * (i64) sizeof(Vertex));
+
+        header.triangles.offset = offset;
+        header.triangles.count = triangles_count;
+        offset = _format_mesh_align(offset + triangles_count * (i64) sizeof(Triangle_Index));
+
+        header.lod_indices.offset = offset;
+        header.lod_indices.count = lod_indices_count;
+        offset = _format_mesh_align(offset + lod_indices_count * (i64) sizeof(i32));
+
+        header.lods.offset = offset;
+        header.lods.count = lods_count;
+        offset = _format_mesh_align(offset + lods_count * (i64) sizeof(Mesh_Lod));
+
+        header.groups.offset = offset;
+        header.groups.count = out_groups.len;
+        offset = _format_mesh_align(offset + out_groups.len * (i64) sizeof(Format_Mesh_Group));
+
+        header.material_files.offset = offset;
+        header.material_files.count = out_material_files.len;
+        offset = _format_mesh_align(offset + out_material_files.len * (i64) sizeof(Format_Mesh_String));
+
+        header.strings.offset = offset;
+        header.strings.count = strings.len;
+        offset = _format_mesh_align(offset + strings.len);
+        header.file_size = offset;
+
+        //Everything including the padding is zeroed so the output is deterministic
+        builder_clear(into);
+        builder_resize(into, offset);
+        memset(into->data, 0, (size_t) offset);
+        memcpy(into->data, &header, sizeof header);
+        memcpy(into->data + header.vertices.offset, vertices, (size_t) vertices_count * sizeof(Vertex));
+        memcpy(into->data + header.triangles.offset, triangles, (size_t) triangles_count * sizeof(Triangle_Index));
+        memcpy(into->data + header.lod_indices.offset, lod_indices, (size_t) lod_indices_count * sizeof(i32));
+        memcpy(into->data + header.lods.offset, lods, (size_t) lods_count * sizeof(Mesh_Lod));
+        memcpy(into->data + header.groups.offset, out_groups.data, (size_t) array_byte_size(out_groups));
+        memcpy(into->data + header.material_files.offset, out_material_files.data, (size_t) array_byte_size(out_material_files));
+        memcpy(into->data + header.strings.offset, strings.data, (size_t) strings.len);
+    }
+}
+
+INTERNAL bool _format_mesh_section_is_valid(Format_Mesh_Section section, i64 item_size, i64 file_size)
+{
+    return section.offset >= (i64) sizeof(Format_Mesh_Header)
+        && section.offset % FORMAT_MESH_ALIGN == 0
+        && section.count >= 0
+        && section.offset <= file_size
+        && section.count <= (file_size - section.offset) / item_size;
+}
+
+//Each string has to fit into the strings section together with its null terminator.
+INTERNAL bool _format_mesh_string_is_valid(Format_Mesh_String string, i64 strings_size)
+{
+    return string.offset >= 0
+        && string.len >= 0
+        && string.offset < strings_size
+        && string.len < strings_size - string.offset;
+}
+
+//Checks everything the engine indexes with without further checks: the triangle ranges of groups,
+// the index ranges of lods and the strings. The contents of vertices, triangles and lod_indices are not checked.
+INTERNAL bool _format_mesh_contents_are_valid(Format_Mesh mesh)
+{
+    i64 full_index_count = (i64) mesh.triangles_count*3;
+    i64 all_index_count = full_index_count + mesh.lod_indices_count;
+    if(mesh.lods_count < 1 || mesh.lods_count > MESH_LOD_MAX 
+        || mesh.lods[0].index_from != 0 || mesh.lods[0].index_count != full_index_count)
+        return false;
+
+    for(isize i = 0; i < mesh.lods_count; i++)
+    {
+        Mesh_Lod lod = mesh.lods[i];
+        if(lod.index_from < 0 || lod.index_count < 0 || lod.index_count % 3 != 0 
+            || lod.index_count > all_index_count - lod.index_from)
+            return false;
+    }
+
+    i64 strings_size = mesh.strings.len;
+    for(isize i = 0; i < mesh.groups_count; i++)
+    {
+        Format_Mesh_Group group = mesh.groups[i];
+        if(group.triangles_from < 0 || group.triangles_from > group.triangles_to || group.triangles_to > mesh.triangles_count)
+            return false;
+
+        if(_format_mesh_string_is_valid(group.name, strings_size) == false
+            || _format_mesh_string_is_valid(group.material_name, strings_size) == false
+            || _format_mesh_string_is_valid(group.material_path, strings_size) == false)
+            return false;
+    }
+
+    for(isize i = 0; i < mesh.material_files_count; i++)
+        if(_format_mesh_string_is_valid(mesh.material_files[i], strings_size) == false)
+            return false;
+
+    return true;
+}
+
+EXTERNAL bool format_mesh_read(Format_Mesh* out, String data)
+{
+    Format_Mesh mesh = {0};
+    //The data only needs to be aligned enough for the i64 header fields. Mapped files are page aligned.
+    if(data.len < (isize) sizeof(Format_Mesh_Header) || (usize) data.data % 8 != 0)
+        return false;
+
+    const Format_Mesh_Header* header = (const Format_Mesh_Header*) (const void*) data.data;
+    bool state = header->magic == FORMAT_MESH_MAGIC
+        && header->version == FORMAT_MESH_VERSION
+        && header->header_size == sizeof(Format_Mesh_Header)
+        && header->vertex_size == sizeof(Vertex)
+        && header->triangle_size == sizeof(Triangle_Index)
+        && header->lod_size == sizeof(Mesh_Lod)
+        && header->file_size <= data.len
+        && _format_mesh_section_is_valid(header->vertices, sizeof(Vertex), header->file_size)
+        && _format_mesh_section_is_valid(header->triangles, sizeof(Triangle_Index), header->file_size)
+        && _format_mesh_section_is_valid(header->lod_indices, sizeof(i32), header->file_size)
+        && _format_mesh_section_is_valid(header->lods, sizeof(Mesh_Lod), header->file_size)
+        && _format_mesh_section_is_valid(header->groups, sizeof(Format_Mesh_Group), header->file_size)
+        && _format_mesh_section_is_valid(header->material_files, sizeof(Format_Mesh_String), header->file_size)
+        && _format_mesh_section_is_valid(header->strings, 1, header->file_size);
+
+    if(state)
+    {
+        mesh.header = header;
+        mesh.vertices = (const Vertex*) (const void*) (data.data + header->vertices.offset);
+        mesh.triangles = (const Triangle_Index*) (const void*) (data.data + header->triangles.offset);
+        mesh.lod_indices = (const i32*) (const void*) (data.data + header->lod_indices.offset);
+        mesh.lods = (const Mesh_Lod*) (const void*) (data.data + header->lods.offset);
+        mesh.groups = (const Format_Mesh_Group*) (const void*) (data.data + header->groups.offset);
+        mesh.material_files = (const Format_Mesh_String*) (const void*) (data.data + header->material_files.offset);
+        mesh.strings = string_make(data.data + header->strings.offset, header->strings.count);
+
+        mesh.vertices_count = header->vertices.count;
+        mesh.triangles_count = header->triangles.count;
+        mesh.lod_indices_count = header->lod_indices.count;
+        mesh.lods_count = header->lods.count;
+        mesh.groups_count = header->groups.count;
+        mesh.material_files_count = header->material_files.count;
+        state = _format_mesh_contents_are_valid(mesh);
+    }
+
+    if(state)
+        *out = mesh;
+
+    return state;
+}
+
+EXTERNAL String format_mesh_get_string(Format_Mesh mesh, Format_Mesh_String string)
+{
+    if(string.offset < 0 || string.len < 0 || string.offset + string.len > mesh.strings.len)
+        return STRING("");
+
+    return string_make(mesh.strings.data + string.offset, string.len);
+}
+
+#endif
@@ -10,8 +10,8 @@
 // Probably the bigest dependency is on the array.h file but doing the parsing without
 // it would be needlessly annoying.
 // 
-// The parsing itself is really fast. About 8x faster than using scanf however the float parsing is not
-// very accurate at the moment.
+// The parsing itself is really fast. Lines are found using SIMD and floats are parsed
+// using the Eisel-Lemire algorithm which is both fast and correctly rounded (same as strtof).
 
 #include "lib/math.h"
 #include "lib/array.h"
@@ -182,6 +182,15 @@ typedef Array(Format_Obj_Group) Format_Obj_Group_Array;
 typedef Array(Format_Mtl_Material) Format_Mtl_Material_Array;
 typedef Array(Format_Obj_Vertex_Index) Format_Obj_Vertex_Index_Array;
 
+//A face with more than 3 corners. Is stored as a fan of corner_count - 2 trinagles 
+// around its first corner starting at trinagles_from.
+typedef struct Format_Obj_Polygon {
+    i32 trinagles_from;
+    i32 corner_count;
+} Format_Obj_Polygon;
+
+typedef Array(Format_Obj_Polygon) Format_Obj_Polygon_Array;
+
 typedef struct Format_Obj_Model {
     Vec3_Array positions; 
     Vec2_Array uvs; 
@@ -189,6 +198,7 @@ typedef struct Format_Obj_Model {
     Format_Obj_Vertex_Index_Array indices;
     Format_Obj_Group_Array groups;
     String_Builder_Array material_files;
+    Format_Obj_Polygon_Array polygons;
 } Format_Obj_Model;
 
 typedef enum Format_Obj_Mtl_Error_Statement Format_Obj_Mtl_Error_Statement;
@@ -205,10 +215,18 @@ EXTERNAL void format_obj_group_deinit(Format_Obj_Group* info);
 EXTERNAL void format_obj_model_deinit(Format_Obj_Model* info);
 
 EXTERNAL bool format_obj_read(Format_Obj_Model* out, String obj_source, Format_Obj_Mtl_Error* errors, isize errors_max_count, isize* had_errors);
+EXTERNAL bool format_obj_read_parallel(Format_Obj_Model* out, String obj_source, Format_Obj_Mtl_Error* errors, isize errors_max_count, isize* had_errors);
 EXTERNAL bool format_mtl_read(Format_Mtl_Material_Array* out, String mtl_source, Format_Obj_Mtl_Error* errors, isize errors_max_count, isize* had_errors);
 
+//Faces with more than 3 corners are fan triangulated while reading which is only correct for convex polygons.
+//Retriangulates all concave polygons in model->polygons using ear clipping. The trinagle count does not change.
+EXTERNAL void format_obj_triangulate_concave_polygons(Format_Obj_Model* model);
+
 EXTERNAL const char* format_obj_mtl_error_statement_to_string(Format_Obj_Mtl_Error_Statement statement);
 
+//Parses [+-]digits[.digits][(e|E)[+-]digits] into the correctly rounded f32. Used for all floats in obj and mtl files.
+EXTERNAL bool format_obj_match_decimal_f32(String str, isize* index, f32* out);
+
 enum {
     FORMAT_MTL_ILLUM_MIN = 0,
     FORMAT_MTL_ILLUM_MAX = 10,
@@ -274,6 +292,8 @@ typedef struct Format_Obj_Mtl_Error
 #if (defined(LIB_ALL_IMPL) || defined(LIB_FORMAT_OBJ_MTL_IMPL)) && !defined(LIB_FORMAT_OBJ_MTL_HAS_IMPL)
 #define LIB_FORMAT_OBJ_MTL_HAS_IMPL
 
+#include "parallel.h"
+
 EXTERNAL void _format_obj_texture_info_init_or_deinit(Format_Mtl_Map* info, Allocator* alloc, bool is_init)
 {
     if(is_init)
@@ -355,6 +375,7 @@ EXTERNAL void format_obj_model_deinit(Format_Obj_Model* info)
     array_deinit(&info->normals);
     array_deinit(&info->indices);
     array_deinit(&info->groups);
+    array_deinit(&info->polygons);
     builder_array_deinit(&info->material_files);
 }
 
@@ -377,6 +398,7 @@ EXTERNAL void format_obj_model_init(Format_Obj_Model* info, Allocator* alloc)
     array_init(&info->indices, alloc);
     array_init(&info->groups, alloc);
     array_init(&info->material_files, alloc);
+    array_init(&info->polygons, alloc);
 }
 
 EXTERNAL void format_obj_group_init(Format_Obj_Group* info, Allocator* alloc)
@@ -474,382 +496,1340 @@ INTERNAL Format_Obj_Group* _obj_parser_get_active_group(Format_Obj_Model* out, S
     return _obj_parser_add_group(out, active_object, &def_groups, vertex_index);
 }
 
-EXTERNAL bool format_obj_read(Format_Obj_Model* out, String obj_source, Format_Obj_Mtl_Error* errors, isize errors_max_count, isize* had_errors)
+//========================= FAST SCANNING =========================
+// The obj files we load are often hundreds of MB large so the parsing needs to be as fast as possible.
+// Lines are found 16 or 32 bytes at a time using SSE2/AVX2 (with scalar fallback for the remainder).
+// Face lines are classified into whitespace and '/' bit masks in one SSE2 pass so that the corners 
+// and their indices are delimited by bit scans instead of char by char.
+// Floats are parsed into a decimal mantissa and exponent and converted using the Clinger fast path
+// for the common short numbers and Eisel-Lemire algorithm for the rest. Both are correctly rounded.
+// The very rare inputs neither can decide (too many digits, subnormals, ...) go to strtof.
+
+#if defined(__AVX2__)
+    #define FORMAT_OBJ_AVX2
+    #include <immintrin.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define FORMAT_OBJ_SSE2
+    #include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+    #include <intrin.h>
+#endif
+
+#include <stdlib.h>
+
+typedef struct _Format_Obj_Line_Iterator {
+    String line;        //the line without the ending '\n'
+    isize line_from;    //index of the first char of line within the source
+    isize line_number;  //one based
+    isize next_from;
+} _Format_Obj_Line_Iterator;
+
+INTERNAL i32 _format_obj_find_first_set_bit32(u32 num)
 {
-    bool had_error = false;
-    PROFILE_SCOPE() 
+    ASSERT(num != 0);
+    #ifdef _MSC_VER
+        unsigned long index = 0;
+        _BitScanForward(&index, (unsigned long) num);
+        return (i32) index;
+    #else
+        return __builtin_ctz(num);
+    #endif
+}
+
+INTERNAL i32 _format_obj_find_first_set_bit64(u64 num)
+{
+    ASSERT(num != 0);
+    #ifdef _MSC_VER
+        unsigned long index = 0;
+        _BitScanForward64(&index, num);
+        return (i32) index;
+    #else
+        return __builtin_ctzll(num);
+    #endif
+}
+
+INTERNAL i32 _format_obj_count_leading_zeros64(u64 num)
+{
+    ASSERT(num != 0);
+    #ifdef _MSC_VER
+        unsigned long index = 0;
+        _BitScanReverse64(&index, num);
+        return 63 - (i32) index;
+    #else
+        return __builtin_clzll(num);
+    #endif
+}
+
+INTERNAL u64 _format_obj_mul128(u64 a, u64 b, u64* lo)
+{
+    #ifdef _MSC_VER
+        u64 hi = 0;
+        *lo = _umul128(a, b, &hi);
+        return hi;
+    #else
+        unsigned __int128 product = (unsigned __int128) a * b;
+        *lo = (u64) product;
+        return (u64) (product >> 64);
+    #endif
+}
+
+//Returns the index of the first '\n' in data[from, to) or to if there is none.
+INTERNAL isize _format_obj_find_newline(const char* data, isize from, isize to)
+{
+    isize i = from;
+    #ifdef FORMAT_OBJ_AVX2
+    __m256i newlines32 = _mm256_set1_epi8('\n');
+    for(; i + 32 <= to; i += 32)
     {
-        Allocator* alloc = out->indices.allocator;
-        ASSERT(alloc);
+        __m256i chunk = _mm256_loadu_si256((const __m256i*) (const void*) (data + i));
+        u32 mask = (u32) _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, newlines32));
+        if(mask)
+            return i + _format_obj_find_first_set_bit32(mask);
+    }
+    #endif
 
-        format_obj_model_init(out, alloc);
-    
-        isize error_count = 0;
+    #ifdef FORMAT_OBJ_SSE2
+    __m128i newlines16 = _mm_set1_epi8('\n');
+    for(; i + 16 <= to; i += 16)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i*) (const void*) (data + i));
+        u32 mask = (u32) _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newlines16));
+        if(mask)
+            return i + _format_obj_find_first_set_bit32(mask);
+    }
+    #endif
+
+    for(; i < to; i++)
+        if(data[i] == '\n')
+            return i;
+
+    return to;
+}
+
+INTERNAL bool _format_obj_line_iterator_next(_Format_Obj_Line_Iterator* it, String source)
+{
+    if(it->next_from >= source.len)
+        return false;
+
+    isize from = it->next_from;
+    isize to = _format_obj_find_newline(source.data, from, source.len);
+    it->line = string_range(source, from, to);
+    it->line_from = from;
+    it->line_number += 1;
+    it->next_from = to + 1;
+    return true;
+}
+
+INTERNAL bool _format_obj_is_whitespace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+//Matches one or more whitespace characters. The lines are already split so we dont look for '\n'.
+INTERNAL bool _format_obj_match_whitespace(String str, isize* index)
+{
+    isize i = *index;
+    while(i < str.len && _format_obj_is_whitespace(str.data[i]))
+        i++;
+
+    bool matched = i != *index;
+    *index = i;
+    return matched;
+}
+
+//Top 64 bits of 5^q normalized so that the highest bit is set. Truncated (not rounded).
+//Covers every q for which a up to 19 digit decimal can be a normal f32.
+#define FORMAT_OBJ_POW5_MIN -64
+#define FORMAT_OBJ_POW5_MAX 38
+static const u64 _format_obj_pow5_table[FORMAT_OBJ_POW5_MAX - FORMAT_OBJ_POW5_MIN + 1] = {
+    0xa87fea27a539e9a5ULL, 0xd29fe4b18e88640eULL, 0x83a3eeeef9153e89ULL,
+    0xa48ceaaab75a8e2bULL, 0xcdb02555653131b6ULL, 0x808e17555f3ebf11ULL,
+    0xa0b19d2ab70e6ed6ULL, 0xc8de047564d20a8bULL, 0xfb158592be068d2eULL,
+    0x9ced737bb6c4183dULL, 0xc428d05aa4751e4cULL, 0xf53304714d9265dfULL,
+    0x993fe2c6d07b7fabULL, 0xbf8fdb78849a5f96ULL, 0xef73d256a5c0f77cULL,
+    0x95a8637627989aadULL, 0xbb127c53b17ec159ULL, 0xe9d71b689dde71afULL,
+    0x9226712162ab070dULL, 0xb6b00d69bb55c8d1ULL, 0xe45c10c42a2b3b05ULL,
+    0x8eb98a7a9a5b04e3ULL, 0xb267ed1940f1c61cULL, 0xdf01e85f912e37a3ULL,
+    0x8b61313bbabce2c6ULL, 0xae397d8aa96c1b77ULL, 0xd9c7dced53c72255ULL,
+    0x881cea14545c7575ULL, 0xaa242499697392d2ULL, 0xd4ad2dbfc3d07787ULL,
+    0x84ec3c97da624ab4ULL, 0xa6274bbdd0fadd61ULL, 0xcfb11ead453994baULL,
+    0x81ceb32c4b43fcf4ULL, 0xa2425ff75e14fc31ULL, 0xcad2f7f5359a3b3eULL,
+    0xfd87b5f28300ca0dULL, 0x9e74d1b791e07e48ULL, 0xc612062576589ddaULL,
+    0xf79687aed3eec551ULL, 0x9abe14cd44753b52ULL, 0xc16d9a0095928a27ULL,
+    0xf1c90080baf72cb1ULL, 0x971da05074da7beeULL, 0xbce5086492111aeaULL,
+    0xec1e4a7db69561a5ULL, 0x9392ee8e921d5d07ULL, 0xb877aa3236a4b449ULL,
+    0xe69594bec44de15bULL, 0x901d7cf73ab0acd9ULL, 0xb424dc35095cd80fULL,
+    0xe12e13424bb40e13ULL, 0x8cbccc096f5088cbULL, 0xafebff0bcb24aafeULL,
+    0xdbe6fecebdedd5beULL, 0x89705f4136b4a597ULL, 0xabcc77118461cefcULL,
+    0xd6bf94d5e57a42bcULL, 0x8637bd05af6c69b5ULL, 0xa7c5ac471b478423ULL,
+    0xd1b71758e219652bULL, 0x83126e978d4fdf3bULL, 0xa3d70a3d70a3d70aULL,
+    0xccccccccccccccccULL, 0x8000000000000000ULL, 0xa000000000000000ULL,
+    0xc800000000000000ULL, 0xfa00000000000000ULL, 0x9c40000000000000ULL,
+    0xc350000000000000ULL, 0xf424000000000000ULL, 0x9896800000000000ULL,
+    0xbebc200000000000ULL, 0xee6b280000000000ULL, 0x9502f90000000000ULL,
+    0xba43b74000000000ULL, 0xe8d4a51000000000ULL, 0x9184e72a00000000ULL,
+    0xb5e620f480000000ULL, 0xe35fa931a0000000ULL, 0x8e1bc9bf04000000ULL,
+    0xb1a2bc2ec5000000ULL, 0xde0b6b3a76400000ULL, 0x8ac7230489e80000ULL,
+    0xad78ebc5ac620000ULL, 0xd8d726b7177a8000ULL, 0x878678326eac9000ULL,
+    0xa968163f0a57b400ULL, 0xd3c21bcecceda100ULL, 0x84595161401484a0ULL,
+    0xa56fa5b99019a5c8ULL, 0xcecb8f27f4200f3aULL, 0x813f3978f8940984ULL,
+    0xa18f07d736b90be5ULL, 0xc9f2c9cd04674edeULL, 0xfc6f7c4045812296ULL,
+    0x9dc5ada82b70b59dULL, 0xc5371912364ce305ULL, 0xf684df56c3e01bc6ULL,
+    0x9a130b963a6c115cULL, 0xc097ce7bc90715b3ULL, 0xf0bdc21abb48db20ULL,
+    0x96769950b50d88f4ULL,
+};
+
+//Converts w * 10^q into the nearest f32. Returns false if the result cannot be decided
+// with the available precision or is not a normal number.
+//See "Number Parsing at a Gigabyte per Second" by Daniel Lemire.
+INTERNAL bool _format_obj_eisel_lemire_f32(u64 w, i32 q, f32* out)
+{
+    if(w == 0)
+    {
+        *out = 0;
+        return true;
+    }
+
+    if(q < FORMAT_OBJ_POW5_MIN || q > FORMAT_OBJ_POW5_MAX)
+        return false;
+
+    i32 leading_zeros = _format_obj_count_leading_zeros64(w);
+    u64 lo = 0;
+    u64 hi = _format_obj_mul128(w << leading_zeros, _format_obj_pow5_table[q - FORMAT_OBJ_POW5_MIN], &lo);
     
-        //Try to guess the needed size based on a simple heurestic
-        isize expected_line_count = obj_source.len / 32 + 128;
-        array_reserve(&out->indices, expected_line_count);
-        array_reserve(&out->positions, expected_line_count);
-        array_reserve(&out->uvs, expected_line_count);
-        array_reserve(&out->normals, expected_line_count);
+    //The true product lies in [hi:lo, hi:lo + w) because of the truncated table entry.
+    // That is less than one unit of hi. If the bits below the mantissa are right at the rounding 
+    // boundary (or a tie) this error might change the result so we give up.
+    i32 upperbit = (i32) (hi >> 63);
+    i32 shift = upperbit + 63 - 24;
+    u64 dropped_mask = ((u64) 1 << shift) - 1;
+    u64 dropped = hi & dropped_mask;
+    u64 half = (u64) 1 << (shift - 1);
+    if(dropped == dropped_mask || dropped == half - 1 || dropped == half)
+        return false;
+
+    u64 mantissa = (hi >> shift) + (dropped > half);
+    i32 exponent = ((q * 217706) >> 16) + 63 + upperbit - leading_zeros;
+    if(mantissa == (u64) 1 << 24)
+    {
+        mantissa >>= 1;
+        exponent += 1;
+    }
+
+    i32 biased = exponent + 127;
+    if(biased < 1 || biased > 254)
+        return false;
+
+    u32 bits = ((u32) biased << 23) | ((u32) mantissa & 0x7FFFFF);
+    memcpy(out, &bits, sizeof bits);
+    return true;
+}
+
+//Parses [+-]digits[.digits][(e|E)[+-]digits] with at least one digit in the mantissa into 
+// the correctly rounded f32. Returns false and leaves index unchanged if no number is found. 
+EXTERNAL bool format_obj_match_decimal_f32(String str, isize* index, f32* out)
+{
+    static const f32 exact_pow10[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f};
 
-        String active_object = {0};
-        Format_Obj_Group* active_group = NULL;
+    isize from = *index;
+    isize i = from;
+    bool is_negative = false;
+    if(i < str.len && (str.data[i] == '-' || str.data[i] == '+'))
+    {
+        is_negative = str.data[i] == '-';
+        i += 1;
+    }
 
-        SCRATCH_ARENA(arena)
+    u64 mantissa = 0;
+    i32 exponent = 0;
+    i32 digit_count = 0;
+    bool had_digits = false;
+    bool truncated = false;
+    for(; i < str.len && (u32) (str.data[i] - '0') < 10; i++)
+    {
+        u32 digit = (u32) (str.data[i] - '0');
+        had_digits = true;
+        if(digit_count < 19)
         {
-            array_init_with_capacity(&out->groups, arena.alloc, 64);
-            i32 trinagle_index = 0;
-            for(Line_Iterator it = {0}; line_iterator_get_line(&it, obj_source); )
+            mantissa = mantissa*10 + digit;
+            digit_count += mantissa != 0;
+        }
+        else
+        {
+            exponent += 1;
+            truncated = truncated || digit != 0;
+        }
+    }
+
+    if(i < str.len && str.data[i] == '.')
+    {
+        i += 1;
+        for(; i < str.len && (u32) (str.data[i] - '0') < 10; i++)
+        {
+            u32 digit = (u32) (str.data[i] - '0');
+            had_digits = true;
+            if(digit_count < 19)
             {
-                String line = string_trim_whitespace(it.line);
+                mantissa = mantissa*10 + digit;
+                digit_count += mantissa != 0;
+                exponent -= 1;
+            }
+            else
+                truncated = truncated || digit != 0;
+        }
+    }
 
-                // Skip blank lines.
-                if(line.len == 0)
-                    continue;
+    if(had_digits == false)
+        return false;
 
-                Format_Obj_Mtl_Error_Statement error = FORMAT_OBJ_ERROR_NONE;
+    //exponent is only consumed if it has at least one digit
+    if(i + 1 < str.len && (str.data[i] == 'e' || str.data[i] == 'E'))
+    {
+        isize k = i + 1;
+        bool exponent_negative = false;
+        if(str.data[k] == '-' || str.data[k] == '+')
+        {
+            exponent_negative = str.data[k] == '-';
+            k += 1;
+        }
 
-                char first_char = line.data[0];
-                switch (first_char) 
-                {
-                    case '#': {
-                        // Skip comments
-                        continue;
-                    } break;
+        if(k < str.len && (u32) (str.data[k] - '0') < 10)
+        {
+            i32 explicit_exponent = 0;
+            for(; k < str.len && (u32) (str.data[k] - '0') < 10; k++)
+                if(explicit_exponent < 100000)
+                    explicit_exponent = explicit_exponent*10 + (str.data[k] - '0');
 
-                    //vertex variants
-                    case 'v': {
-                        char second_char = line.data[1];
-                        switch (second_char)
-                        {
-                            case ' ': {
-                                Vec3 pos = {0};
-                                isize line_index = 1;
-                                bool matched = true
-                                    && match_whitespace(line, &line_index)
-                                    && match_decimal_f32(line, &line_index, &pos.x)
-                                    && match_whitespace(line, &line_index)
-                                    && match_decimal_f32(line, &line_index, &pos.y)
-                                    && match_whitespace(line, &line_index)
-                                    && match_decimal_f32(line, &line_index, &pos.z);
-
-                                if(!matched)
-                                    error = FORMAT_OBJ_ERROR_VERTEX_POS;
-                                else
-                                    array_push(&out->positions, pos);
-                            } break;
-
-                            case 'n': {
-
-                                Vec3 norm = {0};
-                                isize line_index = 2;
-                                bool matched = true
-                                    && match_whitespace(line, &line_index)
-                                    && match_decimal_f32(line, &line_index, &norm.x)
-                                    && match_whitespace(line, &line_index)
-                                    && match_decimal_f32(line, &line_index, &norm.y)
-                                    && match_whitespace(line, &line_index)
-                                    && match_decimal_f32(line, &line_index, &norm.z);
-
-                                if(!matched)
-                                    error = FORMAT_OBJ_ERROR_VERTEX_NORM;
-                                else
-                                    array_push(&out->normals, norm);
-                            } break;
-
-                            case 't': {
-
-                                // @NOTE: Ignoring Z if present.
-                                Vec2 tex_coord = {0};
-                                isize line_index = 2;
-                                bool matched = true
-                                    && match_whitespace(line, &line_index)
-                                    && match_decimal_f32(line, &line_index, &tex_coord.x)
-                                    && match_whitespace(line, &line_index)
-                                    && match_decimal_f32(line, &line_index, &tex_coord.y);
-                            
-                                if(!matched)
-                                    error = FORMAT_OBJ_ERROR_VERTEX_UV;
-                                else 
-                                    array_push(&out->uvs, tex_coord);
-                            } break;
-
-                            default: {
-                                error = FORMAT_OBJ_ERROR_OTHER;
-                            }
-                        }
-                    } break;
+            exponent += exponent_negative ? -explicit_exponent : explicit_exponent;
+            i = k;
+        }
+    }
+
+    f32 value = 0;
+    bool ok = false;
+    //Clinger fast path: both mantissa and the power of ten are exact f32 so the single 
+    // multiplication/division is correctly rounded.
+    if(truncated == false && mantissa <= ((u64) 1 << 24) && exponent >= -10 && exponent <= 10)
+    {
+        value = (f32) mantissa;
+        if(exponent < 0)
+            value /= exact_pow10[-exponent];
+        else
+            value *= exact_pow10[exponent];
+        ok = true;
+    }
+    else if(truncated == false)
+        ok = _format_obj_eisel_lemire_f32(mantissa, exponent, &value);
+
+    if(ok)
+        value = is_negative ? -value : value;
+    else
+    {
+        //slow path. strtof needs a null terminated copy of the entire number which can be arbitrarily long
+        char buffer[128] = {0};
+        isize len = i - from;
+        if(len < (isize) sizeof buffer)
+        {
+            memcpy(buffer, str.data + from, (size_t) len);
+            value = strtof(buffer, NULL);
+        }
+        else
+        {
+            SCRATCH_ARENA(arena)
+            {
+                String_Builder number = builder_from_string(arena.alloc, string_range(str, from, i));
+                value = strtof(number.data, NULL);
+            }
+        }
+    }
 
-                    //faces
-                    case 'f': {
+    *out = value;
+    *index = i;
+    return true;
+}
 
-                        // can be one of the following:
-                        // 1: f 1/1/1 2/2/2 3/3/3   ~~ pos/tex/norm pos/tex/norm pos/tex/norm
-                        // 2: f 1/1 2/2 3/3         ~~ pos/tex pos/tex pos/tex
-                        // 3: f 1//1 2//2 3//3      ~~ pos//norm pos//norm pos//norm
-                        // 3: f 1 2 3               ~~ pos pos pos
+//Statements which change the grouping of the model. These are very rare compared to vertex and face
+// statements so we only parse them while reading the (possibly many) chunks and apply them 
+// afterwards in order. This is what makes the parallel parsing produce exactly the same groups as the serial one.
+typedef enum _Format_Obj_Statement_Type {
+    _FORMAT_OBJ_STATEMENT_GROUP,
+    _FORMAT_OBJ_STATEMENT_OBJECT,
+    _FORMAT_OBJ_STATEMENT_SMOOTHING,
+    _FORMAT_OBJ_STATEMENT_MATERIAL_USE,
+    _FORMAT_OBJ_STATEMENT_MATERIAL_LIBRARY,
+} _Format_Obj_Statement_Type;
+
+typedef struct _Format_Obj_Statement {
+    _Format_Obj_Statement_Type type;
+    i32 trinagle_index;     //chunk local!
+    String value;           //the matched name. For groups the entire line.
+    i32 smoothing_index;
+    u32 _;
+} _Format_Obj_Statement;
+
+typedef Array(_Format_Obj_Statement) _Format_Obj_Statement_Array;
+
+//A newline aligned part of the obj file. The serial path is simply a single chunk spanning 
+// the entire file writing directly into the output arrays.
+typedef struct _Format_Obj_Chunk {
+    String source;
+    isize source_offset;
 
-                        //looks for "//" or the lack of "/" inside the string to narrow our options
-                        bool has_double_slash = string_find_first(line, STRING("//") , 0) != -1;
-                        bool has_slash = string_find_first_char(line, '/' , 0) != -1;
+    Vec3_Array positions; 
+    Vec2_Array uvs; 
+    Vec3_Array normals;
+    Format_Obj_Vertex_Index_Array indices;
 
-                        Format_Obj_Vertex_Index indices[3] = {0};
-                    
-                        bool ok = false;
-                        isize line_index = 1;
-                        //tries first the ones based on our analysis and then the rest until valid is found
-                    
-                        //f 1//1 2//2 3//3 
-                        if(has_double_slash)
-                        {
-                            line_index = 1;
-                            ok = true
-                                    && match_whitespace(line, &line_index)
-                                    && match_decimal_i32(line, &line_index, &indices[0].pos_i1)
-                                    && match_sequence(line, &line_index, STRING("//"))
-                                    && match_decimal_i32(line, &line_index, &indices[0].norm_i1)
-                                    && match_whitespace(line, &line_index)
-                                    && match_decimal_i32(line, &line_index, &indices[1].pos_i1)
-                                    && match_sequence(line, &line_index, STRING("//"))
-                                    && match_decimal_i32(line, &line_index, &indices[1].norm_i1)
-                                    && match_whitespace(line, &line_index)
-                                    && match_decimal_i32(line, &line_index, &indices[2].pos_i1)
-                                    && match_sequence(line, &line_index, STRING("//"))
-                                    && match_decimal_i32(line, &line_index, &indices[2].norm_i1);
-                        }
-                        //f 1 2 3
-                        else if(!has_slash)
-                        {
-                            line_index = 1;
-                            ok = true
-                                    && match_whitespace(line, &line_index)
-                                    && match_decimal_i32(line, &line_index, &indices[0].pos_i1)
-                                    && match_whitespace(line, &line_index)
-                                    && match_decimal_i32(line, &line_index, &indices[1].pos_i1)
-                                    && match_whitespace(line, &line_index)
-                                    && match_decimal_i32(line, &line_index, &indices[2].pos_i1);
-                        }
-                    
-                        //f 1/1/1 2/2/2 3/3/3
-                        if(!ok)
-                        {
-                            line_index = 1;
-                            ok = true
-                                    && match_whitespace(line, &line_index)
-                                    && match_decimal_i32(line, &line_index, &indices[0].pos_i1)
-                                    && match_char(line, &line_index, '/')
-                                    && match_decimal_i32(line, &line_index, &indices[0].uv_i1)
-                                    && match_char(line, &line_index, '/')
-                                    && match_decimal_i32(line, &line_index, &indices[0].norm_i1)
-                                    && match_whitespace(line, &line_index)
-                                    && match_decimal_i32(line, &line_index, &indices[1].pos_i1)
-                                    && match_char(line, &line_index, '/')
-                                    && match_decimal_i32(line, &line_index, &indices[1].uv_i1)
-                                    && match_char(line, &line_index, '/')
-                                    && match_decimal_i32(line, &line_index, &indices[1].norm_i1)
-                                    && match_whitespace(line, &line_index)
-                                    && match_decimal_i32(line, &line_index, &indices[2].pos_i1)
-                                    && match_char(line, &line_index, '/')
-                                    && match_decimal_i32(line, &line_index, &indices[2].uv_i1)
-                                    && match_char(line, &line_index, '/')
-                                    && match_decimal_i32(line, &line_index, &indices[2].norm_i1);
-                        }
+    //Negative (relative) indices are resolved against the counts inside this chunk. 
+    // When stitching we need to add the counts of all previous chunks to them. 
+    // Holds index_i*3 + (0 for pos, 1 for uv, 2 for norm) of each such index. These are very rare.
+    i32_Array relative_indices;
+    _Format_Obj_Statement_Array statements;
+    Format_Obj_Polygon_Array polygons; //trinagles_from is chunk local!
+
+    Format_Obj_Mtl_Error* errors;
+    isize errors_max_count;
+    isize error_count;
+    i32 trinagle_count;
+    u32 _;
+} _Format_Obj_Chunk;
+
+INTERNAL void _format_obj_chunk_init(_Format_Obj_Chunk* chunk, Allocator* alloc, String source, isize source_offset)
+{
+    chunk->source = source;
+    chunk->source_offset = source_offset;
+    array_init(&chunk->positions, alloc);
+    array_init(&chunk->uvs, alloc);
+    array_init(&chunk->normals, alloc);
+    array_init(&chunk->indices, alloc);
+    array_init(&chunk->relative_indices, alloc);
+    array_init(&chunk->statements, alloc);
+    array_init(&chunk->polygons, alloc);
+}
 
-                        //f 1/1 2/2 3/3
-                        if(!ok)
-                        {
-                            line_index = 1;
-                            ok = true
-                                    && match_whitespace(line, &line_index)
-                                    && match_decimal_i32(line, &line_index, &indices[0].pos_i1)
-                                    && match_char(line, &line_index, '/')
-                                    && match_decimal_i32(line, &line_index, &indices[0].uv_i1)
-                                    && match_whitespace(line, &line_index)
-                                    && match_decimal_i32(line, &line_index, &indices[1].pos_i1)
-                                    && match_char(line, &line_index, '/')
-                                    && match_decimal_i32(line, &line_index, &indices[1].uv_i1)
-                                    && match_whitespace(line, &line_index)
-                                    && match_decimal_i32(line, &line_index, &indices[2].pos_i1)
-                                    && match_char(line, &line_index, '/')
-                                    && match_decimal_i32(line, &line_index, &indices[2].uv_i1);
-                        }
+INTERNAL void _format_obj_chunk_deinit(_Format_Obj_Chunk* chunk)
+{
+    array_deinit(&chunk->positions);
+    array_deinit(&chunk->uvs);
+    array_deinit(&chunk->normals);
+    array_deinit(&chunk->indices);
+    array_deinit(&chunk->relative_indices);
+    array_deinit(&chunk->statements);
+    array_deinit(&chunk->polygons);
+}
 
-                        if(!ok)
-                            error = FORMAT_OBJ_ERROR_FACE;
+typedef struct _Format_Obj_Corner {
+    Format_Obj_Vertex_Index index;
+    u32 relative_mask; //bit 0 for pos, 1 for uv, 2 for norm set if that index was negative (relative)
+} _Format_Obj_Corner;
 
-                        //correct negative values indices. If index is negative it refers to the -i-nth last parsed
-                        // value in the given category. If the category does not recieve data (NULL) set the index to 0
-                        for(isize i = 0; i < 3; i++)
-                        {
-                            Format_Obj_Vertex_Index index = indices[i];
-                            if(index.pos_i1 < 0)
-                                index.pos_i1 = (u32) out->positions.len + index.pos_i1 + 1;
-                        
-                            if(index.uv_i1 < 0)
-                                index.uv_i1 = (u32) out->uvs.len + index.uv_i1 + 1;
-                            
-                            if(index.norm_i1 < 0)
-                                index.norm_i1 = (u32) out->normals.len + index.norm_i1 + 1;
-                        }
+//matches one face corner: pos | pos/uv | pos//norm | pos/uv/norm
+INTERNAL bool _format_obj_match_corner(String line, isize* index, Format_Obj_Vertex_Index* corner)
+{
+    Format_Obj_Vertex_Index matched = {0};
+    isize i = *index;
+    if(!match_decimal_i32(line, &i, &matched.pos_i1))
+        return false;
 
-                        array_push(&out->indices, indices[0]); 
-                        array_push(&out->indices, indices[1]); 
-                        array_push(&out->indices, indices[2]);
+    if(i < line.len && line.data[i] == '/')
+    {
+        i += 1;
+        if(i < line.len && line.data[i] == '/')
+        {
+            i += 1;
+            if(!match_decimal_i32(line, &i, &matched.norm_i1))
+                return false;
+        }
+        else
+        {
+            if(!match_decimal_i32(line, &i, &matched.uv_i1))
+                return false;
 
-                        trinagle_index += 1;
-                    } break;
-                
-                    //Smoothing
-                    case 's': {
-                        isize line_index1 = 1;
-                        u64 smoothing_index = 0;
-                        bool matched_smoothing_index = true
-                            && match_whitespace(line, &line_index1)
-                            && match_decimal_u64(line, &line_index1, &smoothing_index);
-                        
-                        isize line_index2 = 1;
-                        bool matched_smoothing_off = !matched_smoothing_index
-                            && match_whitespace(line, &line_index2)
-                            && match_sequence(line, &line_index2, STRING("off"));
-                    
-                        if(matched_smoothing_off)
-                            smoothing_index = 0;
+            if(i < line.len && line.data[i] == '/')
+            {
+                i += 1;
+                if(!match_decimal_i32(line, &i, &matched.norm_i1))
+                    return false;
+            }
+        }
+    }
 
-                        if(matched_smoothing_index || matched_smoothing_off)
-                        {
-                            if(active_group == NULL)
-                                active_group = _obj_parser_get_active_group(out, active_object, trinagle_index);
+    *corner = matched;
+    *index = i;
+    return true;
+}
 
-                            active_group->smoothing_index = (i32) smoothing_index;
-                        }
-                        else
-                        {
-                            error = FORMAT_OBJ_ERROR_SMOOTH_SHADING;
-                        }
-                    } break;
-                
-                    //Group: g [group1] [group2] ...
-                    case 'g': {
-                        String_Builder_Array groups = {alloc};
-                        isize line_index = 1;
-                        while(true)
-                        {
-                            isize group_from = 0;
-                            isize group_to = 0;
-                            if(match_whitespace_separated(line, &line_index, &group_from, &group_to))
-                            {
-                                String group = string_range(line, group_from, group_to);
-                                array_push(&groups, builder_from_string(alloc, group));
-                            }
-                            else
-                            {
-                                break;
-                            }
-                        }
+//Bit i of whitespace / slash is set if line.data[i] is whitespace / '/'. 
+//Only lines up to 64 chars (which is nearly all face lines) fit. Longer lines are matched by the scalar code.
+typedef struct _Format_Obj_Line_Masks {
+    u64 whitespace;
+    u64 slash;
+    b32 is_valid;
+    u32 _;
+} _Format_Obj_Line_Masks;
+
+//Classifies the whole line 16 chars at a time. The line is first copied into a zero padded 
+// buffer so that we never read past the end of the source.
+INTERNAL _Format_Obj_Line_Masks _format_obj_line_masks(String line)
+{
+    _Format_Obj_Line_Masks masks = {0};
+    #ifdef FORMAT_OBJ_SSE2
+    if(line.len <= 64)
+    {
+        char padded[64] = {0};
+        memcpy(padded, line.data, (size_t) line.len);
+
+        //whitespace is ' ' or '\t' to '\r'. '\n' never appears inside a line.
+        __m128i spaces16 = _mm_set1_epi8(' ');
+        __m128i slashes16 = _mm_set1_epi8('/');
+        __m128i tabs16 = _mm_set1_epi8('\t');
+        __m128i control_range16 = _mm_set1_epi8('\r' - '\t');
+        for(isize i = 0; i < line.len; i += 16)
+        {
+            __m128i chunk = _mm_loadu_si128((const __m128i*) (const void*) (padded + i));
+            __m128i from_tab = _mm_sub_epi8(chunk, tabs16);
+            __m128i is_control = _mm_cmpeq_epi8(_mm_min_epu8(from_tab, control_range16), from_tab);
+            __m128i is_whitespace = _mm_or_si128(_mm_cmpeq_epi8(chunk, spaces16), is_control);
+            __m128i is_slash = _mm_cmpeq_epi8(chunk, slashes16);
+            masks.whitespace |= (u64) (u32) _mm_movemask_epi8(is_whitespace) << i;
+            masks.slash |= (u64) (u32) _mm_movemask_epi8(is_slash) << i;
+        }
+        masks.is_valid = true;
+    }
+    #else
+    (void) line;
+    #endif
+    return masks;
+}
 
-                        if(groups.len > 0)
-                            active_group = _obj_parser_add_group(out, active_object, &groups, trinagle_index);
-                        else
-                            error = FORMAT_OBJ_ERROR_GROUP;
+//Matches a single index spanning exactly line[from, to)
+INTERNAL bool _format_obj_match_index_exact(String line, isize from, isize to, i32* index)
+{
+    isize i = from;
+    return match_decimal_i32(line, &i, index) && i == to;
+}
 
-                        builder_array_deinit(&groups);
-                    } break;
+//Same as whitespace followed by _format_obj_match_corner but finds the extent of the corner 
+// and its '/' separators from the line masks instead of char by char.
+INTERNAL bool _format_obj_match_corner_masked(String line, _Format_Obj_Line_Masks masks, isize* index, Format_Obj_Vertex_Index* corner)
+{
+    isize i = *index;
+    if(i >= line.len || (masks.whitespace >> i & 1) == 0)
+        return false;
+
+    //Past the line end counts as whitespace so that the shifts below never run out of set bits
+    u64 past_end = line.len < 64 ? ~(u64) 0 << line.len : 0;
+    u64 not_whitespace = ~masks.whitespace & ~past_end;
+    if((not_whitespace >> i) == 0)
+        return false;
+
+    isize from = i + _format_obj_find_first_set_bit64(not_whitespace >> i);
+    u64 stops = (masks.whitespace | past_end) >> from;
+    isize to = stops ? from + _format_obj_find_first_set_bit64(stops) : line.len;
+    u64 slashes = (masks.slash >> from) & (((u64) 1 << (to - from)) - 1);
+
+    Format_Obj_Vertex_Index matched = {0};
+    bool state = false;
+    if(slashes == 0)
+        state = _format_obj_match_index_exact(line, from, to, &matched.pos_i1);
+    else
+    {
+        isize first = from + _format_obj_find_first_set_bit64(slashes);
+        u64 rest = slashes & (slashes - 1);
+        state = _format_obj_match_index_exact(line, from, first, &matched.pos_i1);
+        if(rest == 0)
+            state = state && _format_obj_match_index_exact(line, first + 1, to, &matched.uv_i1);
+        else if((rest & (rest - 1)) == 0)
+        {
+            isize second = from + _format_obj_find_first_set_bit64(rest);
+            if(second != first + 1)
+                state = state && _format_obj_match_index_exact(line, first + 1, second, &matched.uv_i1);
+            state = state && _format_obj_match_index_exact(line, second + 1, to, &matched.norm_i1);
+        }
+        else
+            state = false;
+    }
 
-                    //Object: g [object_name] ...
-                    case 'o': {
-                        isize line_index = 1;
-                        isize object_from = 0;
-                        isize object_to = 0;
+    if(state)
+    {
+        *corner = matched;
+        *index = to;
+    }
+    return state;
+}
+
+//Matches whitespace followed by a corner using the masks if the line fit into them.
+INTERNAL bool _format_obj_match_next_corner(String line, _Format_Obj_Line_Masks masks, isize* index, Format_Obj_Vertex_Index* corner)
+{
+    if(masks.is_valid)
+        return _format_obj_match_corner_masked(line, masks, index, corner);
+
+    isize i = *index;
+    if(!_format_obj_match_whitespace(line, &i) || !_format_obj_match_corner(line, &i, corner))
+        return false;
+
+    *index = i;
+    return true;
+}
+
+//correct negative values indices. If index is negative it refers to the -i-nth last parsed
+// value in the given category. We can only resolve them against this chunk so we also 
+// remember them for the stitching.
+INTERNAL void _format_obj_chunk_resolve_relative(_Format_Obj_Chunk* chunk, _Format_Obj_Corner* corner)
+{
+    Format_Obj_Vertex_Index* index = &corner->index;
+    if(index->pos_i1 < 0)
+    {
+        index->pos_i1 = (i32) chunk->positions.len + index->pos_i1 + 1;
+        corner->relative_mask |= 1;
+    }
+
+    if(index->uv_i1 < 0)
+    {
+        index->uv_i1 = (i32) chunk->uvs.len + index->uv_i1 + 1;
+        corner->relative_mask |= 2;
+    }
+    
+    if(index->norm_i1 < 0)
+    {
+        index->norm_i1 = (i32) chunk->normals.len + index->norm_i1 + 1;
+        corner->relative_mask |= 4;
+    }
+}
+
+INTERNAL void _format_obj_chunk_push_triangle(_Format_Obj_Chunk* chunk, _Format_Obj_Corner a, _Format_Obj_Corner b, _Format_Obj_Corner c)
+{
+    _Format_Obj_Corner corners[3] = {a, b, c};
+    for(isize i = 0; i < 3; i++)
+    {
+        i32 index_i = (i32) chunk->indices.len;
+        for(i32 component = 0; component < 3; component++)
+            if(corners[i].relative_mask & (1u << component))
+                array_push(&chunk->relative_indices, index_i*3 + component);
 
-                        if(match_whitespace_separated(line, &line_index, &object_from, &object_to))
-                            active_object = string_range(line, object_from, object_to);
+        array_push(&chunk->indices, corners[i].index);
+    }
+}
+
+INTERNAL void _format_obj_read_chunk(_Format_Obj_Chunk* chunk)
+{
+    String source = chunk->source;
+
+    //Try to guess the needed size based on a simple heurestic
+    isize expected_line_count = source.len / 32 + 128;
+    array_reserve(&chunk->indices, expected_line_count);
+    array_reserve(&chunk->positions, expected_line_count);
+    array_reserve(&chunk->uvs, expected_line_count);
+    array_reserve(&chunk->normals, expected_line_count);
+
+    i32 trinagle_index = 0;
+    for(_Format_Obj_Line_Iterator it = {0}; _format_obj_line_iterator_next(&it, source); )
+    {
+        String line = string_trim_whitespace(it.line);
+
+        // Skip blank lines.
+        if(line.len == 0)
+            continue;
+
+        Format_Obj_Mtl_Error_Statement error = FORMAT_OBJ_ERROR_NONE;
+
+        char first_char = line.data[0];
+        switch (first_char) 
+        {
+            case '#': {
+                // Skip comments
+                continue;
+            } break;
+
+            //vertex variants
+            case 'v': {
+                char second_char = line.data[1];
+                switch (second_char)
+                {
+                    case ' ': {
+                        Vec3 pos = {0};
+                        isize line_index = 1;
+                        bool matched = true
+                            && _format_obj_match_whitespace(line, &line_index)
+                            && format_obj_match_decimal_f32(line, &line_index, &pos.x)
+                            && _format_obj_match_whitespace(line, &line_index)
+                            && format_obj_match_decimal_f32(line, &line_index, &pos.y)
+                            && _format_obj_match_whitespace(line, &line_index)
+                            && format_obj_match_decimal_f32(line, &line_index, &pos.z);
+
+                        if(!matched)
+                            error = FORMAT_OBJ_ERROR_VERTEX_POS;
                         else
-                            error = FORMAT_OBJ_ERROR_OBJECT;
+                            array_push(&chunk->positions, pos);
                     } break;
 
-                    //Material library
-                    case 'm': {
-                        isize line_index = 0;
-                        isize from_index = 0;
-                        isize to_index = 0;
+                    case 'n': {
 
-                        if(match_sequence(line, &line_index, STRING("mtllib")) 
-                            && match_whitespace_separated(line, &line_index, &from_index, &to_index))
-                        {
-                            String material_lib = string_range(line, from_index, to_index);
-                            array_push(&out->material_files, builder_from_string(NULL, material_lib));
-                        }
+                        Vec3 norm = {0};
+                        isize line_index = 2;
+                        bool matched = true
+                            && _format_obj_match_whitespace(line, &line_index)
+                            && format_obj_match_decimal_f32(line, &line_index, &norm.x)
+                            && _format_obj_match_whitespace(line, &line_index)
+                            && format_obj_match_decimal_f32(line, &line_index, &norm.y)
+                            && _format_obj_match_whitespace(line, &line_index)
+                            && format_obj_match_decimal_f32(line, &line_index, &norm.z);
+
+                        if(!matched)
+                            error = FORMAT_OBJ_ERROR_VERTEX_NORM;
                         else
-                        {
-                            error = FORMAT_OBJ_ERROR_MATERIAL_LIBRARY;
-                        }
+                            array_push(&chunk->normals, norm);
                     } break;
-                
-                    //use material
-                    case 'u': {
-                        isize line_index = 0;
-                        isize from_index = 0;
-                        isize to_index = 0;
-
-                        if(match_sequence(line, &line_index, STRING("usemtl")) 
-                            && match_whitespace_separated(line, &line_index, &from_index, &to_index))
-                        {
-                            if(active_group == NULL)
-                                active_group = _obj_parser_get_active_group(out, active_object, trinagle_index);
 
-                            String material_use = string_range(line, from_index, to_index);
-                            builder_assign(&active_group->material, material_use);
-                        }
-                        else
-                        {
-                            error = FORMAT_OBJ_ERROR_MATERIAL_USE;
-                        }
+                    case 't': {
+
+                        // @NOTE: Ignoring Z if present.
+                        Vec2 tex_coord = {0};
+                        isize line_index = 2;
+                        bool matched = true
+                            && _format_obj_match_whitespace(line, &line_index)
+                            && format_obj_match_decimal_f32(line, &line_index, &tex_coord.x)
+                            && _format_obj_match_whitespace(line, &line_index)
+                            && format_obj_match_decimal_f32(line, &line_index, &tex_coord.y);
+                    
+                        if(!matched)
+                            error = FORMAT_OBJ_ERROR_VERTEX_UV;
+                        else 
+                            array_push(&chunk->uvs, tex_coord);
                     } break;
 
                     default: {
                         error = FORMAT_OBJ_ERROR_OTHER;
                     }
                 }
+            } break;
+
+            //faces
+            case 'f': {
+
+                // Each corner can be one of the following:
+                // 1: f 1/1/1 2/2/2 3/3/3 ...   ~~ pos/tex/norm pos/tex/norm pos/tex/norm
+                // 2: f 1/1 2/2 3/3 ...         ~~ pos/tex pos/tex pos/tex
+                // 3: f 1//1 2//2 3//3 ...      ~~ pos//norm pos//norm pos//norm
+                // 4: f 1 2 3 ...               ~~ pos pos pos
+                //
+                // Faces with more corners are triangulated as a fan around the first corner 
+                // while reading so we never need to store the whole polygon.
+                // If anything but whitespace follows the last matched corner the whole face is dropped.
+                _Format_Obj_Corner first = {0};
+                _Format_Obj_Corner previous = {0};
+                i32 corner_count = 0;
+                i32 trinagle_index_before = trinagle_index;
+                isize indices_before = chunk->indices.len;
+                isize relative_indices_before = chunk->relative_indices.len;
+                isize line_index = 1;
+                _Format_Obj_Line_Masks masks = _format_obj_line_masks(line);
+                for(;;)
+                {
+                    _Format_Obj_Corner corner = {0};
+                    if(!_format_obj_match_next_corner(line, masks, &line_index, &corner.index))
+                        break;
+
+                    _format_obj_chunk_resolve_relative(chunk, &corner);
+                    if(corner_count == 0)
+                        first = corner;
+                    else if(corner_count >= 2)
+                    {
+                        _format_obj_chunk_push_triangle(chunk, first, previous, corner);
+                        trinagle_index += 1;
+                    }
 
-                //Handle errors
-                if(error)
+                    previous = corner;
+                    corner_count += 1;
+                }
+
+                _format_obj_match_whitespace(line, &line_index);
+                if(corner_count < 3 || line_index < line.len)
                 {
-                    Format_Obj_Mtl_Error parser_error = {0};
-                    parser_error.index = it.line_from;
-                    parser_error.line = (i32) it.line_number;
-                    parser_error.statement = error;
-                    parser_error.unimplemented = false; //@TODO
+                    error = FORMAT_OBJ_ERROR_FACE;
+                    trinagle_index = trinagle_index_before;
+                    array_resize(&chunk->indices, indices_before);
+                    array_resize(&chunk->relative_indices, relative_indices_before);
+                }
+                else if(corner_count > 3)
+                {
+                    Format_Obj_Polygon polygon = {trinagle_index - (corner_count - 2), corner_count};
+                    array_push(&chunk->polygons, polygon);
+                }
+            } break;
+        
+            //Smoothing
+            case 's': {
+                isize line_index1 = 1;
+                u64 smoothing_index = 0;
+                bool matched_smoothing_index = true
+                    && _format_obj_match_whitespace(line, &line_index1)
+                    && match_decimal_u64(line, &line_index1, &smoothing_index);
+                
+                isize line_index2 = 1;
+                bool matched_smoothing_off = !matched_smoothing_index
+                    && _format_obj_match_whitespace(line, &line_index2)
+                    && match_sequence(line, &line_index2, STRING("off"));
+            
+                if(matched_smoothing_off)
+                    smoothing_index = 0;
 
-                    had_error = true;
-                    if(errors && error_count < errors_max_count)
-                        errors[error_count] = parser_error;
+                if(matched_smoothing_index || matched_smoothing_off)
+                {
+                    _Format_Obj_Statement statement = {_FORMAT_OBJ_STATEMENT_SMOOTHING, trinagle_index};
+                    statement.smoothing_index = (i32) smoothing_index;
+                    array_push(&chunk->statements, statement);
+                }
+                else
+                {
+                    error = FORMAT_OBJ_ERROR_SMOOTH_SHADING;
+                }
+            } break;
+        
+            //Group: g [group1] [group2] ...
+            case 'g': {
+                //Only check there is at least one group. The names are extracted when applying.
+                isize line_index = 1;
+                isize group_from = 0;
+                isize group_to = 0;
+                if(match_whitespace_separated(line, &line_index, &group_from, &group_to))
+                {
+                    _Format_Obj_Statement statement = {_FORMAT_OBJ_STATEMENT_GROUP, trinagle_index};
+                    statement.value = line;
+                    array_push(&chunk->statements, statement);
+                }
+                else
+                    error = FORMAT_OBJ_ERROR_GROUP;
+            } break;
 
-                    error_count++;
+            //Object: g [object_name] ...
+            case 'o': {
+                isize line_index = 1;
+                isize object_from = 0;
+                isize object_to = 0;
+
+                if(match_whitespace_separated(line, &line_index, &object_from, &object_to))
+                {
+                    _Format_Obj_Statement statement = {_FORMAT_OBJ_STATEMENT_OBJECT, trinagle_index};
+                    statement.value = string_range(line, object_from, object_to);
+                    array_push(&chunk->statements, statement);
+                }
+                else
+                    error = FORMAT_OBJ_ERROR_OBJECT;
+            } break;
+
+            //Material library
+            case 'm': {
+                isize line_index = 0;
+                isize from_index = 0;
+                isize to_index = 0;
+
+                if(match_sequence(line, &line_index, STRING("mtllib")) 
+                    && match_whitespace_separated(line, &line_index, &from_index, &to_index))
+                {
+                    _Format_Obj_Statement statement = {_FORMAT_OBJ_STATEMENT_MATERIAL_LIBRARY, trinagle_index};
+                    statement.value = string_range(line, from_index, to_index);
+                    array_push(&chunk->statements, statement);
+                }
+                else
+                {
+                    error = FORMAT_OBJ_ERROR_MATERIAL_LIBRARY;
                 }
-            } 
+            } break;
+        
+            //use material
+            case 'u': {
+                isize line_index = 0;
+                isize from_index = 0;
+                isize to_index = 0;
+
+                if(match_sequence(line, &line_index, STRING("usemtl")) 
+                    && match_whitespace_separated(line, &line_index, &from_index, &to_index))
+                {
+                    _Format_Obj_Statement statement = {_FORMAT_OBJ_STATEMENT_MATERIAL_USE, trinagle_index};
+                    statement.value = string_range(line, from_index, to_index);
+                    array_push(&chunk->statements, statement);
+                }
+                else
+                {
+                    error = FORMAT_OBJ_ERROR_MATERIAL_USE;
+                }
+            } break;
+
+            default: {
+                error = FORMAT_OBJ_ERROR_OTHER;
+            }
+        }
+
+        //Handle errors
+        if(error)
+        {
+            Format_Obj_Mtl_Error parser_error = {0};
+            parser_error.index = it.line_from;
+            parser_error.line = (i32) it.line_number;
+            parser_error.statement = error;
+            parser_error.unimplemented = false; //@TODO
+
+            if(chunk->errors && chunk->error_count < chunk->errors_max_count)
+                chunk->errors[chunk->error_count] = parser_error;
+
+            chunk->error_count++;
+        }
+    } 
+
+    chunk->trinagle_count = trinagle_index;
+}
+
+//Applies the grouping statements of all chunks in order. trinagles_before[i] is the number
+// of triangles in all chunks before chunk i.
+INTERNAL void _format_obj_apply_statements(Format_Obj_Model* out, const _Format_Obj_Chunk* chunks, const i32* trinagles_before, isize chunk_count)
+{
+    Allocator* alloc = out->indices.allocator;
+    String active_object = {0};
+    Format_Obj_Group* active_group = NULL;
+    i32 trinagle_index = 0;
+    for(isize chunk_i = 0; chunk_i < chunk_count; chunk_i++)
+    {
+        const _Format_Obj_Chunk* chunk = &chunks[chunk_i];
+        for(isize i = 0; i < chunk->statements.len; i++)
+        {
+            _Format_Obj_Statement statement = chunk->statements.data[i];
+            trinagle_index = trinagles_before[chunk_i] + statement.trinagle_index;
+            switch(statement.type)
+            {
+                case _FORMAT_OBJ_STATEMENT_SMOOTHING: {
+                    if(active_group == NULL)
+                        active_group = _obj_parser_get_active_group(out, active_object, trinagle_index);
+
+                    active_group->smoothing_index = statement.smoothing_index;
+                } break;
+
+                case _FORMAT_OBJ_STATEMENT_GROUP: {
+                    String line = statement.value;
+                    String_Builder_Array groups = {alloc};
+                    isize line_index = 1;
+                    while(true)
+                    {
+                        isize group_from = 0;
+                        isize group_to = 0;
+                        if(match_whitespace_separated(line, &line_index, &group_from, &group_to))
+                        {
+                            String group = string_range(line, group_from, group_to);
+                            array_push(&groups, builder_from_string(alloc, group));
+                        }
+                        else
+                        {
+                            break;
+                        }
+                    }
+
+                    ASSERT(groups.len > 0, "must have been checked when reading the chunk");
+                    active_group = _obj_parser_add_group(out, active_object, &groups, trinagle_index);
+                    builder_array_deinit(&groups);
+                } break;
+
+                case _FORMAT_OBJ_STATEMENT_OBJECT: {
+                    active_object = statement.value;
+                } break;
+
+                case _FORMAT_OBJ_STATEMENT_MATERIAL_LIBRARY: {
+                    array_push(&out->material_files, builder_from_string(NULL, statement.value));
+                } break;
+
+                case _FORMAT_OBJ_STATEMENT_MATERIAL_USE: {
+                    if(active_group == NULL)
+                        active_group = _obj_parser_get_active_group(out, active_object, trinagle_index);
+
+                    builder_assign(&active_group->material, statement.value);
+                } break;
+            }
+        }
+    }
+
+    trinagle_index = 0;
+    if(chunk_count > 0)
+        trinagle_index = trinagles_before[chunk_count - 1] + chunks[chunk_count - 1].trinagle_count;
+
+    //end the last group
+    if(active_group == NULL)
+        active_group = _obj_parser_get_active_group(out, active_object, trinagle_index);
+    active_group->trinagles_count = trinagle_index - active_group->trinagles_from;
+}
+
+EXTERNAL bool format_obj_read(Format_Obj_Model* out, String obj_source, Format_Obj_Mtl_Error* errors, isize errors_max_count, isize* had_errors)
+{
+    bool had_error = false;
+    PROFILE_SCOPE() 
+    {
+        Allocator* alloc = out->indices.allocator;
+        ASSERT(alloc);
+
+        format_obj_model_init(out, alloc);
+
+        //Read everything as a single chunk directly into the output arrays
+        _Format_Obj_Chunk chunk = {0};
+        _format_obj_chunk_init(&chunk, alloc, obj_source, 0);
+        chunk.errors = errors;
+        chunk.errors_max_count = errors_max_count;
+        _format_obj_read_chunk(&chunk);
+
+        SWAP(&out->positions, &chunk.positions);
+        SWAP(&out->uvs, &chunk.uvs);
+        SWAP(&out->normals, &chunk.normals);
+        SWAP(&out->indices, &chunk.indices);
+        SWAP(&out->polygons, &chunk.polygons);
+
+        i32 trinagles_before = 0;
+        array_reserve(&out->groups, 64);
+        _format_obj_apply_statements(out, &chunk, &trinagles_before, 1);
+
+        _format_obj_chunk_deinit(&chunk);
+        had_error = chunk.error_count > 0;
+        *had_errors = chunk.error_count;
+    }
+    return had_error;
+}
+
+//Below this size we dont bother splitting the file
+#define FORMAT_OBJ_PARALLEL_MIN_CHUNK_SIZE (256*1024)
+
+typedef struct _Format_Obj_Parallel_Context {
+    Format_Obj_Model* out;
+    _Format_Obj_Chunk* chunks;
+    isize* positions_before;
+    isize* uvs_before;
+    isize* normals_before;
+    isize* indices_before;
+} _Format_Obj_Parallel_Context;
+
+INTERNAL void _format_obj_read_chunks_func(void* context, isize from, isize to, isize thread_index)
+{
+    (void) thread_index;
+    _Format_Obj_Parallel_Context* c = (_Format_Obj_Parallel_Context*) context;
+    for(isize i = from; i < to; i++)
+        _format_obj_read_chunk(&c->chunks[i]);
+}
+
+INTERNAL void _format_obj_stitch_chunks_func(void* context, isize from, isize to, isize thread_index)
+{
+    (void) thread_index;
+    _Format_Obj_Parallel_Context* c = (_Format_Obj_Parallel_Context*) context;
+    Format_Obj_Model* out = c->out;
+    for(isize i = from; i < to; i++)
+    {
+        _Format_Obj_Chunk* chunk = &c->chunks[i];
+        memcpy(out->positions.data + c->positions_before[i], chunk->positions.data, (size_t) array_byte_size(chunk->positions));
+        memcpy(out->uvs.data + c->uvs_before[i], chunk->uvs.data, (size_t) array_byte_size(chunk->uvs));
+        memcpy(out->normals.data + c->normals_before[i], chunk->normals.data, (size_t) array_byte_size(chunk->normals));
+        memcpy(out->indices.data + c->indices_before[i], chunk->indices.data, (size_t) array_byte_size(chunk->indices));
+
+        //Relative indices were resolved only against this chunk. Offset them by everything before.
+        Format_Obj_Vertex_Index* indices = out->indices.data + c->indices_before[i];
+        for(isize k = 0; k < chunk->relative_indices.len; k++)
+        {
+            i32 relative = chunk->relative_indices.data[k];
+            Format_Obj_Vertex_Index* index = &indices[relative / 3];
+            switch(relative % 3)
+            {
+                case 0: index->pos_i1 += (i32) c->positions_before[i]; break;
+                case 1: index->uv_i1 += (i32) c->uvs_before[i]; break;
+                case 2: index->norm_i1 += (i32) c->normals_before[i]; break;
+            }
+        }
+    }
+}
+
+//Same as format_obj_read but splits the file into newline aligned chunks which are parsed on all threads 
+// (see parallel.h) and then stitched together. The result is identical to format_obj_read.
+EXTERNAL bool format_obj_read_parallel(Format_Obj_Model* out, String obj_source, Format_Obj_Mtl_Error* errors, isize errors_max_count, isize* had_errors)
+{
+    isize chunk_size = parallel_batch_size(obj_source.len, 4, FORMAT_OBJ_PARALLEL_MIN_CHUNK_SIZE);
+    isize chunk_count = (obj_source.len + chunk_size - 1) / chunk_size;
+    if(chunk_count <= 1)
+        return format_obj_read(out, obj_source, errors, errors_max_count, had_errors);
+
+    bool had_error = false;
+    PROFILE_SCOPE() 
+    {
+        Allocator* alloc = out->indices.allocator;
+        ASSERT(alloc);
+
+        format_obj_model_init(out, alloc);
+
+        //The chunks are filled from many threads at once so they need a thread safe allocator
+        Allocator* chunk_alloc = allocator_get_malloc();
+        Array(_Format_Obj_Chunk) chunks = {chunk_alloc};
+        Array(Format_Obj_Mtl_Error) chunk_errors = {chunk_alloc};
+        isize_Array before = {chunk_alloc};
+        i32_Array trinagles_before = {chunk_alloc};
+
+        //Split into chunks ending just after a newline
+        for(isize from = 0; from < obj_source.len; )
+        {
+            isize to = MIN(from + chunk_size, obj_source.len);
+            while(to < obj_source.len && obj_source.data[to - 1] != '\n')
+                to += 1;
+
+            _Format_Obj_Chunk chunk = {0};
+            _format_obj_chunk_init(&chunk, chunk_alloc, string_range(obj_source, from, to), from);
+            array_push(&chunks, chunk);
+            from = to;
+        }
+
+        chunk_count = chunks.len;
+        array_resize(&chunk_errors, chunk_count * errors_max_count);
+        for(isize i = 0; i < chunk_count; i++)
+        {
+            chunks.data[i].errors = chunk_errors.data + i*errors_max_count;
+            chunks.data[i].errors_max_count = errors_max_count;
+        }
+
+        _Format_Obj_Parallel_Context context = {0};
+        context.out = out;
+        context.chunks = chunks.data;
+
+        PROFILE_SCOPE(format_obj_read_chunks)
+            parallel_for(chunk_count, 1, _format_obj_read_chunks_func, &context);
         
-            //end the last group
-            if(active_group == NULL)
-                active_group = _obj_parser_get_active_group(out, active_object, trinagle_index);
-            active_group->trinagles_count = trinagle_index - active_group->trinagles_from;
+        //Calculate where each chunk goes
+        array_resize(&before, chunk_count * 4);
+        array_resize(&trinagles_before, chunk_count);
+        context.positions_before = before.data + 0*chunk_count;
+        context.uvs_before       = before.data + 1*chunk_count;
+        context.normals_before   = before.data + 2*chunk_count;
+        context.indices_before   = before.data + 3*chunk_count;
+
+        isize positions_count = 0;
+        isize uvs_count = 0;
+        isize normals_count = 0;
+        isize indices_count = 0;
+        i32 trinagle_count = 0;
+        for(isize i = 0; i < chunk_count; i++)
+        {
+            _Format_Obj_Chunk* chunk = &chunks.data[i];
+            context.positions_before[i] = positions_count;
+            context.uvs_before[i] = uvs_count;
+            context.normals_before[i] = normals_count;
+            context.indices_before[i] = indices_count;
+            trinagles_before.data[i] = trinagle_count;
+
+            positions_count += chunk->positions.len;
+            uvs_count += chunk->uvs.len;
+            normals_count += chunk->normals.len;
+            indices_count += chunk->indices.len;
+            trinagle_count += chunk->trinagle_count;
+        }
+
+        array_resize_for_overwrite(&out->positions, positions_count);
+        array_resize_for_overwrite(&out->uvs, uvs_count);
+        array_resize_for_overwrite(&out->normals, normals_count);
+        array_resize_for_overwrite(&out->indices, indices_count);
+
+        PROFILE_SCOPE(format_obj_stitch_chunks)
+            parallel_for(chunk_count, 1, _format_obj_stitch_chunks_func, &context);
+
+        //Polygons are rare so are simply merged here
+        for(isize i = 0; i < chunk_count; i++)
+        {
+            _Format_Obj_Chunk* chunk = &chunks.data[i];
+            for(isize k = 0; k < chunk->polygons.len; k++)
+            {
+                Format_Obj_Polygon polygon = chunk->polygons.data[k];
+                polygon.trinagles_from += trinagles_before.data[i];
+                array_push(&out->polygons, polygon);
+            }
+        }
 
-            *had_errors = error_count;
+        //Merge errors translating them from chunk local to global positions.
+        //Line numbers need the newline counts of all previous chunks. Count them only if needed.
+        isize error_count = 0;
+        isize lines_before = 0;
+        isize lines_counted_upto = 0;
+        for(isize i = 0; i < chunk_count; i++)
+        {
+            _Format_Obj_Chunk* chunk = &chunks.data[i];
+            if(chunk->error_count > 0)
+            {
+                for(; lines_counted_upto < i; lines_counted_upto++)
+                {
+                    String counted = chunks.data[lines_counted_upto].source;
+                    for(isize k = 0; k < counted.len; k++)
+                        lines_before += counted.data[k] == '\n';
+                }
+
+                isize stored = MIN(chunk->error_count, chunk->errors_max_count);
+                for(isize k = 0; k < stored; k++)
+                {
+                    Format_Obj_Mtl_Error error = chunk->errors[k];
+                    error.index += chunk->source_offset;
+                    error.line += (i32) lines_before;
+                    if(errors && error_count + k < errors_max_count)
+                        errors[error_count + k] = error;
+                }
+            }
+            error_count += chunk->error_count;
         }
 
+        array_reserve(&out->groups, 64);
+        _format_obj_apply_statements(out, chunks.data, trinagles_before.data, chunk_count);
+
+        for(isize i = 0; i < chunk_count; i++)
+            _format_obj_chunk_deinit(&chunks.data[i]);
+
+        array_deinit(&chunks);
+        array_deinit(&chunk_errors);
+        array_deinit(&before);
+        array_deinit(&trinagles_before);
+
+        had_error = error_count > 0;
+        *had_errors = error_count;
     }
     return had_error;
 }
 
+INTERNAL f32 _format_obj_cross2(Vec2 a, Vec2 b, Vec2 c)
+{
+    return (b.x - a.x)*(c.y - a.y) - (b.y - a.y)*(c.x - a.x);
+}
+
+INTERNAL bool _format_obj_is_inside_trinagle(Vec2 p, Vec2 a, Vec2 b, Vec2 c, f32 orientation)
+{
+    return _format_obj_cross2(a, b, p)*orientation >= 0
+        && _format_obj_cross2(b, c, p)*orientation >= 0
+        && _format_obj_cross2(c, a, p)*orientation >= 0;
+}
+
+EXTERNAL void format_obj_triangulate_concave_polygons(Format_Obj_Model* model)
+{
+    PROFILE_SCOPE()
+    SCRATCH_ARENA(arena)
+    {
+        Format_Obj_Vertex_Index_Array corners = {arena.alloc};
+        Vec2_Array projected = {arena.alloc};
+        i32_Array remaining = {arena.alloc};
+
+        for(isize polygon_i = 0; polygon_i < model->polygons.len; polygon_i++)
+        {
+            Format_Obj_Polygon polygon = model->polygons.data[polygon_i];
+            Format_Obj_Vertex_Index* trinagles = model->indices.data + polygon.trinagles_from*3;
+            isize n = polygon.corner_count;
+            
+            //Reconstruct the polygon from the fan: first trinagle has corners 0 1 2, each next one adds a corner
+            array_clear(&corners);
+            array_push(&corners, trinagles[0]);
+            array_push(&corners, trinagles[1]);
+            for(isize i = 0; i < n - 2; i++)
+                array_push(&corners, trinagles[i*3 + 2]);
+
+            bool valid = true;
+            for(isize i = 0; i < n; i++)
+                valid = valid && 0 < corners.data[i].pos_i1 && corners.data[i].pos_i1 <= model->positions.len;
+            if(valid == false)
+                continue;
+
+            //Newell normal of the polygon. We project onto the plane of its largest component.
+            Vec3 normal = {0};
+            for(isize i = 0; i < n; i++)
+            {
+                Vec3 curr = model->positions.data[corners.data[i].pos_i1 - 1];
+                Vec3 next = model->positions.data[corners.data[(i + 1) % n].pos_i1 - 1];
+                normal.x += (curr.y - next.y)*(curr.z + next.z);
+                normal.y += (curr.z - next.z)*(curr.x + next.x);
+                normal.z += (curr.x - next.x)*(curr.y + next.y);
+            }
+
+            f32 ax = fabsf(normal.x);
+            f32 ay = fabsf(normal.y);
+            f32 az = fabsf(normal.z);
+            f32 normal_major = az;
+            array_resize(&projected, n);
+            for(isize i = 0; i < n; i++)
+            {
+                Vec3 pos = model->positions.data[corners.data[i].pos_i1 - 1];
+                Vec2 proj = {0};
+                if(ax >= ay && ax >= az)      { proj.x = pos.y; proj.y = pos.z; normal_major = normal.x; }
+                else if(ay >= az)             { proj.x = pos.z; proj.y = pos.x; normal_major = normal.y; }
+                else                          { proj.x = pos.x; proj.y = pos.y; normal_major = normal.z; }
+                projected.data[i] = proj;
+            }
+
+            f32 orientation = normal_major >= 0 ? 1.0f : -1.0f;
+
+            //Convex polygons are already triangulated correctly
+            bool is_convex = true;
+            for(isize i = 0; i < n && is_convex; i++)
+                is_convex = _format_obj_cross2(projected.data[i], projected.data[(i + 1) % n], projected.data[(i + 2) % n])*orientation >= 0;
+            if(is_convex)
+                continue;
+
+            //Ear clipping. Writes the trinagles back in place.
+            array_resize(&remaining, n);
+            for(isize i = 0; i < n; i++)
+                remaining.data[i] = (i32) i;
+
+            isize written = 0;
+            isize left = n;
+            isize guard = 0;
+            for(isize i = 0; left > 3; )
+            {
+                i32 prev = remaining.data[(i + left - 1) % left];
+                i32 curr = remaining.data[i % left];
+                i32 next = remaining.data[(i + 1) % left];
+                Vec2 a = projected.data[prev];
+                Vec2 b = projected.data[curr];
+                Vec2 c = projected.data[next];
+
+                //Is ear if convex and contains no other corner. 
+                //If we went around without finding an ear (degenerate polygon) we just take any.
+                bool is_ear = _format_obj_cross2(a, b, c)*orientation > 0 || guard >= left;
+                for(isize k = 0; k < left && is_ear && guard < left; k++)
+                {
+                    i32 other = remaining.data[k];
+                    if(other != prev && other != curr && other != next)
+                        is_ear = !_format_obj_is_inside_trinagle(projected.data[other], a, b, c, orientation);
+                }
+
+                if(is_ear)
+                {
+                    trinagles[written*3 + 0] = corners.data[prev];
+                    trinagles[written*3 + 1] = corners.data[curr];
+                    trinagles[written*3 + 2] = corners.data[next];
+                    written += 1;
+
+                    isize removed = i % left;
+                    memmove(remaining.data + removed, remaining.data + removed + 1, (size_t) (left - removed - 1) * sizeof(i32));
+                    left -= 1;
+                    guard = 0;
+                    i = removed;
+                }
+                else
+                {
+                    i += 1;
+                    guard += 1;
+                }
+            }
+
+            trinagles[written*3 + 0] = corners.data[remaining.data[0]];
+            trinagles[written*3 + 1] = corners.data[remaining.data[1]];
+            trinagles[written*3 + 2] = corners.data[remaining.data[2]];
+            ASSERT(written + 1 == n - 2);
+        }
+    }
+}
+
 //matches: x y z where x, y, z are f32
 INTERNAL bool _match_space_separated_vec3(String str, isize* index, Vec3* matched)
 {
     isize i = *index;
-    bool state = match_decimal_f32(str, &i, &matched->x)
-        && match_whitespace(str, &i)
-        && match_decimal_f32(str, &i, &matched->y)
-        && match_whitespace(str, &i)
-        && match_decimal_f32(str, &i, &matched->z);
+    bool state = format_obj_match_decimal_f32(str, &i, &matched->x)
+        && _format_obj_match_whitespace(str, &i)
+        && format_obj_match_decimal_f32(str, &i, &matched->y)
+        && _format_obj_match_whitespace(str, &i)
+        && format_obj_match_decimal_f32(str, &i, &matched->z);
 
     if(state)
         *index = i;
@@ -860,15 +1840,15 @@ INTERNAL bool _match_space_separated_vec3(String str, isize* index, Vec3* matche
 INTERNAL bool _match_space_separated_optional_vec3(String str, isize* index, Vec3* matched)
 {
     isize i = *index;
-    bool matched_x = match_decimal_f32(str, &i, &matched->x);
+    bool matched_x = format_obj_match_decimal_f32(str, &i, &matched->x);
 
     bool matched_y = matched_x 
-        && match_whitespace(str, &i)
-        && match_decimal_f32(str, &i, &matched->y);
+        && _format_obj_match_whitespace(str, &i)
+        && format_obj_match_decimal_f32(str, &i, &matched->y);
     
     bool matched_z = matched_y 
-        && match_whitespace(str, &i)
-        && match_decimal_f32(str, &i, &matched->z);
+        && _format_obj_match_whitespace(str, &i)
+        && format_obj_match_decimal_f32(str, &i, &matched->z);
 
     bool state = matched_x || matched_y || matched_z;
     if(state)
@@ -887,7 +1867,7 @@ EXTERNAL bool format_mtl_read(Format_Mtl_Material_Array* out, String mtl_source,
         Format_Mtl_Material* material = NULL;
         isize error_count = 0;
 
-        for(Line_Iterator it = {0}; line_iterator_get_line(&it, mtl_source); )
+        for(_Format_Obj_Line_Iterator it = {0}; _format_obj_line_iterator_next(&it, mtl_source); )
         {
             PROFILE_SCOPE(line) 
             {
@@ -940,7 +1920,7 @@ EXTERNAL bool format_mtl_read(Format_Mtl_Material_Array* out, String mtl_source,
                 //ambient_color
                 else if(i = 0, match_sequence(line, &i, STRING("Ka")))
                 {
-                    if(match_whitespace(line, &i) && _match_space_separated_vec3(line, &i, &vec))
+                    if(_format_obj_match_whitespace(line, &i) && _match_space_separated_vec3(line, &i, &vec))
                         SET_PROP(material,ambient_color) = vec;
                     else
                         error = FORMAT_MTL_ERROR_COLOR_AMBIENT;
@@ -949,7 +1929,7 @@ EXTERNAL bool format_mtl_read(Format_Mtl_Material_Array* out, String mtl_source,
                 //diffuse_color
                 else if(i = 0, match_sequence(line, &i, STRING("Kd")))
                 {
-                    if(match_whitespace(line, &i) && _match_space_separated_vec3(line, &i, &vec))
+                    if(_format_obj_match_whitespace(line, &i) && _match_space_separated_vec3(line, &i, &vec))
                         SET_PROP(material, diffuse_color) = vec;
                     else
                         error = FORMAT_MTL_ERROR_COLOR_DIFFUSE;
@@ -958,7 +1938,7 @@ EXTERNAL bool format_mtl_read(Format_Mtl_Material_Array* out, String mtl_source,
                 //specular_color
                 else if(i = 0, match_sequence(line, &i, STRING("Ks")))
                 {
-                    if(match_whitespace(line, &i) && _match_space_separated_vec3(line, &i, &vec))
+                    if(_format_obj_match_whitespace(line, &i) && _match_space_separated_vec3(line, &i, &vec))
                         SET_PROP(material, specular_color) = vec;
                     else
                         error = FORMAT_MTL_ERROR_COLOR_SPECULAR;
@@ -967,7 +1947,7 @@ EXTERNAL bool format_mtl_read(Format_Mtl_Material_Array* out, String mtl_source,
                 //emissive_color
                 else if(i = 0, match_sequence(line, &i, STRING("Ke")))
                 {
-                    if(match_whitespace(line, &i) && _match_space_separated_vec3(line, &i, &vec))
+                    if(_format_obj_match_whitespace(line, &i) && _match_space_separated_vec3(line, &i, &vec))
                         SET_PROP(material, emissive_color) = vec;
                     else
                         error = FORMAT_MTL_ERROR_COLOR_EMISSIVE;
@@ -977,7 +1957,7 @@ EXTERNAL bool format_mtl_read(Format_Mtl_Material_Array* out, String mtl_source,
                 else if(i = 0, match_sequence(line, &i, STRING("Ns")))
                 {
                     f32 val = 0;
-                    if(match_whitespace(line, &i) && match_decimal_f32(line, &i, &val))
+                    if(_format_obj_match_whitespace(line, &i) && format_obj_match_decimal_f32(line, &i, &val))
                         SET_PROP(material, specular_exponent) = val;
                     else
                         error = FORMAT_MTL_ERROR_SHEEN;
@@ -987,7 +1967,7 @@ EXTERNAL bool format_mtl_read(Format_Mtl_Material_Array* out, String mtl_source,
                 else if(i = 0, match_sequence(line, &i, STRING("Pr")))
                 {
                     f32 val = 0;
-                    if(match_whitespace(line, &i) && match_decimal_f32(line, &i, &val))
+                    if(_format_obj_match_whitespace(line, &i) && format_obj_match_decimal_f32(line, &i, &val))
                         SET_PROP(material, pbr_roughness) = val;
                     else
                         error = FORMAT_MTL_ERROR_ROUGHNESS;
@@ -997,7 +1977,7 @@ EXTERNAL bool format_mtl_read(Format_Mtl_Material_Array* out, String mtl_source,
                 else if(i = 0, match_sequence(line, &i, STRING("Pm")))
                 {
                     f32 val = 0;
-                    if(match_whitespace(line, &i) && match_decimal_f32(line, &i, &val))
+                    if(_format_obj_match_whitespace(line, &i) && format_obj_match_decimal_f32(line, &i, &val))
                         SET_PROP(material, pbr_metallic) = val;
                     else
                         error = FORMAT_MTL_ERROR_METALIC;
@@ -1007,7 +1987,7 @@ EXTERNAL bool format_mtl_read(Format_Mtl_Material_Array* out, String mtl_source,
                 else if(i = 0, match_sequence(line, &i, STRING("Ps")))
                 {
                     f32 val = 0;
-                    if(match_whitespace(line, &i) && match_decimal_f32(line, &i, &val))
+                    if(_format_obj_match_whitespace(line, &i) && format_obj_match_decimal_f32(line, &i, &val))
                         SET_PROP(material, pbr_sheen) = val;
                     else
                         error = FORMAT_MTL_ERROR_SHEEN;
@@ -1017,7 +1997,7 @@ EXTERNAL bool format_mtl_read(Format_Mtl_Material_Array* out, String mtl_source,
                 else if(i = 0, match_sequence(line, &i, STRING("aniso")))
                 {
                     f32 val = 0;
-                    if(match_whitespace(line, &i) && match_decimal_f32(line, &i, &val))
+                    if(_format_obj_match_whitespace(line, &i) && format_obj_match_decimal_f32(line, &i, &val))
                         SET_PROP(material, pbr_anisotropy) = val;
                     else
                         error = FORMAT_MTL_ERROR_SHEEN;
@@ -1027,7 +2007,7 @@ EXTERNAL bool format_mtl_read(Format_Mtl_Material_Array* out, String mtl_source,
                 else if(i = 0, match_sequence(line, &i, STRING("anisor")))
                 {
                     f32 val = 0;
-                    if(match_whitespace(line, &i) && match_decimal_f32(line, &i, &val))
+                    if(_format_obj_match_whitespace(line, &i) && format_obj_match_decimal_f32(line, &i, &val))
                         SET_PROP(material, pbr_anisotropy_rotation) = val;
                     else
                         error = FORMAT_MTL_ERROR_SHEEN;
@@ -1037,7 +2017,7 @@ EXTERNAL bool format_mtl_read(Format_Mtl_Material_Array* out, String mtl_source,
                 else if(i = 0, match_sequence(line, &i, STRING("Pc")))
                 {
                     f32 val = 0;
-                    if(match_whitespace(line, &i) && match_decimal_f32(line, &i, &val))
+                    if(_format_obj_match_whitespace(line, &i) && format_obj_match_decimal_f32(line, &i, &val))
                         SET_PROP(material, pbr_clearcoat_thickness) = val;
                     else
                         error = FORMAT_MTL_ERROR_CLEARCOAT_THICKNESS;
@@ -1047,7 +2027,7 @@ EXTERNAL bool format_mtl_read(Format_Mtl_Material_Array* out, String mtl_source,
                 else if(i = 0, match_sequence(line, &i, STRING("Pcr")))
                 {
                     f32 val = 0;
-                    if(match_whitespace(line, &i) && match_decimal_f32(line, &i, &val))
+                    if(_format_obj_match_whitespace(line, &i) && format_obj_match_decimal_f32(line, &i, &val))
                         SET_PROP(material, pbr_clearcoat_roughness) = val;
                     else
                         error = FORMAT_MTL_ERROR_CLEARCOAT_ROUGHNESS;
@@ -1057,7 +2037,7 @@ EXTERNAL bool format_mtl_read(Format_Mtl_Material_Array* out, String mtl_source,
                 else if(i = 0, match_sequence(line, &i, STRING("d")))
                 {
                     f32 val = 0;
-                    if(match_whitespace(line, &i) && match_decimal_f32(line, &i, &val))
+                    if(_format_obj_match_whitespace(line, &i) && format_obj_match_decimal_f32(line, &i, &val))
                         SET_PROP(material, opacity) = val; //d=0 => transparent
                     else
                         error = FORMAT_MTL_ERROR_OPACITY;
@@ -1067,7 +2047,7 @@ EXTERNAL bool format_mtl_read(Format_Mtl_Material_Array* out, String mtl_source,
                 else if(i = 0, match_sequence(line, &i, STRING("Tr"))) 
                 {
                     f32 val = 0;
-                    if(match_whitespace(line, &i) && match_decimal_f32(line, &i, &val))
+                    if(_format_obj_match_whitespace(line, &i) && format_obj_match_decimal_f32(line, &i, &val))
                         SET_PROP(material, opacity) = 1.0f - val; //Tr=1 => transparent
                     else
                         error = FORMAT_MTL_ERROR_OPACITY;
@@ -1076,7 +2056,7 @@ EXTERNAL bool format_mtl_read(Format_Mtl_Material_Array* out, String mtl_source,
                 //transmission_filter_color
                 else if(i = 0, match_sequence(line, &i, STRING("Tf")))
                 {
-                    if(match_whitespace(line, &i) && _match_space_separated_vec3(line, &i, &vec))
+                    if(_format_obj_match_whitespace(line, &i) && _match_space_separated_vec3(line, &i, &vec))
                         SET_PROP(material, only_for_transparent_transmission_filter_color) = vec;
                     else
                         error = FORMAT_MTL_ERROR_TRANSMISSION_FILTER;
@@ -1086,7 +2066,7 @@ EXTERNAL bool format_mtl_read(Format_Mtl_Material_Array* out, String mtl_source,
                 else if(i = 0, match_sequence(line, &i, STRING("Ni")))
                 {
                     f32 val = 0;
-                    if(match_whitespace(line, &i) && match_decimal_f32(line, &i, &val))
+                    if(_format_obj_match_whitespace(line, &i) && format_obj_match_decimal_f32(line, &i, &val))
                         SET_PROP(material, only_for_transparent_optical_density) = val;
                     else
                         error = FORMAT_MTL_ERROR_TRANSMISSION_OPTICAL_DENSITY;
@@ -1096,7 +2076,7 @@ EXTERNAL bool format_mtl_read(Format_Mtl_Material_Array* out, String mtl_source,
                 else if(i = 0, match_sequence(line, &i, STRING("illum")))
                 {
                     u64 val = 0;
-                    if(match_whitespace(line, &i) && match_decimal_u64(line, &i, &val)
+                    if(_format_obj_match_whitespace(line, &i) && match_decimal_u64(line, &i, &val)
                         && FORMAT_MTL_ILLUM_MIN <= val && val <= FORMAT_MTL_ILLUM_MAX)
                             SET_PROP(material, illumination_mode) = (i32) val;
                     else
@@ -1165,7 +2145,7 @@ EXTERNAL bool format_mtl_read(Format_Mtl_Material_Array* out, String mtl_source,
 
                             while(matched && i < line.len)
                             {
-                                matched = match_whitespace(line, &i);
+                                matched = _format_obj_match_whitespace(line, &i);
                                 isize arg_from = i;
                                 String arg = string_tail(line, arg_from);
                                 isize arg_i = 0;
@@ -1174,7 +2154,7 @@ EXTERNAL bool format_mtl_read(Format_Mtl_Material_Array* out, String mtl_source,
                                 //offset
                                 if(arg_i = 0, match_sequence(arg, &arg_i, STRING("-o")))
                                 {
-                                    if(match_whitespace(arg, &arg_i) && _match_space_separated_optional_vec3(arg, &arg_i, &arg_vec))
+                                    if(_format_obj_match_whitespace(arg, &arg_i) && _match_space_separated_optional_vec3(arg, &arg_i, &arg_vec))
                                         SET_PROP_(temp_tex_info,offset) = arg_vec;
                                     else
                                         matched = false;
@@ -1183,7 +2163,7 @@ EXTERNAL bool format_mtl_read(Format_Mtl_Material_Array* out, String mtl_source,
                                 else if(arg_i = 0, match_sequence(arg, &arg_i, STRING("-s")))
                                 {
                         
-                                    if(match_whitespace(arg, &arg_i) && _match_space_separated_optional_vec3(arg, &arg_i, &arg_vec))
+                                    if(_format_obj_match_whitespace(arg, &arg_i) && _match_space_separated_optional_vec3(arg, &arg_i, &arg_vec))
                                         SET_PROP_(temp_tex_info,scale) = arg_vec;
                                     else
                                         matched = false;
@@ -1192,7 +2172,7 @@ EXTERNAL bool format_mtl_read(Format_Mtl_Material_Array* out, String mtl_source,
                                 else if(arg_i = 0, match_sequence(arg, &arg_i, STRING("-t")))
                                 {
                         
-                                    if(match_whitespace(arg, &arg_i) && _match_space_separated_optional_vec3(arg, &arg_i, &arg_vec))
+                                    if(_format_obj_match_whitespace(arg, &arg_i) && _match_space_separated_optional_vec3(arg, &arg_i, &arg_vec))
                                         SET_PROP_(temp_tex_info,turbulance) = arg_vec;
                                     else
                                         matched = false;
@@ -1201,7 +2181,7 @@ EXTERNAL bool format_mtl_read(Format_Mtl_Material_Array* out, String mtl_source,
                                 else if(arg_i = 0, match_sequence(arg, &arg_i, STRING("-texres")))
                                 {
                                     u64 res = 0;
-                                    if(match_whitespace(arg, &arg_i) && match_decimal_u64(arg, &arg_i, &res))
+                                    if(_format_obj_match_whitespace(arg, &arg_i) && match_decimal_u64(arg, &arg_i, &res))
                                         SET_PROP_(temp_tex_info,texture_resolution) = (i32) res;
                                     else
                                         matched = false;
@@ -1210,7 +2190,7 @@ EXTERNAL bool format_mtl_read(Format_Mtl_Material_Array* out, String mtl_source,
                                 else if(arg_i = 0, match_sequence(arg, &arg_i, STRING("-boost")))
                                 {
                                     f32 val = 0;
-                                    if(match_whitespace(arg, &arg_i) && match_decimal_f32(arg, &arg_i, &val))
+                                    if(_format_obj_match_whitespace(arg, &arg_i) && format_obj_match_decimal_f32(arg, &arg_i, &val))
                                         SET_PROP_(temp_tex_info,mipmap_sharpness_boost) = val;
                                     else
                                         matched = false;
@@ -1219,7 +2199,7 @@ EXTERNAL bool format_mtl_read(Format_Mtl_Material_Array* out, String mtl_source,
                                 else if(arg_i = 0, match_sequence(arg, &arg_i, STRING("-bm")))
                                 {
                                     f32 val = 0;
-                                    if(match_whitespace(arg, &arg_i) && match_decimal_f32(arg, &arg_i, &val))
+                                    if(_format_obj_match_whitespace(arg, &arg_i) && format_obj_match_decimal_f32(arg, &arg_i, &val))
                                         material->map_bump.bump_multiplier = val - 1.0f;
                                     else
                                         matched = false;
@@ -1229,8 +2209,8 @@ EXTERNAL bool format_mtl_read(Format_Mtl_Material_Array* out, String mtl_source,
                                 {
                                     f32 modify_brigthness = 0;
                                     f32 modify_contrast = 0;
-                                    if(match_whitespace(arg, &arg_i) && match_decimal_f32(arg, &arg_i, &modify_brigthness)
-                                        && match_whitespace(arg, &arg_i) && match_decimal_f32(arg, &arg_i, &modify_contrast))
+                                    if(_format_obj_match_whitespace(arg, &arg_i) && format_obj_match_decimal_f32(arg, &arg_i, &modify_brigthness)
+                                        && _format_obj_match_whitespace(arg, &arg_i) && format_obj_match_decimal_f32(arg, &arg_i, &modify_contrast))
                                     {
                                         SET_PROP_(temp_tex_info,modify_brigthness) = modify_brigthness;
                                         SET_PROP_(temp_tex_info,modify_contrast) = modify_contrast - 1.0f;
@@ -1241,7 +2221,7 @@ EXTERNAL bool format_mtl_read(Format_Mtl_Material_Array* out, String mtl_source,
                                 //is_clamped
                                 else if(arg_i = 0, match_sequence(arg, &arg_i, STRING("-clamp")))
                                 {
-                                    bool had_space = match_whitespace(arg, &arg_i);
+                                    bool had_space = _format_obj_match_whitespace(arg, &arg_i);
                                     if(had_space && match_sequence(arg, &arg_i, STRING("on")))
                                         SET_PROP_(temp_tex_info,is_clamped) = true;
                                     else if(had_space && match_sequence(arg, &arg_i, STRING("off")))
@@ -1252,7 +2232,7 @@ EXTERNAL bool format_mtl_read(Format_Mtl_Material_Array* out, String mtl_source,
                                 //blend_u
                                 else if(arg_i = 0, match_sequence(arg, &arg_i, STRING("-blendu")))
                                 {
-                                    bool had_space = match_whitespace(arg, &arg_i);
+                                    bool had_space = _format_obj_match_whitespace(arg, &arg_i);
                                     if(had_space && match_sequence(arg, &arg_i, STRING("on")))
                                         SET_PROP_(temp_tex_info,blend_u) = false;
                                     else if(had_space && match_sequence(arg, &arg_i, STRING("off")))
@@ -1263,7 +2243,7 @@ EXTERNAL bool format_mtl_read(Format_Mtl_Material_Array* out, String mtl_source,
                                 //blend_v
                                 else if(arg_i = 0, match_sequence(arg, &arg_i, STRING("-blendv")))
                                 {
-                                    bool had_space = match_whitespace(arg, &arg_i);
+                                    bool had_space = _format_obj_match_whitespace(arg, &arg_i);
                                     if(had_space && match_sequence(arg, &arg_i, STRING("on")))
                                         SET_PROP_(temp_tex_info,blend_v) = false;
                                     else if(had_space && match_sequence(arg, &arg_i, STRING("off")))
@@ -1275,7 +2255,7 @@ EXTERNAL bool format_mtl_read(Format_Mtl_Material_Array* out, String mtl_source,
                                 else if(arg_i = 0, match_sequence(arg, &arg_i, STRING("-type")))
                                 {
                                     Format_Mtl_Map* found_tex_info = NULL; 
-                                    if(match_whitespace(arg, &arg_i))
+                                    if(_format_obj_match_whitespace(arg, &arg_i))
                                     {
                                         if(match_sequence(arg, &arg_i, STRING("sphere")))
                                             found_tex_info = &material->map_reflection_sphere;
@@ -1308,7 +2288,7 @@ EXTERNAL bool format_mtl_read(Format_Mtl_Material_Array* out, String mtl_source,
                                 //-imfchan [r | g | b | m | l | z]  
                                 else if(arg_i = 0, match_sequence(arg, &arg_i, STRING("-imfchan")))
                                 {
-                                    bool matched_arg = match_whitespace(arg, &arg_i);
+                                    bool matched_arg = _format_obj_match_whitespace(arg, &arg_i);
                                     char c = 0;
                                     if(matched_arg && arg.len - arg_i > 1)
                                         c = arg.data[arg_i];
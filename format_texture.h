@@ -0,0 +1,185 @@
+#ifndef LIB_FORMAT_TEXTURE
+#define LIB_FORMAT_TEXTURE
+
+// A binary "cooked" texture file containing the whole mip chain of an image exactly in the
+// form it is uploaded to the gpu. Thus loading a cooked texture skips image decoding, mip 
+// generation (see mip_chain.h) and block compression (see texture_compress.h).
+//
+// Like format_mesh.h the file is designed to be memory mapped and used in place. Each mip
+// is aligned to FORMAT_TEXTURE_ALIGN with its rows tightly packed. Compressed mips are stored
+// as images of blocks. format_texture_read only validates the header and points the mips into the data.
+//
+// Layout:
+//  [Format_Texture_Header]
+//  [mip 0 pixels]
+//  [mip 1 pixels]
+//  ...
+//
+// The header stores the source file info (the same as cooked meshes) and a hash of the
+// Mip_Options and block format the chain was made with. A change in either means the file is stale.
+
+#include "lib/string.h"
+#include "lib/image.h"
+#include "format_mesh.h"
+#include "mip_chain.h"
+#include "texture_compress.h"
+
+#define FORMAT_TEXTURE_MAGIC   0x747865746b6f6f63ULL //"cooktext" in little endian
+#define FORMAT_TEXTURE_VERSION 2
+#define FORMAT_TEXTURE_ALIGN   64
+
+typedef struct Format_Texture_Mip {
+    i64 offset; //from the start of the file
+    i32 width;  //in pixels even if compressed
+    i32 height;
+} Format_Texture_Mip;
+
+typedef struct Format_Texture_Header {
+    u64 magic;
+    u32 version;
+    u32 header_size;
+    i64 file_size;
+
+    Format_Source_Info source;
+    u64 options_hash;
+
+    i32 pixel_type;
+    i32 pixel_size;     //size of a block if compressed
+    i32 mip_count;
+    i32 block_format;   //Texture_Block_Format
+    i32 channel_count;  //of the source image
+    u32 _;
+    Format_Texture_Mip mips[MIP_CHAIN_MAX_MIPS];
+} Format_Texture_Header;
+
+//View into the read file. Is only valid while the data passed to format_texture_read is.
+//The pixels must not be written to. If compressed the mips are images of blocks.
+typedef struct Format_Texture {
+    const Format_Texture_Header* header;
+    Subimage mips[MIP_CHAIN_MAX_MIPS];
+    i32 mip_count;
+    u32 _;
+} Format_Texture;
+
+EXTERNAL u64 format_texture_options_hash(const Mip_Options* options, Texture_Block_Format block_format);
+//Writes the mip chain of a width x height image with channel_count channels. If block_format 
+// is not TEXTURE_BLOCK_NONE the mips are images of blocks (see texture_compress.h).
+EXTERNAL void format_texture_write(String_Builder* into, Format_Source_Info source, u64 options_hash, Texture_Block_Format block_format, 
+    i32 width, i32 height, const Image* mips, i32 mip_count, i32 channel_count);
+
+//Validates the data and fills out with views into it. Returns false if the data is not
+// a valid texture file of the current version.
+EXTERNAL bool format_texture_read(Format_Texture* out, String data);
+
+#endif
+
+#if (defined(LIB_ALL_IMPL) || defined(LIB_FORMAT_TEXTURE_IMPL)) && !defined(LIB_FORMAT_TEXTURE_HAS_IMPL)
+#define LIB_FORMAT_TEXTURE_HAS_IMPL
+
+INTERNAL i64 _format_texture_align(i64 offset)
+{
+    return (offset + FORMAT_TEXTURE_ALIGN - 1) / FORMAT_TEXTURE_ALIGN * FORMAT_TEXTURE_ALIGN;
+}
+
+EXTERNAL u64 format_texture_options_hash(const Mip_Options* options, Texture_Block_Format block_format)
+{
+    //Also changes when the generator itself changes in a way that affects the output
+    return xxhash64(options, sizeof *options, (u64) block_format << 32 | FORMAT_TEXTURE_VERSION);
+}
+
+EXTERNAL void format_texture_write(String_Builder* into, Format_Source_Info source, u64 options_hash, Texture_Block_Format block_format, 
+    i32 width, i32 height, const Image* mips, i32 mip_count, i32 channel_count)
+{
+    PROFILE_SCOPE()
+    {
+        ASSERT(0 < mip_count && mip_count <= MIP_CHAIN_MAX_MIPS);
+        bool is_compressed = block_format != TEXTURE_BLOCK_NONE;
+        Format_Texture_Header header = {0};
+        header.magic = FORMAT_TEXTURE_MAGIC;
+        header.version = FORMAT_TEXTURE_VERSION;
+        header.header_size = sizeof(Format_Texture_Header);
+        header.source = source;
+        header.options_hash = options_hash;
+        header.pixel_type = mips[0].type;
+        header.pixel_size = mips[0].pixel_size;
+        header.mip_count = mip_count;
+        header.block_format = block_format;
+        header.channel_count = channel_count;
+
+        i64 offset = _format_texture_align(sizeof(Format_Texture_Header));
+        for(i32 i = 0; i < mip_count; i++)
+        {
+            i32 mip_width = MAX(width >> i, 1);
+            i32 mip_height = MAX(height >> i, 1);
+            ASSERT(mips[i].type == mips[0].type && mips[i].pixel_size == mips[0].pixel_size);
+            ASSERT(is_compressed 
+                ? mips[i].width == (mip_width + 3)/4 && mips[i].height == (mip_height + 3)/4 && mips[i].pixel_size == texture_block_size(block_format)
+                : mips[i].width == mip_width && mips[i].height == mip_height);
+
+            header.mips[i].offset = offset;
+            header.mips[i].width = mip_width;
+            header.mips[i].height = mip_height;
+            offset = _format_texture_align(offset + (i64) mips[i].width * mips[i].height * mips[i].pixel_size);
+        }
+        header.file_size = offset;
+
+        //Everything including the padding is zeroed so the output is deterministic
+        builder_clear(into);
+        builder_resize(into, offset);
+        memset(into->data, 0, (size_t) offset);
+        memcpy(into->data, &header, sizeof header);
+        for(i32 i = 0; i < mip_count; i++)
+        {
+            isize row_size = (isize) mips[i].width * mips[i].pixel_size;
+            isize stride = image_byte_stride(mips[i]);
+            for(i32 y = 0; y < mips[i].height; y++)
+                memcpy(into->data + header.mips[i].offset + y*row_size, mips[i].pixels + y*stride, (size_t) row_size);
+        }
+    }
+}
+
+EXTERNAL bool format_texture_read(Format_Texture* out, String data)
+{
+    Format_Texture texture = {0};
+    //The data only needs to be aligned enough for the i64 header fields. Mapped files are page aligned.
+    if(data.len < (isize) sizeof(Format_Texture_Header) || (usize) data.data % 8 != 0)
+        return false;
+
+    const Format_Texture_Header* header = (const Format_Texture_Header*) (const void*) data.data;
+    bool state = header->magic == FORMAT_TEXTURE_MAGIC
+        && header->version == FORMAT_TEXTURE_VERSION
+        && header->header_size == sizeof(Format_Texture_Header)
+        && header->file_size <= data.len
+        && header->pixel_size > 0
+        && header->channel_count > 0
+        && 0 < header->mip_count && header->mip_count <= MIP_CHAIN_MAX_MIPS
+        && 0 <= header->block_format && header->block_format < TEXTURE_BLOCK_FORMAT_COUNT;
+
+    //Size of the stored image of each mip (blocks if compressed)
+    i32 widths[MIP_CHAIN_MAX_MIPS] = {0};
+    i32 heights[MIP_CHAIN_MAX_MIPS] = {0};
+    for(i32 i = 0; i < header->mip_count && state; i++)
+    {
+        Format_Texture_Mip mip = header->mips[i];
+        widths[i] = header->block_format != TEXTURE_BLOCK_NONE ? (mip.width + 3)/4 : mip.width;
+        heights[i] = header->block_format != TEXTURE_BLOCK_NONE ? (mip.height + 3)/4 : mip.height;
+        state = mip.offset >= (i64) sizeof(Format_Texture_Header)
+            && mip.offset % FORMAT_TEXTURE_ALIGN == 0
+            && mip.width > 0 && mip.height > 0
+            && mip.offset <= header->file_size
+            && (i64) widths[i] * heights[i] <= (header->file_size - mip.offset) / header->pixel_size;
+    }
+
+    if(state)
+    {
+        texture.header = header;
+        texture.mip_count = header->mip_count;
+        for(i32 i = 0; i < header->mip_count; i++)
+            texture.mips[i] = subimage_make((void*) (data.data + header->mips[i].offset), widths[i], heights[i], header->pixel_size, (Pixel_Type) header->pixel_type);
+        *out = texture;
+    }
+
+    return state;
+}
+
+#endif
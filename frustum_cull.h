@@ -0,0 +1,272 @@
+#ifndef LIB_FRUSTUM_CULL
+#define LIB_FRUSTUM_CULL
+
+// Culling of axis aligned boxes against a camera frustum.
+//
+// The frustum is extracted from the combined projection * view matrix as six planes
+// facing inwards (Gribb-Hartmann). A box given by its center and extent is outside
+// if it lies fully behind any of the planes. This is conservative: some boxes near
+// the frustum corners are reported visible even though they are not, but no visible
+// box is ever culled.
+//
+// The boxes are tested in SoA form 4 (SSE2) or 8 (AVX) at a time. Object space
+// boxes are first moved into world space with frustum_transform_aabb which keeps
+// the box axis aligned by growing it (Arvo's method).
+//
+// Nothing here touches opengl so it can be used and tested without a context.
+
+#include "engine_types.h"
+
+typedef struct Frustum {
+    //xyz is the normalized inward facing normal, w is the distance.
+    //Point p is inside when dot(p, xyz) + w >= 0 for all planes.
+    Vec4 planes[6];
+} Frustum;
+
+//Boxes stored as separate arrays of each component. All arrays have count items.
+typedef struct Frustum_Cull_Boxes {
+    const f32* center_x;
+    const f32* center_y;
+    const f32* center_z;
+    const f32* extent_x;
+    const f32* extent_y;
+    const f32* extent_z;
+    isize count;
+} Frustum_Cull_Boxes;
+
+//Extracts the frustum planes from projection * view.
+EXTERNAL Frustum frustum_from_matrix(Mat4 projection_view);
+
+//Transforms the local box by the affine transform and returns the world space box
+// containing it as center and extent (half size).
+EXTERNAL void frustum_transform_aabb(AABB local, Mat4 transform, Vec3* center, Vec3* extent);
+
+//Writes 1 to visible[i] if the i-th box intersects the frustum and 0 otherwise.
+//Returns the number of visible boxes.
+EXTERNAL isize frustum_cull_boxes(const Frustum* frustum, Frustum_Cull_Boxes boxes, u8* visible);
+
+//The same as frustum_cull_boxes but tests one box at a time. Used for the remainder
+// and as the reference implementation.
+EXTERNAL isize frustum_cull_boxes_scalar(const Frustum* frustum, Frustum_Cull_Boxes boxes, u8* visible);
+
+#endif
+
+#if (defined(LIB_ALL_IMPL) || defined(LIB_FRUSTUM_CULL_IMPL)) && !defined(LIB_FRUSTUM_CULL_HAS_IMPL)
+#define LIB_FRUSTUM_CULL_HAS_IMPL
+
+#if defined(__AVX__)
+    #define FRUSTUM_CULL_AVX
+    #include <immintrin.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define FRUSTUM_CULL_SSE2
+    #include <emmintrin.h>
+#endif
+
+#include <math.h>
+
+//Matrices are stored column major (the same layout the shaders receive them in).
+INTERNAL f32 _frustum_mat4_at(const Mat4* matrix, isize row, isize col)
+{
+    return ((const f32*) (const void*) matrix)[col*4 + row];
+}
+
+EXTERNAL Frustum frustum_from_matrix(Mat4 projection_view)
+{
+    Vec4 rows[4] = {0};
+    for(isize r = 0; r < 4; r++)
+    {
+        rows[r].x = _frustum_mat4_at(&projection_view, r, 0);
+        rows[r].y = _frustum_mat4_at(&projection_view, r, 1);
+        rows[r].z = _frustum_mat4_at(&projection_view, r, 2);
+        rows[r].w = _frustum_mat4_at(&projection_view, r, 3);
+    }
+
+    //In clip space a point is inside when -w <= x, y, z <= w.
+    //Each of the six inequalities is one plane: row3 +- row0/1/2.
+    Frustum frustum = {0};
+    for(isize i = 0; i < 6; i++)
+    {
+        Vec4 axis = rows[i / 2];
+        f32 sign = i % 2 == 0 ? 1.0f : -1.0f;
+
+        Vec4 plane = {0};
+        plane.x = rows[3].x + sign*axis.x;
+        plane.y = rows[3].y + sign*axis.y;
+        plane.z = rows[3].z + sign*axis.z;
+        plane.w = rows[3].w + sign*axis.w;
+
+        f32 len = sqrtf(plane.x*plane.x + plane.y*plane.y + plane.z*plane.z);
+        if(len > 0)
+        {
+            plane.x /= len;
+            plane.y /= len;
+            plane.z /= len;
+            plane.w /= len;
+        }
+
+        frustum.planes[i] = plane;
+    }
+
+    return frustum;
+}
+
+EXTERNAL void frustum_transform_aabb(AABB local, Mat4 transform, Vec3* center, Vec3* extent)
+{
+    f32 local_center[3] = {
+        (local.min.x + local.max.x)*0.5f,
+        (local.min.y + local.max.y)*0.5f,
+        (local.min.z + local.max.z)*0.5f
+    };
+    f32 local_extent[3] = {
+        (local.max.x - local.min.x)*0.5f,
+        (local.max.y - local.min.y)*0.5f,
+        (local.max.z - local.min.z)*0.5f
+    };
+
+    f32 out_center[3] = {0};
+    f32 out_extent[3] = {0};
+    for(isize r = 0; r < 3; r++)
+    {
+        out_center[r] = _frustum_mat4_at(&transform, r, 3);
+        for(isize c = 0; c < 3; c++)
+        {
+            f32 m = _frustum_mat4_at(&transform, r, c);
+            out_center[r] += m*local_center[c];
+            out_extent[r] += fabsf(m)*local_extent[c];
+        }
+    }
+
+    *center = vec3(out_center[0], out_center[1], out_center[2]);
+    *extent = vec3(out_extent[0], out_extent[1], out_extent[2]);
+}
+
+INTERNAL bool _frustum_is_box_visible(const Frustum* frustum, f32 cx, f32 cy, f32 cz, f32 ex, f32 ey, f32 ez)
+{
+    for(isize i = 0; i < 6; i++)
+    {
+        Vec4 p = frustum->planes[i];
+        //Summed in the same order as the SIMD paths so all of them give bit identical results
+        f32 distance = (p.x*cx + p.y*cy) + (p.z*cz + p.w);
+        f32 radius = fabsf(p.x)*ex + fabsf(p.y)*ey + fabsf(p.z)*ez;
+        if(distance + radius < 0)
+            return false;
+    }
+
+    return true;
+}
+
+INTERNAL isize _frustum_cull_boxes_scalar_range(const Frustum* frustum, Frustum_Cull_Boxes boxes, u8* visible, isize from)
+{
+    isize visible_count = 0;
+    for(isize i = from; i < boxes.count; i++)
+    {
+        bool is_visible = _frustum_is_box_visible(frustum,
+            boxes.center_x[i], boxes.center_y[i], boxes.center_z[i],
+            boxes.extent_x[i], boxes.extent_y[i], boxes.extent_z[i]);
+
+        visible[i] = (u8) is_visible;
+        visible_count += is_visible;
+    }
+
+    return visible_count;
+}
+
+EXTERNAL isize frustum_cull_boxes_scalar(const Frustum* frustum, Frustum_Cull_Boxes boxes, u8* visible)
+{
+    return _frustum_cull_boxes_scalar_range(frustum, boxes, visible, 0);
+}
+
+EXTERNAL isize frustum_cull_boxes(const Frustum* frustum, Frustum_Cull_Boxes boxes, u8* visible)
+{
+    isize visible_count = 0;
+    isize i = 0;
+
+    #if defined(FRUSTUM_CULL_AVX)
+    {
+        __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+        __m256 zero = _mm256_setzero_ps();
+        for(; i + 8 <= boxes.count; i += 8)
+        {
+            __m256 cx = _mm256_loadu_ps(boxes.center_x + i);
+            __m256 cy = _mm256_loadu_ps(boxes.center_y + i);
+            __m256 cz = _mm256_loadu_ps(boxes.center_z + i);
+            __m256 ex = _mm256_loadu_ps(boxes.extent_x + i);
+            __m256 ey = _mm256_loadu_ps(boxes.extent_y + i);
+            __m256 ez = _mm256_loadu_ps(boxes.extent_z + i);
+
+            __m256 outside = _mm256_setzero_ps();
+            for(isize k = 0; k < 6; k++)
+            {
+                Vec4 p = frustum->planes[k];
+                __m256 nx = _mm256_set1_ps(p.x);
+                __m256 ny = _mm256_set1_ps(p.y);
+                __m256 nz = _mm256_set1_ps(p.z);
+
+                __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, cx), _mm256_mul_ps(ny, cy)),
+                                                _mm256_add_ps(_mm256_mul_ps(nz, cz), _mm256_set1_ps(p.w)));
+                __m256 radius = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_and_ps(nx, abs_mask), ex),
+                                                            _mm256_mul_ps(_mm256_and_ps(ny, abs_mask), ey)),
+                                              _mm256_mul_ps(_mm256_and_ps(nz, abs_mask), ez));
+
+                outside = _mm256_or_ps(outside, _mm256_cmp_ps(_mm256_add_ps(distance, radius), zero, _CMP_LT_OQ));
+            }
+
+            u32 outside_bits = (u32) _mm256_movemask_ps(outside);
+            for(isize k = 0; k < 8; k++)
+            {
+                u8 is_visible = (u8) (((outside_bits >> k) & 1) == 0);
+                visible[i + k] = is_visible;
+                visible_count += is_visible;
+            }
+        }
+    }
+    #endif
+
+    #if defined(FRUSTUM_CULL_SSE2)
+    {
+        __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+        __m128 zero = _mm_setzero_ps();
+        for(; i + 4 <= boxes.count; i += 4)
+        {
+            __m128 cx = _mm_loadu_ps(boxes.center_x + i);
+            __m128 cy = _mm_loadu_ps(boxes.center_y + i);
+            __m128 cz = _mm_loadu_ps(boxes.center_z + i);
+            __m128 ex = _mm_loadu_ps(boxes.extent_x + i);
+            __m128 ey = _mm_loadu_ps(boxes.extent_y + i);
+            __m128 ez = _mm_loadu_ps(boxes.extent_z + i);
+
+            __m128 outside = _mm_setzero_ps();
+            for(isize k = 0; k < 6; k++)
+            {
+                Vec4 p = frustum->planes[k];
+                __m128 nx = _mm_set1_ps(p.x);
+                __m128 ny = _mm_set1_ps(p.y);
+                __m128 nz = _mm_set1_ps(p.z);
+
+                __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, cx), _mm_mul_ps(ny, cy)),
+                                             _mm_add_ps(_mm_mul_ps(nz, cz), _mm_set1_ps(p.w)));
+                __m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_and_ps(nx, abs_mask), ex),
+                                                      _mm_mul_ps(_mm_and_ps(ny, abs_mask), ey)),
+                                           _mm_mul_ps(_mm_and_ps(nz, abs_mask), ez));
+
+                outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, radius), zero));
+            }
+
+            u32 outside_bits = (u32) _mm_movemask_ps(outside);
+            for(isize k = 0; k < 4; k++)
+            {
+                u8 is_visible = (u8) (((outside_bits >> k) & 1) == 0);
+                visible[i + k] = is_visible;
+                visible_count += is_visible;
+            }
+        }
+    }
+    #endif
+
+    visible_count += _frustum_cull_boxes_scalar_range(frustum, boxes, visible, i);
+    return visible_count;
+}
+
+#endif
@@ -0,0 +1,295 @@
+#ifndef LIB_LIGHT_CLUSTER
+#define LIB_LIGHT_CLUSTER
+
+// Assignment of point lights to clusters of the view frustum (clustered shading).
+//
+// The view frustum is split into tiles_x * tiles_y screen space tiles and slices depth slices.
+// The slices are exponentially spaced between near and far so that clusters stay roughly cubical.
+// Each such cluster (froxel) is bounded by a view space AABB and every light whose sphere of
+// influence touches the AABB is assigned to it. The shader then only evaluates the lights
+// of the cluster the pixel falls into instead of all of them.
+//
+// The output is in the form that can be uploaded as is: a range {offset, count} for each cluster
+// pointing into a single compact array of light indices. Within each cluster the indices are
+// sorted ascending, so the result is the same regardless of the number of threads.
+//
+// The slices are processed in parallel. Each slice first gathers the lights overlapping its
+// depth range and then tests them against the AABB of each of its tiles 4 at a time (SSE2).
+//
+// Nothing here touches opengl so it can be used and tested without a context.
+
+#include "parallel.h"
+#include "engine_types.h"
+#include "lib/allocator_malloc.h"
+
+typedef struct Light_Cluster_Params {
+    i32 tiles_x;
+    i32 tiles_y;
+    i32 slices;
+    f32 fov; //vertical, in radians
+    f32 aspect_ratio; //width / height
+    f32 near;
+    f32 far;
+    u32 _;
+} Light_Cluster_Params;
+
+//Spheres of influence of lights in view space (looking down -z) stored as separate arrays
+// of each component. All arrays have count items.
+typedef struct Light_Cluster_Lights {
+    const f32* x;
+    const f32* y;
+    const f32* z;
+    const f32* radius;
+    isize count;
+} Light_Cluster_Lights;
+
+typedef struct Light_Cluster_Range {
+    u32 offset;
+    u32 count;
+} Light_Cluster_Range;
+
+typedef Array(Light_Cluster_Range) Light_Cluster_Range_Array;
+typedef Array(u32) Light_Cluster_Index_Array;
+
+typedef struct Light_Cluster_Slice {
+    Light_Cluster_Index_Array indices;
+    Light_Cluster_Index_Array candidates;
+    Array(f32) candidate_spheres; //x, y, z, radius arrays of candidates.len each
+    u8 _[64]; //no false sharing
+} Light_Cluster_Slice;
+
+typedef Array(Light_Cluster_Slice) Light_Cluster_Slice_Array;
+
+typedef struct Light_Clusters {
+    Light_Cluster_Params params;
+    Light_Cluster_Range_Array ranges; //of cluster x + tiles_x*(y + tiles_y*slice)
+    Light_Cluster_Index_Array indices;
+    Light_Cluster_Slice_Array slices;
+    Allocator* allocator;
+} Light_Clusters;
+
+EXTERNAL void light_clusters_init(Light_Clusters* clusters, Allocator* allocator);
+EXTERNAL void light_clusters_deinit(Light_Clusters* clusters);
+
+//Assigns the lights to clusters of the frustum given by params.
+EXTERNAL void light_clusters_build(Light_Clusters* clusters, Light_Cluster_Params params, Light_Cluster_Lights lights);
+
+//Returns the view space bounds of the cluster.
+EXTERNAL AABB light_cluster_bounds(Light_Cluster_Params params, i32 x, i32 y, i32 slice);
+//Returns the slice containing the view space depth (distance along -z).
+EXTERNAL i32 light_cluster_slice_of_depth(Light_Cluster_Params params, f32 depth);
+EXTERNAL bool light_cluster_sphere_intersects(AABB bounds, f32 x, f32 y, f32 z, f32 radius);
+
+#endif
+
+#if (defined(LIB_ALL_IMPL) || defined(LIB_LIGHT_CLUSTER_IMPL)) && !defined(LIB_LIGHT_CLUSTER_HAS_IMPL)
+#define LIB_LIGHT_CLUSTER_HAS_IMPL
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define LIGHT_CLUSTER_SSE2
+    #include <emmintrin.h>
+#endif
+
+#include <math.h>
+
+EXTERNAL void light_clusters_init(Light_Clusters* clusters, Allocator* allocator)
+{
+    memset(clusters, 0, sizeof *clusters);
+    clusters->allocator = allocator;
+    array_init(&clusters->ranges, allocator);
+    array_init(&clusters->indices, allocator);
+    array_init(&clusters->slices, allocator);
+}
+
+EXTERNAL void light_clusters_deinit(Light_Clusters* clusters)
+{
+    for(isize i = 0; i < clusters->slices.len; i++)
+    {
+        Light_Cluster_Slice* slice = &clusters->slices.data[i];
+        array_deinit(&slice->indices);
+        array_deinit(&slice->candidates);
+        array_deinit(&slice->candidate_spheres);
+    }
+
+    array_deinit(&clusters->ranges);
+    array_deinit(&clusters->indices);
+    array_deinit(&clusters->slices);
+    memset(clusters, 0, sizeof *clusters);
+}
+
+INTERNAL f32 _light_cluster_slice_depth(Light_Cluster_Params params, i32 slice)
+{
+    return params.near * powf(params.far / params.near, (f32) slice / (f32) params.slices);
+}
+
+EXTERNAL i32 light_cluster_slice_of_depth(Light_Cluster_Params params, f32 depth)
+{
+    f32 slice = logf(depth / params.near) / logf(params.far / params.near) * (f32) params.slices;
+    return (i32) CLAMP(slice, 0.0f, (f32) params.slices - 1);
+}
+
+EXTERNAL AABB light_cluster_bounds(Light_Cluster_Params params, i32 x, i32 y, i32 slice)
+{
+    f32 near = _light_cluster_slice_depth(params, slice);
+    f32 far = _light_cluster_slice_depth(params, slice + 1);
+    f32 tan_y = tanf(params.fov / 2);
+    f32 tan_x = tan_y * params.aspect_ratio;
+
+    //The tile in normalized device coordinates. Scaled by depth gives the view space extent.
+    f32 x0 = -1 + 2*(f32) x / (f32) params.tiles_x;
+    f32 x1 = -1 + 2*(f32) (x + 1) / (f32) params.tiles_x;
+    f32 y0 = -1 + 2*(f32) y / (f32) params.tiles_y;
+    f32 y1 = -1 + 2*(f32) (y + 1) / (f32) params.tiles_y;
+
+    AABB bounds = {0};
+    bounds.min.x = MIN(x0*near, x0*far) * tan_x;
+    bounds.max.x = MAX(x1*near, x1*far) * tan_x;
+    bounds.min.y = MIN(y0*near, y0*far) * tan_y;
+    bounds.max.y = MAX(y1*near, y1*far) * tan_y;
+    bounds.min.z = -far;
+    bounds.max.z = -near;
+    return bounds;
+}
+
+EXTERNAL bool light_cluster_sphere_intersects(AABB bounds, f32 x, f32 y, f32 z, f32 radius)
+{
+    f32 dx = MAX(MAX(bounds.min.x - x, x - bounds.max.x), 0);
+    f32 dy = MAX(MAX(bounds.min.y - y, y - bounds.max.y), 0);
+    f32 dz = MAX(MAX(bounds.min.z - z, z - bounds.max.z), 0);
+    return dx*dx + dy*dy + dz*dz <= radius*radius;
+}
+
+typedef struct _Light_Cluster_Context {
+    Light_Clusters* clusters;
+    Light_Cluster_Lights lights;
+} _Light_Cluster_Context;
+
+INTERNAL void _light_cluster_build_slice(Light_Clusters* clusters, Light_Cluster_Lights lights, i32 slice_i)
+{
+    Light_Cluster_Params params = clusters->params;
+    Light_Cluster_Slice* slice = &clusters->slices.data[slice_i];
+    array_clear(&slice->indices);
+    array_clear(&slice->candidates);
+
+    //Only the lights overlapping the depth range of the slice can touch any of its clusters
+    f32 near = _light_cluster_slice_depth(params, slice_i);
+    f32 far = _light_cluster_slice_depth(params, slice_i + 1);
+    for(isize i = 0; i < lights.count; i++)
+    {
+        f32 depth = -lights.z[i];
+        if(depth + lights.radius[i] >= near && depth - lights.radius[i] <= far)
+            array_push(&slice->candidates, (u32) i);
+    }
+
+    isize count = slice->candidates.len;
+    array_resize_for_overwrite(&slice->candidate_spheres, 4*count);
+    f32* xs = slice->candidate_spheres.data;
+    f32* ys = xs + count;
+    f32* zs = ys + count;
+    f32* rs = zs + count;
+    for(isize i = 0; i < count; i++)
+    {
+        u32 light = slice->candidates.data[i];
+        xs[i] = lights.x[light];
+        ys[i] = lights.y[light];
+        zs[i] = lights.z[light];
+        rs[i] = lights.radius[light];
+    }
+
+    for(i32 y = 0; y < params.tiles_y; y++)
+        for(i32 x = 0; x < params.tiles_x; x++)
+        {
+            AABB bounds = light_cluster_bounds(params, x, y, slice_i);
+            isize cluster = x + params.tiles_x*(y + (isize) params.tiles_y*slice_i);
+            Light_Cluster_Range* range = &clusters->ranges.data[cluster];
+            range->offset = (u32) slice->indices.len;
+
+            isize i = 0;
+            #if defined(LIGHT_CLUSTER_SSE2)
+            {
+                __m128 min_x = _mm_set1_ps(bounds.min.x), max_x = _mm_set1_ps(bounds.max.x);
+                __m128 min_y = _mm_set1_ps(bounds.min.y), max_y = _mm_set1_ps(bounds.max.y);
+                __m128 min_z = _mm_set1_ps(bounds.min.z), max_z = _mm_set1_ps(bounds.max.z);
+                __m128 zero = _mm_setzero_ps();
+                for(; i + 4 <= count; i += 4)
+                {
+                    __m128 cx = _mm_loadu_ps(xs + i);
+                    __m128 cy = _mm_loadu_ps(ys + i);
+                    __m128 cz = _mm_loadu_ps(zs + i);
+                    __m128 r = _mm_loadu_ps(rs + i);
+
+                    __m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(min_x, cx), _mm_sub_ps(cx, max_x)), zero);
+                    __m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(min_y, cy), _mm_sub_ps(cy, max_y)), zero);
+                    __m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(min_z, cz), _mm_sub_ps(cz, max_z)), zero);
+                    __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+                    u32 hits = (u32) _mm_movemask_ps(_mm_cmple_ps(distance, _mm_mul_ps(r, r)));
+
+                    for(isize k = 0; k < 4; k++)
+                        if(hits & (1u << k))
+                            array_push(&slice->indices, slice->candidates.data[i + k]);
+                }
+            }
+            #endif
+
+            for(; i < count; i++)
+                if(light_cluster_sphere_intersects(bounds, xs[i], ys[i], zs[i], rs[i]))
+                    array_push(&slice->indices, slice->candidates.data[i]);
+
+            range->count = (u32) slice->indices.len - range->offset;
+        }
+}
+
+INTERNAL void _light_cluster_build_slices(void* context, isize from, isize to, isize thread_index)
+{
+    (void) thread_index;
+    _Light_Cluster_Context* c = (_Light_Cluster_Context*) context;
+    for(isize i = from; i < to; i++)
+        _light_cluster_build_slice(c->clusters, c->lights, (i32) i);
+}
+
+EXTERNAL void light_clusters_build(Light_Clusters* clusters, Light_Cluster_Params params, Light_Cluster_Lights lights)
+{
+    PROFILE_SCOPE()
+    {
+        ASSERT(params.tiles_x > 0 && params.tiles_y > 0 && params.slices > 0);
+        ASSERT(0 < params.near && params.near < params.far);
+
+        clusters->params = params;
+        isize cluster_count = (isize) params.tiles_x * params.tiles_y * params.slices;
+        array_resize_for_overwrite(&clusters->ranges, cluster_count);
+
+        //Slices are built on other threads so they must use a thread safe allocator
+        isize old_slice_count = clusters->slices.len;
+        array_resize(&clusters->slices, MAX(params.slices, old_slice_count));
+        for(isize i = old_slice_count; i < clusters->slices.len; i++)
+        {
+            Light_Cluster_Slice* slice = &clusters->slices.data[i];
+            array_init(&slice->indices, allocator_get_malloc());
+            array_init(&slice->candidates, allocator_get_malloc());
+            array_init(&slice->candidate_spheres, allocator_get_malloc());
+        }
+
+        _Light_Cluster_Context context = {clusters, lights};
+        parallel_for(params.slices, 1, _light_cluster_build_slices, &context);
+
+        //Concatenate the slices in order
+        isize total = 0;
+        for(isize i = 0; i < params.slices; i++)
+            total += clusters->slices.data[i].indices.len;
+
+        array_resize_for_overwrite(&clusters->indices, total);
+        isize offset = 0;
+        isize clusters_per_slice = (isize) params.tiles_x * params.tiles_y;
+        for(isize i = 0; i < params.slices; i++)
+        {
+            Light_Cluster_Slice* slice = &clusters->slices.data[i];
+            memcpy(clusters->indices.data + offset, slice->indices.data, (size_t) slice->indices.len * sizeof(u32));
+            for(isize k = 0; k < clusters_per_slice; k++)
+                clusters->ranges.data[i*clusters_per_slice + k].offset += (u32) offset;
+
+            offset += slice->indices.len;
+        }
+    }
+}
+
+#endif
@@ -45,6 +45,19 @@
 #include "gl_utils/gl_debug_output.h"
 #include "shapes.h"
 #include "format_obj.h"
+#include "parallel.h"
+#include "vertex_pack.h"
+#include "radix_sort.h"
+#include "frustum_cull.h"
+#include "bvh.h"
+#include "buffer_diff.h"
+#include "upload_ring.h"
+#include "light_cluster.h"
+#include "mesh_lod.h"
+#include "atlas_pack.h"
+#include "texture_stream.h"
+#include "mip_chain.h"
+#include "texture_compress.h"
 #include "image_loader.h"
 #include "todo.h"
 #include "asset_loading.h"
@@ -295,6 +308,7 @@ int main()
 {
     platform_init();
     arena_stack_init(scratch_arena_stack(), "scratch arena", 0, 0, 0);
+    parallel_init(-1);
 
     //TODO();
     //TEST(profile_init(PROFILE_NATIVE_OUTPUT));
@@ -552,9 +566,43 @@ typedef struct GL_Texture_Array {
     GLuint min_filter; //defaults to GL_LINEAR
     GLuint wrap_s;     //defaults to GL_CLAMP_TO_EDGE
     GLuint wrap_t;     //defaults to GL_CLAMP_TO_EDGE
-    
+
+    //If not TEXTURE_BLOCK_NONE gl_format must be set to gl_compressed_format(block_format). 
+    //The mips are then uploaded as images of blocks (see texture_compress.h).
+    Texture_Block_Format block_format;
 } GL_Texture_Array;
 
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+    #define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+    #define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_RED_RGTC1
+    #define GL_COMPRESSED_RED_RGTC1 0x8DBB
+#endif
+#ifndef GL_COMPRESSED_RG_RGTC2
+    #define GL_COMPRESSED_RG_RGTC2 0x8DBD
+#endif
+#ifndef GL_COMPRESSED_RGBA_BPTC_UNORM
+    #define GL_COMPRESSED_RGBA_BPTC_UNORM 0x8E8C
+#endif
+
+//Compressed textures are sampled as unorm the same as the U8 textures they replace (no sRGB). 
+//BC1 is the S3TC extension but is supported practically everywhere, the rest is core since 4.2.
+GLenum gl_compressed_format(Texture_Block_Format format)
+{
+    switch(format)
+    {
+        case TEXTURE_BLOCK_BC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        case TEXTURE_BLOCK_BC3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        case TEXTURE_BLOCK_BC4: return GL_COMPRESSED_RED_RGTC1;
+        case TEXTURE_BLOCK_BC5: return GL_COMPRESSED_RG_RGTC2;
+        case TEXTURE_BLOCK_BC7: return GL_COMPRESSED_RGBA_BPTC_UNORM;
+        default: return 0;
+    }
+}
+
 void gl_texture_array_deinit(GL_Texture_Array* array)
 {
     glDeleteTextures(1, &array->handle);
@@ -624,9 +672,10 @@ bool gl_texture_array_init(GL_Texture_Array* partially_filled, void* data_or_nul
     return true;
 }
 
+//Compressed arrays cannot generate their mips on the gpu and are left as they are.
 void gl_texture_array_generate_mips(GL_Texture_Array* array)
 {
-    if(array->mip_level_count > 0)
+    if(array->mip_level_count > 0 && array->block_format == TEXTURE_BLOCK_NONE)
     {
         glBindTexture(GL_TEXTURE_2D_ARRAY, array->handle);
         glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
@@ -649,69 +698,192 @@ void gl_texture_array_set(GL_Texture_Array* array, i32 layer, i32 x, i32 y, Imag
         glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
 }
 
+//Uploads image into the given mip level of the layer at x, y (in that mips pixels).
+//If the array is compressed image is an image of blocks and x, y must be multiples of 4.
+void gl_texture_array_set_mip(GL_Texture_Array* array, i32 layer, i32 mip, i32 x, i32 y, Image image)
+{
+    ASSERT_BOUNDS(layer, array->layer_count);
+    ASSERT_BOUNDS(mip, array->mip_level_count);
+    if(image.width > 0 && image.height > 0)
+    {
+        glBindTexture(GL_TEXTURE_2D_ARRAY, array->handle);
+        if(array->block_format != TEXTURE_BLOCK_NONE)
+        {
+            //The blocks past the edge of mips smaller than a block are only partially used
+            ASSERT(x % 4 == 0 && y % 4 == 0 && image.pixel_size == texture_block_size(array->block_format));
+            i32 width = MIN(image.width*4, MAX(array->width >> mip, 1) - x);
+            i32 height = MIN(image.height*4, MAX(array->height >> mip, 1) - y);
+            GLsizei size = (GLsizei) (image_byte_stride(image) * image.height);
+            glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, mip, x, y, layer, width, height, 1, array->gl_format.internal_format, size, image.pixels);
+        }
+        else
+        {
+            GL_Pixel_Format format = gl_pixel_format_from_pixel_type_size(image.type, image.pixel_size);
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, mip, x, y, layer, image.width, image.height, 1, format.access_format, format.channel_type, image.pixels);
+        }
+    }
+}
+
+//Returns a copy of image of size width x height allocated from alloc. 
+//The right and bottom remainder is filled by extending the last pixels of the image.
+Image render_image_extend(Allocator* alloc, Subimage image, i32 width, i32 height)
+{
+    ASSERT(image.width > 0 && image.height > 0 && image.width <= width && image.height <= height);
+    Image out = {0};
+    image_init_sized(&out, alloc, width, height, image.pixel_size, image.type, NULL);
+    image_copy(&out, image, 0, 0);
+    
+    isize stride = image_byte_stride(out);
+    i32 pixel_size = out.pixel_size;
+
+    //Extend sideways
+    for(i32 y = 0; y < image.height; y++)
+    {
+        u8* curr_row = out.pixels + stride*y;
+        u8* last_pixel = curr_row + pixel_size*(image.width - 1);
+
+        //memtile(curr_row + pixel_size*image.width, (width - image.width)*pixel_size, color, pixel_size);
+        memtile(curr_row + pixel_size*image.width, (width - image.width)*pixel_size, last_pixel, pixel_size);
+    }
+
+    //Extend downwards
+    u8* last_row = out.pixels + stride*(image.height - 1);
+    for(i32 y = image.height; y < out.height; y++)
+    {
+        u8* curr_row = out.pixels + stride*y;
+        memmove(curr_row, last_row, stride);
+    }
+
+    return out;
+}
+
+//A mip chain of a width x height image as it is uploaded. 
+//If block_format is not TEXTURE_BLOCK_NONE the mips are images of blocks (see texture_compress.h).
+typedef struct Render_Texture_Mips {
+    const Subimage* mips;
+    i32 mip_count;
+    Texture_Block_Format block_format;
+    i32 width;
+    i32 height;
+} Render_Texture_Mips;
+
+Render_Texture_Mips render_texture_mips_make(const Subimage* mips, i32 mip_count)
+{
+    Render_Texture_Mips out = {mips, mip_count, TEXTURE_BLOCK_NONE, mips[0].width, mips[0].height};
+    return out;
+}
+
+//Extends each mip of the chain from first_mip on to the size of the same mip of the layer. 
+//Mips the chain is missing are extended from its last one so it should go all the way down to 1x1.
+//out has array->mip_level_count images of which the ones before first_mip are left untouched.
+void render_image_extend_mips(Allocator* alloc, Image* out, const GL_Texture_Array* array, Render_Texture_Mips chain, i32 first_mip)
+{
+    ASSERT(chain.mip_count > 0 && array->mip_level_count <= MIP_CHAIN_MAX_MIPS);
+    ASSERT(chain.block_format == array->block_format);
+    for(i32 mip = first_mip; mip < array->mip_level_count; mip++)
+    {
+        i32 from_mip = MIN(mip, chain.mip_count - 1);
+        Subimage from = chain.mips[from_mip];
+        i32 mip_width = MAX(array->width >> mip, 1);
+        i32 mip_height = MAX(array->height >> mip, 1);
+        if(chain.block_format != TEXTURE_BLOCK_NONE)
+            out[mip] = texture_blocks_extend(alloc, from, chain.block_format, MAX(chain.width >> from_mip, 1), MAX(chain.height >> from_mip, 1), mip_width, mip_height);
+        else
+            out[mip] = render_image_extend(alloc, from, mip_width, mip_height);
+    }
+}
+
 //Fills txture array layer in such a way that mipmapping wont effect the edges of the image. 
 //The image needs to be smaller than the texture array.
-//That is the corner pixels will be expanded to fill the remianing size around the image.
+//That is the corner pixels will be expanded to fill the remianing size around each mip.
 //If the image is exactly the size of the array jsut copies it over.
-bool gl_texture_array_fill_layer(GL_Texture_Array* array, i32 layer, Image image, bool regenerate_mips)
+//The mips are precomputed on the cpu (see mip_chain.h) and only mips from first_mip onwards are uploaded. 
+bool gl_texture_array_fill_layer(GL_Texture_Array* array, i32 layer, Render_Texture_Mips chain, i32 first_mip)
 {
     bool state = true;
     ASSERT_BOUNDS(layer, array->layer_count);
+    ASSERT(chain.mip_count > 0);
     
-    if(image.width > array->width || image.height > array->height)
+    if(chain.width > array->width || chain.height > array->height)
     {
         ASSERT(false);
         LOG_ERROR("render", "invalid texture size filled to array");
         state = false;
     }
-    else if(image.width <= 0 || image.height <= 0)
-    {
-        if(regenerate_mips)
-            gl_texture_array_generate_mips(array);
-    }
-    else if(image.width == array->width && image.height == array->height)
-    {
-        gl_texture_array_set(array, layer, 0, 0, image, regenerate_mips);
-    }
-    else
+    else if(chain.width > 0 && chain.height > 0)
     {
-        LOG_WARN("render", "image of size %d x %d doesnt fit exactly. Resorting back to extending it.", image.width, image.height);
+        if(chain.width != array->width || chain.height != array->height)
+            LOG_WARN("render", "image of size %d x %d doesnt fit exactly. Resorting back to extending it.", chain.width, chain.height);
 
         Arena_Frame arena = scratch_arena_frame_acquire();
-        Image temp_storage = {0};
-        image_init_sized(&temp_storage, arena.alloc, array->width, array->height, image.pixel_size, image.type, NULL);
+        Image extended[MIP_CHAIN_MAX_MIPS] = {0};
+        render_image_extend_mips(arena.alloc, extended, array, chain, first_mip);
+        for(i32 mip = first_mip; mip < array->mip_level_count; mip++)
+            gl_texture_array_set_mip(array, layer, mip, 0, 0, extended[mip]);
+        arena_frame_release(&arena);
+    }
 
-        ASSERT(image.height > 0 && image.width > 0);
-        image_copy(&temp_storage, subimage_of(image), 0, 0);
-        
-        isize stride = image_byte_stride(temp_storage);
-        i32 pixel_size = temp_storage.pixel_size;
+    return state;
+}
 
-        //Extend sideways
-        for(i32 y = 0; y < image.height; y++)
-        {
-            u8* curr_row = temp_storage.pixels + stride*y;
-            u8* last_pixel = curr_row + pixel_size*(image.width - 1);
+//Fills a rectangle of a texture array layer with the image surrounded by padding pixels on all sides.
+//The padding is filled by extending the edges of the image so that filtering and mips 
+// dont pull in the neighbouring images. The padding must lie within the layer.
+//The mips are generated with options from the padded rectangle alone and placed at its position scaled down. 
+//Past log2(padding) mips the rectangles start to bleed into each other, same as with glGenerateMipmap.
+void gl_texture_array_fill_rect(GL_Texture_Array* array, i32 layer, i32 x, i32 y, Subimage image, i32 padding, const Mip_Options* options)
+{
+    ASSERT_BOUNDS(layer, array->layer_count);
+    ASSERT(x - padding >= 0 && y - padding >= 0 && x + image.width + padding <= array->width && y + image.height + padding <= array->height);
+    if(image.width <= 0 || image.height <= 0)
+        return;
 
-            //memtile(curr_row + pixel_size*image.width, (array->width - image.width)*pixel_size, color, pixel_size);
-            memtile(curr_row + pixel_size*image.width, (array->width - image.width)*pixel_size, last_pixel, pixel_size);
-        }
+    Arena_Frame arena = scratch_arena_frame_acquire();
+    Image temp_storage = {0};
+    image_init_sized(&temp_storage, arena.alloc, image.width + 2*padding, image.height + 2*padding, image.pixel_size, image.type, NULL);
+    image_copy(&temp_storage, image, padding, padding);
+    
+    isize stride = image_byte_stride(temp_storage);
+    i32 pixel_size = temp_storage.pixel_size;
 
-        //Extend downwards
-        u8* last_row = temp_storage.pixels + stride*(image.height - 1);
-        for(i32 y = image.height; y < temp_storage.height; y++)
-        {
-            u8* curr_row = temp_storage.pixels + stride*y;
-            memmove(curr_row, last_row, stride);
-        }
-        
-        //memtile(temp_storage->pixels, image_all_pixels_size(*temp_storage), color, sizeof(color));
-        gl_texture_array_set(array, layer, 0, 0, temp_storage, regenerate_mips);
+    //Extend sideways
+    for(i32 y_i = padding; y_i < padding + image.height; y_i++)
+    {
+        u8* curr_row = temp_storage.pixels + stride*y_i;
+        u8* first_pixel = curr_row + pixel_size*padding;
+        u8* last_pixel = curr_row + pixel_size*(padding + image.width - 1);
+        memtile(curr_row, padding*pixel_size, first_pixel, pixel_size);
+        memtile(last_pixel + pixel_size, padding*pixel_size, last_pixel, pixel_size);
+    }
 
-        arena_frame_release(&arena);
+    //Extend up and down
+    u8* first_row = temp_storage.pixels + stride*padding;
+    u8* last_row = temp_storage.pixels + stride*(padding + image.height - 1);
+    for(i32 y_i = 0; y_i < padding; y_i++)
+    {
+        memmove(temp_storage.pixels + stride*y_i, first_row, stride);
+        memmove(temp_storage.pixels + stride*(padding + image.height + y_i), last_row, stride);
     }
 
-    return state;
+    Image mips[MIP_CHAIN_MAX_MIPS] = {0};
+    i32 mip_count = MIN(array->mip_level_count, MIP_CHAIN_MAX_MIPS);
+    mip_chain_generate(mips, mip_count, subimage_of(temp_storage), options, arena.alloc);
+    for(i32 mip = 0; mip < mip_count; mip++)
+    {
+        i32 mip_x = (x - padding) >> mip;
+        i32 mip_y = (y - padding) >> mip;
+        i32 mip_width = MAX(array->width >> mip, 1);
+        i32 mip_height = MAX(array->height >> mip, 1);
+        Subimage visible = subimage_of(mips[mip]);
+        visible.width = MIN(visible.width, mip_width - mip_x);
+        visible.height = MIN(visible.height, mip_height - mip_y);
+
+        Image clipped = {0};
+        image_init_sized(&clipped, arena.alloc, visible.width, visible.height, mips[mip].pixel_size, mips[mip].type, NULL);
+        image_copy(&clipped, visible, 0, 0);
+        gl_texture_array_set_mip(array, layer, mip, mip_x, mip_y, clipped);
+    }
+    arena_frame_release(&arena);
 }
 
 #include "name.h"
@@ -721,11 +893,18 @@ typedef struct Render_Texture_Layer {
     i32 resolution_index;
 } Render_Texture_Layer;
 
+//Where within its layer the texture is. uv_in_layer = uv*scale + offset
+typedef struct Render_Texture_Uv {
+    Vec2 offset;
+    Vec2 scale;
+} Render_Texture_Uv;
+
 typedef struct Render_Texture_Layer_Info {
-    Name name;
     i32 used_width;
     i32 used_height;
     b64 is_used;
+    i32 atlas_index; //index + 1 into Render_Texture_Manager atlases if the layer is shared by many small textures
+    u32 _;
 } Render_Texture_Layer_Info;
 
 typedef Array(Render_Texture_Layer_Info) Render_Texture_Layer_Info_Array;
@@ -733,6 +912,8 @@ typedef Array(Render_Texture_Layer_Info) Render_Texture_Layer_Info_Array;
 typedef struct Render_Texture_Resolution {
     GL_Texture_Array array;
     Render_Texture_Layer_Info_Array layers;
+    Array(u64) free_layers; //bit set for each layer that is not used
+    isize first_free_word; //all words of free_layers before this one are zero
     i32 used_layers;
     i32 grow_by;
     
@@ -740,14 +921,49 @@ typedef struct Render_Texture_Resolution {
 
 typedef Array(Render_Texture_Resolution) Render_Texture_Resolution_Array;
 
+//Textures at most RENDER_TEXTURE_ATLAS_MAX_DIM in size are packed together into layers
+// of RENDER_TEXTURE_ATLAS_SIZE instead of each taking a whole layer. See atlas_pack.h
+#define RENDER_TEXTURE_ATLAS_SIZE 512
+#define RENDER_TEXTURE_ATLAS_MAX_DIM 128
+#define RENDER_TEXTURE_ATLAS_PADDING 4
+
+typedef struct Render_Texture_Atlas {
+    Render_Texture_Layer layer;
+    Atlas_Packer packer;
+} Render_Texture_Atlas;
+
+typedef Array(Render_Texture_Atlas) Render_Texture_Atlas_Array;
+
+//The resolutions an image of a size class and format might fit into from the best fit 
+// (least wasted space) to the worst. Computed once for each distinct size class and format.
+//The size class is the power of two below each dimension so the list can contain resolutions
+// too small for a particular image. Those are skipped when searching.
+typedef struct Render_Texture_Candidates {
+    i32 max_dim_log2;
+    i32 min_dim_log2;
+    i32 type;
+    i32 channel_count;
+    i32 block_format;
+    i32 from; //into Render_Texture_Manager candidates
+    i32 count;
+} Render_Texture_Candidates;
+
+typedef Array(Render_Texture_Candidates) Render_Texture_Candidates_Array;
+
 //@TODO: what to do with outliers?
 //@TODO: what to do with different formats?
 //@TODO: rework images so that they have capacity! Add rehsape!
 
 typedef struct Render_Texture_Manager {
     Render_Texture_Resolution_Array resolutions;
+    Render_Texture_Atlas_Array atlases;
     Allocator* allocator;
 
+    //(size class, type, channel_count, block_format) -> index into candidate_lists. Cleared when resolutions are added.
+    Hash candidate_hash;
+    Render_Texture_Candidates_Array candidate_lists;
+    i32_Array candidates; //resolution indices
+
     isize memory_used;
     isize memory_budget;
 } Render_Texture_Manager;
@@ -769,6 +985,8 @@ i32 int_log2_upper_bound(i32 val)
     return upper;
 }
 
+//Regenerates all mips from the first one on the gpu. Not needed normally since the textures
+// are uploaded with their mips. Must not be used with streamed textures whose first mip is not resident.
 void render_texture_manager_generate_mips(Render_Texture_Manager* manager)
 {
     for(isize i = 0; i < manager->resolutions.len; i++)
@@ -778,17 +996,159 @@ void render_texture_manager_generate_mips(Render_Texture_Manager* manager)
     }
 }
 
-isize render_texture_manager_add_resolution(Render_Texture_Manager* manager, i32 width, i32 height, i32 layers, i32 grow_by, Pixel_Type type, i32 channel_count)
+//Adds an already created resolution with all of its layers free. Returns its index.
+isize render_texture_manager_push_resolution(Render_Texture_Manager* manager, Render_Texture_Resolution resolution)
+{
+    i32 layer_count = (i32) resolution.layers.len;
+    array_init(&resolution.free_layers, manager->allocator);
+    array_resize(&resolution.free_layers, (layer_count + 63) / 64);
+    for(i32 i = 0; i < layer_count; i++)
+        resolution.free_layers.data[i / 64] |= (u64) 1 << (i % 64);
+    resolution.used_layers = 0;
+    resolution.first_free_word = 0;
+
+    isize out = manager->resolutions.len;
+    array_push(&manager->resolutions, resolution);
+
+    //The best fits might have changed
+    hash_deinit(&manager->candidate_hash);
+    hash_init(&manager->candidate_hash, manager->allocator);
+    array_clear(&manager->candidate_lists);
+    array_clear(&manager->candidates);
+    return out;
+}
+
+INTERNAL bool _render_texture_fits(const GL_Texture_Array* array, i32 width, i32 height)
+{
+    //@TODO: rotate the image if it fits only rotated
+    i32 max_layer_dim = MAX(array->width, array->height);
+    i32 min_layer_dim = MIN(array->width, array->height);
+    return max_layer_dim >= MAX(width, height) && min_layer_dim >= MIN(width, height);
+}
+
+INTERNAL isize _render_texture_waste(const GL_Texture_Array* array, i32 width, i32 height, i32 channel_count)
+{
+    //If number of channels dont match we effectively also waste all the other channels on that layer
+    isize layer_size = (isize) array->width * array->height;
+    isize size_diff = layer_size - (isize) width * height;
+    isize channel_diff = array->channel_count - channel_count;
+    return size_diff + channel_diff*layer_size;
+}
+
+INTERNAL Render_Texture_Candidates _render_texture_manager_candidates(Render_Texture_Manager* manager, i32 width, i32 height, Pixel_Type type, i32 channel_count, Texture_Block_Format block_format)
+{
+    i32 max_dim_log2 = int_log2_lower_bound(MAX(width, height));
+    i32 min_dim_log2 = int_log2_lower_bound(MIN(width, height));
+    u64 key = hash64_mix(((u64) (u32) max_dim_log2 << 32) | (u32) min_dim_log2, ((u64) (u32) type << 32) | (u32) channel_count);
+    key = hash64_mix(key, (u64) block_format);
+    for(Hash_Found found = hash_find(manager->candidate_hash, key); found.index != -1; found = hash_find_next(manager->candidate_hash, found))
+    {
+        Render_Texture_Candidates list = manager->candidate_lists.data[found.value];
+        if(list.max_dim_log2 == max_dim_log2 && list.min_dim_log2 == min_dim_log2 && list.type == (i32) type 
+            && list.channel_count == channel_count && list.block_format == (i32) block_format)
+            return list;
+    }
+
+    //The resolution must be:
+    // 1) big enough for the smallest image of the size class
+    // 2) the pixel format is the same and the number of channels is big enough
+    // 3) the block format is the same. Compressed data cannot go anywhere else.
+    //The area of the image is subtracted from the waste of every resolution alike 
+    // so the order is the same for all images of the size class.
+    Render_Texture_Candidates list = {max_dim_log2, min_dim_log2, (i32) type, channel_count, (i32) block_format, (i32) manager->candidates.len, 0};
+    for(isize i = 0; i < manager->resolutions.len; i++)
+    {
+        GL_Texture_Array* array = &manager->resolutions.data[i].array;
+        bool image_fits = _render_texture_fits(array, 1 << max_dim_log2, 1 << min_dim_log2);
+        bool format_fits = array->type == type && array->channel_count >= channel_count && array->block_format == block_format;
+        if(image_fits == false || format_fits == false)
+            continue;
+
+        //Insertion sort by waste. There are only a few resolutions.
+        isize waste = _render_texture_waste(array, 0, 0, channel_count);
+        array_push(&manager->candidates, (i32) i);
+        i32* candidates = manager->candidates.data + list.from;
+        i32 at = list.count++;
+        for(; at > 0 && _render_texture_waste(&manager->resolutions.data[candidates[at - 1]].array, 0, 0, channel_count) > waste; at--)
+            candidates[at] = candidates[at - 1];
+        candidates[at] = (i32) i;
+    }
+
+    hash_insert(&manager->candidate_hash, key, (u64) manager->candidate_lists.len);
+    array_push(&manager->candidate_lists, list);
+    return list;
+}
+
+//Returns the first layer that is used (or not used) or -1 if there is none. 
+INTERNAL i32 _render_texture_resolution_first_layer(Render_Texture_Resolution* resolution, bool used)
+{
+    //Skip the words known to be full so that filling up a resolution is not quadratic
+    isize from = 0;
+    if(used == false)
+    {
+        while(resolution->first_free_word < resolution->free_layers.len && resolution->free_layers.data[resolution->first_free_word] == 0)
+            resolution->first_free_word += 1;
+        from = resolution->first_free_word;
+    }
+
+    i32 layer_count = (i32) resolution->layers.len;
+    for(isize w = from; w < resolution->free_layers.len; w++)
+    {
+        u64 word = resolution->free_layers.data[w];
+        if(used)
+        {
+            word = ~word;
+            i32 valid = layer_count - (i32) w*64;
+            if(valid < 64)
+                word &= ((u64) 1 << valid) - 1;
+        }
+
+        if(word != 0)
+            return (i32) w*64 + platform_find_first_set_bit64(word);
+    }
+
+    return -1;
+}
+
+INTERNAL void _render_texture_resolution_set_used(Render_Texture_Resolution* resolution, i32 layer, bool used)
+{
+    ASSERT_BOUNDS(layer, resolution->layers.len);
+    Render_Texture_Layer_Info* info = &resolution->layers.data[layer];
+    ASSERT(info->is_used != used);
+
+    u64 bit = (u64) 1 << (layer % 64);
+    if(used)
+        resolution->free_layers.data[layer / 64] &= ~bit;
+    else
+    {
+        resolution->free_layers.data[layer / 64] |= bit;
+        resolution->first_free_word = MIN(resolution->first_free_word, layer / 64);
+        memset(info, 0, sizeof *info);
+    }
+    
+    info->is_used = used;
+    resolution->used_layers += used ? 1 : -1;
+}
+
+//Compressed resolutions (block_format not TEXTURE_BLOCK_NONE) take U8 type and the channel count of the block format.
+isize render_texture_manager_add_resolution(Render_Texture_Manager* manager, i32 width, i32 height, i32 layers, i32 grow_by, Pixel_Type type, i32 channel_count, Texture_Block_Format block_format)
 {
-    LOG_INFO("render", "adding texture resolution: " "%d x %d x %d : %s x %d", width, height, layers, pixel_type_name(type), channel_count);
+    LOG_INFO("render", "adding texture resolution: " "%d x %d x %d : %s x %d %s", width, height, layers, pixel_type_name(type), channel_count, texture_block_format_name(block_format));
     i32 max_dim = MAX(width, height);
     i32 log_2_resolution = int_log2_upper_bound(max_dim);
 
     Render_Texture_Resolution resolution = {0};
     resolution.array.mip_level_count = MAX(log_2_resolution - 1, 1);
-    resolution.array.gl_format = gl_pixel_format_from_pixel_type(type, channel_count);
     resolution.array.type = type;
     resolution.array.channel_count = channel_count;
+    resolution.array.block_format = block_format;
+    if(block_format != TEXTURE_BLOCK_NONE)
+    {
+        ASSERT(type == PIXEL_TYPE_U8 && channel_count == texture_block_channel_count(block_format));
+        resolution.array.gl_format.internal_format = gl_compressed_format(block_format);
+    }
+    else
+        resolution.array.gl_format = gl_pixel_format_from_pixel_type(type, channel_count);
     resolution.array.layer_count = layers;
     resolution.array.width = width;
     resolution.array.height = height;
@@ -797,6 +1157,8 @@ isize render_texture_manager_add_resolution(Render_Texture_Manager* manager, i32
     
     isize out = -1;
     isize needed_size = (isize) width * height * layers * channel_count * pixel_type_size(type);
+    if(block_format != TEXTURE_BLOCK_NONE)
+        needed_size = texture_blocks_size(block_format, width, height) * layers;
     if(manager->memory_used + needed_size > manager->memory_budget)
         LOG_ERROR(">render", "Out of texture memory! Using %s / %s (%lli%%)", format_bytes(manager->memory_used).data, format_bytes(manager->memory_budget).data, (lli) manager->memory_used * 100 / manager->memory_budget);
     else if(layers == 0 || width == 0 || height == 0)
@@ -810,8 +1172,7 @@ isize render_texture_manager_add_resolution(Render_Texture_Manager* manager, i32
         {
             array_init(&resolution.layers, manager->allocator);
             array_resize(&resolution.layers, layers);
-            out = manager->resolutions.len;
-            array_push(&manager->resolutions, resolution);
+            out = render_texture_manager_push_resolution(manager, resolution);
             manager->memory_used  += needed_size;
         }
         log_outdent();
@@ -842,6 +1203,10 @@ void render_texture_manager_init(Render_Texture_Manager* manager, Allocator* all
     manager->allocator = allocator;
     manager->memory_budget = memory_budget;
     array_init(&manager->resolutions, allocator);
+    array_init(&manager->atlases, allocator);
+    array_init(&manager->candidate_lists, allocator);
+    array_init(&manager->candidates, allocator);
+    hash_init(&manager->candidate_hash, allocator);
 }
 
 void render_texture_manager_add_default_resolutions(Render_Texture_Manager* manager, f64 fraction_of_remaining_memory_budget)
@@ -855,6 +1220,16 @@ void render_texture_manager_add_default_resolutions(Render_Texture_Manager* mana
         Pixel_Type pixel_type = PIXEL_TYPE_U8;
         i32 channel_counts[4] = {1, 2, 3, 0};
 
+        //Compressed maps need resolutions of their own (see texture_compress.h)
+        Texture_Block_Format block_formats[4] = {TEXTURE_BLOCK_NONE};
+        if(ASSET_COMPRESS_TEXTURES)
+        {
+            block_formats[0] = TEXTURE_BLOCK_BC4;
+            block_formats[1] = TEXTURE_BLOCK_BC5;
+            block_formats[2] = TEXTURE_COMPRESS_COLOR_BC7 ? TEXTURE_BLOCK_BC7 : TEXTURE_BLOCK_BC1;
+            block_formats[3] = TEXTURE_COMPRESS_COLOR_BC7 ? TEXTURE_BLOCK_NONE : TEXTURE_BLOCK_BC3;
+        }
+
         //These act like proportions rather than final counts because we still have the memory budget to worry about!
         i32 layer_counts[20] = {0};
         layer_counts[int_log2_lower_bound(32)] = 128;
@@ -878,7 +1253,12 @@ void render_texture_manager_add_default_resolutions(Render_Texture_Manager* mana
         for(isize i = 0; i < ARRAY_LEN(channel_counts); i++)
             combined_channel_count += channel_counts[i];
 
-        isize ideal_total_size = combined_channel_count * combined_layer_size * pixel_type_size(pixel_type);
+        //Blocks are 4x4 pixels
+        isize combined_block_size = 0;
+        for(isize i = 0; i < ARRAY_LEN(block_formats); i++)
+            combined_block_size += texture_block_size(block_formats[i]);
+
+        isize ideal_total_size = combined_channel_count * combined_layer_size * pixel_type_size(pixel_type) + combined_block_size * combined_layer_size / 16;
         isize desired_total_size = (isize) (remaining_budget * fraction_of_remaining_memory_budget);
     
         f64 scaling_factor = (f64) desired_total_size / (f64) ideal_total_size;
@@ -906,7 +1286,24 @@ void render_texture_manager_add_default_resolutions(Render_Texture_Manager* mana
                     combined_size += resolution_bytes_size;
             
 
-                    render_texture_manager_add_resolution(manager, size, size, scaled_layers, grow_by, PIXEL_TYPE_U8, channels);
+                    render_texture_manager_add_resolution(manager, size, size, scaled_layers, grow_by, PIXEL_TYPE_U8, channels, TEXTURE_BLOCK_NONE);
+                }
+            }
+        }
+
+        for(i32 j = 0; j < ARRAY_LEN(block_formats); j++)
+        {
+            for(i32 i = 0; i < ARRAY_LEN(layer_counts); i++)
+            {
+                i32 size = 1 << i;
+                Texture_Block_Format block_format = block_formats[j];
+                i32 layers = layer_counts[i];
+                i32 scaled_layers = (i32) ((f64) layers * scaling_factor);
+                if(layers && block_format != TEXTURE_BLOCK_NONE)
+                {
+                    i32 grow_by = layers / 8;
+                    combined_size += texture_blocks_size(block_format, size, size) * scaled_layers;
+                    render_texture_manager_add_resolution(manager, size, size, scaled_layers, grow_by, PIXEL_TYPE_U8, texture_block_channel_count(block_format), block_format);
                 }
             }
         }
@@ -923,88 +1320,38 @@ typedef enum Found_Type{
     FOUND_APPROXIMATE_BAD_FORMAT,
 } Found_Type;
 
-Render_Texture_Layer render_texture_manager_find(Render_Texture_Manager* manager, Found_Type* found_type_or_null, i32 width, i32 height, Pixel_Type type, i32 channel_count, bool used)
+Render_Texture_Layer render_texture_manager_find(Render_Texture_Manager* manager, Found_Type* found_type_or_null, i32 width, i32 height, Pixel_Type type, i32 channel_count, Texture_Block_Format block_format, bool used)
 {
     Render_Texture_Layer out = {0};
     PROFILE_SCOPE() 
     {
-        bool state = false;
-        i32 max_dim = MAX(width, height);
-        i32 min_dim = MIN(width, height);
-        isize needed_size = width * height;
-
         Found_Type found_type = NOT_FOUND;
-
-        if(max_dim > 0)
+        if(MAX(width, height) > 0)
         {
-            //Simple for loop to find a best fit in terms of space wasted 
-            // because this will not be called very often.
-            isize min_diff = INT64_MAX;
-            isize min_diff_index = -1;
-            for(isize i = 0; i < manager->resolutions.len; i++)
+            //The candidates are sorted from the best fit in terms of space wasted so we take the first
+            // one that has a layer for us. Only the first lookup of each size class does the full scan.
+            Render_Texture_Candidates list = _render_texture_manager_candidates(manager, width, height, type, channel_count, block_format);
+            for(i32 i = 0; i < list.count; i++)
             {
-                Render_Texture_Resolution* resolution = &manager->resolutions.data[i];
-                GL_Texture_Array* array = &resolution->array;
-                isize max_layer_dim = MAX(array->width, array->height);
-                isize min_layer_dim = MIN(array->width, array->height);
-
-                //The layer must have:
-                // 1) image_fits: big enough (can be rotated) @TODO: IMPLEMENT FURTHER DOWN!
-                // 2) format_fits: the pixel format is the same and the number of channels is big enough
-                // 3) has_space: needs to not be full or not be empty based on what we are looking for.
-                bool image_fits = max_layer_dim >= max_dim && min_layer_dim >= min_dim;
-                bool format_fits = array->type == type && array->channel_count >= channel_count;
-                bool has_space = true;
-         
-                if(used == false)
-                    has_space = resolution->used_layers != resolution->layers.len;
-                else
-                    has_space = resolution->used_layers != 0;
-
-                if(image_fits && format_fits && has_space)
-                {
-                    isize layer_size = array->width * array->height;
-                    isize size_diff = layer_size - needed_size;
-                    isize channel_diff = array->channel_count - channel_count;
-                    ASSERT(size_diff >= 0);
+                i32 resolution_index = manager->candidates.data[list.from + i];
+                Render_Texture_Resolution* resolution = &manager->resolutions.data[resolution_index];
+                if(_render_texture_fits(&resolution->array, width, height) == false)
+                    continue;
 
-                    //If number of channels dont match we effectively also waste all the other channels 
-                    // on that layer
-                    size_diff += channel_diff*layer_size;
-                    ASSERT(size_diff >= 0);
+                i32 layer = _render_texture_resolution_first_layer(resolution, used);
+                if(layer == -1)
+                    continue;
 
-                    if(min_diff > size_diff)
-                    {
-                        min_diff = size_diff;
-                        min_diff_index = i;
-                    }
-                }
-            }
-        
-            //If was found
-            if(min_diff_index != -1)
-            {
-                Render_Texture_Resolution* resolution = &manager->resolutions.data[min_diff_index];
-                if(min_diff == 0)
+                if(_render_texture_waste(&resolution->array, width, height, channel_count) == 0)
                     found_type = FOUND_EXACT;
                 else if(resolution->array.type == type)
                     found_type = FOUND_APPROXIMATE;
                 else
                     found_type = FOUND_APPROXIMATE_BAD_FORMAT;
 
-                out.resolution_index = (i32) min_diff_index + 1;
-                out.layer = -1;
-                for(isize i = 0; i < resolution->layers.len; i++)
-                {
-                    if(resolution->layers.data[i].is_used == used)
-                    {
-                        out.layer = (i32) i;
-                        break;
-                    }
-                }
-
-                ASSERT(out.layer != -1, "The resolution->used_layers must be wrong!");
-                state = true;
+                out.resolution_index = resolution_index + 1;
+                out.layer = layer;
+                break;
             }
         }
 
@@ -1014,6 +1361,48 @@ Render_Texture_Layer render_texture_manager_find(Render_Texture_Manager* manager
     return out;
 }
 
+//Finds a free layer and marks it as used by a width x height image. 
+Render_Texture_Layer render_texture_manager_alloc_layer(Render_Texture_Manager* manager, Found_Type* found_type_or_null, i32 width, i32 height, Pixel_Type type, i32 channel_count, Texture_Block_Format block_format)
+{
+    Render_Texture_Layer out = render_texture_manager_find(manager, found_type_or_null, width, height, type, channel_count, block_format, false);
+    if(out.resolution_index > 0)
+    {
+        Render_Texture_Resolution* resolution = &manager->resolutions.data[out.resolution_index - 1];
+        _render_texture_resolution_set_used(resolution, out.layer, true);
+        resolution->layers.data[out.layer].used_width = width;
+        resolution->layers.data[out.layer].used_height = height;
+    }
+    return out;
+}
+
+//Releases the layer of a removed texture. 
+//Atlas layers are shared so they are only released once all images in them are removed.
+void render_texture_manager_free_layer(Render_Texture_Manager* manager, Render_Texture_Layer layer)
+{
+    if(layer.resolution_index <= 0)
+        return;
+
+    ASSERT_BOUNDS(layer.resolution_index - 1, manager->resolutions.len);
+    Render_Texture_Resolution* resolution = &manager->resolutions.data[layer.resolution_index - 1];
+    Render_Texture_Layer_Info* layer_info = &resolution->layers.data[layer.layer];
+    ASSERT(layer_info->is_used, "double free of texture layer");
+
+    if(layer_info->atlas_index > 0)
+    {
+        Render_Texture_Atlas* atlas = &manager->atlases.data[layer_info->atlas_index - 1];
+        atlas->packer.rect_count -= 1;
+        if(atlas->packer.rect_count > 0)
+            return;
+
+        //Keep the empty atlas around (with resolution_index 0) so its packer can be reused
+        LOG_INFO("render", "released texture atlas #%i", layer_info->atlas_index);
+        atlas_packer_reset(&atlas->packer);
+        atlas->layer.resolution_index = 0;
+    }
+
+    _render_texture_resolution_set_used(resolution, layer.layer, false);
+}
+
 //if((f64) manager->used_layers[resolution_index] >= layer_infos->len * 0.75)
 //    LOG_WARN("render", "more than 75% texture slots used of size : width: %d height: %d", width, height);
 //
@@ -1023,99 +1412,376 @@ Render_Texture_Layer render_texture_manager_find(Render_Texture_Manager* manager
 //    LOG_WARN("render", "out of render textures of size: width: %d height: %d", width, height);
 //}
 
-Render_Texture_Layer render_texture_manager_add(Render_Texture_Manager* manager, Image image, String name)
+//Places a small image into one of the shared atlas layers starting a new one if none has space.
+//Returns layer with resolution_index 0 if there is no free layer for a new atlas.
+INTERNAL Render_Texture_Layer _render_texture_manager_add_to_atlas(Render_Texture_Manager* manager, Subimage image, const Mip_Options* options, Render_Texture_Uv* uv)
 {
-    Render_Texture_Layer empty_slot = {0};
+    Render_Texture_Layer out = {0};
+    Pixel_Type type = (Pixel_Type) image.type;
+    i32 channel_count = (i32) subimage_channel_count(image);
 
-    PROFILE_SCOPE() 
+    Atlas_Rect rect = {0};
+    isize atlas_index = -1;
+    for(isize i = 0; i < manager->atlases.len; i++)
     {
-        Found_Type found_type = NOT_FOUND;
-        empty_slot = render_texture_manager_find(manager, &found_type, image.width, image.height, (Pixel_Type) image.type, image_channel_count(image), false);
+        Render_Texture_Atlas* atlas = &manager->atlases.data[i];
+        if(atlas->layer.resolution_index <= 0)
+            continue;
 
-        LOG_INFO("render", "adding texture %d x %d : %s x %d", image.width, image.height, pixel_type_name(image.type), image_channel_count(image));
+        GL_Texture_Array* array = &manager->resolutions.data[atlas->layer.resolution_index - 1].array;
+        if(array->type == type && array->channel_count == channel_count && array->block_format == TEXTURE_BLOCK_NONE
+            && atlas_packer_add(&atlas->packer, image.width, image.height, &rect))
+        {
+            atlas_index = i;
+            break;
+        }
+    }
 
-        if(empty_slot.resolution_index <= 0)
-            LOG_ERROR(">render", "render_texture_manager_add() Unable to find empty slot! ");
-        else
+    if(atlas_index == -1)
+    {
+        //The atlas layer must match exactly. Otherwise we would waste more than we save.
+        Found_Type found_type = NOT_FOUND;
+        Render_Texture_Layer layer = render_texture_manager_find(manager, &found_type, RENDER_TEXTURE_ATLAS_SIZE, RENDER_TEXTURE_ATLAS_SIZE, type, channel_count, TEXTURE_BLOCK_NONE, false);
+        if(found_type == FOUND_EXACT)
         {
-            Render_Texture_Resolution* resolution = &manager->resolutions.data[empty_slot.resolution_index - 1];
-            LOG_DEBUG(">render", "added to resolution #%d layer #%d", empty_slot.resolution_index, empty_slot.layer + 1);
+            //Reuse the packer of a released atlas if there is one
+            for(isize i = 0; i < manager->atlases.len; i++)
+                if(manager->atlases.data[i].layer.resolution_index <= 0)
+                    atlas_index = i;
 
-            if(found_type == FOUND_APPROXIMATE)
-            {
-                LOG_WARN(">render", "Found only approximate match!");
-                LOG_WARN(">render", "resolution %d x %d : %s x %d", resolution->array.width, resolution->array.height, pixel_type_name(resolution->array.type), resolution->array.channel_count);
-            }
-            
-            if(found_type == FOUND_APPROXIMATE_BAD_FORMAT)
+            if(atlas_index == -1)
             {
-                LOG_WARN(">render", "Found only approximate match with wrong format!");
-                LOG_WARN(">render", "resolution %d x %d : %s x %d", resolution->array.width, resolution->array.height, pixel_type_name(resolution->array.type), resolution->array.channel_count);
+                Render_Texture_Atlas new_atlas = {0};
+                atlas_packer_init(&new_atlas.packer, manager->allocator, RENDER_TEXTURE_ATLAS_SIZE, RENDER_TEXTURE_ATLAS_SIZE, RENDER_TEXTURE_ATLAS_PADDING);
+                array_push(&manager->atlases, new_atlas);
+                atlas_index = manager->atlases.len - 1;
             }
 
-            resolution->used_layers += 1;
+            Render_Texture_Resolution* resolution = &manager->resolutions.data[layer.resolution_index - 1];
+            _render_texture_resolution_set_used(resolution, layer.layer, true);
 
-            Render_Texture_Layer_Info* layer_info = &resolution->layers.data[empty_slot.layer];
-            layer_info->is_used = true;
-            layer_info->used_width = image.width;
-            layer_info->used_height = image.height;
-            layer_info->name = name_make(name);
+            Render_Texture_Layer_Info* layer_info = &resolution->layers.data[layer.layer];
+            layer_info->used_width = resolution->array.width;
+            layer_info->used_height = resolution->array.height;
+            layer_info->atlas_index = (i32) atlas_index + 1;
 
-            bool fill_state = gl_texture_array_fill_layer(&resolution->array, empty_slot.layer, image, false);
-            ASSERT(fill_state);
+            Render_Texture_Atlas* atlas = &manager->atlases.data[atlas_index];
+            atlas->layer = layer;
+            bool fits = atlas_packer_add(&atlas->packer, image.width, image.height, &rect);
+            ASSERT(fits, "RENDER_TEXTURE_ATLAS_MAX_DIM must fit into an empty atlas");
+            LOG_INFO("render", "started texture atlas #%i in resolution #%i layer #%i", (int) atlas_index + 1, layer.resolution_index, layer.layer + 1);
         }
     }
 
-    return empty_slot;
+    if(atlas_index != -1)
+    {
+        Render_Texture_Atlas* atlas = &manager->atlases.data[atlas_index];
+        GL_Texture_Array* array = &manager->resolutions.data[atlas->layer.resolution_index - 1].array;
+        gl_texture_array_fill_rect(array, atlas->layer.layer, rect.x, rect.y, image, RENDER_TEXTURE_ATLAS_PADDING, options);
+
+        uv->offset = vec2((f32) rect.x / (f32) array->width, (f32) rect.y / (f32) array->height);
+        uv->scale = vec2((f32) rect.width / (f32) array->width, (f32) rect.height / (f32) array->height);
+        out = atlas->layer;
+    }
+
+    return out;
 }
 
-//@TODO: once its needed use this to abstract away.
-typedef struct Vertex_Attribute {
-    Name name;
-    i32 offset;
-    i32 size;
-    i32 index;
-    i32 instance_divisor; //if 0 assume not instanced
-    Pixel_Type type;
-    u32 _;
-} Vertex_Attribute;
+//Adds the image given by its mip chain to a free layer (or a part of an atlas layer if its small).
+//Uv is set to where in the layer the image ended up.
+//Atlas textures regenerate their mips from mips[0] with options since they need to include the padding.
+//Streamed textures get only their tail mips uploaded (see texture_stream.h). Atlas textures are never streamed.
+//Compressed textures always take a whole layer. The atlas would have to decompress them to add the padding.
+Render_Texture_Layer render_texture_manager_add(Render_Texture_Manager* manager, Render_Texture_Mips chain, const Mip_Options* options, String name, Render_Texture_Uv* uv_or_null, bool is_streamed)
+{
+    Render_Texture_Layer empty_slot = {0};
+    Render_Texture_Uv uv = {0};
+    Subimage image = chain.mips[0];
+    Pixel_Type type = (Pixel_Type) image.type;
+    i32 channel_count = (i32) subimage_channel_count(image);
+    if(chain.block_format != TEXTURE_BLOCK_NONE)
+        channel_count = texture_block_channel_count(chain.block_format);
 
-//i32 vertex_size;
-//i32 index_size;
-//Vertex_Index_Type index_type;
+    PROFILE_SCOPE() 
+    {
+        LOG_INFO("render", "adding texture %d x %d : %s x %d %s", chain.width, chain.height, pixel_type_name(type), channel_count, texture_block_format_name(chain.block_format));
+        
+        if(chain.block_format == TEXTURE_BLOCK_NONE && image.width > 0 && image.height > 0 && MAX(image.width, image.height) <= RENDER_TEXTURE_ATLAS_MAX_DIM)
+            empty_slot = _render_texture_manager_add_to_atlas(manager, image, options, &uv);
 
-typedef enum Vertex_Index_Type {
-    VERTEX_INDEX_TYPE_I32 = 0,
-    VERTEX_INDEX_TYPE_I16,
+        if(empty_slot.resolution_index > 0)
+            LOG_DEBUG(">render", "added to atlas in resolution #%d layer #%d", empty_slot.resolution_index, empty_slot.layer + 1);
+        else
+        {
+            Found_Type found_type = NOT_FOUND;
+            empty_slot = render_texture_manager_alloc_layer(manager, &found_type, chain.width, chain.height, type, channel_count, chain.block_format);
 
-    VERTEX_INDEX_TYPE_U32,
-    VERTEX_INDEX_TYPE_U16,
-} Vertex_Index_Type;
+            if(empty_slot.resolution_index <= 0)
+                LOG_ERROR(">render", "render_texture_manager_add() Unable to find empty slot! ");
+            else
+            {
+                Render_Texture_Resolution* resolution = &manager->resolutions.data[empty_slot.resolution_index - 1];
+                LOG_DEBUG(">render", "added '%.*s' to resolution #%d layer #%d", STRING_PRINT(name), empty_slot.resolution_index, empty_slot.layer + 1);
 
+                if(found_type == FOUND_APPROXIMATE)
+                {
+                    LOG_WARN(">render", "Found only approximate match!");
+                    LOG_WARN(">render", "resolution %d x %d : %s x %d", resolution->array.width, resolution->array.height, pixel_type_name(resolution->array.type), resolution->array.channel_count);
+                }
+            
+                if(found_type == FOUND_APPROXIMATE_BAD_FORMAT)
+                {
+                    LOG_WARN(">render", "Found only approximate match with wrong format!");
+                    LOG_WARN(">render", "resolution %d x %d : %s x %d", resolution->array.width, resolution->array.height, pixel_type_name(resolution->array.type), resolution->array.channel_count);
+                }
 
-typedef struct Render_Info {
-    Name name;
-    //Name path;
-    Id id;
-    i64 created_etime;
-    i64 last_modified_etime;
-    i64 generation;
-} Render_Info;
+                i32 first_mip = 0;
+                if(is_streamed)
+                    first_mip = texture_stream_tail_mip(resolution->array.width, resolution->array.height, resolution->array.mip_level_count);
 
-Render_Info render_info_make(String name)
-{
-    ASSERT(name.len > 0);
-    Render_Info out = {0};
-    out.name = name_make(name);
-    out.id = id_generate();
-    out.created_etime = platform_epoch_time();
-    return out;
-}
+                bool fill_state = gl_texture_array_fill_layer(&resolution->array, empty_slot.layer, chain, first_mip);
+                ASSERT(fill_state);
 
-void render_info_modify(Render_Info* info)
-{
-    info->last_modified_etime = platform_epoch_time();
-    info->generation += 1;
+                //The image is in the corner of the layer
+                uv.scale = vec2((f32) chain.width / (f32) resolution->array.width, (f32) chain.height / (f32) resolution->array.height);
+            }
+        }
+    }
+
+    if(uv_or_null)
+        *uv_or_null = uv;
+    return empty_slot;
+}
+
+//Loads the mips of streamed textures from their cooked textures on a background thread.
+//The render thread pushes requests and later pops the finished loads which it uploads to gl.
+//Each of the two rings is written by one thread and read by the other so no locks are needed.
+#define RENDER_TEXTURE_LOADER_CAPACITY 64
+
+typedef struct Render_Texture_Load {
+    i32 stream_index;
+    i32 mip;
+    //The mip is read from the cooked texture at cooked_path (see format_texture.h) and extended to
+    // width x height. chain_width, chain_height is the size of the first mip the file must have.
+    //cooked_path is only read while the load is in flight.
+    String cooked_path;
+    i32 chain_width;
+    i32 chain_height;
+    i32 width;
+    i32 height;
+    Image result; //allocated by the loader from allocator_get_malloc(). Empty if the read failed
+} Render_Texture_Load;
+
+typedef struct Render_Texture_Loader {
+    Render_Texture_Load requests[RENDER_TEXTURE_LOADER_CAPACITY];
+    Render_Texture_Load done[RENDER_TEXTURE_LOADER_CAPACITY];
+    PARALLEL_ATOMIC(u32) requests_pushed;
+    PARALLEL_ATOMIC(u32) requests_popped;
+    PARALLEL_ATOMIC(u32) done_pushed;
+    PARALLEL_ATOMIC(u32) done_popped;
+    PARALLEL_ATOMIC(u32) is_stopping;
+    b32 is_launched;
+    Platform_Thread thread;
+} Render_Texture_Loader;
+
+//Reads the mip of the cooked texture at cooked_path and extends it to width x height.
+//Returns an empty image if the file cannot be read or no longer holds a chain of chain_width x chain_height.
+Image render_texture_read_cooked_mip(Allocator* alloc, String cooked_path, i32 mip, i32 chain_width, i32 chain_height, i32 width, i32 height)
+{
+    Image out = {0};
+    Platform_Memory_Mapping mapping = {0};
+    Platform_Error error = platform_file_memory_map(cooked_path, 0, &mapping);
+    if(error)
+        LOG_ERROR("render", "Failed to map the cooked texture '%.*s'. The mip %i is not streamed in.", STRING_PRINT(cooked_path), (int) mip);
+    else
+    {
+        Format_Texture texture = {0};
+        if(format_texture_read(&texture, string_make(mapping.address, mapping.size)) == false 
+            || texture.header->mips[0].width != chain_width || texture.header->mips[0].height != chain_height)
+            LOG_ERROR("render", "Cooked texture '%.*s' changed since it was added. The mip %i is not streamed in.", STRING_PRINT(cooked_path), (int) mip);
+        else
+        {
+            //Same as render_image_extend_mips
+            i32 from_mip = MIN(mip, texture.mip_count - 1);
+            Subimage from = texture.mips[from_mip];
+            Texture_Block_Format block_format = (Texture_Block_Format) texture.header->block_format;
+            if(block_format != TEXTURE_BLOCK_NONE)
+                out = texture_blocks_extend(alloc, from, block_format, texture.header->mips[from_mip].width, texture.header->mips[from_mip].height, width, height);
+            else
+                out = render_image_extend(alloc, from, width, height);
+        }
+
+        platform_file_memory_unmap(&mapping);
+    }
+
+    return out;
+}
+
+INTERNAL int _render_texture_loader_func(void* context)
+{
+    Render_Texture_Loader* loader = (Render_Texture_Loader*) context;
+    for(;;)
+    {
+        //render_texture_loader_deinit sets is_stopping before bumping requests_pushed
+        // so seeing the bump means also seeing is_stopping
+        u32 popped = atomic_load_explicit(&loader->requests_popped, memory_order_relaxed);
+        u32 pushed = atomic_load_explicit(&loader->requests_pushed, memory_order_acquire);
+        if(atomic_load_explicit(&loader->is_stopping, memory_order_acquire))
+            break;
+
+        if(popped == pushed)
+        {
+            platform_futex_wait(&loader->requests_pushed, pushed, -1);
+            continue;
+        }
+
+        Render_Texture_Load load = loader->requests[popped % RENDER_TEXTURE_LOADER_CAPACITY];
+        atomic_store_explicit(&loader->requests_popped, popped + 1, memory_order_release);
+
+        load.result = render_texture_read_cooked_mip(allocator_get_malloc(), load.cooked_path, load.mip, load.chain_width, load.chain_height, load.width, load.height);
+
+        //There are never more loads in flight than the capacity so there is always space
+        u32 done_pushed = atomic_load_explicit(&loader->done_pushed, memory_order_relaxed);
+        ASSERT(done_pushed - atomic_load_explicit(&loader->done_popped, memory_order_acquire) < RENDER_TEXTURE_LOADER_CAPACITY);
+        loader->done[done_pushed % RENDER_TEXTURE_LOADER_CAPACITY] = load;
+        atomic_store_explicit(&loader->done_pushed, done_pushed + 1, memory_order_release);
+    }
+
+    return 0;
+}
+
+void render_texture_loader_init(Render_Texture_Loader* loader)
+{
+    memset(loader, 0, sizeof *loader);
+    Platform_Error error = platform_thread_launch(&loader->thread, 0, _render_texture_loader_func, loader);
+    if(error)
+        LOG_ERROR("render", "Failed to launch the texture loader thread. Textures will not be streamed.");
+    else
+        loader->is_launched = true;
+}
+
+//Stops the loader thread and waits for it to finish. Requests not yet started are dropped.
+void render_texture_loader_deinit(Render_Texture_Loader* loader)
+{
+    if(loader->is_launched)
+    {
+        //Bumping requests_pushed wakes the thread even if it is just about to wait
+        atomic_store_explicit(&loader->is_stopping, 1, memory_order_seq_cst);
+        atomic_fetch_add_explicit(&loader->requests_pushed, 1, memory_order_seq_cst);
+        platform_futex_wake(&loader->requests_pushed);
+        platform_thread_join(&loader->thread, 1);
+
+        u32 done_popped = atomic_load(&loader->done_popped);
+        u32 done_pushed = atomic_load(&loader->done_pushed);
+        for(u32 i = done_popped; i != done_pushed; i++)
+            image_deinit(&loader->done[i % RENDER_TEXTURE_LOADER_CAPACITY].result);
+    }
+
+    memset(loader, 0, sizeof *loader);
+}
+
+//Returns false if the loader is full.
+bool render_texture_loader_push(Render_Texture_Loader* loader, Render_Texture_Load load)
+{
+    u32 pushed = atomic_load_explicit(&loader->requests_pushed, memory_order_relaxed);
+    u32 popped = atomic_load_explicit(&loader->requests_popped, memory_order_acquire);
+    if(pushed - popped >= RENDER_TEXTURE_LOADER_CAPACITY)
+        return false;
+
+    loader->requests[pushed % RENDER_TEXTURE_LOADER_CAPACITY] = load;
+    atomic_store_explicit(&loader->requests_pushed, pushed + 1, memory_order_release);
+    platform_futex_wake(&loader->requests_pushed);
+    return true;
+}
+
+//Returns false if no load is finished.
+bool render_texture_loader_pop(Render_Texture_Loader* loader, Render_Texture_Load* load)
+{
+    u32 popped = atomic_load_explicit(&loader->done_popped, memory_order_relaxed);
+    u32 pushed = atomic_load_explicit(&loader->done_pushed, memory_order_acquire);
+    if(popped == pushed)
+        return false;
+
+    *load = loader->done[popped % RENDER_TEXTURE_LOADER_CAPACITY];
+    atomic_store_explicit(&loader->done_popped, popped + 1, memory_order_release);
+    return true;
+}
+
+//@TODO: once its needed use this to abstract away.
+typedef struct Vertex_Attribute {
+    Name name;
+    i32 offset;
+    i32 size;
+    i32 index;
+    i32 instance_divisor; //if 0 assume not instanced
+    Pixel_Type type;
+    u32 _;
+} Vertex_Attribute;
+
+//i32 vertex_size;
+//i32 index_size;
+//Vertex_Index_Type index_type;
+
+typedef enum Vertex_Index_Type {
+    VERTEX_INDEX_TYPE_I32 = 0,
+    VERTEX_INDEX_TYPE_I16,
+
+    VERTEX_INDEX_TYPE_U32,
+    VERTEX_INDEX_TYPE_U16,
+} Vertex_Index_Type;
+
+isize vertex_index_type_size(Vertex_Index_Type type)
+{
+    switch(type)
+    {
+        case VERTEX_INDEX_TYPE_I16:
+        case VERTEX_INDEX_TYPE_U16: return 2;
+        case VERTEX_INDEX_TYPE_I32:
+        case VERTEX_INDEX_TYPE_U32: 
+        default: return 4;
+    }
+}
+
+//Opengl only supports unsigned indices. The signed types are treated as unsigned.
+GLenum vertex_index_type_to_gl(Vertex_Index_Type type)
+{
+    if(vertex_index_type_size(type) == 2)
+        return GL_UNSIGNED_SHORT;
+    else
+        return GL_UNSIGNED_INT;
+}
+
+
+typedef struct Render_Info {
+    Name name;
+    //Name path;
+    Id id;
+    i64 created_etime;
+    i64 last_modified_etime;
+    i64 generation;
+
+    //Small sequential number used in render command sort keys
+    u32 sort_index;
+    u32 _;
+} Render_Info;
+
+Render_Info render_info_make(String name)
+{
+    static u32 sort_index_counter = 0;
+
+    ASSERT(name.len > 0);
+    Render_Info out = {0};
+    out.name = name_make(name);
+    out.id = id_generate();
+    out.created_etime = platform_epoch_time();
+    out.sort_index = sort_index_counter++;
+    return out;
+}
+
+void render_info_modify(Render_Info* info)
+{
+    info->last_modified_etime = platform_epoch_time();
+    info->generation += 1;
 }
 
 typedef struct Render_Geometry_Batch_Index {
@@ -1125,6 +1791,15 @@ typedef struct Render_Geometry_Batch_Index {
     
     i32 vertex_from;
     i32 vertex_count;
+
+    //If the batch stores Packed_Vertex the positions are relative to bounds
+    b32 is_packed;
+    AABB bounds;
+
+    //Index ranges within the batch of the progressively simplified versions using the same vertices.
+    //lods[0] is the full mesh ie. index_from, index_count. See mesh_lod.h
+    i32 lod_count;
+    Mesh_Lod lods[MESH_LOD_MAX];
 } Render_Geometry_Batch_Index;
 
 typedef struct Render_Geometry_Batch_Group {
@@ -1135,6 +1810,13 @@ typedef struct Render_Geometry_Batch_Group {
     
     i32 vertex_from;
     i32 vertex_count;
+
+    AABB bounds;
+
+    //The indices of all lods are part of the group (see Render_Geometry_Batch_Index)
+    i32 lod_count;
+    u32 _;
+    Mesh_Lod lods[MESH_LOD_MAX];
 } Render_Geometry_Batch_Group;
 
 typedef Array(Render_Geometry_Batch_Group) Render_Batch_Group_Info_Array;
@@ -1153,6 +1835,12 @@ typedef struct Render_Geometry_Batch{
 
     i32 num_vertex_attributes;
 
+    i32 vertex_size;
+    b32 is_packed; //stores Packed_Vertex instead of Vertex
+
+    Vertex_Index_Type index_type;
+    i32 index_size;
+
     #if 0
     #define MAX_VERTEX_ATTRIBUTES 128
     Vertex_Attribute attributes[MAX_VERTEX_ATTRIBUTES];
@@ -1169,7 +1857,7 @@ typedef struct Render_Geometry_Batch{
 
 typedef Array(Render_Geometry_Batch) Render_Geometry_Batch_Array;
 
-void render_geometry_batch_init(Render_Geometry_Batch* mesh, Allocator* alloc, isize vertex_count, isize index_count, GLuint instance_buffer)
+void render_geometry_batch_init(Render_Geometry_Batch* mesh, Allocator* alloc, isize vertex_count, isize index_count, GLuint instance_buffer, bool is_packed, Vertex_Index_Type index_type)
 {
     PROFILE_SCOPE() 
     {
@@ -1181,18 +1869,35 @@ void render_geometry_batch_init(Render_Geometry_Batch* mesh, Allocator* alloc, i
         glGenBuffers(1, &mesh->vertex_buffer_handle);
         glGenBuffers(1, &mesh->index_buffer_handle);
   
+        mesh->is_packed = is_packed;
+        mesh->vertex_size = is_packed ? sizeof(Packed_Vertex) : sizeof(Vertex);
+        mesh->index_type = index_type;
+        mesh->index_size = (i32) vertex_index_type_size(index_type);
+
         glBindVertexArray(mesh->vertex_array_handle);
         glBindBuffer(GL_ARRAY_BUFFER, mesh->vertex_buffer_handle);
-        glBufferData(GL_ARRAY_BUFFER, vertex_count * sizeof(Vertex), NULL, GL_STATIC_DRAW);
+        glBufferData(GL_ARRAY_BUFFER, vertex_count * mesh->vertex_size, NULL, GL_STATIC_DRAW);
 
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->index_buffer_handle);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, index_count * sizeof(i32), NULL, GL_STATIC_DRAW);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, index_count * mesh->index_size, NULL, GL_STATIC_DRAW);
     
         i32 i = 0;
-        i++; glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, pos));
-        i++; glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, uv));
-        i++; glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, norm));
-        i++; glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, tan));
+        if(is_packed)
+        {
+            //Positions are read as [0, 1] and scaled by the bounds through the model matrix.
+            //Normals and tangents are octahedral and decoded in the shader.
+            i++; glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(Packed_Vertex), (void*)offsetof(Packed_Vertex, pos));
+            i++; glVertexAttribPointer(1, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(Packed_Vertex), (void*)offsetof(Packed_Vertex, uv));
+            i++; glVertexAttribPointer(2, 2, GL_SHORT, GL_TRUE, sizeof(Packed_Vertex), (void*)offsetof(Packed_Vertex, norm));
+            i++; glVertexAttribPointer(3, 2, GL_SHORT, GL_TRUE, sizeof(Packed_Vertex), (void*)offsetof(Packed_Vertex, tan));
+        }
+        else
+        {
+            i++; glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, pos));
+            i++; glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, uv));
+            i++; glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, norm));
+            i++; glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, tan));
+        }
     
         glEnableVertexAttribArray(0);	
         glEnableVertexAttribArray(1);	
@@ -1231,12 +1936,30 @@ void render_geometry_batch_init(Render_Geometry_Batch* mesh, Allocator* alloc, i
     }
 }
 
-void render_geometry_batch_set_data(Render_Geometry_Batch* mesh, const Vertex vertices[], i32 vertex_count, i32 vertex_offset, const i32 indices[], i32 index_count, i32 index_offset)
+//vertices must be Vertex or Packed_Vertex depending on mesh->is_packed.
+//indices are converted to mesh->index_type. They must fit into it.
+void render_geometry_batch_set_data(Render_Geometry_Batch* mesh, const void* vertices, i32 vertex_count, i32 vertex_offset, const i32 indices[], i32 index_count, i32 index_offset)
 {
     PROFILE_SCOPE() 
     {
-        glNamedBufferSubData(mesh->vertex_buffer_handle, sizeof(Vertex)*vertex_offset, sizeof(Vertex)*vertex_count, vertices);
-        glNamedBufferSubData(mesh->index_buffer_handle, sizeof(i32)*index_offset, sizeof(i32)*index_count, indices);
+        glNamedBufferSubData(mesh->vertex_buffer_handle, (isize) mesh->vertex_size*vertex_offset, (isize) mesh->vertex_size*vertex_count, vertices);
+        if(mesh->index_size == 2)
+        {
+            SCRATCH_ARENA(arena)
+            {
+                Array(u16) narrowed = {arena.alloc};
+                array_resize_for_overwrite(&narrowed, index_count);
+                for(isize i = 0; i < index_count; i++)
+                {
+                    ASSERT(0 <= indices[i] && indices[i] <= UINT16_MAX);
+                    narrowed.data[i] = (u16) indices[i];
+                }
+
+                glNamedBufferSubData(mesh->index_buffer_handle, 2*index_offset, 2*index_count, narrowed.data);
+            }
+        }
+        else
+            glNamedBufferSubData(mesh->index_buffer_handle, sizeof(i32)*index_offset, sizeof(i32)*index_count, indices);
     }
 }
 
@@ -1276,6 +1999,10 @@ typedef struct Render_Geometry_Manager {
     i32 outlier_vertex_size;
     i32 outlier_index_size;
 
+    //New batches store Packed_Vertex instead of Vertex. Off by default.
+    b32 pack_vertices;
+    u32 _;
+
     isize used_memory;
     isize memory_limit;
 
@@ -1314,10 +2041,14 @@ Render_Geometry_Batch_Index render_geometry_manager_find(Render_Geometry_Manager
                 if(name_is_equal(&group->name, &n))
                 {
                     out.index_from = group->index_from;
-                    out.index_count = group->index_count;
+                    out.index_count = group->lod_count > 0 ? group->lods[0].index_count : group->index_count;
                     out.vertex_from = group->vertex_from;
                     out.vertex_count = group->vertex_count;
+                    out.is_packed = batch->is_packed;
+                    out.bounds = group->bounds;
                     out.batch_index = (i32) k + 1;
+                    out.lod_count = group->lod_count;
+                    memcpy(out.lods, group->lods, sizeof group->lods);
                     goto function_end;
                 }
             }
@@ -1327,7 +2058,7 @@ Render_Geometry_Batch_Index render_geometry_manager_find(Render_Geometry_Manager
     return out;
 }
 
-i32 render_geometry_manager_add_batch(Render_Geometry_Manager* manager, isize min_vertex_count, isize min_index_count)
+i32 render_geometry_manager_add_batch(Render_Geometry_Manager* manager, isize min_vertex_count, isize min_index_count, Vertex_Index_Type index_type)
 {
     i32 out = 0;
     PROFILE_SCOPE() 
@@ -1335,16 +2066,17 @@ i32 render_geometry_manager_add_batch(Render_Geometry_Manager* manager, isize mi
         isize vertex_count = MAX(manager->def_batch_vertex_size, min_vertex_count);
         isize index_count = MAX(manager->def_batch_index_size, min_index_count);
 
-        isize memory_requirement = min_vertex_count * sizeof(Vertex) + min_index_count * sizeof(i32);
+        isize vertex_size = manager->pack_vertices ? sizeof(Packed_Vertex) : sizeof(Vertex);
+        isize memory_requirement = min_vertex_count * vertex_size + min_index_count * vertex_index_type_size(index_type);
 
         if(manager->used_memory >= manager->memory_limit * 3/4)
             LOG_WARN("render", "Geometry manager nearly out of memory. Using %s out of %s", format_bytes(manager->used_memory).data, format_bytes(manager->memory_limit).data);
     
         if(memory_requirement + manager->used_memory <= manager->memory_limit)
         {
-            LOG_INFO("render", "creating new geometry batch %i:%i", (int) vertex_count, (int) index_count);
+            LOG_INFO("render", "creating new geometry batch %i:%i (%i byte indices)", (int) vertex_count, (int) index_count, (int) vertex_index_type_size(index_type));
             Render_Geometry_Batch batch = {0};
-            render_geometry_batch_init(&batch, manager->allocator, vertex_count, index_count, manager->instance_buffer->handle);
+            render_geometry_batch_init(&batch, manager->allocator, vertex_count, index_count, manager->instance_buffer->handle, manager->pack_vertices, index_type);
             manager->used_memory += memory_requirement;
 
             array_push(&manager->batches, batch);
@@ -1358,16 +2090,31 @@ i32 render_geometry_manager_add_batch(Render_Geometry_Manager* manager, isize mi
     return out;
 }
 
-Render_Geometry_Batch_Index render_geometry_manager_add(Render_Geometry_Manager* manager, const Vertex vertices[], isize vertex_count, const i32 indices[], isize index_count, String name)
+//Adds a geometry whose lods were already built (see mesh_lod_build). all_indices are the indices
+// of all lods into vertices and the lod ranges are relative to them. lods[0] is the full mesh.
+Render_Geometry_Batch_Index render_geometry_manager_add_lods(Render_Geometry_Manager* manager, const Vertex vertices[], isize vertex_count, 
+    const i32 all_indices[], isize all_index_count, const Mesh_Lod lods[], isize lod_count, String name)
 {
     Render_Geometry_Batch_Index out = {0};
     PROFILE_SCOPE() 
     {
+        //All lods are stored in the same group right after the full mesh and share its vertices.
+        //The group thus has more indices than the mesh itself.
+        ASSERT(1 <= lod_count && lod_count <= MESH_LOD_MAX);
+        isize index_count = lods[0].index_count;
+
+        //Indices are relative to the start of the group (base_vertex) so small groups
+        // can use 16 bit indices regardless of where in the batch they are.
+        Vertex_Index_Type index_type = vertex_count <= UINT16_MAX ? VERTEX_INDEX_TYPE_U16 : VERTEX_INDEX_TYPE_I32;
+
         i32 batch_index = 0;
         for(isize i = 0; i < manager->batches.len; i++)
         {
             Render_Geometry_Batch* batch = &manager->batches.data[i];
-            if(batch->used_index_count + index_count <= batch->index_count && batch->used_vertex_count + vertex_count <= batch->vertex_count)
+            if(batch->used_index_count + all_index_count <= batch->index_count 
+                && batch->used_vertex_count + vertex_count <= batch->vertex_count
+                && batch->is_packed == manager->pack_vertices
+                && batch->index_type == index_type)
             {
                 batch_index = (i32) i + 1;
                 break;
@@ -1377,7 +2124,7 @@ Render_Geometry_Batch_Index render_geometry_manager_add(Render_Geometry_Manager*
         if(batch_index == 0)
         {
             log_indent();
-            batch_index = render_geometry_manager_add_batch(manager, vertex_count, index_count);
+            batch_index = render_geometry_manager_add_batch(manager, vertex_count, all_index_count, index_type);
             log_outdent();
         }
 
@@ -1386,24 +2133,57 @@ Render_Geometry_Batch_Index render_geometry_manager_add(Render_Geometry_Manager*
             Render_Geometry_Batch* batch = &manager->batches.data[batch_index - 1];
             Render_Geometry_Batch_Group group = {0};
             group.index_from = batch->used_index_count;
-            group.index_count = (i32) index_count;
+            group.index_count = (i32) all_index_count;
         
             group.vertex_from = batch->used_vertex_count;
             group.vertex_count = (i32) vertex_count;
 
             group.name = name_make(name);
 
-            batch->used_index_count += (i32) index_count;
+            batch->used_index_count += (i32) all_index_count;
             batch->used_vertex_count += (i32) vertex_count;
 
-            render_geometry_batch_set_data(batch, vertices, group.vertex_count, group.vertex_from, indices, group.index_count, group.index_from);
+            //The bounds are needed for culling as well
+            group.bounds = vertex_pack_bounds(vertices, vertex_count);
+            if(batch->is_packed)
+            {
+                SCRATCH_ARENA(arena)
+                {
+                    Packed_Vertex_Array packed = {arena.alloc};
+                    array_resize_for_overwrite(&packed, vertex_count);
+                    vertex_pack(packed.data, vertices, vertex_count, group.bounds);
+                    render_geometry_batch_set_data(batch, packed.data, group.vertex_count, group.vertex_from, all_indices, group.index_count, group.index_from);
+
+                    Vertex_Pack_Error error = vertex_pack_error(vertices, vertex_count, group.bounds);
+                    LOG_INFO("render", "packed '%.*s' max error: pos %g uv %g norm %g deg tan %g deg", STRING_PRINT(name), 
+                        error.max_pos, error.max_uv, error.max_norm, error.max_tan);
+                }
+            }
+            else
+                render_geometry_batch_set_data(batch, vertices, group.vertex_count, group.vertex_from, all_indices, group.index_count, group.index_from);
 
             out.index_from = group.index_from;
-            out.index_count = group.index_count;
+            out.index_count = (i32) index_count;
             out.vertex_from = group.vertex_from;
             out.vertex_count = group.vertex_count;
+            out.is_packed = batch->is_packed;
+            out.bounds = group.bounds;
             out.batch_index = batch_index;
+            group.lod_count = (i32) lod_count;
+            for(isize i = 0; i < lod_count; i++)
+            {
+                group.lods[i] = lods[i];
+                group.lods[i].index_from += group.index_from;
+            }
+
+            out.lod_count = group.lod_count;
+            memcpy(out.lods, group.lods, sizeof group.lods);
+
             LOG_INFO("render", "render_geometry_manager_add() '%.*s' %i:%i (vertex:index) added to batch #%i", STRING_PRINT(name), (int) vertex_count, (int) index_count, (int) out.batch_index);
+            log_indent();
+            for(isize i = 1; i < lod_count; i++)
+                LOG_INFO("render", "lod %i: %i triangles error %g", (int) i, (int) lods[i].index_count/3, lods[i].error);
+            log_outdent();
 
             array_push(&batch->groups, group);
         }
@@ -1415,6 +2195,20 @@ Render_Geometry_Batch_Index render_geometry_manager_add(Render_Geometry_Manager*
     return out;
 }
 
+Render_Geometry_Batch_Index render_geometry_manager_add(Render_Geometry_Manager* manager, const Vertex vertices[], isize vertex_count, const i32 indices[], isize index_count, String name)
+{
+    Render_Geometry_Batch_Index out = {0};
+    PROFILE_SCOPE() 
+    SCRATCH_ARENA(lod_arena)
+    {
+        i32_Array all_indices = {lod_arena.alloc};
+        Mesh_Lod lods[MESH_LOD_MAX] = {0};
+        isize lod_count = mesh_lod_build(&all_indices, lods, indices, index_count, vertices, vertex_count);
+        out = render_geometry_manager_add_lods(manager, vertices, vertex_count, all_indices.data, all_indices.len, lods, lod_count, name);
+    }
+    return out;
+}
+
 
 
 
@@ -1432,6 +2226,12 @@ Render_Geometry_Batch_Index render_geometry_manager_add(Render_Geometry_Manager*
 #define MAX_LIGHTS 32
 #define MAX_RESOULTIONS 7
 
+//Size of the grid of light clusters of the view frustum. See light_cluster.h
+#define LIGHT_CLUSTER_TILES_X 16
+#define LIGHT_CLUSTER_TILES_Y 9
+#define LIGHT_CLUSTER_SLICES 24
+#define LIGHT_CLUSTER_COUNT (LIGHT_CLUSTER_TILES_X*LIGHT_CLUSTER_TILES_Y*LIGHT_CLUSTER_SLICES)
+
 typedef struct Render_Geometry {
     Render_Info info;
     Render_Geometry_Batch_Index group;
@@ -1441,9 +2241,49 @@ typedef struct Render_Geometry {
 typedef struct Render_Texture {
     Render_Info info;
     Render_Texture_Layer layer;
+    Render_Texture_Uv uv;
+    isize storage_index; //into Render textures
+    i32 stream_index; //index + 1 into Render texture_stream or 0 if not streamed
+    u32 _;
 } Render_Texture;
+
+//The cpu side of a streamed texture. The streamed mips are read from its cooked texture 
+// by the loader. Only the always resident tail is kept in memory.
+typedef struct Render_Streamed_Texture {
+    Render_Texture_Layer layer;
+    String_Builder cooked_path; //see format_texture.h
+    i32 chain_width; //size of the first mip in the cooked texture
+    i32 chain_height;
+    Image mips[MIP_CHAIN_MAX_MIPS]; //the tail mips extended to the sizes of its layer. Finer mips are empty
+    i32 mip_count;
+    b32 is_removed; //cooked_path is freed once the load in flight finishes
+} Render_Streamed_Texture;
+
+typedef Array(Render_Streamed_Texture) Render_Streamed_Texture_Array;
+
+void render_streamed_texture_deinit(Render_Streamed_Texture* streamed)
+{
+    for(i32 i = 0; i < streamed->mip_count; i++)
+        image_deinit(&streamed->mips[i]);
+    builder_deinit(&streamed->cooked_path);
+    streamed->mip_count = 0;
+}
 DEFINE_RENDER_PTR_TYPE(Render_Texture);
 
+//Where the textures of a material currently live. 
+//Computed once by render_material_bind_textures so that building batches
+// does not need to look up each texture on every material change.
+typedef struct Render_Material_Binding {
+    Render_Texture_Layer layers[MAX_TEXTURES_PER_MATERIAL]; //resolution_index is 0 for textures that were not found
+    Render_Texture_Uv uvs[MAX_TEXTURES_PER_MATERIAL];
+    u8 min_mips[MAX_TEXTURES_PER_MATERIAL]; //the finest resident mip of streamed textures
+    i32 resolutions[MAX_TEXTURES_PER_MATERIAL]; //distinct resolution indices of layers
+    i32 resolution_count;
+    i32 bound_textures; //used_textures at the time of binding
+    i32 not_found_textures;
+    u32 _;
+} Render_Material_Binding;
+
 typedef struct Render_Material {
     Render_Info info;
     Render_Texture_Ptr textures[MAX_TEXTURES_PER_MATERIAL];
@@ -1455,6 +2295,8 @@ typedef struct Render_Material {
     Vec3 ambient_color;
     f32 specular_exponent;
     f32 metallic;
+
+    Render_Material_Binding binding;
 } Render_Material;
 
 typedef struct {
@@ -1490,8 +2332,41 @@ typedef struct Render_Command_Expanded {
     //Is used in the primary phase of sorting so
     // this saves us one ptr deref per iteration
     i32 geometry_batch_index;
+    //See render_command_sort_key
+    u64 sort_key;
 } Render_Command_Expanded;
 
+//The commands are sorted by a single packed key. From the most significant:
+// environment index  6 bits
+// geometry batch    10 bits
+// geometry          21 bits
+// lod                3 bits
+// material          24 bits
+//This groups the commands exactly like batching needs: batches split on environment and
+// geometry batch, draws on geometry, lod and material. Values that dont fit are wrapped which
+// can only cause more draws, never wrong ones. The lod is 0 until chosen by culling 
+// (see render_command_sort_key_set_lod) and is only ever read back from the key.
+u64 render_command_sort_key(u32 environment_index, i32 geometry_batch_index, const Render_Geometry* geometry, const Render_Material* material)
+{
+    u64 key = 0;
+    key |= ((u64) environment_index & 0x3F) << 58;
+    key |= ((u64) geometry_batch_index & 0x3FF) << 48;
+    key |= ((u64) geometry->info.sort_index & 0x1FFFFF) << 27;
+    key |= ((u64) material->info.sort_index & 0xFFFFFF);
+    return key;
+}
+
+u64 render_command_sort_key_set_lod(u64 key, i32 lod)
+{
+    STATIC_ASSERT(MESH_LOD_MAX <= 8);
+    return (key & ~((u64) 0x7 << 24)) | ((u64) lod & 0x7) << 24;
+}
+
+i32 render_command_sort_key_lod(u64 key)
+{
+    return (i32) (key >> 24) & 0x7;
+}
+
 typedef Array(Render_Geometry_Ptr) Render_Geometry_Ptr_Array;
 typedef Array(Render_Material_Ptr) Render_Material_Ptr_Array;
 typedef Array(Render_Environment_Ptr) Render_Environment_Ptr_Array;
@@ -1506,7 +2381,9 @@ typedef Array(Mat4) Mat4_Array;
 #define DO_MONO_RENDER_QUEUE
 //#define DO_MONO_EXPANDED_QUEUE
 
-typedef struct Render_Queue {
+//Commands submitted by a single thread. Each stream is delta encoded on its own
+// (see render_queue_submit_phong_on_thread) so threads never touch each others data.
+typedef struct Render_Queue_Stream {
     u8_Array masks;
     Mat4_Array transforms;
     Render_Geometry_Ptr_Array geometries;
@@ -1514,11 +2391,83 @@ typedef struct Render_Queue {
     Render_Environment_Ptr_Array environments;
     Render_Command_Expanded_Array expanded;
 
+    //Keeps the array headers of neighbouring streams on different cache lines
+    // so that pushing from different threads does not cause false sharing.
+    u8 _[64];
+} Render_Queue_Stream;
+
+typedef Array(Render_Queue_Stream) Render_Queue_Stream_Array;
+
+typedef struct Render_Queue {
+    //One stream per thread of parallel.h indexed by thread_index.
+    Render_Queue_Stream_Array streams;
+
+    //The merged transforms and expanded commands of all streams. 
+    //Filled by render_queue_expand.
+    Mat4_Array transforms;
+    Render_Command_Expanded_Array expanded;
+
     Render_Phong_Command_Array mono_queue;
+
+    //Statistics of the last render_queue_cull
+    isize visible_count;
+    isize culled_count;
 } Render_Queue;
 
+//A handle to an instance of Render_Scene. Stays valid untill the instance is removed.
+//Handles of removed instances are detected by their generation.
+typedef struct Render_Scene_Handle {
+    u32 index;
+    u32 generation; //0 is never a valid generation
+} Render_Scene_Handle;
+
+typedef struct Render_Scene_Instance {
+    Render_Phong_Command command;
+    u32 generation;
+    b32 is_alive;
+} Render_Scene_Instance;
+
+typedef Array(Render_Scene_Instance) Render_Scene_Instance_Array;
+
+//Retained set of instances that persists across frames. Unlike Render_Queue which is
+// filled and thrown away every frame the scene only does work for what changed:
+// - adding/removing instances or changing their geometry or material rebuilds the bvh and 
+//   the expanded commands.
+// - moving instances only refits the bvh nodes above them.
+// - the sorted visible commands are recomputed only when something above happened 
+//   or when the frustum changed. Otherwise the last frames list is reused.
+//The scene is drawn by render_render together with the commands of the Render_Queue.
+typedef struct Render_Scene {
+    Render_Scene_Instance_Array instances;
+    i32_Array free_indices;
+    Mat4_Array transforms; //indexed by instance index, referenced by transform_index of the commands 
+    
+    //One entry per alive instance with resolvable geometry and material. 
+    //The bvh indexes into these.
+    i32_Array alive;
+    i32_Array alive_slot_of; //indexed by instance index, index into alive or -1
+    AABB_Array alive_bounds;
+    Render_Command_Expanded_Array alive_commands;
+    Array(u64) alive_keys;
+    Bvh bvh;
+
+    i32_Array moved; //instance indices moved since the last render_scene_prepare
+    i32_Array query;
+    Render_Command_Expanded_Array visible; //sorted visible commands of the last frame
+    Frustum visible_frustum;
+    u64 visible_generation; //incremented whenever visible changes
+    u64 resolved_generation; //resource_generation of Render the alive commands were resolved against
+
+    isize alive_count;
+    b32 is_structure_dirty;
+    b32 is_visible_dirty;
+} Render_Scene;
+
 
 enum {MAX_TEXTURE_SLOTS = 32};
+//Size of the open addressed set of texture slots within each batch. 
+//Kept at most half full so that probe sequences stay short.
+enum {TEXTURE_SLOT_TABLE_SIZE = 2*MAX_TEXTURE_SLOTS};
 
 
 
@@ -1550,7 +2499,7 @@ enum {MAX_TEXTURE_SLOTS = 32};
 //Each draw must track where it bound its textures to
 typedef struct Render_Per_Draw {
     i32 instance_from;
-    u32 _;
+    i32 lod;
     Render_Material* material;
     Render_Geometry* geometry;
 
@@ -1561,8 +2510,55 @@ typedef struct Render_Per_Instance {
     Mat4 model;
 } Render_Per_Instance;
 
+//Each batch is a single multi draw. Its draws are [draw_from, draw_from + draw_count) 
+// of the draws of the whole frame.
+typedef struct Render_Per_Batch {
+    i32 texture_slots[MAX_TEXTURE_SLOTS]; //resolution index bound to each slot
+    i32 used_texture_slots;
+    u8 texture_slot_table[TEXTURE_SLOT_TABLE_SIZE]; //resolution index hash -> slot + 1 (0 is empty)
+
+    i32 geometry_batch_index;
+    i32 draw_from;
+    i32 draw_count;
+    //@TODO
+    Render_Environment* environment;
+    GL_Shader* shader;
+} Render_Per_Batch;
+
 typedef Array(Render_Per_Draw) Render_Per_Draw_Array;
 typedef Array(Render_Per_Instance) Render_Per_Instance_Array;
+typedef Array(Render_Per_Batch) Render_Per_Batch_Array;
+
+//Commands [command_from, command_to) of the same geometry batch and environment.
+//Built on a single thread into its Render_Batch_Builder.
+typedef struct Render_Batch_Run {
+    isize command_from;
+    isize command_to;
+    isize thread_index;
+
+    //Within the builder of the thread
+    isize batch_from;
+    isize batch_count;
+    isize draw_from;
+    isize draw_count;
+    
+    //Within the whole frame
+    isize global_batch_from;
+    isize global_draw_from;
+} Render_Batch_Run;
+
+//Per thread storage for building batches
+typedef struct Render_Batch_Builder {
+    Render_Per_Batch_Array batches;
+    Render_Per_Draw_Array draws;
+    isize not_found_textures;
+    u8 _[64]; //no false sharing
+} Render_Batch_Builder;
+
+typedef Array(Render_Batch_Run) Render_Batch_Run_Array;
+typedef Array(Render_Batch_Builder) Render_Batch_Builder_Array;
+
+#define RENDER_BUILD_MIN_RUN 1024
 
 typedef  struct {
     GLuint count;
@@ -1588,7 +2584,13 @@ typedef struct Blinn_Phong_Per_Draw {
     ATTRIBUTE_ALIGNED(4) int map_specular; 
     ATTRIBUTE_ALIGNED(4) int map_normal; 
     ATTRIBUTE_ALIGNED(4) int map_ambient; 
-    ATTRIBUTE_ALIGNED(4) int _[2]; 
+    ATTRIBUTE_ALIGNED(4) int map_min_mips; //the finest mip that can be sampled 8 bits per map in the order above
+    ATTRIBUTE_ALIGNED(4) int _; 
+    //Render_Texture_Uv of each map packed as offset.xy, scale.zw
+    ATTRIBUTE_ALIGNED(16) Vec4 map_diffuse_uv;
+    ATTRIBUTE_ALIGNED(16) Vec4 map_specular_uv;
+    ATTRIBUTE_ALIGNED(16) Vec4 map_normal_uv;
+    ATTRIBUTE_ALIGNED(16) Vec4 map_ambient_uv;
 } Blinn_Phong_Per_Draw;
 
 typedef struct Blinn_Phong_Light {
@@ -1607,6 +2609,11 @@ typedef struct Blinn_Phong_Per_Batch {
     ATTRIBUTE_ALIGNED(4) float gamma;
     ATTRIBUTE_ALIGNED(4) int lights_count;
 
+    //The light clusters the pixels look up their lights in: tiles_x, tiles_y, slices, unused
+    ATTRIBUTE_ALIGNED(16) int cluster_size[4];
+    //near, far, viewport width, viewport height
+    ATTRIBUTE_ALIGNED(16) Vec4 cluster_depth_and_viewport;
+
     ATTRIBUTE_ALIGNED(16) Blinn_Phong_Light lights[MAX_LIGHTS];
 } Blinn_Phong_Per_Batch;
 
@@ -1675,27 +2682,70 @@ typedef struct Render {
     GL_Buffer buffer_environment_uniform;
     GL_Buffer buffer_draw_uniform;
     GL_Buffer buffer_instance;
+    GL_Buffer buffer_light_ranges;
+    GL_Buffer buffer_light_indices;
 
     //For debug mostly
     GL_Shader_Block_Info uniform_block_environment;
     GL_Shader_Block_Info uniform_block_draw;
+    GL_Shader_Block_Info storage_block_light_ranges;
+    GL_Shader_Block_Info storage_block_light_indices;
+
+    //Lights assigned to clusters of the view frustum. Rebuilt every frame in render_render.
+    Light_Clusters light_clusters;
 
     Blinn_Phong_Per_Instance_Array blinn_phong_per_instance;
     Blinn_Phong_Per_Draw_Array blinn_phong_per_draw;
 
     Render_Per_Instance_Array render_per_instance;
     Render_Per_Draw_Array render_per_draw;
+    Render_Per_Batch_Array render_per_batch;
+    Render_Batch_Run_Array batch_runs;
+    Render_Batch_Builder_Array batch_builders;
 
     Gl_Draw_Elements_Indirect_Command_Array indirect_draws;
 
+    //Cpu copies of the gpu buffers. Only the changed parts get uploaded.
+    Buffer_Shadow shadow_command;
+    Buffer_Shadow shadow_draw_uniform;
+    Buffer_Shadow shadow_instance;
+    isize uploaded_bytes; //bytes uploaded in the last render_render
+
+    //All uploads go through this persistently mapped ring and are copied on the gpu.
+    Upload_Ring upload_ring;
+    GLuint upload_ring_handle;
+    i32 uniform_offset_alignment;
+
     Render_Texture_Manager texture_manager;
     Render_Geometry_Manager geometry_manager;
+
+    //Streaming of the mips of big textures. Disabled if the texture_stream budget is 0.
+    Texture_Stream texture_stream;
+    Render_Streamed_Texture_Array streamed_textures; //indexed by texture stream index
+    Texture_Stream_Event_Array stream_events;
+    Render_Texture_Loader texture_loader;
+
     Render_Queue render_queue;
+    Render_Scene scene;
 
     Stable_Array textures;
     Stable_Array geometries;
     Stable_Array materials;
 
+    //Incremented whenever textures or materials are added, textures removed or streamed in/out. 
+    //All material bindings are recomputed when it differs from bound_generation.
+    u64 binding_generation;
+    u64 bound_generation;
+
+    //Incremented whenever geometries or materials are added or textures removed. 
+    //Render_Scene caches raw pointers to the resources and resolves them again when it differs.
+    u64 resource_generation;
+
+    //The scene visible_generation and binding_generation the current batches were built from.
+    //Batches built from anything other than the scene alone have built_scene_generation 0.
+    u64 built_scene_generation;
+    u64 built_binding_generation;
+
     Allocator* allocator;
 } Render;
 
@@ -1703,6 +2753,7 @@ Render_Texture* render_texture_get(Render* render, Render_Texture_Ptr ptr);
 Render_Geometry* render_geometry_get(Render* render, Render_Geometry_Ptr ptr);
 Render_Material* render_material_get(Render* render, Render_Material_Ptr ptr);
 Render_Environment* render_environment_get(Render* render, Render_Environment_Ptr ptr);
+void render_queue_sort_expanded(Render_Command_Expanded* commands, isize count, bool is_parallel);
 
 
 Render_Environment* render_environment_get(Render* render, Render_Environment_Ptr ptr)
@@ -1733,19 +2784,39 @@ void render_queue_init(Render_Queue* buffers, Allocator* allocator, isize total_
         isize environemnt_count = environemnt_bytes / sizeof(Render_Environment);
 
         //If you dont want these arrays to grow you can give failing allocator.
-        array_init_with_capacity(&buffers->masks, allocator, command_cound);
         array_init_with_capacity(&buffers->transforms, allocator, command_cound);
         array_init_with_capacity(&buffers->expanded, allocator, command_cound);
-        array_init_with_capacity(&buffers->materials, allocator, material_count);
-        array_init_with_capacity(&buffers->geometries, allocator, geometry_count);
-        array_init_with_capacity(&buffers->environments, allocator, environemnt_count);
         array_init_with_capacity(&buffers->mono_queue, allocator, command_cound);
+        
+        //The streams are pushed to from many threads at once so they cannot share the 
+        // (not thread safe) render allocator. The first stream belongs to the main thread 
+        // which also receives all serial submissions so it gets the full capacity.
+        isize stream_count = parallel_thread_count();
+        array_init(&buffers->streams, allocator);
+        array_resize(&buffers->streams, stream_count);
+        for(isize i = 0; i < stream_count; i++)
+        {
+            Render_Queue_Stream* stream = &buffers->streams.data[i];
+            Allocator* stream_allocator = i == 0 ? allocator : allocator_get_malloc();
+            isize divisor = i == 0 ? 1 : stream_count;
+
+            array_init_with_capacity(&stream->masks, stream_allocator, command_cound / divisor);
+            array_init_with_capacity(&stream->transforms, stream_allocator, command_cound / divisor);
+            array_init_with_capacity(&stream->expanded, stream_allocator, command_cound / divisor);
+            array_init_with_capacity(&stream->materials, stream_allocator, material_count / divisor);
+            array_init_with_capacity(&stream->geometries, stream_allocator, geometry_count / divisor);
+            array_init_with_capacity(&stream->environments, stream_allocator, environemnt_count / divisor);
+        }
     }
 }
 
-void render_queue_submit_phong(Render* render, const Render_Phong_Command* command)
+//Submits the command into the stream of the given thread. Can be called concurrently 
+// as long as each thread uses its own thread_index (as given by parallel_for).
+void render_queue_submit_phong_on_thread(Render* render, const Render_Phong_Command* command, isize thread_index)
 {
-    Render_Queue* buffers = &render->render_queue;
+    Render_Queue* queue = &render->render_queue;
+    ASSERT(0 <= thread_index && thread_index < queue->streams.len);
+    Render_Queue_Stream* buffers = &queue->streams.data[thread_index];
     {
         //#if defined(DO_MONO_RENDER_QUEUE)
 
@@ -1765,11 +2836,12 @@ void render_queue_submit_phong(Render* render, const Render_Phong_Command* comma
             expanded.geometry = geometry;
             expanded.material = material;
             expanded.environment = environment;
-            expanded.transform_index = (i32) buffers->transforms.len;
+            expanded.transform_index = (i32) queue->transforms.len;
             expanded.geometry_batch_index = geometry_batch_index;
+            expanded.sort_key = render_command_sort_key(0, geometry_batch_index, geometry, material);
 
-            array_push(&buffers->transforms, command->transform);
-            array_push(&buffers->expanded, expanded);
+            array_push(&queue->transforms, command->transform);
+            array_push(&queue->expanded, expanded);
         }
 
         #else
@@ -1817,13 +2889,41 @@ void render_queue_submit_phong(Render* render, const Render_Phong_Command* comma
     }
 }
 
-void render_queue_expand(Render* render)
+void render_queue_submit_phong(Render* render, const Render_Phong_Command* command)
 {
-    PROFILE_START(render_queue_expand);
-    Render_Queue* buffers = &render->render_queue;
+    render_queue_submit_phong_on_thread(render, command, 0);
+}
+
+//Environments are few and change rarely so we simply number them in order of appearance
+enum {MAX_SORTED_ENVIRONMENTS = 64};
+
+typedef struct _Render_Queue_Expand_Context {
+    Render* render;
+    Render_Environment* seen_environments[MAX_SORTED_ENVIRONMENTS];
+    u32 seen_environments_count;
+    u32 _;
+    isize* transform_offsets;
+    isize* expanded_offsets;
+    PARALLEL_ATOMIC(isize) skipped_meshes_count;
+} _Render_Queue_Expand_Context;
+
+INTERNAL u32 _render_queue_environment_index(Render_Environment* const* seen_environments, u32 seen_environments_count, Render_Environment* environment)
+{
+    u32 environment_index = 0;
+    for(; environment_index < seen_environments_count; environment_index++)
+        if(seen_environments[environment_index] == environment)
+            break;
+
+    return environment_index;
+}
+
+//Expands the delta encoded stream into stream->expanded. 
+//transform_index is relative to the merged transforms array.
+INTERNAL isize _render_queue_expand_stream(_Render_Queue_Expand_Context* context, Render_Queue_Stream* buffers, isize transform_offset)
+{
+    Render* render = context->render;
     array_clear(&buffers->expanded);
-    
-    i32 skipped_meshes_count = 0;
+    isize skipped_meshes_count = 0;
     
     Render_Geometry* geometry = NULL;
     Render_Material* material = NULL;
@@ -1833,7 +2933,7 @@ void render_queue_expand(Render* render)
     i32 material_cursor = 0;
     i32 environment_cursor = 0;
     i32 geometry_batch_index = 0;
-
+    u32 environment_index = 0;
 
     for(isize i = 0; i < buffers->masks.len; i++)
     {
@@ -1862,6 +2962,7 @@ void render_queue_expand(Render* render)
             ASSERT(environment_cursor < buffers->environments.len);
             Render_Environment_Ptr environment_ptr = buffers->environments.data[environment_cursor++];
             environment = render_environment_get(render, environment_ptr);
+            environment_index = _render_queue_environment_index(context->seen_environments, context->seen_environments_count, environment);
         }
 
         if(geometry && material && environment)
@@ -1870,8 +2971,9 @@ void render_queue_expand(Render* render)
             expanded.geometry = geometry;
             expanded.material = material;
             expanded.environment = environment;
-            expanded.transform_index = (i32) i;
+            expanded.transform_index = (i32) (transform_offset + i);
             expanded.geometry_batch_index = geometry_batch_index;
+            expanded.sort_key = render_command_sort_key(environment_index, geometry_batch_index, geometry, material);
 
             array_push(&buffers->expanded, expanded);
         }
@@ -1881,34 +2983,601 @@ void render_queue_expand(Render* render)
         }
     }
 
-    if(skipped_meshes_count > 0)
-        LOG_WARN("render", "render_queue_expand detected %i / %i are invalid meshes!", (int) skipped_meshes_count, (int) buffers->masks.len);
-    PROFILE_STOP(render_queue_expand);
+    return skipped_meshes_count;
 }
 
-void render_queue_clear(Render_Queue* buffers)
+INTERNAL void _render_queue_expand_streams(void* context, isize from, isize to, isize thread_index)
 {
-    array_clear(&buffers->masks);
-    array_clear(&buffers->transforms);
-    array_clear(&buffers->expanded);
-    array_clear(&buffers->materials);
-    array_clear(&buffers->geometries);
-    array_clear(&buffers->environments);
+    (void) thread_index;
+    _Render_Queue_Expand_Context* c = (_Render_Queue_Expand_Context*) context;
+    Render_Queue* queue = &c->render->render_queue;
+    for(isize i = from; i < to; i++)
+    {
+        Render_Queue_Stream* stream = &queue->streams.data[i];
+        isize skipped = _render_queue_expand_stream(c, stream, c->transform_offsets[i]);
+        memcpy(queue->transforms.data + c->transform_offsets[i], stream->transforms.data, (size_t) array_byte_size(stream->transforms));
+        if(skipped > 0)
+            atomic_fetch_add(&c->skipped_meshes_count, skipped);
+    }
 }
 
-typedef struct Render_Memory_Budget {
-    isize geometry; 
-    isize texture;
-    isize instance_buffer;
-    isize draw_buffer; 
-    isize command_buffer;
-} Render_Memory_Budget;
+INTERNAL void _render_queue_merge_expanded(void* context, isize from, isize to, isize thread_index)
+{
+    (void) thread_index;
+    _Render_Queue_Expand_Context* c = (_Render_Queue_Expand_Context*) context;
+    Render_Queue* queue = &c->render->render_queue;
+    for(isize i = from; i < to; i++)
+    {
+        Render_Queue_Stream* stream = &queue->streams.data[i];
+        memcpy(queue->expanded.data + c->expanded_offsets[i], stream->expanded.data, (size_t) array_byte_size(stream->expanded));
+    }
+}
 
-void render_init(Render* render, Allocator* alloc, GL_Shader* blinn_phong, Render_Memory_Budget mem_budget)
+//Expands all streams and merges them into a single transforms and expanded arrays
+// in stream order. The streams are expanded in parallel. Since everything is
+// sorted afterwards the order of the streams does not matter for the result. 
+void render_queue_expand(Render* render)
 {
-    PROFILE_SCOPE() 
+    PROFILE_START(render_queue_expand);
+    SCRATCH_ARENA(arena)
     {
-        render->allocator = alloc ? alloc : allocator_get_default();
+        Render_Queue* queue = &render->render_queue;
+        isize stream_count = queue->streams.len;
+
+        _Render_Queue_Expand_Context context = {0};
+        context.render = render;
+
+        isize_Array transform_offsets = {arena.alloc};
+        isize_Array expanded_offsets = {arena.alloc};
+        array_resize(&transform_offsets, stream_count);
+        array_resize(&expanded_offsets, stream_count);
+        context.transform_offsets = transform_offsets.data;
+        context.expanded_offsets = expanded_offsets.data;
+
+        //Number the environments up front so that all streams agree on the indices.
+        //Only changes are stored so this touches very few entries.
+        isize command_count = 0;
+        for(isize i = 0; i < stream_count; i++)
+        {
+            Render_Queue_Stream* stream = &queue->streams.data[i];
+            transform_offsets.data[i] = command_count;
+            command_count += stream->masks.len;
+
+            for(isize k = 0; k < stream->environments.len; k++)
+            {
+                Render_Environment* environment = render_environment_get(render, stream->environments.data[k]);
+                u32 environment_index = _render_queue_environment_index(context.seen_environments, context.seen_environments_count, environment);
+                if(environment_index == context.seen_environments_count && context.seen_environments_count < MAX_SORTED_ENVIRONMENTS)
+                    context.seen_environments[context.seen_environments_count++] = environment;
+            }
+        }
+
+        array_resize_for_overwrite(&queue->transforms, command_count);
+        parallel_for(stream_count, 1, _render_queue_expand_streams, &context);
+        
+        isize expanded_count = 0;
+        for(isize i = 0; i < stream_count; i++)
+        {
+            expanded_offsets.data[i] = expanded_count;
+            expanded_count += queue->streams.data[i].expanded.len;
+        }
+
+        array_resize_for_overwrite(&queue->expanded, expanded_count);
+        parallel_for(stream_count, 1, _render_queue_merge_expanded, &context);
+
+        isize skipped_meshes_count = atomic_load(&context.skipped_meshes_count);
+        if(skipped_meshes_count > 0)
+            LOG_WARN("render", "render_queue_expand detected %i / %i are invalid meshes!", (int) skipped_meshes_count, (int) command_count);
+    }
+    PROFILE_STOP(render_queue_expand);
+}
+
+//The largest error of a lod on screen in half screen heights. About a pixel at 1080p.
+#define RENDER_LOD_MAX_SCREEN_ERROR (2.0f/1080)
+
+//What is needed to choose lods for a single camera
+typedef struct Render_Lod_View {
+    Vec3 eye;
+    f32 projection_scale; //1/tan(fov/2)
+    f32 max_screen_error;
+} Render_Lod_View;
+
+Render_Lod_View render_lod_view_make(Mat4 projection, Mat4 view)
+{
+    //Column major. The view is [R t] so the camera is at -R^T t.
+    const f32* v = (const f32*) (const void*) &view;
+    const f32* p = (const f32*) (const void*) &projection;
+    Render_Lod_View out = {0};
+    out.eye.x = -(v[0]*v[12] + v[1]*v[13] + v[2]*v[14]);
+    out.eye.y = -(v[4]*v[12] + v[5]*v[13] + v[6]*v[14]);
+    out.eye.z = -(v[8]*v[12] + v[9]*v[13] + v[10]*v[14]);
+    out.projection_scale = p[5];
+    out.max_screen_error = RENDER_LOD_MAX_SCREEN_ERROR;
+    return out;
+}
+
+//Chooses the lod of geometry drawn with transform whose world space bounds are center +- extent.
+//The distance is taken to the closest point of the bounds so that we never underestimate the error.
+i32 render_geometry_select_lod(const Render_Geometry* geometry, Mat4 transform, Vec3 center, Vec3 extent, const Render_Lod_View* view)
+{
+    const Render_Geometry_Batch_Index* group = &geometry->group;
+    if(group->lod_count <= 1)
+        return 0;
+
+    f32 dx = MAX(fabsf(center.x - view->eye.x) - extent.x, 0);
+    f32 dy = MAX(fabsf(center.y - view->eye.y) - extent.y, 0);
+    f32 dz = MAX(fabsf(center.z - view->eye.z) - extent.z, 0);
+    f32 distance = sqrtf(dx*dx + dy*dy + dz*dz);
+
+    const f32* m = (const f32*) (const void*) &transform;
+    f32 scale_x = m[0]*m[0] + m[1]*m[1] + m[2]*m[2];
+    f32 scale_y = m[4]*m[4] + m[5]*m[5] + m[6]*m[6];
+    f32 scale_z = m[8]*m[8] + m[9]*m[9] + m[10]*m[10];
+    f32 scale = sqrtf(MAX(MAX(scale_x, scale_y), scale_z));
+
+    return mesh_lod_select(group->lods, group->lod_count, scale, distance, view->projection_scale, view->max_screen_error);
+}
+
+//The number of pixels the bounds center +- extent span on a RENDER_STREAM_SCREEN_HEIGHT tall screen.
+//Assumes the uvs span the object once. Used to pick the mips of streamed textures.
+#define RENDER_STREAM_SCREEN_HEIGHT 1080
+
+f32 render_screen_footprint(Vec3 center, Vec3 extent, const Render_Lod_View* view)
+{
+    f32 radius = vec3_len(extent);
+    f32 distance = MAX(vec3_len(vec3_sub(center, view->eye)) - radius, 1e-3f);
+    return radius * view->projection_scale / distance * RENDER_STREAM_SCREEN_HEIGHT;
+}
+
+enum {RENDER_QUEUE_CULL_CHUNK = 256};
+
+typedef struct _Render_Queue_Cull_Context {
+    Frustum frustum;
+    Render_Lod_View lod_view;
+    u32 _;
+    Render_Command_Expanded* commands;
+    const Mat4* transforms;
+    u8* visible;
+    PARALLEL_ATOMIC(isize) visible_count;
+} _Render_Queue_Cull_Context;
+
+INTERNAL void _render_queue_cull_range(void* context, isize from, isize to, isize thread_index)
+{
+    (void) thread_index;
+    _Render_Queue_Cull_Context* c = (_Render_Queue_Cull_Context*) context;
+
+    f32 center_x[RENDER_QUEUE_CULL_CHUNK];
+    f32 center_y[RENDER_QUEUE_CULL_CHUNK];
+    f32 center_z[RENDER_QUEUE_CULL_CHUNK];
+    f32 extent_x[RENDER_QUEUE_CULL_CHUNK];
+    f32 extent_y[RENDER_QUEUE_CULL_CHUNK];
+    f32 extent_z[RENDER_QUEUE_CULL_CHUNK];
+
+    isize visible_count = 0;
+    for(isize chunk_from = from; chunk_from < to; chunk_from += RENDER_QUEUE_CULL_CHUNK)
+    {
+        isize chunk_count = MIN(to - chunk_from, RENDER_QUEUE_CULL_CHUNK);
+        for(isize i = 0; i < chunk_count; i++)
+        {
+            Render_Command_Expanded* command = &c->commands[chunk_from + i];
+            Mat4 transform = c->transforms[command->transform_index];
+            Vec3 center = {0};
+            Vec3 extent = {0};
+            frustum_transform_aabb(command->geometry->group.bounds, transform, &center, &extent);
+
+            //Lods are chosen for culled commands as well since it is cheaper than a second pass
+            i32 lod = render_geometry_select_lod(command->geometry, transform, center, extent, &c->lod_view);
+            command->sort_key = render_command_sort_key_set_lod(command->sort_key, lod);
+
+            center_x[i] = center.x;
+            center_y[i] = center.y;
+            center_z[i] = center.z;
+            extent_x[i] = extent.x;
+            extent_y[i] = extent.y;
+            extent_z[i] = extent.z;
+        }
+
+        Frustum_Cull_Boxes boxes = {center_x, center_y, center_z, extent_x, extent_y, extent_z, chunk_count};
+        visible_count += frustum_cull_boxes(&c->frustum, boxes, c->visible + chunk_from);
+    }
+
+    atomic_fetch_add(&c->visible_count, visible_count);
+}
+
+//Removes all expanded commands whose world space bounds lie outside the frustum 
+// of projection * view. The order of the remaining commands is kept.
+//Also chooses the lod of each command and stores it in its sort key.
+void render_queue_cull(Render_Queue* queue, Mat4 projection, Mat4 view)
+{
+    PROFILE_SCOPE()
+    SCRATCH_ARENA(arena)
+    {
+        isize count = queue->expanded.len;
+        u8_Array visible = {arena.alloc};
+        array_resize_for_overwrite(&visible, count);
+
+        _Render_Queue_Cull_Context context = {0};
+        context.frustum = frustum_from_matrix(mat4_mul(projection, view));
+        context.lod_view = render_lod_view_make(projection, view);
+        context.commands = queue->expanded.data;
+        context.transforms = queue->transforms.data;
+        context.visible = visible.data;
+        
+        isize batch_size = parallel_batch_size(count, 4, 4*RENDER_QUEUE_CULL_CHUNK);
+        parallel_for(count, batch_size, _render_queue_cull_range, &context);
+
+        isize kept = 0;
+        for(isize i = 0; i < count; i++)
+        {
+            if(visible.data[i])
+                queue->expanded.data[kept++] = queue->expanded.data[i];
+        }
+
+        ASSERT(kept == atomic_load(&context.visible_count));
+        array_resize(&queue->expanded, kept);
+        queue->visible_count = kept;
+        queue->culled_count = count - kept;
+    }
+}
+
+void render_queue_clear(Render_Queue* buffers)
+{
+    array_clear(&buffers->transforms);
+    array_clear(&buffers->expanded);
+    for(isize i = 0; i < buffers->streams.len; i++)
+    {
+        Render_Queue_Stream* stream = &buffers->streams.data[i];
+        array_clear(&stream->masks);
+        array_clear(&stream->transforms);
+        array_clear(&stream->expanded);
+        array_clear(&stream->materials);
+        array_clear(&stream->geometries);
+        array_clear(&stream->environments);
+    }
+}
+
+void render_scene_init(Render_Scene* scene, Allocator* allocator)
+{
+    memset(scene, 0, sizeof *scene);
+    array_init(&scene->instances, allocator);
+    array_init(&scene->free_indices, allocator);
+    array_init(&scene->transforms, allocator);
+    array_init(&scene->alive, allocator);
+    array_init(&scene->alive_slot_of, allocator);
+    array_init(&scene->alive_bounds, allocator);
+    array_init(&scene->alive_commands, allocator);
+    array_init(&scene->alive_keys, allocator);
+    array_init(&scene->moved, allocator);
+    array_init(&scene->query, allocator);
+    array_init(&scene->visible, allocator);
+    bvh_init(&scene->bvh, allocator);
+}
+
+void render_scene_deinit(Render_Scene* scene)
+{
+    array_deinit(&scene->instances);
+    array_deinit(&scene->free_indices);
+    array_deinit(&scene->transforms);
+    array_deinit(&scene->alive);
+    array_deinit(&scene->alive_slot_of);
+    array_deinit(&scene->alive_bounds);
+    array_deinit(&scene->alive_commands);
+    array_deinit(&scene->alive_keys);
+    array_deinit(&scene->moved);
+    array_deinit(&scene->query);
+    array_deinit(&scene->visible);
+    bvh_deinit(&scene->bvh);
+    memset(scene, 0, sizeof *scene);
+}
+
+INTERNAL Render_Scene_Instance* _render_scene_get(Render_Scene* scene, Render_Scene_Handle handle)
+{
+    if(handle.index >= (u32) scene->instances.len)
+        return NULL;
+
+    Render_Scene_Instance* instance = &scene->instances.data[handle.index];
+    if(instance->is_alive == false || instance->generation != handle.generation)
+        return NULL;
+
+    return instance;
+}
+
+Render_Scene_Handle render_scene_add(Render_Scene* scene, const Render_Phong_Command* command)
+{
+    u32 index = 0;
+    if(scene->free_indices.len > 0)
+        index = (u32) scene->free_indices.data[--scene->free_indices.len];
+    else
+    {
+        index = (u32) scene->instances.len;
+        array_resize(&scene->instances, scene->instances.len + 1);
+        array_resize(&scene->transforms, scene->transforms.len + 1);
+    }
+
+    Render_Scene_Instance* instance = &scene->instances.data[index];
+    instance->command = *command;
+    instance->generation += 1;
+    if(instance->generation == 0)
+        instance->generation = 1;
+    instance->is_alive = true;
+    scene->transforms.data[index] = command->transform;
+
+    scene->alive_count += 1;
+    scene->is_structure_dirty = true;
+
+    Render_Scene_Handle handle = {index, instance->generation};
+    return handle;
+}
+
+bool render_scene_remove(Render_Scene* scene, Render_Scene_Handle handle)
+{
+    Render_Scene_Instance* instance = _render_scene_get(scene, handle);
+    if(instance == NULL)
+        return false;
+
+    instance->is_alive = false;
+    array_push(&scene->free_indices, (i32) handle.index);
+    scene->alive_count -= 1;
+    scene->is_structure_dirty = true;
+    return true;
+}
+
+//Changes the transform only. This is a lot cheaper than render_scene_update.
+bool render_scene_update_transform(Render_Scene* scene, Render_Scene_Handle handle, Mat4 transform)
+{
+    Render_Scene_Instance* instance = _render_scene_get(scene, handle);
+    if(instance == NULL)
+        return false;
+
+    instance->command.transform = transform;
+    scene->transforms.data[handle.index] = transform;
+    array_push(&scene->moved, (i32) handle.index);
+    return true;
+}
+
+bool render_scene_update(Render_Scene* scene, Render_Scene_Handle handle, const Render_Phong_Command* command)
+{
+    Render_Scene_Instance* instance = _render_scene_get(scene, handle);
+    if(instance == NULL)
+        return false;
+
+    if(instance->command.geometry.id == command->geometry.id
+        && instance->command.material.id == command->material.id
+        && instance->command.environment.id == command->environment.id)
+        return render_scene_update_transform(scene, handle, command->transform);
+
+    instance->command = *command;
+    scene->transforms.data[handle.index] = command->transform;
+    scene->is_structure_dirty = true;
+    return true;
+}
+
+void render_scene_clear(Render_Scene* scene)
+{
+    for(isize i = 0; i < scene->instances.len; i++)
+    {
+        if(scene->instances.data[i].is_alive)
+        {
+            scene->instances.data[i].is_alive = false;
+            array_push(&scene->free_indices, (i32) i);
+        }
+    }
+
+    scene->alive_count = 0;
+    scene->is_structure_dirty = true;
+}
+
+INTERNAL AABB _render_scene_world_bounds(const Render_Command_Expanded* command, Mat4 transform)
+{
+    Vec3 center = {0};
+    Vec3 extent = {0};
+    frustum_transform_aabb(command->geometry->group.bounds, transform, &center, &extent);
+
+    AABB out = {vec3_sub(center, extent), vec3_add(center, extent)};
+    return out;
+}
+
+//Brings the visible commands of the scene up to date with the frustum of projection * view. 
+//Does nothing if neither the scene nor the frustum changed since the last call.
+void render_scene_prepare(Render* render, Render_Scene* scene, Mat4 projection, Mat4 view)
+{
+    PROFILE_SCOPE()
+    {
+        //Geometries and materials can change so the commands have to be resolved again
+        if(scene->resolved_generation != render->resource_generation)
+            scene->is_structure_dirty = true;
+
+        if(scene->is_structure_dirty)
+        {
+            PROFILE_SCOPE(render_scene_rebuild)
+            {
+                array_clear(&scene->alive);
+                array_resize(&scene->alive_slot_of, scene->instances.len);
+                for(isize i = 0; i < scene->alive_slot_of.len; i++)
+                    scene->alive_slot_of.data[i] = -1;
+                array_clear(&scene->alive_bounds);
+                array_clear(&scene->alive_commands);
+                array_clear(&scene->alive_keys);
+
+                //Environments are numbered in order of appearance just like in render_queue_expand.
+                //The numbering can differ from the queue which can only cause more batches, never wrong ones.
+                enum {MAX_SCENE_ENVIRONMENTS = 64};
+                Render_Environment* seen_environments[MAX_SCENE_ENVIRONMENTS] = {0};
+                u32 seen_environments_count = 0;
+                isize skipped_meshes_count = 0;
+                for(isize i = 0; i < scene->instances.len; i++)
+                {
+                    Render_Scene_Instance* instance = &scene->instances.data[i];
+                    if(instance->is_alive == false)
+                        continue;
+
+                    Render_Geometry* geometry = render_geometry_get(render, instance->command.geometry);
+                    Render_Material* material = render_material_get(render, instance->command.material);
+                    Render_Environment* environment = render_environment_get(render, instance->command.environment);
+                    if(geometry == NULL || material == NULL || environment == NULL)
+                    {
+                        skipped_meshes_count += 1;
+                        continue;
+                    }
+
+                    u32 environment_index = 0;
+                    for(; environment_index < seen_environments_count; environment_index++)
+                        if(seen_environments[environment_index] == environment)
+                            break;
+                    if(environment_index == seen_environments_count && seen_environments_count < MAX_SCENE_ENVIRONMENTS)
+                        seen_environments[seen_environments_count++] = environment;
+
+                    Render_Command_Expanded expanded = {0};
+                    expanded.geometry = geometry;
+                    expanded.material = material;
+                    expanded.environment = environment;
+                    expanded.transform_index = (i32) i;
+                    expanded.geometry_batch_index = geometry->group.batch_index;
+                    expanded.sort_key = render_command_sort_key(environment_index, expanded.geometry_batch_index, geometry, material);
+
+                    scene->alive_slot_of.data[i] = (i32) scene->alive.len;
+                    array_push(&scene->alive, (i32) i);
+                    array_push(&scene->alive_commands, expanded);
+                    array_push(&scene->alive_keys, expanded.sort_key);
+                    array_push(&scene->alive_bounds, _render_scene_world_bounds(&expanded, scene->transforms.data[i]));
+                }
+
+                if(skipped_meshes_count > 0)
+                    LOG_WARN("render", "render_scene_prepare detected %i / %i are invalid meshes!", (int) skipped_meshes_count, (int) scene->alive_count);
+
+                bvh_build(&scene->bvh, scene->alive_bounds.data, scene->alive_keys.data, scene->alive_bounds.len);
+            }
+
+            array_clear(&scene->moved);
+            scene->resolved_generation = render->resource_generation;
+            scene->is_structure_dirty = false;
+            scene->is_visible_dirty = true;
+        }
+
+        //Moved instances only need their bounds and the bvh nodes above them updated. 
+        //Instances that were skipped as invalid have no slot. 
+        //The same instance can be in moved multiple times which is harmless.
+        if(scene->moved.len > 0)
+        {
+            PROFILE_SCOPE(render_scene_refit)
+            {
+                //query is only used by the cull below so it serves as the list of moved alive slots 
+                array_clear(&scene->query);
+                for(isize i = 0; i < scene->moved.len; i++)
+                {
+                    i32 instance_index = scene->moved.data[i];
+                    i32 alive_index = scene->alive_slot_of.data[instance_index];
+                    if(alive_index >= 0)
+                    {
+                        scene->alive_bounds.data[alive_index] = _render_scene_world_bounds(&scene->alive_commands.data[alive_index], scene->transforms.data[instance_index]);
+                        array_push(&scene->query, alive_index);
+                    }
+                }
+
+                bvh_refit_items(&scene->bvh, scene->alive_bounds.data, scene->query.data, scene->query.len);
+            }
+
+            array_clear(&scene->moved);
+            scene->is_visible_dirty = true;
+        }
+
+        Frustum frustum = frustum_from_matrix(mat4_mul(projection, view));
+        if(memcmp(&frustum, &scene->visible_frustum, sizeof frustum) != 0)
+            scene->is_visible_dirty = true;
+
+        if(scene->is_visible_dirty)
+        {
+            PROFILE_SCOPE(render_scene_cull)
+            {
+                array_clear(&scene->query);
+                bvh_query_frustum(&scene->bvh, scene->alive_bounds.data, &frustum, &scene->query);
+            
+                //The frustum changes whenever the camera moves so this is also when the lods change
+                Render_Lod_View lod_view = render_lod_view_make(projection, view);
+                array_resize_for_overwrite(&scene->visible, scene->query.len);
+                for(isize i = 0; i < scene->query.len; i++)
+                {
+                    i32 alive_index = scene->query.data[i];
+                    Render_Command_Expanded command = scene->alive_commands.data[alive_index];
+                    AABB bounds = scene->alive_bounds.data[alive_index];
+                    Vec3 center = vec3_scale(vec3_add(bounds.min, bounds.max), 0.5f);
+                    Vec3 extent = vec3_scale(vec3_sub(bounds.max, bounds.min), 0.5f);
+                    Mat4 transform = scene->transforms.data[scene->alive.data[alive_index]];
+                    
+                    i32 lod = render_geometry_select_lod(command.geometry, transform, center, extent, &lod_view);
+                    command.sort_key = render_command_sort_key_set_lod(command.sort_key, lod);
+                    scene->visible.data[i] = command;
+                }
+            }
+
+            render_queue_sort_expanded(scene->visible.data, scene->visible.len, true);
+            scene->visible_frustum = frustum;
+            scene->visible_generation += 1;
+            scene->is_visible_dirty = false;
+        }
+    }
+}
+
+//Initializes the cpu side storage used by render_build_batches. 
+//Is separate from render_init so the building can be run without opengl.
+void render_build_init(Render* render)
+{
+    array_init(&render->render_per_batch, render->allocator);
+    array_init(&render->batch_runs, render->allocator);
+    array_init(&render->batch_builders, render->allocator);
+    array_resize(&render->batch_builders, parallel_thread_count());
+    for(isize i = 0; i < render->batch_builders.len; i++)
+    {
+        //Only the calling thread may use the render allocator
+        Allocator* allocator = i == 0 ? render->allocator : allocator_get_malloc();
+        array_init(&render->batch_builders.data[i].batches, allocator);
+        array_init(&render->batch_builders.data[i].draws, allocator);
+    }
+}
+
+typedef struct Render_Memory_Budget {
+    isize geometry; 
+    isize texture;
+    isize instance_buffer;
+    isize draw_buffer; 
+    isize command_buffer;
+    isize upload_ring;
+    isize texture_stream; //of the texture memory how much can the streamed mips use. 0 disables streaming
+} Render_Memory_Budget;
+
+u64 render_gl_fence_insert(void* context)
+{
+    (void) context;
+    GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    return (u64) fence;
+}
+
+void render_gl_fence_wait(void* context, u64 fence_handle)
+{
+    (void) context;
+    GLsync fence = (GLsync) fence_handle;
+    PROFILE_SCOPE()
+    {
+        //Only flush on the first try. The timeout is in nanoseconds.
+        GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+        for(;;)
+        {
+            GLenum state = glClientWaitSync(fence, flags, 1000*1000*1000);
+            if(state == GL_ALREADY_SIGNALED || state == GL_CONDITION_SATISFIED || state == GL_WAIT_FAILED)
+                break;
+
+            flags = 0;
+            LOG_WARN("render", "waiting for upload ring fence for over a second");
+        }
+        glDeleteSync(fence);
+    }
+}
+
+void render_init(Render* render, Allocator* alloc, GL_Shader* blinn_phong, Render_Memory_Budget mem_budget)
+{
+    PROFILE_SCOPE() 
+    {
+        render->allocator = alloc ? alloc : allocator_get_default();
 
         isize max_num_instances = mem_budget.instance_buffer / (sizeof(Blinn_Phong_Per_Instance) + sizeof(Render_Per_Instance));
         isize max_num_draws = mem_budget.draw_buffer / (sizeof(Blinn_Phong_Per_Draw) + sizeof(Render_Per_Draw) + sizeof(Gl_Draw_Elements_Indirect_Command));
@@ -1918,28 +3587,63 @@ void render_init(Render* render, Allocator* alloc, GL_Shader* blinn_phong, Rende
         array_init_with_capacity(&render->render_per_instance, render->allocator, max_num_instances);
         array_init_with_capacity(&render->render_per_draw, render->allocator, max_num_draws);
         array_init_with_capacity(&render->indirect_draws, render->allocator, max_num_draws);
+        render_build_init(render);
         //Allocator* failing = allocator_get_failing();
 
         //@TODO: budget?
         stable_array_init(&render->textures, render->allocator, sizeof(Render_Texture));
-        stable_array_init(&render->geometries, render->allocator, sizeof(Render_Material));
-        stable_array_init(&render->materials, render->allocator, sizeof(Render_Geometry));
+        stable_array_init(&render->geometries, render->allocator, sizeof(Render_Geometry));
+        stable_array_init(&render->materials, render->allocator, sizeof(Render_Material));
 
-        render->buffer_command = gl_buffer_make(sizeof(Gl_Draw_Elements_Indirect_Command), max_num_draws, NULL, false);
-        render->buffer_instance = gl_buffer_make(sizeof(Blinn_Phong_Per_Instance), max_num_instances, NULL, false);
+        //The buffers start with the (zeroed) contents of their shadows so that both agree from the start
+        buffer_shadow_init(&render->shadow_command, render->allocator, sizeof(Gl_Draw_Elements_Indirect_Command) * max_num_draws);
+        buffer_shadow_init(&render->shadow_instance, render->allocator, sizeof(Blinn_Phong_Per_Instance) * max_num_instances);
+        buffer_shadow_init(&render->shadow_draw_uniform, render->allocator, sizeof(Blinn_Phong_Per_Draw) * max_num_draws);
+
+        render->buffer_command = gl_buffer_make(sizeof(Gl_Draw_Elements_Indirect_Command), max_num_draws, render->shadow_command.data.data, false);
+        render->buffer_instance = gl_buffer_make(sizeof(Blinn_Phong_Per_Instance), max_num_instances, render->shadow_instance.data.data, false);
         render->buffer_environment_uniform = gl_buffer_make(sizeof(Blinn_Phong_Per_Batch), 1, NULL, false);
-        render->buffer_draw_uniform = gl_buffer_make(sizeof(Blinn_Phong_Per_Draw), max_num_draws, NULL, false);
+
+        //Each cluster can contain at most all lights
+        light_clusters_init(&render->light_clusters, render->allocator);
+        render->buffer_light_ranges = gl_buffer_make(sizeof(Light_Cluster_Range), LIGHT_CLUSTER_COUNT, NULL, false);
+        render->buffer_light_indices = gl_buffer_make(sizeof(u32), LIGHT_CLUSTER_COUNT*MAX_LIGHTS, NULL, false);
+
+        //The ring stays mapped for the whole lifetime. Coherent so that written data needs no explicit flush.
+        {
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glCreateBuffers(1, &render->upload_ring_handle);
+            glNamedBufferStorage(render->upload_ring_handle, mem_budget.upload_ring, NULL, flags);
+            void* mapped = glMapNamedBufferRange(render->upload_ring_handle, 0, mem_budget.upload_ring, flags);
+            ASSERT(mapped != NULL, "failed to map the upload ring of size %lli", (lli) mem_budget.upload_ring);
+
+            Upload_Ring_Sync sync = {NULL, render_gl_fence_insert, render_gl_fence_wait};
+            upload_ring_init(&render->upload_ring, mapped, mem_budget.upload_ring, sync);
+
+            GLint alignment = 0;
+            glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+            render->uniform_offset_alignment = MAX(alignment, 16);
+        }
+        render->buffer_draw_uniform = gl_buffer_make(sizeof(Blinn_Phong_Per_Draw), max_num_draws, render->shadow_draw_uniform.data.data, false);
 
         render_texture_manager_init(&render->texture_manager, render->allocator, mem_budget.texture);
         render_geometry_manager_init(&render->geometry_manager, render->allocator, &render->buffer_instance, mem_budget.geometry);
         render_texture_manager_add_default_resolutions(&render->texture_manager, 1.0f);
+        texture_stream_init(&render->texture_stream, render->allocator, mem_budget.texture_stream, RENDER_TEXTURE_LOADER_CAPACITY);
+        array_init(&render->streamed_textures, render->allocator);
+        array_init(&render->stream_events, render->allocator);
+        if(mem_budget.texture_stream > 0)
+            render_texture_loader_init(&render->texture_loader);
         render_queue_init(&render->render_queue, render->allocator, mem_budget.command_buffer);
+        render_scene_init(&render->scene, render->allocator);
 
         render->shader_blinn_phong = *blinn_phong;
 
     
         render->uniform_block_draw = shader_storage_block_make(render->shader_blinn_phong.handle, "Params", 0, render->buffer_draw_uniform.handle);
         render->uniform_block_environment = uniform_block_make(render->shader_blinn_phong.handle, "Environment", 1, render->buffer_environment_uniform.handle);
+        render->storage_block_light_ranges = shader_storage_block_make(render->shader_blinn_phong.handle, "Light_Ranges", 2, render->buffer_light_ranges.handle);
+        render->storage_block_light_indices = shader_storage_block_make(render->shader_blinn_phong.handle, "Light_Indices", 3, render->buffer_light_indices.handle);
     }
 }
 
@@ -2046,358 +3750,933 @@ int command_buffer_compare_func(const void* a_, const void* b_)
     return sign_64(a->material - b->material);
 }
 
-void render_render(Render* render, Camera camera)
+//Stably sorts the commands by their sort_key using radix sort on (key, index) pairs.
+void render_queue_sort_expanded(Render_Command_Expanded* commands, isize count, bool is_parallel)
 {
-    PROFILE_SCOPE() 
+    PROFILE_SCOPE()
+    SCRATCH_ARENA(arena)
     {
-        //@TODO get from environment
-        Mat4 view = camera_make_view_matrix(camera);
-        Mat4 projection = camera_make_projection_matrix(camera);
-
-        Render_Queue* buffers = &render->render_queue;
-    
-        #if !defined(DO_MONO_EXPANDED_QUEUE)
-        render_queue_expand(render);
-        #endif
+        Array(Radix_Sort_Pair) pairs = {arena.alloc};
+        Array(Radix_Sort_Pair) temp = {arena.alloc};
+        array_resize_for_overwrite(&pairs, count);
+        array_resize_for_overwrite(&temp, count);
+        for(isize i = 0; i < count; i++)
+        {
+            pairs.data[i].key = commands[i].sort_key;
+            pairs.data[i].index = i;
+        }
 
-        PROFILE_SCOPE(sort) 
-            qsort(buffers->expanded.data, buffers->expanded.len, sizeof *buffers->expanded.data, command_buffer_compare_func);
+        if(is_parallel)
+            radix_sort_pairs_parallel(pairs.data, temp.data, count);
+        else
+            radix_sort_pairs(pairs.data, temp.data, count);
 
-        glEnable(GL_DEPTH_TEST); 
-        glEnable(GL_CULL_FACE);  
-        glCullFace(GL_BACK);
-        glFrontFace(GL_CCW);
-    
-        typedef struct Render_Per_Batch {
-            i32 texture_slots[MAX_TEXTURE_SLOTS];
-            i32 used_texture_slots;
+        Render_Command_Expanded_Array sorted = {arena.alloc};
+        array_resize_for_overwrite(&sorted, count);
+        for(isize i = 0; i < count; i++)
+            sorted.data[i] = commands[pairs.data[i].index];
 
-            i32 geometry_batch_index;
-            //@TODO
-            Render_Environment* environment;
-            GL_Shader* shader;
-        } Render_Per_Batch;
+        memcpy(commands, sorted.data, (size_t) array_byte_size(sorted));
+    }
+}
 
-        Render_Per_Draw_Array* batch_draws = &render->render_per_draw;
-        Render_Per_Instance_Array* batch_instances = &render->render_per_instance;
+//Merges the sorted visible commands of the scene into the sorted expanded commands of the queue.
+//The scene transforms are appended to the queue transforms.
+void render_queue_merge_scene(Render_Queue* queue, const Render_Scene* scene)
+{
+    PROFILE_SCOPE()
+    SCRATCH_ARENA(arena)
+    {
+        i32 transform_offset = (i32) queue->transforms.len;
+        array_resize_for_overwrite(&queue->transforms, queue->transforms.len + scene->transforms.len);
+        memcpy(queue->transforms.data + transform_offset, scene->transforms.data, (size_t) array_byte_size(scene->transforms));
+        
+        Render_Command_Expanded_Array merged = {arena.alloc};
+        array_resize_for_overwrite(&merged, queue->expanded.len + scene->visible.len);
 
-        i32 not_found_textures = 0;
-        for(isize j = 0; j < buffers->expanded.len; )
+        isize from_queue = 0;
+        isize from_scene = 0;
+        for(isize i = 0; i < merged.len; i++)
         {
-            PROFILE_START(batch_prepare);
-
-            Render_Command_Expanded first = buffers->expanded.data[j];
+            bool take_queue = from_scene >= scene->visible.len 
+                || (from_queue < queue->expanded.len && queue->expanded.data[from_queue].sort_key <= scene->visible.data[from_scene].sort_key);
 
-            Render_Per_Batch batch = {0};
-            array_clear(batch_draws);
-            array_clear(batch_instances);
-
-            batch.geometry_batch_index = first.geometry->group.batch_index;
-            batch.environment = first.environment;
-            batch.shader = NULL; //@TODO
-
-            Render_Per_Draw prev_draw = {0};
-            isize k = j;
-            for(; k < buffers->expanded.len; k++)
+            if(take_queue)
+                merged.data[i] = queue->expanded.data[from_queue++];
+            else
             {
-                Render_Command_Expanded curr = buffers->expanded.data[k];   
-                Mat4 curr_transform = buffers->transforms.data[curr.transform_index];
-
-                //If differs too much end the batch
-                if(curr.geometry_batch_index != first.geometry_batch_index || 
-                    curr.environment != first.environment)
-                    goto end_batch;
-                
-                //If draws or isntances would no longer fit into the gpu buffers
-                // end the batch.
-                if(batch_draws->len >= render->buffer_draw_uniform.item_count
-                    || batch_instances->len >= render->buffer_instance.item_count)
-                {
-                    ASSERT(batch_draws->len == render->buffer_draw_uniform.item_count || batch_instances->len == render->buffer_instance.item_count);
-                    goto end_batch;
-                }
+                merged.data[i] = scene->visible.data[from_scene++];
+                merged.data[i].transform_index += transform_offset;
+            }
+        }
 
-                bool push_new_draw = false;
-                Render_Per_Draw new_draw = {0}; //@TODO: modify directly draw
+        array_resize_for_overwrite(&queue->expanded, merged.len);
+        memcpy(queue->expanded.data, merged.data, (size_t) array_byte_size(merged));
+    }
+}
 
-                //if geoemtries or matterials differ add new draw
-                if(curr.material != prev_draw.material)
-                {
-                    push_new_draw = true;
+//Looks up the textures of the material and stores where they live into material->binding.
+//Must be called after changing the textures of a material which was already rendered.
+void render_material_bind_textures(Render* render, Render_Material* material)
+{
+    Render_Material_Binding binding = {0};
+    binding.bound_textures = material->used_textures;
+    for(isize i = 0; i < material->used_textures; i++)
+    {
+        Render_Texture* texture = render_texture_get(render, material->textures[i]);
+        if(!texture)
+        {
+            binding.not_found_textures += 1;
+            continue;
+        }
 
-                    //We prohibit a single material with too many textures to be rendered!
-                    isize used_textures = curr.material->used_textures;
-                    (void) used_textures; //@TODO
-                    
-                    //material changed so we analyze anew its textures
-                    //Go through all of the materials textures and check if it was added
-                    //If not add it. If too full end the batch early.
-                    for(isize tex_i = 0; tex_i < curr.material->used_textures; tex_i ++)
-                    {
-                        Render_Texture_Ptr texture_ptr = curr.material->textures[tex_i];
-                        Render_Texture* texture = render_texture_get(render, texture_ptr);
-                        if(!texture)
-                            not_found_textures += 1;
-                        else
-                        {
-                            i32 resolution_index = texture->layer.resolution_index;
-                            ASSERT(resolution_index > 0, "valid textures must have valid res index. index %d", resolution_index);
-
-                            //We use dense hashtable to acelaret the search
-                            // Start at the has for the texture (its id can be used as hash)
-                            // and iterate unill we have either 
-                            // 1) iterated the whole array
-                            // 2) found it
-                            // 3) found empty index (thus this hash couldnt have been added before)
-                            //bool was_texture_found = false;
-                            //u64 slot_at = 0;
-                            //for(u64 iter = 0; iter < MAX_TEXTURE_SLOTS; iter++)
-                            //{
-                            //    slot_at = ((u64) texture_ptr.id + iter) % MAX_TEXTURE_SLOTS;
-                            //    if(batch.texture_slots[slot_at] == 0)
-                            //        break;
-                            //    if(batch.texture_slots[slot_at] == resolution_index)
-                            //    {
-                            //        was_texture_found = true;
-                            //        break;
-                            //    }
-                            //}
-
-                            i32 found = 0;
-                            for(i32 iter = 0; iter < batch.used_texture_slots; iter++)
-                            {
-                                if(batch.texture_slots[iter] == resolution_index)
-                                {
-                                    found = iter + 1;
-                                    break;
-                                }
-                            }
-
-                            //If not found add it
-                            if(!found)
-                            {
-                                //If we have too many textures end the batch
-                                if(batch.used_texture_slots >= MAX_TEXTURE_SLOTS)
-                                    goto end_batch;
-
-                                //ASSERT(slot_at < MAX_TEXTURE_SLOTS);
-                                //batch.texture_slots[slot_at] = resolution_index;
-                                //batch.used_texture_slots += 1;
-
-                                //This is slightly confusing configuration with all the indexes flying about but...
-                                // the draw should have its textures in the exact same order as within the material.
-                                //Therefor we assign to index tex_i (the index of the current texture)
-                                // and link it to the slot_at and appropriate texture layer.
-                                //new_draw.compressed_texture_layers[tex_i] = COMPRESS_TEXTURE_LAYER(texture->layer.layer, slot_at);
-
-                                batch.texture_slots[batch.used_texture_slots] = resolution_index;
-                                batch.used_texture_slots += 1;
-                                found = batch.used_texture_slots;
-                            }
-                        
-                            new_draw.bound_textures[tex_i].layer = texture->layer.layer;
-                            new_draw.bound_textures[tex_i].resolution_index = found;
-                        }
-                    }
-                }
-                else if(curr.geometry != prev_draw.geometry)
-                {
-                    if(curr.material == prev_draw.material)
-                        memcpy(new_draw.bound_textures, prev_draw.bound_textures, sizeof prev_draw.bound_textures);
-                    push_new_draw = true;
-                }
+        i32 resolution_index = texture->layer.resolution_index;
+        ASSERT(resolution_index > 0, "valid textures must have valid res index. index %d", resolution_index);
+        binding.layers[i] = texture->layer;
+        binding.uvs[i] = texture->uv;
+        if(texture->stream_index > 0)
+            binding.min_mips[i] = (u8) render->texture_stream.textures.data[texture->stream_index - 1].resident_mip;
 
-                if(batch_draws->len == 0)
-                    ASSERT(push_new_draw);
+        bool is_new = true;
+        for(i32 r = 0; r < binding.resolution_count; r++)
+            is_new = is_new && binding.resolutions[r] != resolution_index;
 
-                if(push_new_draw)
-                {
-                    new_draw.material = curr.material;
-                    new_draw.geometry = curr.geometry;
-                    new_draw.instance_from = (i32) batch_instances->len;
-                    prev_draw = new_draw;
-                    array_push(batch_draws, new_draw);
-                }
+        if(is_new)
+            binding.resolutions[binding.resolution_count++] = resolution_index;
+    }
 
-                ASSERT(batch_draws->len > 0);
+    material->binding = binding;
+}
 
-                Render_Per_Instance instance = {0};
-                instance.model = curr_transform;
-                array_push(batch_instances, instance);
-            }
+//Rebinds all materials if any textures or materials were added since the last call.
+void render_material_bindings_update(Render* render)
+{
+    if(render->bound_generation == render->binding_generation)
+        return;
 
-            end_batch:
-        
+    PROFILE_SCOPE()
+    {
+        STABLE_ARRAY_FOR_EACH_BEGIN(render->materials, Render_Material*, material, isize, index)
+            render_material_bind_textures(render, material);
+        STABLE_ARRAY_FOR_EACH_END
+        render->bound_generation = render->binding_generation;
+    }
+}
+
+INTERNAL isize _render_texture_slot_hash(i32 resolution_index)
+{
+    return (isize) (((u32) resolution_index * 2654435761u) >> 26) & (TEXTURE_SLOT_TABLE_SIZE - 1);
+}
+
+//Returns the slot of the resolution within the batch plus one or 0 if not present.
+INTERNAL i32 _render_texture_slot_find(const Render_Per_Batch* batch, i32 resolution_index)
+{
+    for(isize i = _render_texture_slot_hash(resolution_index);; i = (i + 1) & (TEXTURE_SLOT_TABLE_SIZE - 1))
+    {
+        i32 slot = batch->texture_slot_table[i];
+        if(slot == 0 || batch->texture_slots[slot - 1] == resolution_index)
+            return slot;
+    }
+}
+
+//Adds resolution which must not be present. Returns its slot plus one.
+INTERNAL i32 _render_texture_slot_add(Render_Per_Batch* batch, i32 resolution_index)
+{
+    ASSERT(batch->used_texture_slots < MAX_TEXTURE_SLOTS);
+    isize i = _render_texture_slot_hash(resolution_index);
+    while(batch->texture_slot_table[i] != 0)
+        i = (i + 1) & (TEXTURE_SLOT_TABLE_SIZE - 1);
+
+    batch->texture_slots[batch->used_texture_slots] = resolution_index;
+    batch->used_texture_slots += 1;
+    batch->texture_slot_table[i] = (u8) batch->used_texture_slots;
+    return batch->used_texture_slots;
+}
+
+typedef struct _Render_Build_Context {
+    Render* render;
+    const Render_Command_Expanded* commands;
+    const Mat4* transforms;
+    isize command_count;
+} _Render_Build_Context;
 
-            //Only now we prepare the OPENGL specific buffers
-            //@NOTE: 
-            //THE FOLLOWING IS VERY SPECIFIC TO OUR CURRENT SHADERS!
-            //Also at this point we could push all finalized batches into a buffer 
-            // and then have a separet loop execute all the draw commands. Howver we can use 
-            // the fact that gl functions are async to overlap the rendering time with 
-            // prepering the next batch draw.
+//Builds the batches of a single run into the builder of the thread. 
+//The instance of the i-th command is always the i-th instance so it is written directly.
+INTERNAL void _render_build_run(_Render_Build_Context* c, Render_Batch_Builder* builder, Render_Batch_Run* run)
+{
+    Render* render = c->render;
+    const Render_Command_Expanded* commands = c->commands;
+    const Mat4* transforms = c->transforms;
+
+    run->batch_from = builder->batches.len;
+    run->draw_from = builder->draws.len;
+    for(isize j = run->command_from; j < run->command_to; )
+    {
+        Render_Command_Expanded first = commands[j];
+
+        Render_Per_Batch batch = {0};
+        batch.geometry_batch_index = first.geometry->group.batch_index;
+        batch.environment = first.environment;
+        batch.shader = NULL; //@TODO
+        batch.draw_from = (i32) builder->draws.len;
 
-            //@NOTE: we dont currently use blinn_phong_per_instance at all since the ata required is the same as batch_instances.
-            //array_resize_for_overwrite(&render->blinn_phong_per_instance, batch_instances);
+        Render_Per_Draw prev_draw = {0};
+        isize k = j;
+        for(; k < run->command_to; k++)
+        {
+            Render_Command_Expanded curr = commands[k];   
+            Mat4 curr_transform = transforms[curr.transform_index];
+            ASSERT(curr.geometry_batch_index == first.geometry_batch_index && curr.environment == first.environment, 
+                "runs must not contain batch boundaries");
 
-            array_resize_for_overwrite(&render->blinn_phong_per_draw, batch_draws->len);
-            array_resize_for_overwrite(&render->indirect_draws, batch_draws->len);
+            bool push_new_draw = false;
+            Render_Per_Draw new_draw = {0}; //@TODO: modify directly draw
 
-            ASSERT(render->indirect_draws.len >= batch_draws->len);
-            Gl_Draw_Elements_Indirect_Command* indirect_commands = render->indirect_draws.data;
-            for(u32 i = 0; i < (u32) batch_draws->len; i++)
+            //if geoemtries or matterials differ add new draw
+            if(curr.material != prev_draw.material)
             {
-                Render_Per_Draw* draw = &batch_draws->data[i];
-                Render_Geometry_Batch_Index* geometry = &draw->geometry->group;
+                push_new_draw = true;
+                const Render_Material_Binding* binding = &curr.material->binding;
+                ASSERT(binding->bound_textures == curr.material->used_textures, 
+                    "render_material_bind_textures must be called after changing textures of material");
+                builder->not_found_textures += binding->not_found_textures;
+
+                //If the resolutions the batch is missing dont fit end the batch early.
+                i32 missing = 0;
+                for(i32 r = 0; r < binding->resolution_count; r++)
+                    missing += _render_texture_slot_find(&batch, binding->resolutions[r]) == 0;
+
+                if(batch.used_texture_slots + missing > MAX_TEXTURE_SLOTS)
+                    goto end_batch;
 
-                indirect_commands[i].first_index = geometry->index_from;
-                indirect_commands[i].count = geometry->index_count;
-                indirect_commands[i].base_instance = draw->instance_from;
-                indirect_commands[i].base_vertex = geometry->vertex_from;
+                for(i32 r = 0; r < binding->resolution_count; r++)
+                    if(_render_texture_slot_find(&batch, binding->resolutions[r]) == 0)
+                        _render_texture_slot_add(&batch, binding->resolutions[r]);
 
-                //@TODO: this can be solved in some better way.
-                if(i != batch_draws->len - 1)
-                {
-                    Render_Per_Draw* next_draw = &batch_draws->data[i + 1];
-                    indirect_commands[i].instance_count = next_draw->instance_from - draw->instance_from;
-                }
-                else
+                //The draw has its textures in the exact same order as the material.
+                //Each refers to its layer and the batch slot of its resolution.
+                for(isize tex_i = 0; tex_i < binding->bound_textures; tex_i++)
                 {
-                    indirect_commands[i].instance_count = (GLuint) (batch_instances->len - draw->instance_from);
+                    Render_Texture_Layer layer = binding->layers[tex_i];
+                    if(layer.resolution_index != 0)
+                    {
+                        new_draw.bound_textures[tex_i].layer = layer.layer;
+                        new_draw.bound_textures[tex_i].resolution_index = _render_texture_slot_find(&batch, layer.resolution_index);
+                    }
                 }
             }
-                
-        
-            ASSERT(render->blinn_phong_per_draw.len >= batch_draws->len);
-            //Blinn_Phong_Per_Draw* blinn_per_draw = render->blinn_phong_per_draw.data;
-            for(isize i = 0; i < batch_draws->len; i++)
+            else if(curr.geometry != prev_draw.geometry || render_command_sort_key_lod(curr.sort_key) != prev_draw.lod)
             {
-                Render_Per_Draw* draw = &batch_draws->data[i];
-                Render_Material* material = draw->material;
-                Blinn_Phong_Per_Draw* blinn = &render->blinn_phong_per_draw.data[i];
-                blinn->diffuse_color = (Vec4){material->diffuse_color};
-                blinn->specular_color = (Vec4){material->specular_color};
-                blinn->ambient_color = (Vec4){material->ambient_color};
-                blinn->specular_exponent = material->specular_exponent;
-                blinn->metallic = material->metallic;
-                //@TODO: strcuture
-                #define COMPRESS_TEXTURE_LAYER(layer, slot_at) (i32) ((u32) (layer) | ((u32) (slot_at) << 16))
-                #define COMPRESS_TEXTURE_LAYER2(layer_struct) COMPRESS_TEXTURE_LAYER(layer_struct.layer, layer_struct.resolution_index)
-
-                blinn->map_diffuse =  COMPRESS_TEXTURE_LAYER2(draw->bound_textures[0]);
-                blinn->map_specular = COMPRESS_TEXTURE_LAYER2(draw->bound_textures[1]);
+                if(curr.material == prev_draw.material)
+                    memcpy(new_draw.bound_textures, prev_draw.bound_textures, sizeof prev_draw.bound_textures);
+                push_new_draw = true;
             }
 
-            Blinn_Phong_Per_Batch blinn_environment = {0};
+            if(builder->draws.len == batch.draw_from)
+                ASSERT(push_new_draw);
+
+            if(push_new_draw)
             {
-                blinn_environment.light_quadratic_attentuation = 0.05f;
-                blinn_environment.base_illumination = vec4_of(0.5f);
-                blinn_environment.projection = projection; 
-                blinn_environment.view = view; 
-                blinn_environment.view_pos = (Vec4){camera.pos};
-
-                blinn_environment.lights_count = 2;
-                blinn_environment.lights[0].color_and_radius = vec4(10, 8, 7, 0);
-                blinn_environment.lights[0].pos_and_range = vec4(40, 20, -10, 100);
-                    
-                blinn_environment.lights[1].color_and_radius = vec4(8, 10, 8.5f, 0);
-                blinn_environment.lights[1].pos_and_range = vec4(0, 0, 10, 100);
+                new_draw.material = curr.material;
+                new_draw.geometry = curr.geometry;
+                new_draw.lod = render_command_sort_key_lod(curr.sort_key);
+                new_draw.instance_from = (i32) k;
+                prev_draw = new_draw;
+                array_push(&builder->draws, new_draw);
             }
+
+            ASSERT(builder->draws.len > 0);
+
+            Render_Per_Instance instance = {0};
+            instance.model = curr_transform;
+
+            //Packed positions are in [0, 1]^3 relative to the bounds. Fold the dequantization into the model matrix.
+            if(curr.geometry->group.is_packed)
+            {
+                AABB bounds = curr.geometry->group.bounds;
+                Mat4 dequantize = mat4_translate(mat4_scaling(vec3_sub(bounds.max, bounds.min)), bounds.min);
+                instance.model = mat4_mul(curr_transform, dequantize);
+            }
+            render->render_per_instance.data[k] = instance;
+        }
+
+        end_batch:
+        ASSERT(k > j, "A single material must not use more than MAX_TEXTURE_SLOTS texture arrays");
+        batch.draw_count = (i32) builder->draws.len - batch.draw_from;
+        array_push(&builder->batches, batch);
+        j = k;
+    }
+
+    run->batch_count = builder->batches.len - run->batch_from;
+    run->draw_count = builder->draws.len - run->draw_from;
+}
+
+INTERNAL void _render_build_runs(void* context, isize from, isize to, isize thread_index)
+{
+    _Render_Build_Context* c = (_Render_Build_Context*) context;
+    Render_Batch_Builder* builder = &c->render->batch_builders.data[thread_index];
+    for(isize i = from; i < to; i++)
+    {
+        Render_Batch_Run* run = &c->render->batch_runs.data[i];
+        run->thread_index = thread_index;
+        _render_build_run(c, builder, run);
+    }
+}
+
+//Moves the batches and draws of each run from its builder to their place in the frame.
+INTERNAL void _render_build_gather(void* context, isize from, isize to, isize thread_index)
+{
+    (void) thread_index;
+    _Render_Build_Context* c = (_Render_Build_Context*) context;
+    Render* render = c->render;
+    for(isize i = from; i < to; i++)
+    {
+        Render_Batch_Run run = render->batch_runs.data[i];
+        Render_Batch_Builder* builder = &render->batch_builders.data[run.thread_index];
+        memcpy(render->render_per_draw.data + run.global_draw_from, builder->draws.data + run.draw_from, (size_t) run.draw_count * sizeof(Render_Per_Draw));
+        for(isize b = 0; b < run.batch_count; b++)
+        {
+            Render_Per_Batch batch = builder->batches.data[run.batch_from + b];
+            batch.draw_from = (i32) (batch.draw_from - run.draw_from + run.global_draw_from);
+            render->render_per_batch.data[run.global_batch_from + b] = batch;
+        }
+    }
+}
+
+//Fills the gpu side indirect commands and per draw uniforms.
+INTERNAL void _render_build_draws(void* context, isize from, isize to, isize thread_index)
+{
+    (void) thread_index;
+    _Render_Build_Context* c = (_Render_Build_Context*) context;
+    Render* render = c->render;
+    Render_Per_Draw_Array* batch_draws = &render->render_per_draw;
+
+    //@NOTE: 
+    //THE FOLLOWING IS VERY SPECIFIC TO OUR CURRENT SHADERS!
+    //@NOTE: we dont currently use blinn_phong_per_instance at all since the ata required is the same as batch_instances.
+    Gl_Draw_Elements_Indirect_Command* indirect_commands = render->indirect_draws.data;
+    for(isize i = from; i < to; i++)
+    {
+        Render_Per_Draw* draw = &batch_draws->data[i];
+        Render_Geometry_Batch_Index* geometry = &draw->geometry->group;
+
+        indirect_commands[i].first_index = geometry->index_from;
+        indirect_commands[i].count = geometry->index_count;
+        if(draw->lod > 0 && draw->lod < geometry->lod_count)
+        {
+            indirect_commands[i].first_index = geometry->lods[draw->lod].index_from;
+            indirect_commands[i].count = geometry->lods[draw->lod].index_count;
+        }
+        indirect_commands[i].base_instance = draw->instance_from;
+        indirect_commands[i].base_vertex = geometry->vertex_from;
+
+        //Instances of all batches follow each other so the next draw 
+        // always starts where this one ends, even across batches.
+        if(i != batch_draws->len - 1)
+        {
+            Render_Per_Draw* next_draw = &batch_draws->data[i + 1];
+            indirect_commands[i].instance_count = next_draw->instance_from - draw->instance_from;
+        }
+        else
+        {
+            indirect_commands[i].instance_count = (GLuint) (c->command_count - draw->instance_from);
+        }
+
+        Render_Material* material = draw->material;
+        Blinn_Phong_Per_Draw* blinn = &render->blinn_phong_per_draw.data[i];
+        memset(blinn, 0, sizeof *blinn);
+        blinn->diffuse_color = (Vec4){material->diffuse_color};
+        blinn->specular_color = (Vec4){material->specular_color};
+        blinn->ambient_color = (Vec4){material->ambient_color};
+        blinn->specular_exponent = material->specular_exponent;
+        blinn->metallic = material->metallic;
+        //@TODO: strcuture
+        #define COMPRESS_TEXTURE_LAYER(layer, slot_at) (i32) ((u32) (layer) | ((u32) (slot_at) << 16))
+        #define COMPRESS_TEXTURE_LAYER2(layer_struct) COMPRESS_TEXTURE_LAYER(layer_struct.layer, layer_struct.resolution_index)
+
+        #define PACK_TEXTURE_UV(uv) vec4((uv).offset.x, (uv).offset.y, (uv).scale.x, (uv).scale.y)
+
+        //The material textures are in the order of the maps: diffuse, specular, normal, ambient
+        const u8* min_mips = material->binding.min_mips;
+        blinn->map_diffuse =  COMPRESS_TEXTURE_LAYER2(draw->bound_textures[0]);
+        blinn->map_specular = COMPRESS_TEXTURE_LAYER2(draw->bound_textures[1]);
+        blinn->map_normal =   COMPRESS_TEXTURE_LAYER2(draw->bound_textures[2]);
+        blinn->map_ambient =  COMPRESS_TEXTURE_LAYER2(draw->bound_textures[3]);
+        blinn->map_diffuse_uv = PACK_TEXTURE_UV(material->binding.uvs[0]);
+        blinn->map_specular_uv = PACK_TEXTURE_UV(material->binding.uvs[1]);
+        blinn->map_normal_uv = PACK_TEXTURE_UV(material->binding.uvs[2]);
+        blinn->map_ambient_uv = PACK_TEXTURE_UV(material->binding.uvs[3]);
+        blinn->map_min_mips = (i32) ((u32) min_mips[0] | ((u32) min_mips[1] << 8) | ((u32) min_mips[2] << 16) | ((u32) min_mips[3] << 24));
+    }
+}
+
+INTERNAL void _render_build_for(bool is_parallel, isize count, isize batch_size, Parallel_Func func, void* context)
+{
+    if(is_parallel)
+        parallel_for(count, batch_size, func, context);
+    else if(count > 0)
+        func(context, 0, count, 0);
+}
+
+//Builds batches from the sorted commands into render_per_batch, render_per_draw, render_per_instance, 
+// indirect_draws and blinn_phong_per_draw with all batches laid out one after another.
+//Stops when the gpu buffers would overflow. Returns the number of commands consumed.
+//Does not call opengl so it can run and be benchmarked without a context.
+//
+//The commands are split into runs which share geometry batch and environment (and thus 
+// can never be in the same batch as commands of other runs). Runs are built into per thread 
+// builders in parallel and then gathered in order. The result is the same regardless 
+// of the number of threads.
+isize render_build_batches_ex(Render* render, const Render_Command_Expanded* commands, const Mat4* transforms, isize command_count, bool is_parallel)
+{
+    //Each command is one instance and at most one draw. 
+    isize count = command_count;
+    count = MIN(count, render->buffer_instance.item_count);
+    count = MIN(count, render->buffer_draw_uniform.item_count);
+    
+    PROFILE_SCOPE()
+    {
+        render_material_bindings_update(render);
+
+        _Render_Build_Context context = {0};
+        context.render = render;
+        context.commands = commands;
+        context.transforms = transforms;
+        context.command_count = count;
         
-            PROFILE_STOP(batch_prepare);
-        
-            PROFILE_START(batch_flush);
+        //Long runs are split so that all threads have work. This adds a few more batches.
+        isize max_run = parallel_batch_size(count, 4, RENDER_BUILD_MIN_RUN);
+        Render_Batch_Run_Array* runs = &render->batch_runs;
+        array_clear(runs);
+        for(isize i = 0; i < count; )
+        {
+            Render_Batch_Run run = {0};
+            run.command_from = i;
+            for(i++; i < count && i - run.command_from < max_run; i++)
+            {
+                if(commands[i].geometry_batch_index != commands[run.command_from].geometry_batch_index || 
+                    commands[i].environment != commands[run.command_from].environment)
+                    break;
+            }
+
+            run.command_to = i;
+            array_push(runs, run);
+        }
 
+        for(isize i = 0; i < render->batch_builders.len; i++)
+        {
+            Render_Batch_Builder* builder = &render->batch_builders.data[i];
+            array_clear(&builder->batches);
+            array_clear(&builder->draws);
+            builder->not_found_textures = 0;
+        }
+
+        array_resize_for_overwrite(&render->render_per_instance, count);
+        _render_build_for(is_parallel, runs->len, 1, _render_build_runs, &context);
         
-            PROFILE_START(texture_set);
-            render_shader_use(&render->shader_blinn_phong);
-            GLuint map_array_loc = glGetUniformLocation(render->shader_blinn_phong.handle, "u_map_resolutions");
+        isize draw_count = 0;
+        isize batch_count = 0;
+        isize not_found_textures = 0;
+        for(isize i = 0; i < runs->len; i++)
+        {
+            runs->data[i].global_draw_from = draw_count;
+            runs->data[i].global_batch_from = batch_count;
+            draw_count += runs->data[i].draw_count;
+            batch_count += runs->data[i].batch_count;
+        }
+        for(isize i = 0; i < render->batch_builders.len; i++)
+            not_found_textures += render->batch_builders.data[i].not_found_textures;
+
+        if(not_found_textures > 0)
+            LOG_WARN("render", "render_build_batches could not find %i textures!", (int) not_found_textures);
+
+        array_resize_for_overwrite(&render->render_per_draw, draw_count);
+        array_resize_for_overwrite(&render->render_per_batch, batch_count);
+        _render_build_for(is_parallel, runs->len, 1, _render_build_gather, &context);
+
+        array_resize_for_overwrite(&render->blinn_phong_per_draw, draw_count);
+        array_resize_for_overwrite(&render->indirect_draws, draw_count);
+        _render_build_for(is_parallel, draw_count, parallel_batch_size(draw_count, 2, RENDER_BUILD_MIN_RUN), _render_build_draws, &context);
+    }
+    return count;
+}
+
+isize render_build_batches(Render* render, const Render_Command_Expanded* commands, const Mat4* transforms, isize command_count)
+{
+    return render_build_batches_ex(render, commands, transforms, command_count, true);
+}
+
+//Writes the built arrays into the shadows of the gpu buffers. 
+//Only the parts that differ from what the buffers already hold become upload ops.
+//Does not call opengl.
+void render_diff_batches(Render* render)
+{
+    PROFILE_SCOPE()
+    {
+        ASSERT(array_byte_size(render->render_per_instance) <= render->buffer_instance.byte_size);
+        ASSERT(array_byte_size(render->blinn_phong_per_draw) <= render->buffer_draw_uniform.byte_size);
+        ASSERT(array_byte_size(render->indirect_draws) <= render->buffer_command.byte_size);
+        ASSERT(sizeof *render->render_per_instance.data == render->buffer_instance.item_size);
+
+        buffer_shadow_write(&render->shadow_instance, 0, render->render_per_instance.data, array_byte_size(render->render_per_instance));
+        buffer_shadow_write(&render->shadow_draw_uniform, 0, render->blinn_phong_per_draw.data, array_byte_size(render->blinn_phong_per_draw));
+        buffer_shadow_write(&render->shadow_command, 0, render->indirect_draws.data, array_byte_size(render->indirect_draws));
+    }
+}
+
+//Uploads size bytes at offset of the buffer through the upload ring. 
+//Falls back to a direct (blocking) upload when the ring is full.
+void render_upload_bytes(Render* render, GL_Buffer* buffer, isize offset, const void* data, isize size)
+{
+    Upload_Ring_Slice slice = upload_ring_alloc(&render->upload_ring, size, 16);
+    if(slice.data)
+    {
+        memcpy(slice.data, data, (size_t) size);
+        glCopyNamedBufferSubData(render->upload_ring_handle, buffer->handle, slice.offset, offset, size);
+    }
+    else
+        glNamedBufferSubData(buffer->handle, offset, size, data);
+
+    render->uploaded_bytes += size;
+}
+
+//Uploads the changed ranges through the upload ring. 
+void render_upload_buffer(Render* render, GL_Buffer* buffer, Buffer_Shadow* shadow)
+{
+    for(isize i = 0; i < shadow->ops.len; i++)
+    {
+        Buffer_Upload_Op op = shadow->ops.data[i];
+        render_upload_bytes(render, buffer, op.offset, shadow->data.data + op.offset, op.size);
+    }
+
+    buffer_shadow_clear_ops(shadow);
+}
 
-            i32 tex_slots[MAX_TEXTURE_SLOTS] = {0};
-            for(GLint i = 0; i < MAX_TEXTURE_SLOTS; i++)
+//Uploads the mips finished by the loader and issues new loads and evictions based on 
+// what was reported since the last call. Call once per frame before rendering.
+void render_texture_stream_update(Render* render)
+{
+    Texture_Stream* stream = &render->texture_stream;
+    if(stream->textures.len > 0)
+    {
+        PROFILE_SCOPE()
+        {
+            bool residency_changed = false;
+            Render_Texture_Load load = {0};
+            while(render_texture_loader_pop(&render->texture_loader, &load))
             {
-                tex_slots[i] = i;
-                i32 resolution_index = batch.texture_slots[i];
+                //The layer of a removed texture can already belong to some other texture
+                Render_Streamed_Texture* streamed = &render->streamed_textures.data[load.stream_index];
+                bool is_loaded = load.result.width > 0 && load.result.height > 0;
+                if(streamed->is_removed)
+                {
+                    render_streamed_texture_deinit(streamed);
+                    streamed->is_removed = false;
+                }
+                else if(is_loaded)
+                {
+                    GL_Texture_Array* array = &render->texture_manager.resolutions.data[streamed->layer.resolution_index - 1].array;
+                    gl_texture_array_set_mip(array, streamed->layer.layer, load.mip, 0, 0, load.result);
+                    residency_changed = true;
+                }
+
+                //A failed mip was never uploaded so it must not become resident and sampled
+                image_deinit(&load.result);
+                if(is_loaded)
+                    texture_stream_loaded(stream, load.stream_index, load.mip);
+                else
+                    texture_stream_load_failed(stream, load.stream_index, load.mip);
+            }
 
-                if(resolution_index)
+            array_clear(&render->stream_events);
+            texture_stream_update(stream, &render->stream_events);
+            for(isize i = 0; i < render->stream_events.len; i++)
+            {
+                Texture_Stream_Event event = render->stream_events.data[i];
+                if(event.type == TEXTURE_STREAM_LOAD)
                 {
-                    ASSERT_BOUNDS(resolution_index - 1, render->texture_manager.resolutions.len);
-                    GL_Texture_Array* resolution_array = &render->texture_manager.resolutions.data[resolution_index - 1].array;
+                    Render_Streamed_Texture* streamed = &render->streamed_textures.data[event.texture];
+                    GL_Texture_Array* array = &render->texture_manager.resolutions.data[streamed->layer.resolution_index - 1].array;
+                    Render_Texture_Load request = {event.texture, event.mip};
+                    request.cooked_path = streamed->cooked_path.string;
+                    request.chain_width = streamed->chain_width;
+                    request.chain_height = streamed->chain_height;
+                    request.width = MAX(array->width >> event.mip, 1);
+                    request.height = MAX(array->height >> event.mip, 1);
+                    bool pushed = render_texture_loader_push(&render->texture_loader, request);
+                    ASSERT(pushed, "the stream never has more loads in flight than the loader capacity");
+                }
+                else
+                    residency_changed = true;
+            }
+
+            //The shader must not sample evicted mips and should sample the new ones
+            if(residency_changed)
+                render->binding_generation += 1;
+
+            texture_stream_begin_frame(stream);
+        }
+    }
+}
+
+//Assigns the lights to the clusters of the view frustum of camera and uploads the result.
+//Must be called after upload_ring_begin_frame.
+Light_Cluster_Params render_light_clusters_update(Render* render, Camera camera, Mat4 view, const Blinn_Phong_Light* lights, isize lights_count)
+{
+    Light_Cluster_Params params = {0};
+    params.tiles_x = LIGHT_CLUSTER_TILES_X;
+    params.tiles_y = LIGHT_CLUSTER_TILES_Y;
+    params.slices = LIGHT_CLUSTER_SLICES;
+    params.fov = camera.fov;
+    params.aspect_ratio = camera.aspect_ratio;
+    params.near = camera.near;
+    params.far = camera.far;
+
+    PROFILE_SCOPE()
+    {
+        ASSERT(lights_count <= MAX_LIGHTS);
+        f32 components[4][MAX_LIGHTS] = {0};
+        for(isize i = 0; i < lights_count; i++)
+        {
+            Vec4 pos_and_range = lights[i].pos_and_range;
+            Vec3 view_pos = mat4_apply(view, vec3(pos_and_range.x, pos_and_range.y, pos_and_range.z));
+            components[0][i] = view_pos.x;
+            components[1][i] = view_pos.y;
+            components[2][i] = view_pos.z;
+            components[3][i] = pos_and_range.w;
+        }
+
+        Light_Cluster_Lights cluster_lights = {components[0], components[1], components[2], components[3], lights_count};
+        light_clusters_build(&render->light_clusters, params, cluster_lights);
+
+        Light_Clusters* clusters = &render->light_clusters;
+        ASSERT(array_byte_size(clusters->ranges) <= render->buffer_light_ranges.byte_size);
+        ASSERT(array_byte_size(clusters->indices) <= render->buffer_light_indices.byte_size);
+        render_upload_bytes(render, &render->buffer_light_ranges, 0, clusters->ranges.data, array_byte_size(clusters->ranges));
+        if(clusters->indices.len > 0)
+            render_upload_bytes(render, &render->buffer_light_indices, 0, clusters->indices.data, array_byte_size(clusters->indices));
+    }
+
+    return params;
+}
 
-                    glActiveTexture(GL_TEXTURE0 + i);
-                    glBindTexture(GL_TEXTURE_2D_ARRAY, resolution_array->handle);
+//Reports the screen footprint of the streamed textures of the drawn commands.
+void render_texture_stream_report(Render* render, const Render_Command_Expanded* commands, const Mat4* transforms, isize command_count, const Render_Lod_View* view)
+{
+    Texture_Stream* stream = &render->texture_stream;
+    if(stream->textures.len > 0)
+    {
+        PROFILE_SCOPE()
+        {
+            for(isize i = 0; i < command_count; i++)
+            {
+                const Render_Command_Expanded* command = &commands[i];
+                AABB bounds = _render_scene_world_bounds(command, transforms[command->transform_index]);
+                Vec3 center = vec3_scale(vec3_add(bounds.min, bounds.max), 0.5f);
+                Vec3 extent = vec3_scale(vec3_sub(bounds.max, bounds.min), 0.5f);
+                f32 footprint = render_screen_footprint(center, extent, view);
+
+                Render_Material* material = command->material;
+                for(isize t = 0; t < material->used_textures; t++)
+                {
+                    Render_Texture* texture = render_texture_get(render, material->textures[t]);
+                    if(texture && texture->stream_index > 0)
+                        texture_stream_report(stream, texture->stream_index - 1, footprint);
                 }
             }
-            glUniform1iv(map_array_loc, (GLsizei) MAX_TEXTURE_SLOTS, tex_slots);
-            PROFILE_STOP(texture_set);
+        }
+    }
+}
+
+void render_render(Render* render, Camera camera)
+{
+    PROFILE_SCOPE() 
+    {
+        //@TODO get from environment
+        Mat4 view = camera_make_view_matrix(camera);
+        Mat4 projection = camera_make_projection_matrix(camera);
+
+        Render_Queue* buffers = &render->render_queue;
+        render_texture_stream_update(render);
+    
+        #if !defined(DO_MONO_EXPANDED_QUEUE)
+        render_queue_expand(render);
+        #endif
 
-            ASSERT(sizeof(blinn_environment) <= render->uniform_block_environment.buffer_size);
-            //ASSERT(array_byte_size(render->blinn_phong_per_draw) <= render->uniform_block_draw.buffer_size);
-            ASSERT(array_byte_size(render->render_per_instance) <= render->buffer_instance.byte_size);
-            ASSERT(array_byte_size(render->blinn_phong_per_draw) <= render->buffer_draw_uniform.byte_size);
+        render_queue_cull(buffers, projection, view);
+        render_queue_sort_expanded(buffers->expanded.data, buffers->expanded.len, true);
 
-            ASSERT(sizeof *batch_instances->data == render->buffer_instance.item_size);
-            ASSERT(batch_instances->len <= render->buffer_instance.item_count);
+        //Draw the retained scene directly from its cached list when there are no immediate commands.
+        //Otherwise merge both sorted lists into the queue.
+        Render_Scene* scene = &render->scene;
+        render_scene_prepare(render, scene, projection, view);
+
+        const Render_Command_Expanded* commands = buffers->expanded.data;
+        const Mat4* transforms = buffers->transforms.data;
+        isize command_count = buffers->expanded.len;
+        if(buffers->expanded.len == 0)
+        {
+            commands = scene->visible.data;
+            transforms = scene->transforms.data;
+            command_count = scene->visible.len;
+        }
+        else if(scene->visible.len > 0)
+        {
+            render_queue_merge_scene(buffers, scene);
+            commands = buffers->expanded.data;
+            transforms = buffers->transforms.data;
+            command_count = buffers->expanded.len;
+        }
+
+        Render_Lod_View lod_view = render_lod_view_make(projection, view);
+        render_texture_stream_report(render, commands, transforms, command_count, &lod_view);
+
+        glEnable(GL_DEPTH_TEST); 
+        glEnable(GL_CULL_FACE);  
+        glCullFace(GL_BACK);
+        glFrontFace(GL_CCW);
+
+        //When only the scene is drawn and neither its visible list nor the material bindings changed 
+        // the batches and the gpu buffers from the last frame are still valid. 
+        //This only holds if they were all built in a single pass.
+        bool is_only_scene = buffers->expanded.len == 0 && scene->visible_generation != 0;
+        bool is_batches_reused = is_only_scene
+            && render->built_scene_generation == scene->visible_generation 
+            && render->built_binding_generation == render->binding_generation;
+
+        render->uploaded_bytes = 0;
+        upload_ring_begin_frame(&render->upload_ring);
+
+        //@TODO get from environment
+        Blinn_Phong_Light lights[2] = {0};
+        lights[0].color_and_radius = vec4(10, 8, 7, 0);
+        lights[0].pos_and_range = vec4(40, 20, -10, 100);
+        lights[1].color_and_radius = vec4(8, 10, 8.5f, 0);
+        lights[1].pos_and_range = vec4(0, 0, 10, 100);
+
+        Light_Cluster_Params cluster_params = render_light_clusters_update(render, camera, view, lights, ARRAY_LEN(lights));
+        GLint viewport[4] = {0};
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        for(isize command_from = 0; command_from < command_count; )
+        {
+            if(is_batches_reused)
+                command_from = command_count;
+            else
+            {
+                isize consumed = render_build_batches(render, commands + command_from, transforms, command_count - command_from);
+                ASSERT(consumed > 0, "Must make progress");
+                command_from += consumed;
+
+                render_diff_batches(render);
+
+                bool is_single_pass = consumed == command_count;
+                render->built_scene_generation = is_only_scene && is_single_pass ? scene->visible_generation : 0;
+                render->built_binding_generation = render->binding_generation;
+            }
 
-        
             PROFILE_START(batch_upload);
-            glNamedBufferSubData(render->buffer_environment_uniform.handle, 0, sizeof(blinn_environment), &blinn_environment);
-            glNamedBufferSubData(render->buffer_draw_uniform.handle, 0, array_byte_size(render->blinn_phong_per_draw), render->blinn_phong_per_draw.data);
-            glNamedBufferSubData(render->buffer_instance.handle, 0, array_byte_size(render->render_per_instance), render->render_per_instance.data);
-            //glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, render->buffer_draw_uniform.handle); //@TEMP
+            render_upload_buffer(render, &render->buffer_instance, &render->shadow_instance);
+            render_upload_buffer(render, &render->buffer_draw_uniform, &render->shadow_draw_uniform);
+            render_upload_buffer(render, &render->buffer_command, &render->shadow_command);
             PROFILE_STOP(batch_upload);
 
+            for(isize batch_i = 0; batch_i < render->render_per_batch.len; batch_i++)
+            {
+                Render_Per_Batch batch = render->render_per_batch.data[batch_i];
+                PROFILE_START(batch_flush);
+
+                //The environment is written straight into the ring
+                Blinn_Phong_Per_Batch fallback_environment = {0};
+                Upload_Ring_Slice environment_slice = upload_ring_alloc(&render->upload_ring, sizeof(Blinn_Phong_Per_Batch), render->uniform_offset_alignment);
+                Blinn_Phong_Per_Batch* blinn_environment = environment_slice.data ? (Blinn_Phong_Per_Batch*) (void*) environment_slice.data : &fallback_environment;
+                memset(blinn_environment, 0, sizeof *blinn_environment);
+                {
+                    blinn_environment->light_quadratic_attentuation = 0.05f;
+                    blinn_environment->base_illumination = vec4_of(0.5f);
+                    blinn_environment->projection = projection; 
+                    blinn_environment->view = view; 
+                    blinn_environment->view_pos = (Vec4){camera.pos};
+
+                    blinn_environment->lights_count = (int) ARRAY_LEN(lights);
+                    memcpy(blinn_environment->lights, lights, sizeof lights);
+
+                    blinn_environment->cluster_size[0] = cluster_params.tiles_x;
+                    blinn_environment->cluster_size[1] = cluster_params.tiles_y;
+                    blinn_environment->cluster_size[2] = cluster_params.slices;
+                    blinn_environment->cluster_depth_and_viewport = vec4(cluster_params.near, cluster_params.far, (f32) viewport[2], (f32) viewport[3]);
+                }
         
-            PROFILE_START(draw_call);
-            glBindBuffer(GL_DRAW_INDIRECT_BUFFER , render->buffer_command.handle);
-            glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, batch_draws->len * sizeof *indirect_commands, indirect_commands);
+                PROFILE_START(texture_set);
+                render_shader_use(&render->shader_blinn_phong);
+                GLuint map_array_loc = glGetUniformLocation(render->shader_blinn_phong.handle, "u_map_resolutions");
+
+                i32 tex_slots[MAX_TEXTURE_SLOTS] = {0};
+                for(GLint i = 0; i < MAX_TEXTURE_SLOTS; i++)
+                {
+                    tex_slots[i] = i;
+                    i32 resolution_index = batch.texture_slots[i];
 
+                    if(resolution_index)
+                    {
+                        ASSERT_BOUNDS(resolution_index - 1, render->texture_manager.resolutions.len);
+                        GL_Texture_Array* resolution_array = &render->texture_manager.resolutions.data[resolution_index - 1].array;
+
+                        glActiveTexture(GL_TEXTURE0 + i);
+                        glBindTexture(GL_TEXTURE_2D_ARRAY, resolution_array->handle);
+                    }
+                }
+                glUniform1iv(map_array_loc, (GLsizei) MAX_TEXTURE_SLOTS, tex_slots);
+                PROFILE_STOP(texture_set);
 
-            Render_Geometry_Batch* geometry_batch = &render->geometry_manager.batches.data[batch.geometry_batch_index - 1];
-            glBindVertexArray(geometry_batch->vertex_array_handle);
-            //glBindBuffer(GL_ARRAY_BUFFER, geometry_batch->vertex_buffer_handle);
-            glBindBuffer(GL_ARRAY_BUFFER, render->buffer_instance.handle);
-            PROFILE_STOP(draw_call);
+                ASSERT(sizeof *blinn_environment <= render->uniform_block_environment.buffer_size);
+                GLuint environment_binding = render->uniform_block_environment.binding_point;
+                if(environment_slice.data)
+                    glBindBufferRange(GL_UNIFORM_BUFFER, environment_binding, render->upload_ring_handle, environment_slice.offset, sizeof *blinn_environment);
+                else
+                {
+                    glNamedBufferSubData(render->buffer_environment_uniform.handle, 0, sizeof *blinn_environment, blinn_environment);
+                    glBindBufferBase(GL_UNIFORM_BUFFER, environment_binding, render->buffer_environment_uniform.handle);
+                }
+        
+                PROFILE_START(draw_call);
+                glBindBuffer(GL_DRAW_INDIRECT_BUFFER , render->buffer_command.handle);
 
-            PROFILE_STOP(batch_flush);
+                Render_Geometry_Batch* geometry_batch = &render->geometry_manager.batches.data[batch.geometry_batch_index - 1];
+                glUniform1i(glGetUniformLocation(render->shader_blinn_phong.handle, "u_packed_vertices"), geometry_batch->is_packed);
+                glUniform1i(glGetUniformLocation(render->shader_blinn_phong.handle, "u_draw_offset"), batch.draw_from);
+                glBindVertexArray(geometry_batch->vertex_array_handle);
+                glBindBuffer(GL_ARRAY_BUFFER, render->buffer_instance.handle);
+                PROFILE_STOP(draw_call);
 
-            glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, NULL, (u32) batch_draws->len, 0);
+                PROFILE_STOP(batch_flush);
 
-            ASSERT(k > j, "Must make progress k:%i > i:%i", (int) k, (int) j);
-            j = k;
+                const void* indirect_offset = (const void*) (batch.draw_from * sizeof(Gl_Draw_Elements_Indirect_Command));
+                glMultiDrawElementsIndirect(GL_TRIANGLES, vertex_index_type_to_gl(geometry_batch->index_type), indirect_offset, (u32) batch.draw_count, 0);
+            }
         }
 
-
+        upload_ring_end_frame(&render->upload_ring);
         render_queue_clear(&render->render_queue);
     }
 }
 
-Render_Texture_Ptr render_texture_add(Render* render, Image image, String name)
+//Adds a texture given by its whole mip chain (see mip_chain.h) which should go down to 1x1.
+//The options are used to regenerate the mips of small textures packed into atlases.
+//If cooked_path is not empty the chain was read from the cooked texture at cooked_path (see format_texture.h)
+// and big textures stream their finer mips from it. Otherwise all mips stay resident.
+Render_Texture_Ptr render_texture_add_mips(Render* render, Render_Texture_Mips chain, const Mip_Options* options, String name, String cooked_path)
 {
     Render_Texture texture = {0};
     texture.info = render_info_make(name);
-    texture.layer = render_texture_manager_add(&render->texture_manager, image, name);
+
+    //Small textures go to atlases and consist only of the tail anyways
+    bool is_streamed = render->texture_loader.is_launched && cooked_path.len > 0 
+        && MAX(chain.width, chain.height) > MAX(TEXTURE_STREAM_TAIL_DIM, RENDER_TEXTURE_ATLAS_MAX_DIM);
+    texture.layer = render_texture_manager_add(&render->texture_manager, chain, options, name, &texture.uv, is_streamed);
+    if(is_streamed && texture.layer.resolution_index > 0)
+    {
+        GL_Texture_Array* array = &render->texture_manager.resolutions.data[texture.layer.resolution_index - 1].array;
+        i32 bits_per_pixel = array->channel_count * (i32) pixel_type_size(array->type) * 8;
+        if(array->block_format != TEXTURE_BLOCK_NONE)
+            bits_per_pixel = texture_block_size(array->block_format) * 8 / 16;
+        i32 stream_index = texture_stream_add(&render->texture_stream, array->width, array->height, array->mip_level_count, bits_per_pixel);
+
+        Render_Streamed_Texture streamed = {0};
+        streamed.layer = texture.layer;
+        streamed.cooked_path = builder_from_string(render->allocator, cooked_path);
+        streamed.chain_width = chain.width;
+        streamed.chain_height = chain.height;
+        streamed.mip_count = array->mip_level_count;
+        render_image_extend_mips(render->allocator, streamed.mips, array, chain, render->texture_stream.textures.data[stream_index].tail_mip);
+        if(stream_index >= render->streamed_textures.len)
+            array_resize(&render->streamed_textures, stream_index + 1);
+        render->streamed_textures.data[stream_index] = streamed;
+        texture.stream_index = stream_index + 1;
+    }
 
     Render_Texture_Ptr out = {0};
     out.id = texture.info.id;
-    stable_array_insert(&render->textures, (void**) &out.ptr);
+    texture.storage_index = stable_array_insert(&render->textures, (void**) &out.ptr);
     *out.ptr = texture;
+    render->binding_generation += 1;
     return out;
 }
 
-Render_Geometry_Ptr render_geometry_add(Render* render, const Vertex vertices[], isize vertex_count, const i32 indices[], isize index_count, String name)
+//Adds a texture generating its mips with options.
+Render_Texture_Ptr render_texture_add(Render* render, Image image, const Mip_Options* options, String name)
+{
+    Render_Texture_Ptr out = {0};
+    Arena_Frame arena = scratch_arena_frame_acquire();
+    {
+        Image mips[MIP_CHAIN_MAX_MIPS] = {0};
+        Subimage submips[MIP_CHAIN_MAX_MIPS] = {0};
+        i32 mip_count = MIN(mip_chain_count(image.width, image.height), MIP_CHAIN_MAX_MIPS);
+        mip_chain_generate(mips, mip_count, subimage_of(image), options, arena.alloc);
+        for(i32 i = 0; i < mip_count; i++)
+            submips[i] = subimage_of(mips[i]);
+
+        out = render_texture_add_mips(render, render_texture_mips_make(submips, mip_count), options, name, STRING(""));
+    }
+    arena_frame_release(&arena);
+    return out;
+}
+
+//Releases the texture and its layer. Materials still referencing it will see it as not found.
+bool render_texture_remove(Render* render, Render_Texture_Ptr ptr)
+{
+    Render_Texture* texture = render_texture_get(render, ptr);
+    if(texture == NULL)
+        return false;
+
+    //A load in flight still reads the cooked path. It is freed once the load finishes.
+    if(texture->stream_index > 0)
+    {
+        i32 stream_index = texture->stream_index - 1;
+        Render_Streamed_Texture* streamed = &render->streamed_textures.data[stream_index];
+        if(render->texture_stream.textures.data[stream_index].loading_mip == -1)
+            render_streamed_texture_deinit(streamed);
+        else
+            streamed->is_removed = true;
+        texture_stream_remove(&render->texture_stream, stream_index);
+    }
+
+    render_texture_manager_free_layer(&render->texture_manager, texture->layer);
+    isize storage_index = texture->storage_index;
+    texture->info.id = 0;
+    stable_array_remove(&render->textures, storage_index);
+    render->binding_generation += 1;
+    render->resource_generation += 1;
+    return true;
+}
+
+INTERNAL Render_Geometry_Ptr _render_geometry_add_group(Render* render, Render_Geometry_Batch_Index group, String name)
 {
     Render_Geometry geometry = {0};
     geometry.info = render_info_make(name);
-    geometry.group = render_geometry_manager_add(&render->geometry_manager, vertices, vertex_count, indices, index_count, name);
+    geometry.group = group;
 
     Render_Geometry_Ptr out = {0};
     out.id = geometry.info.id;
     stable_array_insert(&render->geometries, (void**) &out.ptr);
     *out.ptr = geometry;
+    render->resource_generation += 1;
     return out;
 }
 
+Render_Geometry_Ptr render_geometry_add(Render* render, const Vertex vertices[], isize vertex_count, const i32 indices[], isize index_count, String name)
+{
+    Render_Geometry_Batch_Index group = render_geometry_manager_add(&render->geometry_manager, vertices, vertex_count, indices, index_count, name);
+    return _render_geometry_add_group(render, group, name);
+}
+
+//Same as render_geometry_add but with the lods already built (see render_geometry_manager_add_lods).
+Render_Geometry_Ptr render_geometry_add_lods(Render* render, const Vertex vertices[], isize vertex_count, 
+    const i32 all_indices[], isize all_index_count, const Mesh_Lod lods[], isize lod_count, String name)
+{
+    Render_Geometry_Batch_Index group = render_geometry_manager_add_lods(&render->geometry_manager, vertices, vertex_count, all_indices, all_index_count, lods, lod_count, name);
+    return _render_geometry_add_group(render, group, name);
+}
+
 Render_Material_Ptr render_material_add(Render* render, String name)
 {
     Render_Material material = {0};
@@ -2405,8 +4684,10 @@ Render_Material_Ptr render_material_add(Render* render, String name)
 
     Render_Material_Ptr out = {0};
     out.id = material.info.id;
-    stable_array_insert(&render->geometries, (void**) &out.ptr);
+    stable_array_insert(&render->materials, (void**) &out.ptr);
     *out.ptr = material;
+    render->binding_generation += 1;
+    render->resource_generation += 1;
     return out;
 }
 
@@ -2415,7 +4696,52 @@ Render_Geometry_Ptr render_geometry_add_shape(Render* render, Shape shape, Strin
     return render_geometry_add(render, shape.vertices.data, shape.vertices.len, (i32*) (void*) shape.triangles.data, shape.triangles.len * 3, name);
 }
 
-bool render_texture_add_from_disk_named(Render* render, Render_Texture_Ptr* out, String path, String name)
+//Adds the obj model at path as a single geometry. The model is loaded through the cooked mesh
+// next to it (path + ".cooked") so the parsing, deduplication and lod building only happen when the obj changes.
+bool render_geometry_add_from_disk(Render* render, Render_Geometry_Ptr* out, String path)
+{
+    bool state = true;
+    PROFILE_SCOPE()
+    {
+        LOG_INFO("render", "Adding geometry at path '%.*s'", STRING_PRINT(path));
+        Arena_Frame arena = scratch_arena_frame_acquire();
+        {
+            String cooked_path = format(arena.alloc, "%.*s.cooked", STRING_PRINT(path)).string;
+            Cooked_Mesh cooked = {0};
+            state = cooked_mesh_load(&cooked, path, cooked_path);
+            if(state)
+            {
+                //The lod ranges are into the triangles followed by the lod indices which are separate sections in the file
+                Format_Mesh mesh = cooked.mesh;
+                isize full_index_count = mesh.triangles_count*3;
+                i32_Array all_indices = {arena.alloc};
+                array_append(&all_indices, (const i32*) (const void*) mesh.triangles, full_index_count);
+                array_append(&all_indices, mesh.lod_indices, mesh.lod_indices_count);
+
+                String name = path_get_filename_without_extension(path_parse(path));
+                *out = render_geometry_add_lods(render, mesh.vertices, mesh.vertices_count, all_indices.data, all_indices.len, mesh.lods, mesh.lods_count, name);
+            }
+            cooked_mesh_unload(&cooked);
+        }
+        arena_frame_release(&arena);
+    }
+    return state;
+}
+
+INTERNAL Render_Texture_Ptr _render_texture_add_cooked(Render* render, Format_Texture texture, Map_Type map_type, const Map_Info* info_or_null, String name, String cooked_path)
+{
+    Mip_Options options = mip_options_from_map(map_type, info_or_null, texture.header->channel_count);
+    Render_Texture_Mips chain = render_texture_mips_make(texture.mips, texture.mip_count);
+    chain.block_format = (Texture_Block_Format) texture.header->block_format;
+    chain.width = texture.header->mips[0].width;
+    chain.height = texture.header->mips[0].height;
+    return render_texture_add_mips(render, chain, &options, name, cooked_path);
+}
+
+//Adds the image at path as a map of the given type. The image is loaded through the cooked texture
+// next to it (see cooked_texture_path) so the decoding, mip generation and compression only happen when the image changes.
+//info_or_null is the map info of the material the texture is used by (see mip_options_from_map).
+bool render_texture_add_from_disk_named(Render* render, Render_Texture_Ptr* out, String path, Map_Type map_type, const Map_Info* info_or_null, String name)
 {
     bool state = true;
     PROFILE_SCOPE()
@@ -2425,10 +4751,12 @@ bool render_texture_add_from_disk_named(Render* render, Render_Texture_Ptr* out,
 
         Arena_Frame arena = scratch_arena_frame_acquire();
         {
-            Image temp_storage = {arena.alloc};
-            state = image_read_from_file(&temp_storage, path, 0, PIXEL_TYPE_U8, IMAGE_LOAD_FLAG_FLIP_Y);
+            String cooked_path = cooked_texture_path(arena.alloc, path, map_type, info_or_null);
+            Cooked_Texture cooked = {0};
+            state = cooked_texture_load(&cooked, path, cooked_path, map_type, info_or_null);
             if(state)
-                *out = render_texture_add(render, temp_storage, name);
+                *out = _render_texture_add_cooked(render, cooked.texture, map_type, info_or_null, name, cooked_path);
+            cooked_texture_unload(&cooked);
         }
         arena_frame_release(&arena);
         log_outdent();
@@ -2436,13 +4764,118 @@ bool render_texture_add_from_disk_named(Render* render, Render_Texture_Ptr* out,
     return state;
 }
 
-bool render_texture_add_from_disk(Render* render, Render_Texture_Ptr* out, String path)
+bool render_texture_add_from_disk(Render* render, Render_Texture_Ptr* out, String path, Map_Type map_type, const Map_Info* info_or_null)
 {
-    return render_texture_add_from_disk_named(render, out, path, path_get_filename_without_extension(path_parse(path)));
+    return render_texture_add_from_disk_named(render, out, path, map_type, info_or_null, path_get_filename_without_extension(path_parse(path)));
 }
-void run_func(void* context)
+
+//Adds count images at once like render_texture_add_from_disk. The textures which need to be (re)cooked 
+// are cooked in parallel (see cooked_texture_load_many). outs[i] is only written if the i-th texture loaded.
+//Returns true if all textures were added.
+bool render_texture_add_many_from_disk(Render* render, Render_Texture_Ptr* const* outs, const String* paths, const Map_Type* map_types, const Map_Info* infos_or_null, isize count)
 {
-    PROFILE_START(init);
+    bool state = true;
+    PROFILE_SCOPE()
+    {
+        LOG_INFO("render", "Adding %lli textures current working dir '%s'", (lli) count, platform_directory_get_startup_working());
+        log_indent();
+
+        Arena_Frame arena = scratch_arena_frame_acquire();
+        {
+            Array(Cooked_Texture) cooked = {arena.alloc};
+            Array(String) cooked_paths = {arena.alloc};
+            array_resize(&cooked, count);
+            array_resize(&cooked_paths, count);
+            for(isize i = 0; i < count; i++)
+                cooked_paths.data[i] = cooked_texture_path(arena.alloc, paths[i], map_types[i], infos_or_null ? &infos_or_null[i] : NULL);
+
+            state = cooked_texture_load_many(cooked.data, paths, cooked_paths.data, map_types, infos_or_null, count) == count;
+            for(isize i = 0; i < count; i++)
+            {
+                Format_Texture texture = cooked.data[i].texture;
+                if(texture.header)
+                {
+                    String name = path_get_filename_without_extension(path_parse(paths[i]));
+                    const Map_Info* info_or_null = infos_or_null ? &infos_or_null[i] : NULL;
+                    *outs[i] = _render_texture_add_cooked(render, texture, map_types[i], info_or_null, name, cooked_paths.data[i]);
+                }
+                cooked_texture_unload(&cooked.data[i]);
+            }
+        }
+        arena_frame_release(&arena);
+        log_outdent();
+    }
+    return state;
+}
+
+enum {
+    TEST_GRID_Y = 400,
+    TEST_GRID_X = 400,
+};
+
+typedef struct Test_Grid_Submit {
+    Render* render;
+    Render_Geometry_Ptr render_cube;
+    Render_Geometry_Ptr render_cube_sphere;
+    Render_Material_Ptr material_shiny_debug;
+    Render_Material_Ptr material_mat_floor;
+} Test_Grid_Submit;
+
+Render_Phong_Command test_grid_command(const Test_Grid_Submit* grid, isize x, isize y)
+{
+    Render_Phong_Command phong_command = {0};
+
+    phong_command.transform = mat4_translation(vec3((f32) 2*x, (f32) 2*y, 0));
+
+    i32 do_x = 0;
+    if(1)
+    {
+        isize v = x + y;
+        do_x = v % 3 == 0;
+    }
+    else
+    {
+        isize v = x + y*TEST_GRID_Y;
+        if(v < TEST_GRID_X*TEST_GRID_Y * 2/3)
+            do_x = 1;
+        if(v < TEST_GRID_X*TEST_GRID_Y * 1/3)
+            do_x = 2;
+    }
+
+    if(do_x == 0)
+    {
+        phong_command.material = grid->material_shiny_debug;    
+        phong_command.geometry = grid->render_cube;
+    }
+    else if(do_x == 1)
+    {
+        phong_command.material = grid->material_shiny_debug;    
+        phong_command.geometry = grid->render_cube_sphere;
+    }
+    else
+    {
+        phong_command.geometry = grid->render_cube;
+        phong_command.material = grid->material_mat_floor;
+    }
+
+    return phong_command;
+}
+
+//Submits rows [from, to) of the test grid into the queue of the calling thread.
+void test_grid_submit_rows(void* context, isize from, isize to, isize thread_index)
+{
+    Test_Grid_Submit* grid = (Test_Grid_Submit*) context;
+    for(isize y = from; y < to; y++)
+        for(isize x = 0; x < TEST_GRID_X; x++)
+        {
+            Render_Phong_Command phong_command = test_grid_command(grid, x, y);
+            render_queue_submit_phong_on_thread(grid->render, &phong_command, thread_index);
+        }
+}
+
+void run_func(void* context)
+{
+    PROFILE_START(init);
     
     LOG_INFO("APP", "run_func enter");
     Allocator* upstream_alloc = allocator_get_default();
@@ -2490,6 +4923,7 @@ void run_func(void* context)
     
     Render_Geometry_Ptr render_uv_sphere = {0};
     Render_Geometry_Ptr render_cube_sphere = {0};
+    Render_Geometry_Ptr render_falcon = {0};
     Render_Geometry_Ptr render_screen_quad = {0};
     Render_Geometry_Ptr render_cube = {0};
     Render_Geometry_Ptr render_quad = {0};
@@ -2520,6 +4954,8 @@ void run_func(void* context)
     render_mem_budget.command_buffer = MB * 256;
     render_mem_budget.instance_buffer = MB * 100;
     render_mem_budget.draw_buffer = MB * 100;
+    render_mem_budget.upload_ring = MB * 96;
+    render_mem_budget.texture_stream = MB * 128;
     render_init(&render, renderer_alloc.alloc, &shader_instanced_batched, render_mem_budget);
 
     f64 fps_display_frequency = 4;
@@ -2598,6 +5034,8 @@ void run_func(void* context)
                 || frame_num == 0)
             {
                 LOG_INFO("APP", "Refreshing art");
+                //The geometries and materials are added anew so the scene has to be filled anew as well
+                render_scene_clear(&render.scene);
                 PROFILE_SCOPE(art_load)
                 {
                     PROFILE_START(art_counter_shapes);
@@ -2620,10 +5058,16 @@ void run_func(void* context)
                     render_screen_quad = render_geometry_add_shape(&render, screen_quad, STRING("screen_quad"));
                     render_cube = render_geometry_add_shape(&render, unit_cube, STRING("unit_cube"));
                     render_quad = render_geometry_add_shape(&render, unit_quad, STRING("unit_cube"));
+                    render_geometry_add_from_disk(&render, &render_falcon, STRING("resources/falcon/falcon.obj"));
             
-                    texture_state = texture_state && render_texture_add_from_disk(&render, &image_rusted_iron_metallic, STRING("resources/rustediron2/rustediron2_metallic.png"));
-                    texture_state = texture_state && render_texture_add_from_disk(&render, &image_floor, STRING("resources/floor.jpg"));
-                    texture_state = texture_state && render_texture_add_from_disk(&render, &image_debug, STRING("resources/debug.png"));
+                    Render_Texture_Ptr* texture_outs[] = {&image_rusted_iron_metallic, &image_floor, &image_debug};
+                    String texture_paths[] = {
+                        STRING("resources/rustediron2/rustediron2_metallic.png"), 
+                        STRING("resources/floor.jpg"), 
+                        STRING("resources/debug.png"),
+                    };
+                    Map_Type texture_map_types[] = {MAP_TYPE_METALLIC, MAP_TYPE_DIFFUSE, MAP_TYPE_DIFFUSE};
+                    texture_state = render_texture_add_many_from_disk(&render, texture_outs, texture_paths, texture_map_types, NULL, ARRAY_LEN(texture_paths));
 
                     material_shiny_debug = render_material_add(&render, STRING("material_shiny_debug"));
                     material_mat_floor = render_material_add(&render, STRING("material_mat_floor"));
@@ -2635,14 +5079,15 @@ void run_func(void* context)
                     material_shiny_debug.ptr->textures[0] = image_debug;
                     material_shiny_debug.ptr->textures[1] = image_rusted_iron_metallic;
                     material_shiny_debug.ptr->used_textures = 2;
+                    render_material_bind_textures(&render, material_shiny_debug.ptr);
 
                     material_mat_floor.ptr->diffuse_color = vec3(0, 1, 0);
                     material_mat_floor.ptr->specular_color = vec3(0, 1, 1);
                     material_mat_floor.ptr->specular_exponent = 10;
                     material_mat_floor.ptr->textures[0] = image_floor;
                     material_mat_floor.ptr->used_textures = 1;
+                    render_material_bind_textures(&render, material_mat_floor.ptr);
 
-                    render_texture_manager_generate_mips(&render.texture_manager);
                     ASSERT(texture_state);
                 }
             }
@@ -2682,51 +5127,29 @@ void run_func(void* context)
             {
                 PROFILE_SCOPE(submit)
                 {
-                    enum {
-                        GRID_Y = 400,
-                        GRID_X = 400,
-                    };
-
-                    for(isize y = 0; y < GRID_Y; y++)
-                        for(isize x = 0; x < GRID_X; x++)
+                    Test_Grid_Submit test_grid = {0};
+                    test_grid.render = &render;
+                    test_grid.render_cube = render_cube;
+                    test_grid.render_cube_sphere = render_cube_sphere;
+                    test_grid.material_shiny_debug = material_shiny_debug;
+                    test_grid.material_mat_floor = material_mat_floor;
+
+                    //The grid does not move so it is added to the retained scene once. 
+                    //Resubmitting it each frame through the queue does the same thing but slower.
+                    if(1)
+                    {
+                        if(render.scene.alive_count == 0)
                         {
-                            Render_Phong_Command phong_command = {0};
-
-                            phong_command.transform = mat4_translation(vec3((f32) 2*x, (f32) 2*y, 0));
-
-                            i32 do_x = 0;
-                            if(1)
-                            {
-                                isize v = x + y;
-                                do_x = v % 3 == 0;
-                            }
-                            else
-                            {
-                                isize v = x + y*GRID_Y;
-                                if(v < GRID_X*GRID_Y * 2/3)
-                                    do_x = 1;
-                                if(v < GRID_X*GRID_Y * 1/3)
-                                    do_x = 2;
-                            }
-
-                            if(do_x == 0)
-                            {
-                                phong_command.material = material_shiny_debug;    
-                                phong_command.geometry = render_cube;
-                            }
-                            else if(do_x == 1)
-                            {
-                                phong_command.material = material_shiny_debug;    
-                                phong_command.geometry = render_cube_sphere;
-                            }
-                            else
-                            {
-                                phong_command.geometry = render_cube;
-                                phong_command.material = material_mat_floor;
-                            }
-
-                            render_queue_submit_phong(&render, &phong_command);
+                            for(isize y = 0; y < TEST_GRID_Y; y++)
+                                for(isize x = 0; x < TEST_GRID_X; x++)
+                                {
+                                    Render_Phong_Command phong_command = test_grid_command(&test_grid, x, y);
+                                    render_scene_add(&render.scene, &phong_command);
+                                }
                         }
+                    }
+                    else
+                        parallel_for(TEST_GRID_Y, parallel_batch_size(TEST_GRID_Y, 4, 8), test_grid_submit_rows, &test_grid);
                 }
                 
                 //render_screen_frame_buffers_msaa_render_begin(&screen_buffers);
@@ -2743,7 +5166,13 @@ void run_func(void* context)
                 {
                     fps_display_last_update = end_frame_time;
                     SCRATCH_ARENA(arena)
-                        glfwSetWindowTitle(window, format(arena.alloc, "Render %5d fps", (int) (1.0f/frame_time)).data);
+                    {
+                        Render_Queue* queue = &render.render_queue;
+                        Render_Scene* scene = &render.scene;
+                        isize visible = queue->visible_count + scene->visible.len;
+                        isize total = queue->visible_count + queue->culled_count + scene->alive_count;
+                        glfwSetWindowTitle(window, format(arena.alloc, "Render %5d fps %i / %i visible", (int) (1.0f/frame_time), (int) visible, (int) total).data);
+                    }
                 }
             }
         }
@@ -2751,6 +5180,7 @@ void run_func(void* context)
 
     LOG_WARN("APP", "Scratch: rises:%lli falls:%lli", scratch_arena_stack()->rise_count, scratch_arena_stack()->fall_count);
     
+    render_texture_loader_deinit(&render.texture_loader);
     shape_deinit(&uv_sphere);
     shape_deinit(&cube_sphere);
     shape_deinit(&screen_quad);
@@ -2783,30 +5213,2342 @@ void error_func(void* context, Platform_Sandbox_Error error)
 #include "lib/_test_all.h"
 
 #include <stdlib.h>
-void run_test_func(void* context)
+
+//Generates an obj file of roughly the given size with random vertices and faces.
+void benchmark_obj_generate(String_Builder* into, isize size)
 {
-    PROFILE_SCOPE() 
+    u64 state = 0x853c49e6748fea9bULL;
+    char buffer[256] = {0};
+    isize vertex_count = 0;
+    builder_clear(into);
+    builder_reserve(into, size + 256);
+    while(into->len < size)
     {
-        if(0)
+        state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+        int len = 0;
+        if(vertex_count < 3 || state % 3 != 0)
         {
-            uint32_t futex = 1;
+            f32 x = (f32) (state & 0xFFFF) / 0xFFFF * 100 - 50;
+            f32 y = (f32) ((state >> 16) & 0xFFFF) / 0xFFFF * 100 - 50;
+            f32 z = (f32) ((state >> 32) & 0xFFFF) / 0xFFFF * 100 - 50;
+            len = snprintf(buffer, sizeof buffer, "v %f %f %f\nvt %f %f\nvn %f %f %f\n", x, y, z, x/100 + 0.5f, y/100 + 0.5f, x/50, y/50, z/50);
+            vertex_count += 1;
+        }
+        else
+        {
+            lli i1 = (lli) ((state >> 8) % (u64) vertex_count) + 1;
+            lli i2 = (lli) ((state >> 24) % (u64) vertex_count) + 1;
+            lli i3 = (lli) ((state >> 40) % (u64) vertex_count) + 1;
+            len = snprintf(buffer, sizeof buffer, "f %lli/%lli/%lli %lli/%lli/%lli %lli/%lli/%lli\n", i1, i1, i1, i2, i2, i2, i3, i3, i3);
+        }
+        builder_append(into, string_make(buffer, len));
+    }
+}
 
-            Perf_Benchmark bench_futex = {0};
-	        while(perf_benchmark_custom(&bench_futex, NULL, 0.3, 3, 4)) {
-                platform_futex_wake(&futex);
-                platform_futex_wake(&futex);
-                platform_futex_wake(&futex);
-                platform_futex_wake(&futex);
-	        }
+//Parses all floats of 'v ' lines with either the lib or the format_obj.h parser. 
+// Returns the number of floats parsed and adds them to checksum so that the work cannot be optimized away.
+INTERNAL isize _benchmark_obj_parse_floats(String obj_source, bool fast, f64* checksum)
+{
+    isize float_count = 0;
+    f64 sum = 0;
+    for(_Format_Obj_Line_Iterator it = {0}; _format_obj_line_iterator_next(&it, obj_source); )
+    {
+        String line = it.line;
+        if(line.len < 2 || line.data[0] != 'v' || line.data[1] != ' ')
+            continue;
+
+        for(isize i = 1; _format_obj_match_whitespace(line, &i); float_count++)
+        {
+            f32 val = 0;
+            bool ok = fast ? format_obj_match_decimal_f32(line, &i, &val) : match_decimal_f32(line, &i, &val);
+            if(!ok)
+                break;
+            sum += val;
+        }
+    }
+
+    *checksum += sum;
+    return float_count;
+}
+
+INTERNAL isize _benchmark_obj_parse_faces(String obj_source, bool masked, i64* checksum)
+{
+    isize corner_count = 0;
+    i64 sum = 0;
+    _Format_Obj_Line_Masks no_masks = {0};
+    for(_Format_Obj_Line_Iterator it = {0}; _format_obj_line_iterator_next(&it, obj_source); )
+    {
+        String line = it.line;
+        if(line.len < 2 || line.data[0] != 'f' || line.data[1] != ' ')
+            continue;
+
+        _Format_Obj_Line_Masks masks = masked ? _format_obj_line_masks(line) : no_masks;
+        Format_Obj_Vertex_Index corner = {0};
+        for(isize i = 1; _format_obj_match_next_corner(line, masks, &i, &corner); corner_count++)
+            sum += corner.pos_i1 + corner.uv_i1 + corner.norm_i1;
+    }
+
+    *checksum += sum;
+    return corner_count;
+}
+
+//Compares the lib line iteration and float parsing against the ones used by format_obj.h
+// and measures the throughput of the entire serial and parallel obj reading.
+void benchmark_obj_parsing(String name, String obj_source)
+{
+    f64 mb = (f64) obj_source.len / (1024*1024);
+    LOG_INFO("BENCH", "obj parsing '%.*s' (%.2lf MB)", STRING_PRINT(name), mb);
+    log_indent();
+
+    isize lines = 0;
+    f64 start = clock_s();
+    for(Line_Iterator it = {0}; line_iterator_get_line(&it, obj_source); )
+        lines += 1;
+    f64 lib_lines_time = clock_s() - start;
+
+    start = clock_s();
+    for(_Format_Obj_Line_Iterator it = {0}; _format_obj_line_iterator_next(&it, obj_source); )
+        lines -= 1;
+    f64 simd_lines_time = clock_s() - start;
+    LOG_INFO("BENCH", "lines: lib %.2lf MB/s simd %.2lf MB/s (count diff %lli)", mb/lib_lines_time, mb/simd_lines_time, (lli) lines);
+
+    //parse all 'v ' lines both ways. Each loop is timed as a whole so that the clock does not dominate.
+    f64 checksum = 0;
+    start = clock_s();
+    isize float_count = _benchmark_obj_parse_floats(obj_source, false, &checksum);
+    f64 lib_floats_time = clock_s() - start;
+
+    start = clock_s();
+    _benchmark_obj_parse_floats(obj_source, true, &checksum);
+    f64 fast_floats_time = clock_s() - start;
+
+    //count results that differ from strtof
+    isize lib_inexact = 0;
+    isize fast_inexact = 0;
+    String_Builder number = builder_make(allocator_get_default(), 0);
+    for(_Format_Obj_Line_Iterator it = {0}; _format_obj_line_iterator_next(&it, obj_source); )
+    {
+        String line = it.line;
+        if(line.len < 2 || line.data[0] != 'v' || line.data[1] != ' ')
+            continue;
+
+        for(isize i = 1; _format_obj_match_whitespace(line, &i); )
+        {
+            isize lib_i = i;
+            isize fast_i = i;
+            f32 lib_val = 0;
+            f32 fast_val = 0;
+            if(!match_decimal_f32(line, &lib_i, &lib_val) || !format_obj_match_decimal_f32(line, &fast_i, &fast_val))
+                break;
+
+            builder_assign(&number, string_range(line, i, fast_i));
+            f32 exact = strtof(number.data, NULL);
+            lib_inexact += lib_val != exact;
+            fast_inexact += fast_val != exact;
+            i = fast_i;
+        }
+    }
+    builder_deinit(&number);
+    LOG_INFO("BENCH", "floats: lib %.2lf ns fast %.2lf ns per float (wrong: lib %lli fast %lli of %lli) checksum %lf", 
+        lib_floats_time*1e9/MAX(float_count, 1), fast_floats_time*1e9/MAX(float_count, 1), (lli) lib_inexact, (lli) fast_inexact, (lli) float_count, checksum);
+
+    //parse all 'f ' lines char by char and through the whitespace and '/' masks
+    i64 scalar_sum = 0;
+    i64 masked_sum = 0;
+    start = clock_s();
+    isize corner_count = _benchmark_obj_parse_faces(obj_source, false, &scalar_sum);
+    f64 scalar_faces_time = clock_s() - start;
+
+    start = clock_s();
+    isize masked_corner_count = _benchmark_obj_parse_faces(obj_source, true, &masked_sum);
+    f64 masked_faces_time = clock_s() - start;
+    LOG_INFO("BENCH", "faces: scalar %.2lf ns simd %.2lf ns per corner (%lli corners %s)", 
+        scalar_faces_time*1e9/MAX(corner_count, 1), masked_faces_time*1e9/MAX(corner_count, 1), (lli) corner_count,
+        corner_count == masked_corner_count && scalar_sum == masked_sum ? "same" : "RESULTS DIFFER");
+
+    for(isize parallel = 0; parallel < 2; parallel++)
+    {
+        Format_Obj_Model model = {0};
+        format_obj_model_init(&model, allocator_get_default());
+        isize error_count = 0;
+        start = clock_s();
+        if(parallel)
+            format_obj_read_parallel(&model, obj_source, NULL, 0, &error_count);
+        else
+            format_obj_read(&model, obj_source, NULL, 0, &error_count);
+        f64 time = clock_s() - start;
+        LOG_INFO("BENCH", "%s read: %.2lf MB/s (%lli errors)", parallel ? "parallel" : "serial", mb/time, (lli) error_count);
+        format_obj_model_deinit(&model);
+    }
+
+    log_outdent();
+}
+
+//Checks format_obj_match_decimal_f32 against strtof on count random inputs. Covers round trip prints 
+// of random floats, (almost) exact halfway cases between two floats, long and exotic digit strings and 
+// numbers longer than the slow path stack buffer.
+void test_obj_decimal_f32(isize count)
+{
+    LOG_INFO("TEST", "obj decimal f32 (%lli inputs)", (lli) count);
+    log_indent();
+
+    u64 state = 0x9E3779B97F4A7C15ULL;
+    char buffer[512] = {0};
+    isize mismatches = 0;
+    for(isize k = 0; k < count; k++)
+    {
+        state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+        u32 bits = (u32) (state >> 32);
+        f32 random_float = 0;
+        memcpy(&random_float, &bits, sizeof bits);
+        if(isfinite(random_float) == false)
+            random_float = (f32) (state & 0xFFFF);
+
+        int len = 0;
+        switch(state % 6)
+        {
+            case 0: len = snprintf(buffer, sizeof buffer, "%.9g", random_float); break;
+            case 1: len = snprintf(buffer, sizeof buffer, "%.*g", (int) ((state >> 8) % 12) + 1, random_float); break;
+            case 2: len = snprintf(buffer, sizeof buffer, "%f", (f64) random_float); break;
+            case 3: {
+                //halfway between two neighbouring floats, exactly or just below or above
+                f64 halfway = ((f64) random_float + (f64) nextafterf(random_float, INFINITY)) / 2;
+                len = snprintf(buffer, sizeof buffer, "%.*g", (int) ((state >> 8) % 16) + 9, halfway);
+            } break;
+            case 4: {
+                //random digit string with up to 30 digits on each side of the dot and an optional exponent
+                u64 digit_state = state;
+                isize int_digits = (isize) ((state >> 8) % 31);
+                isize frac_digits = (isize) ((state >> 16) % 31);
+                if(state & ((u64) 1 << 24))
+                    buffer[len++] = '-';
+                for(isize i = 0; i < int_digits; i++, digit_state /= 10)
+                    buffer[len++] = (char) ('0' + (digit_state % 10 == 0 ? (state >> 40) % 10 : digit_state % 10));
+                buffer[len++] = '.';
+                for(isize i = 0; i < frac_digits || int_digits + i == 0; i++, digit_state = digit_state*6364136223846793005ULL + 1)
+                    buffer[len++] = (char) ('0' + (digit_state >> 60) % 10);
+                if(state & ((u64) 1 << 25))
+                    len += snprintf(buffer + len, sizeof buffer - (size_t) len, "e%i", (int) ((state >> 32) % 101) - 50);
+                buffer[len] = '\0';
+            } break;
+            case 5: {
+                //longer than the stack buffer used by the strtof fallback
+                len = snprintf(buffer, sizeof buffer, "0.");
+                isize zeros = (isize) ((state >> 8) % 300) + 100;
+                for(isize i = 0; i < zeros; i++)
+                    buffer[len++] = '0';
+                len += snprintf(buffer + len, sizeof buffer - (size_t) len, "%llu%llue%i", 
+                    (unsigned long long) (state >> 20), (unsigned long long) (state*6364136223846793005ULL), (int) zeros);
+            } break;
+        }
+
+        String str = string_make(buffer, len);
+        char* end = NULL;
+        f32 exact = strtof(buffer, &end);
+        f32 parsed = 0;
+        isize index = 0;
+        bool ok = format_obj_match_decimal_f32(str, &index, &parsed);
+        if(!ok || index != end - buffer || memcmp(&exact, &parsed, sizeof exact) != 0)
+        {
+            if(mismatches < 10)
+                LOG_ERROR("TEST", "'%s' parsed as %.9g but strtof gives %.9g", buffer, parsed, exact);
+            mismatches += 1;
+        }
+    }
+
+    LOG_INFO("TEST", "%lli mismatches", (lli) mismatches);
+    ASSERT(mismatches == 0);
+    log_outdent();
+}
+
+//Generates an obj with every statement the parallel reader has to replay in order: objects, 
+// groups, materials and smoothing. Also uses relative indices, quads and an occasional invalid line.
+INTERNAL void _test_obj_generate(String_Builder* into, isize size)
+{
+    u64 state = 0x2545F4914F6CDD1DULL;
+    char buffer[256] = {0};
+    isize vertex_count = 0;
+    builder_clear(into);
+    while(into->len < size)
+    {
+        state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+        u64 kind = state % 64;
+        int len = 0;
+        if(vertex_count < 4 || kind < 30)
+        {
+            f32 x = (f32) (state & 0xFFFF) / 0xFFFF - 0.5f;
+            f32 y = (f32) ((state >> 16) & 0xFFFF) / 0xFFFF - 0.5f;
+            len = snprintf(buffer, sizeof buffer, "v %f %f 1\nvt %f %f\nvn 0 0 1\n", x, y, x, y);
+            vertex_count += 1;
+        }
+        else if(kind < 50)
+        {
+            lli i1 = (lli) ((state >> 8) % (u64) vertex_count) + 1;
+            lli i2 = (lli) ((state >> 24) % (u64) vertex_count) + 1;
+            len = snprintf(buffer, sizeof buffer, "f %lli/%lli/%lli %lli/%lli/%lli -1/-1/-1\n", i1, i1, i1, i2, i2, i2);
+        }
+        else if(kind < 56)
+            len = snprintf(buffer, sizeof buffer, "f -4/-4/-4 -3/-3/-3 -2/-2/-2 -1/-1/-1\n");
+        else if(kind == 56)
+            len = snprintf(buffer, sizeof buffer, "o object_%llu\n", (unsigned long long) (state >> 48));
+        else if(kind == 57)
+            len = snprintf(buffer, sizeof buffer, "g group_%llu other_%llu\n", (unsigned long long) (state >> 48), (unsigned long long) (state >> 56));
+        else if(kind == 58)
+            len = snprintf(buffer, sizeof buffer, "usemtl material_%llu\n", (unsigned long long) (state >> 60));
+        else if(kind == 59)
+            len = snprintf(buffer, sizeof buffer, "s %llu\n", (unsigned long long) (state >> 61));
+        else if(kind == 60 && (state >> 6) % 16 == 0)
+            len = snprintf(buffer, sizeof buffer, "v not_a_number\n");
+        else
+            len = snprintf(buffer, sizeof buffer, "# comment\n");
+        builder_append(into, string_make(buffer, len));
+    }
+}
+
+INTERNAL bool _test_obj_builders_equal(String_Builder_Array a, String_Builder_Array b)
+{
+    bool equal = a.len == b.len;
+    for(isize i = 0; i < a.len && equal; i++)
+        equal = string_is_equal(a.data[i].string, b.data[i].string);
+    return equal;
+}
+
+#define _TEST_OBJ_ARRAYS_EQUAL(a, b) ((a).len == (b).len && ((a).len == 0 || memcmp((a).data, (b).data, (size_t) (a).len * sizeof *(a).data) == 0))
+
+INTERNAL bool _test_obj_models_equal(const Format_Obj_Model* a, const Format_Obj_Model* b)
+{
+    bool equal = _TEST_OBJ_ARRAYS_EQUAL(a->positions, b->positions)
+        && _TEST_OBJ_ARRAYS_EQUAL(a->uvs, b->uvs)
+        && _TEST_OBJ_ARRAYS_EQUAL(a->normals, b->normals)
+        && _TEST_OBJ_ARRAYS_EQUAL(a->indices, b->indices)
+        && _TEST_OBJ_ARRAYS_EQUAL(a->polygons, b->polygons)
+        && _test_obj_builders_equal(a->material_files, b->material_files)
+        && a->groups.len == b->groups.len;
+
+    for(isize i = 0; i < a->groups.len && equal; i++)
+    {
+        Format_Obj_Group ga = a->groups.data[i];
+        Format_Obj_Group gb = b->groups.data[i];
+        equal = ga.trinagles_from == gb.trinagles_from && ga.trinagles_count == gb.trinagles_count
+            && ga.smoothing_index == gb.smoothing_index && ga.merge_group_resolution == gb.merge_group_resolution
+            && string_is_equal(ga.object.string, gb.object.string)
+            && string_is_equal(ga.material.string, gb.material.string)
+            && _test_obj_builders_equal(ga.groups, gb.groups);
+    }
+    return equal;
+}
+
+//The parallel obj reader must give exactly the same model and errors as the serial one.
+//Sizes below FORMAT_OBJ_PARALLEL_MIN_CHUNK_SIZE are read in a single chunk so bigger ones are needed as well.
+void test_obj_parallel_read()
+{
+    LOG_INFO("TEST", "obj parallel read");
+    log_indent();
+
+    enum {MAX_ERRORS = 64};
+    String_Builder obj_source = builder_make(allocator_get_default(), 0);
+    isize sizes[] = {0, 1000, FORMAT_OBJ_PARALLEL_MIN_CHUNK_SIZE + 1, 5*FORMAT_OBJ_PARALLEL_MIN_CHUNK_SIZE + 123, (isize) 256 << 20};
+    for(isize s = 0; s < ARRAY_LEN(sizes); s++)
+    {
+        _test_obj_generate(&obj_source, sizes[s]);
+
+        Format_Obj_Model serial = {0};
+        Format_Obj_Model parallel = {0};
+        Format_Obj_Mtl_Error serial_errors[MAX_ERRORS] = {0};
+        Format_Obj_Mtl_Error parallel_errors[MAX_ERRORS] = {0};
+        isize serial_error_count = 0;
+        isize parallel_error_count = 0;
+        format_obj_model_init(&serial, allocator_get_default());
+        format_obj_model_init(&parallel, allocator_get_default());
+
+        f64 start = clock_s();
+        format_obj_read(&serial, obj_source.string, serial_errors, MAX_ERRORS, &serial_error_count);
+        f64 serial_time = clock_s() - start;
+
+        start = clock_s();
+        format_obj_read_parallel(&parallel, obj_source.string, parallel_errors, MAX_ERRORS, &parallel_error_count);
+        f64 parallel_time = clock_s() - start;
+
+        ASSERT(_test_obj_models_equal(&serial, &parallel));
+        ASSERT(serial_error_count == parallel_error_count);
+        for(isize i = 0; i < MIN(serial_error_count, MAX_ERRORS); i++)
+            ASSERT(serial_errors[i].index == parallel_errors[i].index && serial_errors[i].line == parallel_errors[i].line 
+                && serial_errors[i].statement == parallel_errors[i].statement);
+
+        f64 mb = (f64) obj_source.len / (1024*1024);
+        LOG_INFO("TEST", "%8.2lf MB: serial %8.2lf MB/s parallel %8.2lf MB/s on %lli threads (%lli triangles %lli errors)", 
+            mb, mb/MAX(serial_time, 1e-9), mb/MAX(parallel_time, 1e-9), (lli) parallel_thread_count(), (lli) serial.indices.len/3, (lli) serial_error_count);
+
+        format_obj_model_deinit(&serial);
+        format_obj_model_deinit(&parallel);
+    }
+
+    builder_deinit(&obj_source);
+    log_outdent();
+}
+
+//Compares qsort with command_buffer_compare_func against the radix sort of the sort keys
+// on synthetic commands similar to the ones produced by the demo grid.
+void benchmark_render_sort()
+{
+    enum {GEOMETRY_COUNT = 1000, MATERIAL_COUNT = 200, BATCH_COUNT = 4};
+    LOG_INFO("BENCH", "render command sorting");
+    log_indent();
+
+    Allocator* alloc = allocator_get_default();
+    Array(Render_Geometry) geometries = {alloc};
+    Array(Render_Material) materials = {alloc};
+    array_resize(&geometries, GEOMETRY_COUNT);
+    array_resize(&materials, MATERIAL_COUNT);
+    for(isize i = 0; i < GEOMETRY_COUNT; i++)
+    {
+        geometries.data[i].info.sort_index = (u32) i;
+        geometries.data[i].group.batch_index = (i32) (i % BATCH_COUNT) + 1;
+    }
+    for(isize i = 0; i < MATERIAL_COUNT; i++)
+        materials.data[i].info.sort_index = (u32) i;
+
+    isize counts[] = {10*1000, 100*1000, 1000*1000};
+    for(isize count_i = 0; count_i < ARRAY_LEN(counts); count_i++)
+    {
+        isize count = counts[count_i];
+        Render_Command_Expanded_Array original = {alloc};
+        Render_Command_Expanded_Array by_qsort = {alloc};
+        Render_Command_Expanded_Array by_radix = {alloc};
+        array_resize(&original, count);
+
+        u64 state = 0x9E3779B97F4A7C15ULL;
+        for(isize i = 0; i < count; i++)
+        {
+            state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+            Render_Command_Expanded* command = &original.data[i];
+            command->geometry = &geometries.data[state % GEOMETRY_COUNT];
+            command->material = &materials.data[(state >> 32) % MATERIAL_COUNT];
+            command->environment = (Render_Environment*) 1;
+            command->transform_index = (i32) i;
+            command->geometry_batch_index = command->geometry->group.batch_index;
+            command->sort_key = render_command_sort_key(0, command->geometry_batch_index, command->geometry, command->material);
+        }
+
+        f64 times[3] = {0};
+        bool keys_match = true;
+        for(isize method = 0; method < 3; method++)
+        {
+            Render_Command_Expanded_Array* sorted = method == 0 ? &by_qsort : &by_radix;
+            array_resize_for_overwrite(sorted, count);
+            memcpy(sorted->data, original.data, (size_t) array_byte_size(original));
+
+            f64 start = clock_s();
+            if(method == 0)
+                qsort(sorted->data, (size_t) sorted->len, sizeof *sorted->data, command_buffer_compare_func);
+            else
+                render_queue_sort_expanded(sorted->data, sorted->len, method == 2);
+            times[method] = clock_s() - start;
+
+            //The geometries and materials are allocated in order of their sort_index so both orders must agree
+            for(isize i = 0; i < count && method > 0; i++)
+                keys_match = keys_match && by_qsort.data[i].sort_key == by_radix.data[i].sort_key;
+        }
+
+        LOG_INFO("BENCH", "%7lli commands: qsort %.3lf ms radix %.3lf ms parallel radix %.3lf ms (%s)", 
+            (lli) count, times[0]*1000, times[1]*1000, times[2]*1000, keys_match ? "same order" : "ORDER DIFFERS");
+
+        array_deinit(&original);
+        array_deinit(&by_qsort);
+        array_deinit(&by_radix);
+    }
+
+    array_deinit(&geometries);
+    array_deinit(&materials);
+    log_outdent();
+}
+
+//Checks the simd frustum culling against the scalar version and the expected results 
+// for a few boxes around the camera then measures both on random boxes.
+void benchmark_frustum_cull()
+{
+    enum {BOX_COUNT = 1000*1000};
+    LOG_INFO("BENCH", "frustum culling");
+    log_indent();
+
+    Camera camera = {0};
+    camera.fov = TAU/4;
+    camera.aspect_ratio = 16.0f/9.0f;
+    camera.near = 0.01f;
+    camera.far = 1000.0f;
+    camera.pos = vec3(0, 0, 0);
+    camera.looking_at = vec3(1, 0, 0);
+    camera.up_dir = vec3(0, 1, 0);
+    camera.is_position_relative = true;
+
+    Mat4 projection_view = mat4_mul(camera_make_projection_matrix(camera), camera_make_view_matrix(camera));
+    Frustum frustum = frustum_from_matrix(projection_view);
+
+    Allocator* alloc = allocator_get_default();
+    Array(f32) components[6] = {0};
+    for(isize k = 0; k < 6; k++)
+    {
+        array_init(&components[k], alloc);
+        array_resize(&components[k], BOX_COUNT);
+    }
+
+    //In front, behind, past the far plane, far to the side, straddling the near plane
+    f32 known[5][3] = {{10, 0, 0}, {-10, 0, 0}, {2000, 0, 0}, {10, 500, 0}, {0, 0, 0}};
+    u8 known_visible[5] = {1, 0, 0, 0, 1};
+
+    u64 state = 0x9E3779B97F4A7C15ULL;
+    for(isize i = 0; i < BOX_COUNT; i++)
+    {
+        for(isize k = 0; k < 6; k++)
+        {
+            state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+            f32 random = (f32) (state >> 40) / (f32) (1 << 24);
+            components[k].data[i] = k < 3 ? random*2000 - 1000 : random*5;
+        }
+
+        if(i < ARRAY_LEN(known))
+            for(isize k = 0; k < 3; k++)
+            {
+                components[k].data[i] = known[i][k];
+                components[k + 3].data[i] = 1;
+            }
+    }
+
+    Frustum_Cull_Boxes boxes = {
+        components[0].data, components[1].data, components[2].data, 
+        components[3].data, components[4].data, components[5].data, BOX_COUNT
+    };
+
+    u8_Array visible_simd = {alloc};
+    u8_Array visible_scalar = {alloc};
+    array_resize(&visible_simd, BOX_COUNT);
+    array_resize(&visible_scalar, BOX_COUNT);
+
+    f64 start = clock_s();
+    isize simd_count = frustum_cull_boxes(&frustum, boxes, visible_simd.data);
+    f64 simd_time = clock_s() - start;
+
+    start = clock_s();
+    isize scalar_count = frustum_cull_boxes_scalar(&frustum, boxes, visible_scalar.data);
+    f64 scalar_time = clock_s() - start;
+
+    bool results_match = simd_count == scalar_count && memcmp(visible_simd.data, visible_scalar.data, BOX_COUNT) == 0;
+    for(isize i = 0; i < ARRAY_LEN(known); i++)
+        results_match = results_match && visible_simd.data[i] == known_visible[i];
+
+    LOG_INFO("BENCH", "%lli boxes (%lli visible): simd %.3lf ms scalar %.3lf ms (%s)", 
+        (lli) BOX_COUNT, (lli) simd_count, simd_time*1000, scalar_time*1000, results_match ? "results match" : "RESULTS DIFFER");
+
+    for(isize k = 0; k < 6; k++)
+        array_deinit(&components[k]);
+    array_deinit(&visible_simd);
+    array_deinit(&visible_scalar);
+    log_outdent();
+}
+
+//Measures culling of a grid of instances (like the demo grid) seen from above 
+// by the linear simd test and by the bvh for different instance counts.
+void benchmark_bvh_cull()
+{
+    LOG_INFO("BENCH", "bvh culling");
+    log_indent();
+
+    Allocator* alloc = allocator_get_default();
+    isize sides[] = {100, 400, 1000};
+    for(isize side_i = 0; side_i < ARRAY_LEN(sides); side_i++)
+    {
+        isize side = sides[side_i];
+        isize count = side*side;
+
+        Camera camera = {0};
+        camera.fov = TAU/4;
+        camera.aspect_ratio = 16.0f/9.0f;
+        camera.near = 0.01f;
+        camera.far = 1000.0f;
+        camera.pos = vec3((f32) side, (f32) side, 50);
+        camera.looking_at = vec3(0.1f, 0, -1);
+        camera.up_dir = vec3(0, 1, 0);
+        camera.is_position_relative = true;
+        Frustum frustum = frustum_from_matrix(mat4_mul(camera_make_projection_matrix(camera), camera_make_view_matrix(camera)));
+
+        AABB_Array boxes = {alloc};
+        Array(f32) components[6] = {0};
+        u8_Array visible_linear = {alloc};
+        i32_Array visible_bvh = {alloc};
+        array_resize(&boxes, count);
+        array_resize(&visible_linear, count);
+        for(isize k = 0; k < 6; k++)
+        {
+            array_init(&components[k], alloc);
+            array_resize(&components[k], count);
+        }
+
+        for(isize i = 0; i < count; i++)
+        {
+            Vec3 center = vec3((f32) (2*(i % side)), (f32) (2*(i / side)), 0);
+            boxes.data[i].min = vec3_sub(center, vec3(0.5f, 0.5f, 0.5f));
+            boxes.data[i].max = vec3_add(center, vec3(0.5f, 0.5f, 0.5f));
+            components[0].data[i] = center.x;
+            components[1].data[i] = center.y;
+            components[2].data[i] = center.z;
+            components[3].data[i] = 0.5f;
+            components[4].data[i] = 0.5f;
+            components[5].data[i] = 0.5f;
+        }
+
+        Frustum_Cull_Boxes soa_boxes = {
+            components[0].data, components[1].data, components[2].data, 
+            components[3].data, components[4].data, components[5].data, count
+        };
+
+        Bvh bvh = {0};
+        bvh_init(&bvh, alloc);
+
+        f64 start = clock_s();
+        bvh_build(&bvh, boxes.data, NULL, count);
+        f64 build_time = clock_s() - start;
         
-            Perf_Benchmark protected_futex = {0};
-	        while(perf_benchmark_custom(&protected_futex, NULL, 0.3, 3, 4)) {
-                platform_futex_wake(&futex);
-                platform_futex_wake(&futex);
-                platform_futex_wake(&futex);
-                platform_futex_wake(&futex);
-	        }
+        start = clock_s();
+        bvh_refit(&bvh, boxes.data);
+        f64 refit_time = clock_s() - start;
+
+        //Moves every 64th box a bit and refits only those
+        i32_Array moved = {alloc};
+        for(isize i = 0; i < count; i += 64)
+        {
+            boxes.data[i].min.z += 0.25f;
+            boxes.data[i].max.z += 0.25f;
+            array_push(&moved, (i32) i);
+        }
+
+        start = clock_s();
+        bvh_refit_items(&bvh, boxes.data, moved.data, moved.len);
+        f64 refit_items_time = clock_s() - start;
+
+        start = clock_s();
+        isize linear_count = frustum_cull_boxes(&frustum, soa_boxes, visible_linear.data);
+        f64 linear_time = clock_s() - start;
+        
+        start = clock_s();
+        isize bvh_count = bvh_query_frustum(&bvh, boxes.data, &frustum, &visible_bvh);
+        f64 bvh_time = clock_s() - start;
+
+        LOG_INFO("BENCH", "%7lli instances (%lli visible): linear %.3lf ms bvh %.3lf ms (%s) | build %.2lf ms refit %.2lf ms refit %lli moved %.3lf ms nodes %lli", 
+            (lli) count, (lli) linear_count, linear_time*1000, bvh_time*1000, linear_count == bvh_count ? "same count" : "COUNT DIFFERS",
+            build_time*1000, refit_time*1000, (lli) moved.len, refit_items_time*1000, (lli) bvh.nodes.len);
+
+        bvh_deinit(&bvh);
+        array_deinit(&moved);
+        for(isize k = 0; k < 6; k++)
+            array_deinit(&components[k]);
+        array_deinit(&boxes);
+        array_deinit(&visible_linear);
+        array_deinit(&visible_bvh);
+    }
+
+    log_outdent();
+}
+
+//Distance at which the ray enters the box or -1 if it misses. Handles axis parallel rays 
+// explicitly so it does not share the infinities trick with bvh_ray_pick.
+INTERNAL f32 _test_ray_box_brute(Vec3 origin, Vec3 dir, AABB box, f32 max_distance)
+{
+    f32 o[3] = {origin.x, origin.y, origin.z};
+    f32 d[3] = {dir.x, dir.y, dir.z};
+    f32 lo[3] = {box.min.x, box.min.y, box.min.z};
+    f32 hi[3] = {box.max.x, box.max.y, box.max.z};
+
+    f32 t_min = 0;
+    f32 t_max = max_distance;
+    for(isize axis = 0; axis < 3; axis++)
+    {
+        if(d[axis] == 0)
+        {
+            if(o[axis] < lo[axis] || o[axis] > hi[axis])
+                return -1;
+            continue;
+        }
+
+        f32 t1 = (lo[axis] - o[axis])/d[axis];
+        f32 t2 = (hi[axis] - o[axis])/d[axis];
+        t_min = MAX(t_min, MIN(t1, t2));
+        t_max = MIN(t_max, MAX(t1, t2));
+    }
+
+    return t_min <= t_max ? t_min : -1;
+}
+
+INTERNAL f32 _test_bvh_random(u64* state)
+{
+    *state ^= *state << 13; *state ^= *state >> 7; *state ^= *state << 17;
+    return (f32) (*state >> 40) / (f32) (1 << 24);
+}
+
+//Compares bvh_ray_pick against testing every box over random rays, some of them axis parallel.
+void test_bvh_ray_pick()
+{
+    enum {BOX_COUNT = 20000, RAY_COUNT = 2000};
+    LOG_INFO("TEST", "bvh ray pick");
+    log_indent();
+
+    Allocator* alloc = allocator_get_default();
+    AABB_Array boxes = {alloc};
+    array_resize(&boxes, BOX_COUNT);
+
+    u64 state = 0x9E3779B97F4A7C15ULL;
+    for(isize i = 0; i < BOX_COUNT; i++)
+    {
+        Vec3 center = vec3(_test_bvh_random(&state)*200 - 100, _test_bvh_random(&state)*200 - 100, _test_bvh_random(&state)*200 - 100);
+        Vec3 half = vec3(_test_bvh_random(&state)*2 + 0.01f, _test_bvh_random(&state)*2 + 0.01f, _test_bvh_random(&state)*2 + 0.01f);
+        boxes.data[i].min = vec3_sub(center, half);
+        boxes.data[i].max = vec3_add(center, half);
+    }
+
+    Bvh bvh = {0};
+    bvh_init(&bvh, alloc);
+    bvh_build(&bvh, boxes.data, NULL, BOX_COUNT);
+
+    isize hits = 0;
+    f64 bvh_time = 0;
+    f64 brute_time = 0;
+    for(isize r = 0; r < RAY_COUNT; r++)
+    {
+        Vec3 origin = vec3(_test_bvh_random(&state)*300 - 150, _test_bvh_random(&state)*300 - 150, _test_bvh_random(&state)*300 - 150);
+        Vec3 dir = vec3(_test_bvh_random(&state)*2 - 1, _test_bvh_random(&state)*2 - 1, _test_bvh_random(&state)*2 - 1);
+        if(r % 4 == 0)
+            dir.y = 0;
+        if(r % 8 == 0)
+            dir.z = 0;
+        f32 max_distance = r % 3 == 0 ? 50 : 1000;
+
+        f64 start = clock_s();
+        f32 bvh_distance = 0;
+        i32 bvh_hit = bvh_ray_pick(&bvh, boxes.data, origin, dir, max_distance, &bvh_distance);
+        bvh_time += clock_s() - start;
+
+        start = clock_s();
+        i32 brute_hit = -1;
+        f32 brute_distance = max_distance;
+        for(i32 i = 0; i < BOX_COUNT; i++)
+        {
+            f32 t = _test_ray_box_brute(origin, dir, boxes.data[i], brute_distance);
+            if(t >= 0 && (brute_hit == -1 || t < brute_distance))
+            {
+                brute_hit = i;
+                brute_distance = t;
+            }
+        }
+        brute_time += clock_s() - start;
+
+        //Overlapping boxes may be entered at the same distance so only the distance has to match then
+        ASSERT((bvh_hit == -1) == (brute_hit == -1), "ray %lli: bvh hit %i brute force hit %i", (lli) r, bvh_hit, brute_hit);
+        if(brute_hit != -1)
+        {
+            ASSERT(fabsf(bvh_distance - brute_distance) <= 1e-3f*MAX(1, brute_distance), 
+                "ray %lli: bvh distance %f brute force distance %f", (lli) r, bvh_distance, brute_distance);
+            hits += 1;
+        }
+    }
+
+    LOG_INFO("TEST", "%lli rays against %lli boxes (%lli hits): bvh %.3lf ms brute force %.3lf ms", 
+        (lli) RAY_COUNT, (lli) BOX_COUNT, (lli) hits, bvh_time*1000, brute_time*1000);
+
+    bvh_deinit(&bvh);
+    array_deinit(&boxes);
+    log_outdent();
+}
+
+void benchmark_buffer_diff()
+{
+    LOG_INFO("BENCH", "buffer diff");
+    log_indent();
+
+    Allocator* alloc = allocator_get_default();
+    isize count = 100000;
+    Mat4_Array instances = {alloc};
+    array_resize(&instances, count);
+    for(isize i = 0; i < count; i++)
+        instances.data[i] = mat4_translation(vec3((f32) (i % 400), (f32) (i / 400), 0));
+
+    Buffer_Shadow shadow = {0};
+    buffer_shadow_init(&shadow, alloc, array_byte_size(instances));
+
+    //The first frame uploads everything. After that every frame moves each moving_every-th instance (none when 0).
+    isize moving_every[] = {0, 0, 100, 10, 0};
+    for(isize frame = 0; frame < ARRAY_LEN(moving_every); frame++)
+    {
+        isize moved = 0;
+        if(moving_every[frame] > 0)
+            for(isize i = 0; i < count; i += moving_every[frame], moved++)
+                instances.data[i] = mat4_translation(vec3((f32) (i % 400), (f32) (i / 400), (f32) frame));
+
+        f64 start = clock_s();
+        isize pending = buffer_shadow_write(&shadow, 0, instances.data, array_byte_size(instances));
+        f64 time = clock_s() - start;
+
+        //The shadow must hold the new data and the ops must be sorted, disjoint and in bounds
+        ASSERT(memcmp(shadow.data.data, instances.data, (size_t) array_byte_size(instances)) == 0);
+        isize op_bytes = 0;
+        for(isize i = 0; i < shadow.ops.len; i++)
+        {
+            Buffer_Upload_Op op = shadow.ops.data[i];
+            ASSERT(op.offset >= 0 && op.size > 0 && op.offset + op.size <= shadow.data.len);
+            if(i > 0)
+                ASSERT(shadow.ops.data[i - 1].offset + shadow.ops.data[i - 1].size < op.offset);
+            op_bytes += op.size;
         }
+        ASSERT(op_bytes == pending && pending == shadow.pending_bytes);
+        if(frame > 0 && moved == 0)
+            ASSERT(pending == 0 && shadow.ops.len == 0, "steady state must not upload anything");
+        
+        LOG_INFO("BENCH", "frame %lli: %6lli moved -> %9lli / %lli bytes in %3lli ops (%.3lf ms)", 
+            (lli) frame, (lli) moved, (lli) pending, (lli) shadow.data.len, (lli) shadow.ops.len, time*1000);
+        buffer_shadow_clear_ops(&shadow);
+    }
+
+    buffer_shadow_deinit(&shadow);
+    array_deinit(&instances);
+    log_outdent();
+}
+
+typedef struct Test_Upload_Ring_Fences {
+    isize inserted;
+    isize waited;
+    u64 last_waited;
+} Test_Upload_Ring_Fences;
+
+u64 test_upload_ring_fence_insert(void* context)
+{
+    Test_Upload_Ring_Fences* fences = (Test_Upload_Ring_Fences*) context;
+    fences->inserted += 1;
+    return (u64) fences->inserted;
+}
+
+void test_upload_ring_fence_wait(void* context, u64 fence)
+{
+    Test_Upload_Ring_Fences* fences = (Test_Upload_Ring_Fences*) context;
+    ASSERT(fence > fences->last_waited, "fences must be waited in order");
+    fences->waited += 1;
+    fences->last_waited = fence;
+}
+
+//Checks the upload ring backed by plain memory instead of a mapped gpu buffer.
+void test_upload_ring()
+{
+    LOG_INFO("TEST", "upload ring");
+
+    enum {FRAME_SIZE = 1024};
+    u8 memory[FRAME_SIZE * UPLOAD_RING_FRAMES] = {0};
+    Test_Upload_Ring_Fences fences = {0};
+    Upload_Ring_Sync sync = {&fences, test_upload_ring_fence_insert, test_upload_ring_fence_wait};
+
+    Upload_Ring ring = {0};
+    upload_ring_init(&ring, memory, sizeof memory, sync);
+    for(isize frame = 0; frame < 10; frame++)
+    {
+        upload_ring_begin_frame(&ring);
+
+        //Only the fence of the frame that used this part UPLOAD_RING_FRAMES frames ago is waited for.
+        isize expected_waits = MAX(frame - UPLOAD_RING_FRAMES + 1, 0);
+        ASSERT(fences.waited == expected_waits);
+        ASSERT(fences.waited == 0 || fences.last_waited == (u64) (frame - UPLOAD_RING_FRAMES + 1));
+
+        isize part_from = (frame % UPLOAD_RING_FRAMES) * FRAME_SIZE;
+        isize used = 0;
+        for(isize i = 0;; i++)
+        {
+            isize size = 1 + (i*37) % 100;
+            isize align = (isize) 1 << (i % 8);
+            Upload_Ring_Slice slice = upload_ring_alloc(&ring, size, align);
+            if(slice.data == NULL)
+                break;
+
+            ASSERT(slice.offset % align == 0);
+            ASSERT(slice.offset >= part_from + used && slice.offset + size <= part_from + FRAME_SIZE);
+            ASSERT(slice.data == memory + slice.offset);
+            memset(slice.data, (int) frame, (size_t) size);
+            used = slice.offset + size - part_from;
+        }
+        ASSERT(used > FRAME_SIZE - 100 - 128, "must use nearly whole part");
+
+        upload_ring_end_frame(&ring);
+        ASSERT(fences.inserted == frame + 1);
+    }
+
+    upload_ring_deinit(&ring);
+    ASSERT(fences.waited == fences.inserted);
+}
+
+//Render with only the cpu side state needed by render_build_batches.
+void benchmark_render_headless_init(Render* render, Allocator* alloc, isize capacity)
+{
+    memset(render, 0, sizeof *render);
+    render->allocator = alloc;
+    render->buffer_instance.item_count = (i32) capacity;
+    render->buffer_draw_uniform.item_count = (i32) capacity;
+    array_init(&render->render_per_instance, alloc);
+    array_init(&render->render_per_draw, alloc);
+    array_init(&render->blinn_phong_per_draw, alloc);
+    array_init(&render->indirect_draws, alloc);
+    render_build_init(render);
+}
+
+void benchmark_render_headless_deinit(Render* render)
+{
+    array_deinit(&render->render_per_instance);
+    array_deinit(&render->render_per_draw);
+    array_deinit(&render->blinn_phong_per_draw);
+    array_deinit(&render->indirect_draws);
+    array_deinit(&render->render_per_batch);
+    array_deinit(&render->batch_runs);
+    for(isize i = 0; i < render->batch_builders.len; i++)
+    {
+        array_deinit(&render->batch_builders.data[i].batches);
+        array_deinit(&render->batch_builders.data[i].draws);
+    }
+    array_deinit(&render->batch_builders);
+}
+
+//Builds batches for sorted commands without opengl. 
+//Compares the serial and parallel builds which must produce exactly the same frame.
+void benchmark_render_build_batches()
+{
+    enum {GEOMETRY_COUNT = 1000, MATERIAL_COUNT = 200, BATCH_COUNT = 4};
+    LOG_INFO("BENCH", "render batch building");
+    log_indent();
+
+    Allocator* alloc = allocator_get_default();
+    Array(Render_Geometry) geometries = {alloc};
+    Array(Render_Material) materials = {alloc};
+    array_resize(&geometries, GEOMETRY_COUNT);
+    array_resize(&materials, MATERIAL_COUNT);
+    for(isize i = 0; i < GEOMETRY_COUNT; i++)
+    {
+        geometries.data[i].info.sort_index = (u32) i;
+        geometries.data[i].group.batch_index = (i32) (i % BATCH_COUNT) + 1;
+        geometries.data[i].group.index_count = 36;
+    }
+    for(isize i = 0; i < MATERIAL_COUNT; i++)
+    {
+        materials.data[i].info.sort_index = (u32) i;
+        materials.data[i].diffuse_color = vec3((f32) i, 0, 0);
+    }
+
+    isize counts[] = {10*1000, 100*1000, 1000*1000};
+    for(isize count_i = 0; count_i < ARRAY_LEN(counts); count_i++)
+    {
+        isize count = counts[count_i];
+        Render render = {0};
+        benchmark_render_headless_init(&render, alloc, count);
+
+        Render_Command_Expanded_Array commands = {alloc};
+        Mat4_Array transforms = {alloc};
+        array_resize(&commands, count);
+        array_resize(&transforms, count);
+
+        u64 state = 0x9E3779B97F4A7C15ULL;
+        for(isize i = 0; i < count; i++)
+        {
+            state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+            Render_Command_Expanded* command = &commands.data[i];
+            command->geometry = &geometries.data[state % GEOMETRY_COUNT];
+            command->material = &materials.data[(state >> 32) % MATERIAL_COUNT];
+            command->environment = (Render_Environment*) 1;
+            command->transform_index = (i32) i;
+            command->geometry_batch_index = command->geometry->group.batch_index;
+            command->sort_key = render_command_sort_key(0, command->geometry_batch_index, command->geometry, command->material);
+            transforms.data[i] = mat4_translation(vec3((f32) i, 0, 0));
+        }
+        render_queue_sort_expanded(commands.data, commands.len, true);
+
+        f64 start = clock_s();
+        isize consumed = render_build_batches_ex(&render, commands.data, transforms.data, count, false);
+        f64 serial_time = clock_s() - start;
+        ASSERT(consumed == count);
+
+        Render_Per_Draw_Array serial_draws = {alloc};
+        Gl_Draw_Elements_Indirect_Command_Array serial_indirect = {alloc};
+        array_resize_for_overwrite(&serial_draws, render.render_per_draw.len);
+        array_resize_for_overwrite(&serial_indirect, render.indirect_draws.len);
+        memcpy(serial_draws.data, render.render_per_draw.data, (size_t) array_byte_size(serial_draws));
+        memcpy(serial_indirect.data, render.indirect_draws.data, (size_t) array_byte_size(serial_indirect));
+        isize serial_batches = render.render_per_batch.len;
+
+        start = clock_s();
+        render_build_batches_ex(&render, commands.data, transforms.data, count, true);
+        f64 parallel_time = clock_s() - start;
+
+        bool is_same = serial_batches == render.render_per_batch.len 
+            && serial_draws.len == render.render_per_draw.len
+            && memcmp(serial_draws.data, render.render_per_draw.data, (size_t) array_byte_size(serial_draws)) == 0
+            && memcmp(serial_indirect.data, render.indirect_draws.data, (size_t) array_byte_size(serial_indirect)) == 0;
+
+        //Every instance must be drawn exactly once and batches must cover all draws in order
+        isize instance_sum = 0;
+        for(isize i = 0; i < render.indirect_draws.len; i++)
+            instance_sum += render.indirect_draws.data[i].instance_count;
+        ASSERT(instance_sum == count);
+        for(isize i = 0, draw_at = 0; i < render.render_per_batch.len; i++)
+        {
+            ASSERT(render.render_per_batch.data[i].draw_from == draw_at);
+            draw_at += render.render_per_batch.data[i].draw_count;
+        }
+
+        LOG_INFO("BENCH", "%7lli commands -> %6lli draws in %4lli batches: serial %.3lf ms parallel %.3lf ms (%s)", 
+            (lli) count, (lli) render.render_per_draw.len, (lli) render.render_per_batch.len, 
+            serial_time*1000, parallel_time*1000, is_same ? "same frame" : "FRAME DIFFERS");
+
+        array_deinit(&serial_draws);
+        array_deinit(&serial_indirect);
+        array_deinit(&commands);
+        array_deinit(&transforms);
+        benchmark_render_headless_deinit(&render);
+    }
+
+    array_deinit(&geometries);
+    array_deinit(&materials);
+    log_outdent();
+}
+
+//Builds batches of textured materials. With the material bindings precomputed 
+// and the texture slots in a hash set the time per command should not depend on the material count.
+void benchmark_render_build_materials()
+{
+    enum {COMMAND_COUNT = 200*1000, GEOMETRY_COUNT = 100, RESOLUTION_COUNT = 24, TEXTURES_PER_MATERIAL = 3};
+    LOG_INFO("BENCH", "render batch building with textured materials");
+    log_indent();
+
+    Allocator* alloc = allocator_get_default();
+    Array(Render_Geometry) geometries = {alloc};
+    array_resize(&geometries, GEOMETRY_COUNT);
+    for(isize i = 0; i < GEOMETRY_COUNT; i++)
+    {
+        geometries.data[i].info.sort_index = (u32) i;
+        geometries.data[i].group.batch_index = 1;
+    }
+
+    Render render = {0};
+    benchmark_render_headless_init(&render, alloc, COMMAND_COUNT);
+
+    Render_Command_Expanded_Array commands = {alloc};
+    Mat4_Array transforms = {alloc};
+    array_resize(&commands, COMMAND_COUNT);
+    array_resize(&transforms, COMMAND_COUNT);
+
+    isize material_counts[] = {10, 100, 1000, 10000};
+    for(isize count_i = 0; count_i < ARRAY_LEN(material_counts); count_i++)
+    {
+        isize material_count = material_counts[count_i];
+        Array(Render_Material) materials = {alloc};
+        array_resize(&materials, material_count);
+        
+        //Bindings are filled directly since there are no real textures 
+        u64 state = 0x9E3779B97F4A7C15ULL;
+        for(isize i = 0; i < material_count; i++)
+        {
+            Render_Material* material = &materials.data[i];
+            material->info.sort_index = (u32) i;
+            material->used_textures = TEXTURES_PER_MATERIAL;
+            material->binding.bound_textures = TEXTURES_PER_MATERIAL;
+            for(i32 t = 0; t < TEXTURES_PER_MATERIAL; t++)
+            {
+                state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+                Render_Texture_Layer layer = {(i32) (state >> 40) % 128, (i32) (state % RESOLUTION_COUNT) + 1};
+                material->binding.layers[t] = layer;
+
+                bool is_new = true;
+                for(i32 r = 0; r < material->binding.resolution_count; r++)
+                    is_new = is_new && material->binding.resolutions[r] != layer.resolution_index;
+                if(is_new)
+                    material->binding.resolutions[material->binding.resolution_count++] = layer.resolution_index;
+            }
+        }
+
+        for(isize i = 0; i < COMMAND_COUNT; i++)
+        {
+            state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+            Render_Command_Expanded* command = &commands.data[i];
+            command->geometry = &geometries.data[state % GEOMETRY_COUNT];
+            command->material = &materials.data[(state >> 32) % (u64) material_count];
+            command->environment = (Render_Environment*) 1;
+            command->transform_index = (i32) i;
+            command->geometry_batch_index = command->geometry->group.batch_index;
+            command->sort_key = render_command_sort_key(0, command->geometry_batch_index, command->geometry, command->material);
+        }
+        render_queue_sort_expanded(commands.data, commands.len, true);
+
+        f64 start = clock_s();
+        render_build_batches_ex(&render, commands.data, transforms.data, COMMAND_COUNT, false);
+        f64 time = clock_s() - start;
+
+        //Every draw must refer to slots which hold the resolution of its textures
+        for(isize b = 0; b < render.render_per_batch.len; b++)
+        {
+            Render_Per_Batch batch = render.render_per_batch.data[b];
+            for(isize d = batch.draw_from; d < batch.draw_from + batch.draw_count; d++)
+            {
+                Render_Per_Draw* draw = &render.render_per_draw.data[d];
+                for(isize t = 0; t < TEXTURES_PER_MATERIAL; t++)
+                {
+                    i32 slot = draw->bound_textures[t].resolution_index;
+                    ASSERT(1 <= slot && slot <= batch.used_texture_slots);
+                    ASSERT(batch.texture_slots[slot - 1] == draw->material->binding.layers[t].resolution_index);
+                    ASSERT(draw->bound_textures[t].layer == draw->material->binding.layers[t].layer);
+                }
+            }
+        }
+
+        LOG_INFO("BENCH", "%5lli materials: %6lli draws in %3lli batches %.3lf ms (%.2lf ns per command)", 
+            (lli) material_count, (lli) render.render_per_draw.len, (lli) render.render_per_batch.len, 
+            time*1000, time*1e9/COMMAND_COUNT);
+        array_deinit(&materials);
+    }
+
+    array_deinit(&commands);
+    array_deinit(&transforms);
+    array_deinit(&geometries);
+    benchmark_render_headless_deinit(&render);
+    log_outdent();
+}
+
+//Checks the clustered light assignment against testing every light with every cluster
+// and measures how long it takes.
+void test_light_clusters()
+{
+    LOG_INFO("TEST", "light clusters");
+    log_indent();
+
+    Allocator* alloc = allocator_get_default();
+    Light_Cluster_Params params = {0};
+    params.tiles_x = 16;
+    params.tiles_y = 9;
+    params.slices = 24;
+    params.fov = TAU/4;
+    params.aspect_ratio = 16.0f/9.0f;
+    params.near = 0.1f;
+    params.far = 500.0f;
+
+    Light_Clusters clusters = {0};
+    Light_Clusters clusters_again = {0};
+    light_clusters_init(&clusters, alloc);
+    light_clusters_init(&clusters_again, alloc);
+
+    isize light_counts[] = {1, 100, 1000, 10000};
+    for(isize count_i = 0; count_i < ARRAY_LEN(light_counts); count_i++)
+    {
+        isize count = light_counts[count_i];
+        Array(f32) components[4] = {0};
+        for(isize k = 0; k < 4; k++)
+        {
+            array_init(&components[k], alloc);
+            array_resize(&components[k], count);
+        }
+
+        //Lights scattered in a box around the frustum. Some are fully outside of it.
+        u64 state = 0x9E3779B97F4A7C15ULL + (u64) count;
+        for(isize i = 0; i < count; i++)
+        {
+            f32 random[4] = {0};
+            for(isize k = 0; k < 4; k++)
+            {
+                state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+                random[k] = (f32) (state >> 40) / (f32) (1 << 24);
+            }
+            components[0].data[i] = (random[0] - 0.5f) * 400;
+            components[1].data[i] = (random[1] - 0.5f) * 200;
+            components[2].data[i] = -random[2] * 550 + 20;
+            components[3].data[i] = 0.5f + random[3] * 20;
+        }
+
+        Light_Cluster_Lights lights = {components[0].data, components[1].data, components[2].data, components[3].data, count};
+        f64 start = clock_s();
+        light_clusters_build(&clusters, params, lights);
+        f64 time = clock_s() - start;
+        light_clusters_build(&clusters_again, params, lights);
+
+        ASSERT(clusters.indices.len == clusters_again.indices.len);
+        ASSERT(memcmp(clusters.indices.data, clusters_again.indices.data, (size_t) array_byte_size(clusters.indices)) == 0, "must be deterministic");
+        ASSERT(memcmp(clusters.ranges.data, clusters_again.ranges.data, (size_t) array_byte_size(clusters.ranges)) == 0, "must be deterministic");
+
+        isize max_per_cluster = 0;
+        for(i32 slice = 0; slice < params.slices; slice++)
+            for(i32 y = 0; y < params.tiles_y; y++)
+                for(i32 x = 0; x < params.tiles_x; x++)
+                {
+                    AABB bounds = light_cluster_bounds(params, x, y, slice);
+                    Light_Cluster_Range range = clusters.ranges.data[x + params.tiles_x*(y + params.tiles_y*slice)];
+                    ASSERT(range.offset + range.count <= clusters.indices.len);
+                    
+                    isize at = 0;
+                    for(isize i = 0; i < count; i++)
+                    {
+                        if(light_cluster_sphere_intersects(bounds, lights.x[i], lights.y[i], lights.z[i], lights.radius[i]) == false)
+                            continue;
+
+                        ASSERT(at < range.count && clusters.indices.data[range.offset + at] == (u32) i, 
+                            "cluster %i %i %i is missing light %lli", x, y, slice, (lli) i);
+                        at += 1;
+                    }
+
+                    ASSERT(at == range.count);
+                    max_per_cluster = MAX(max_per_cluster, at);
+                }
+
+        LOG_INFO("TEST", "%5lli lights: %7lli indices (at most %lli per cluster) %.3lf ms", 
+            (lli) count, (lli) clusters.indices.len, (lli) max_per_cluster, time*1000);
+
+        for(isize k = 0; k < 4; k++)
+            array_deinit(&components[k]);
+    }
+
+    light_clusters_deinit(&clusters);
+    light_clusters_deinit(&clusters_again);
+    log_outdent();
+}
+
+INTERNAL int _test_mesh_optimize_compare_triangles(const void* a, const void* b)
+{
+    return memcmp(a, b, sizeof(Triangle_Index));
+}
+
+//Optimizing a randomly shuffled grid split into many groups has to lower its ACMR close to the ideal 
+// while keeping exactly the same triangles within each group.
+void test_mesh_optimize()
+{
+    LOG_INFO("TEST", "mesh optimize");
+    log_indent();
+
+    Allocator* alloc = allocator_get_default();
+    enum {SIZE = 200, GROUP_COUNT = 64};
+    Shape_Assembly assembly = {0};
+    shape_assembly_init(&assembly, alloc);
+    for(isize y = 0; y <= SIZE; y++)
+        for(isize x = 0; x <= SIZE; x++)
+        {
+            Vertex vertex = {0};
+            vertex.pos = vec3((f32) x, (f32) y, 0);
+            array_push(&assembly.vertices, vertex);
+        }
+
+    for(isize y = 0; y < SIZE; y++)
+        for(isize x = 0; x < SIZE; x++)
+        {
+            u32 at = (u32) (y*(SIZE + 1) + x);
+            Triangle_Index tri1 = {{at, at + 1, at + SIZE + 1}};
+            Triangle_Index tri2 = {{at + 1, at + SIZE + 2, at + SIZE + 1}};
+            array_push(&assembly.triangles, tri1);
+            array_push(&assembly.triangles, tri2);
+        }
+
+    //Shuffle the triangles within each group (= consecutive rows of the grid)
+    isize triangle_count = assembly.triangles.len;
+    isize group_size = DIV_CEIL(triangle_count, GROUP_COUNT);
+    Triangle_Mesh_Group_Description groups[GROUP_COUNT] = {0};
+    u64 state = 0x853c49e6748fea9bULL;
+    for(isize g = 0; g < GROUP_COUNT; g++)
+    {
+        groups[g].triangles_from = (i32) MIN(g*group_size, triangle_count);
+        groups[g].triangles_to = (i32) MIN((g + 1)*group_size, triangle_count);
+        for(isize i = groups[g].triangles_to - 1; i > groups[g].triangles_from; i--)
+        {
+            state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+            isize j = groups[g].triangles_from + (isize) (state % (u64) (i - groups[g].triangles_from + 1));
+            SWAP(&assembly.triangles.data[i], &assembly.triangles.data[j]);
+        }
+    }
+
+    Triangle_Index_Array original = {alloc};
+    array_copy(&original, assembly.triangles);
+
+    Mesh_Optimize_Stats stats = {0};
+    f64 start = clock_s();
+    shape_assembly_optimize(&assembly, groups, GROUP_COUNT, &stats);
+    f64 time = clock_s() - start;
+    LOG_INFO("TEST", "%lli triangles in %lli groups: ACMR %.3f -> %.3f ATVR %.3f -> %.3f in %.2lf ms", (lli) triangle_count, (lli) GROUP_COUNT,
+        stats.before.acmr, stats.after.acmr, stats.before.atvr, stats.after.atvr, time*1000);
+
+    ASSERT(stats.before.acmr > 1.5f);
+    ASSERT(stats.after.acmr < 0.8f, "the optimized grid should be close to the ideal ACMR of 0.5");
+    ASSERT(stats.after.atvr < stats.before.atvr);
+
+    //The vertex fetch optimization renumbered the vertices. Map them back through their positions 
+    // and compare the sorted triangles of each group.
+    for(isize t = 0; t < triangle_count; t++)
+        for(isize k = 0; k < 3; k++)
+        {
+            Vec3 pos = assembly.vertices.data[assembly.triangles.data[t].vertex_i[k]].pos;
+            assembly.triangles.data[t].vertex_i[k] = (u32) pos.y*(SIZE + 1) + (u32) pos.x;
+        }
+
+    for(isize g = 0; g < GROUP_COUNT; g++)
+    {
+        isize from = groups[g].triangles_from;
+        isize count = groups[g].triangles_to - from;
+        qsort(assembly.triangles.data + from, (size_t) count, sizeof(Triangle_Index), _test_mesh_optimize_compare_triangles);
+        qsort(original.data + from, (size_t) count, sizeof(Triangle_Index), _test_mesh_optimize_compare_triangles);
+        ASSERT(memcmp(assembly.triangles.data + from, original.data + from, (size_t) count*sizeof(Triangle_Index)) == 0, "group %lli must keep its triangles", (lli) g);
+    }
+
+    array_deinit(&original);
+    shape_assembly_deinit(&assembly);
+    log_outdent();
+}
+
+void test_mesh_lod()
+{
+    LOG_INFO("TEST", "mesh lod");
+    log_indent();
+
+    Allocator* alloc = allocator_get_default();
+    enum {SPHERE, WAVES, MESH_COUNT};
+    for(isize mesh_i = 0; mesh_i < MESH_COUNT; mesh_i++)
+    {
+        //A closed sphere (with seam and poles which have to stay locked) and an open wavy 
+        // grid (whose border has to stay locked)
+        Shape shape = {0};
+        if(mesh_i == SPHERE)
+            shape = shapes_make_uv_sphere(100, 1);
+        else
+        {
+            isize size = 128;
+            array_init(&shape.vertices, alloc);
+            array_init(&shape.triangles, alloc);
+            for(isize y = 0; y <= size; y++)
+                for(isize x = 0; x <= size; x++)
+                {
+                    Vertex vertex = {0};
+                    f32 fx = (f32) x / (f32) size;
+                    f32 fy = (f32) y / (f32) size;
+                    vertex.pos = vec3(fx, 0.05f*sinf(fx*TAU)*cosf(fy*TAU), fy);
+                    vertex.uv = vec2(fx, fy);
+                    array_push(&shape.vertices, vertex);
+                }
+
+            for(isize y = 0; y < size; y++)
+                for(isize x = 0; x < size; x++)
+                {
+                    u32 at = (u32) (y*(size + 1) + x);
+                    Triangle_Index tri1 = {{at, at + (u32) size + 1, at + 1}};
+                    Triangle_Index tri2 = {{at + 1, at + (u32) size + 1, at + (u32) size + 2}};
+                    array_push(&shape.triangles, tri1);
+                    array_push(&shape.triangles, tri2);
+                }
+        }
+
+        const i32* indices = (const i32*) (const void*) shape.triangles.data;
+        isize index_count = shape.triangles.len*3;
+        isize vertex_count = shape.vertices.len;
+
+        i32_Array lod_indices = {alloc};
+        Mesh_Lod lods[MESH_LOD_MAX] = {0};
+        f64 start = clock_s();
+        isize lod_count = mesh_lod_build(&lod_indices, lods, indices, index_count, shape.vertices.data, vertex_count);
+        f64 time = clock_s() - start;
+
+        ASSERT(lod_count > 1, "the mesh should simplify");
+        ASSERT(memcmp(lod_indices.data, indices, (size_t) index_count*sizeof(i32)) == 0, "lod 0 must be the full mesh");
+        LOG_INFO("TEST", "%s: %lli lods in %.3lf ms", mesh_i == SPHERE ? "sphere" : "waves", (lli) lod_count, time*1000);
+        f32 full_deviation = 0;
+        for(isize l = 0; l < lod_count; l++)
+        {
+            Mesh_Lod lod = lods[l];
+            ASSERT(lod.index_from + lod.index_count <= lod_indices.len);
+            if(l > 0)
+            {
+                ASSERT(lod.index_count < lods[l - 1].index_count);
+                ASSERT(lod.error >= lods[l - 1].error);
+            }
+
+            //All vertices of the lods are vertices of the full mesh which lie on the sphere. 
+            //The error has to cover how much further from it the triangles between them are
+            // than the triangles of the full mesh.
+            f32 max_deviation = 0;
+            for(isize t = 0; t < lod.index_count; t += 3)
+            {
+                const i32* tri = lod_indices.data + lod.index_from + t;
+                ASSERT(tri[0] != tri[1] && tri[1] != tri[2] && tri[0] != tri[2], "no degenerate triangles");
+                Vec3 centroid = {0};
+                for(isize k = 0; k < 3; k++)
+                {
+                    ASSERT(0 <= tri[k] && tri[k] < vertex_count);
+                    centroid = vec3_add(centroid, vec3_scale(shape.vertices.data[tri[k]].pos, 1.0f/3));
+                }
+
+                if(mesh_i == SPHERE)
+                    max_deviation = MAX(max_deviation, 1 - vec3_len(centroid));
+            }
+
+            if(l == 0)
+                full_deviation = max_deviation;
+            ASSERT(max_deviation <= lod.error + full_deviation, "lod %lli deviates %f more than its error %f", (lli) l, max_deviation, lod.error);
+
+            LOG_INFO("TEST", "lod %lli: %7lli triangles error %f", (lli) l, (lli) lod.index_count/3, lod.error);
+        }
+
+        //Selection gets coarser with distance and never goes back
+        f32 projection_scale = 1.0f / tanf(TAU/8);
+        f32 max_screen_error = 2.0f / 1080;
+        i32 prev_selected = 0;
+        for(f32 distance = 0.01f; distance < 10000; distance *= 1.5f)
+        {
+            i32 selected = mesh_lod_select(lods, lod_count, 1, distance, projection_scale, max_screen_error);
+            ASSERT(selected >= prev_selected);
+            ASSERT(lods[selected].error / distance * projection_scale <= max_screen_error);
+            prev_selected = selected;
+        }
+        ASSERT(mesh_lod_select(lods, lod_count, 1, 0, projection_scale, max_screen_error) == 0);
+        ASSERT(prev_selected == lod_count - 1);
+
+        array_deinit(&lod_indices);
+        shape_deinit(&shape);
+    }
+
+    log_outdent();
+}
+
+void test_atlas_packer()
+{
+    LOG_INFO("TEST", "atlas packer");
+    log_indent();
+
+    Allocator* alloc = allocator_get_default();
+    enum {SIZE = 512, PADDING = 4};
+    Atlas_Packer packer = {0};
+    atlas_packer_init(&packer, alloc, SIZE, SIZE, 0);
+
+    //Exactly fitting squares fill the atlas completely
+    for(isize i = 0; i < 16; i++)
+    {
+        Atlas_Rect rect = {0};
+        ASSERT(atlas_packer_add(&packer, 128, 128, &rect));
+        ASSERT(rect.x % 128 == 0 && rect.y % 128 == 0);
+    }
+    Atlas_Rect no_space = {0};
+    ASSERT(atlas_packer_add(&packer, 1, 1, &no_space) == false);
+    Atlas_Stats full = atlas_packer_stats(&packer);
+    ASSERT(full.used_area == full.total_area && full.wasted_area == 0 && full.free_area == 0);
+    atlas_packer_deinit(&packer);
+
+    //Random sizes. Every pixel can be covered by at most one padded rect.
+    u8_Array coverage = {alloc};
+    array_resize(&coverage, SIZE*SIZE);
+    atlas_packer_init(&packer, alloc, SIZE, SIZE, PADDING);
+
+    i32 max_dims[] = {16, 32, 64, 128};
+    for(isize dim_i = 0; dim_i < ARRAY_LEN(max_dims); dim_i++)
+    {
+        i32 max_dim = max_dims[dim_i];
+        u64 state = 0x9E3779B97F4A7C15ULL + (u64) max_dim;
+        
+        isize atlas_count = 1;
+        isize image_count = 0;
+        isize layer_area = 0; //area the images would take with a whole power of two layer each
+        isize used_area = 0;
+        f32 waste_sum = 0;
+        
+        atlas_packer_reset(&packer);
+        memset(coverage.data, 0, (size_t) coverage.len);
+        for(isize i = 0; i < 2000; i++)
+        {
+            state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+            i32 width = 1 + (i32) ((state >> 8) % (u64) max_dim);
+            i32 height = 1 + (i32) ((state >> 32) % (u64) max_dim);
+
+            Atlas_Rect rect = {0};
+            if(atlas_packer_add(&packer, width, height, &rect) == false)
+            {
+                Atlas_Stats stats = atlas_packer_stats(&packer);
+                ASSERT(stats.used_area + stats.padding_area + stats.wasted_area + stats.free_area == stats.total_area);
+                waste_sum += stats.waste;
+                used_area += stats.used_area;
+
+                atlas_count += 1;
+                atlas_packer_reset(&packer);
+                memset(coverage.data, 0, (size_t) coverage.len);
+                ASSERT(atlas_packer_add(&packer, width, height, &rect), "must fit into an empty atlas");
+            }
+
+            ASSERT(rect.width == width && rect.height == height);
+            ASSERT(rect.x - PADDING >= 0 && rect.y - PADDING >= 0);
+            ASSERT(rect.x + width + PADDING <= SIZE && rect.y + height + PADDING <= SIZE);
+            for(i32 y = rect.y - PADDING; y < rect.y + height + PADDING; y++)
+                for(i32 x = rect.x - PADDING; x < rect.x + width + PADDING; x++)
+                {
+                    ASSERT(coverage.data[x + y*SIZE] == 0, "rects must not overlap");
+                    coverage.data[x + y*SIZE] = 1;
+                }
+
+            //32 is the smallest default resolution
+            i32 layer_dim = MAX(1 << int_log2_upper_bound(MAX(width, height)), 32);
+            layer_area += (isize) layer_dim * layer_dim;
+            image_count += 1;
+        }
+
+        Atlas_Stats last = atlas_packer_stats(&packer);
+        used_area += last.used_area;
+        isize atlas_area = atlas_count * SIZE*SIZE;
+        LOG_INFO("TEST", "images up to %3i: %lli images in %lli atlases occupancy %.2f waste %.2f (of full atlases). A layer per image takes %.2fx the memory", 
+            max_dim, (lli) image_count, (lli) atlas_count, (f32) used_area / (f32) atlas_area, 
+            atlas_count > 1 ? waste_sum / (f32) (atlas_count - 1) : last.waste, (f32) layer_area / (f32) atlas_area);
+
+        ASSERT(atlas_area < layer_area);
+    }
+
+    array_deinit(&coverage);
+    atlas_packer_deinit(&packer);
+    log_outdent();
+}
+
+//Allocation of texture layers without gl. The resolutions are only bookkeeping.
+INTERNAL isize _test_texture_push_resolution(Render_Texture_Manager* manager, i32 size, i32 layers, i32 channel_count)
+{
+    Render_Texture_Resolution resolution = {0};
+    resolution.array.width = size;
+    resolution.array.height = size;
+    resolution.array.layer_count = layers;
+    resolution.array.type = PIXEL_TYPE_U8;
+    resolution.array.channel_count = channel_count;
+    array_init(&resolution.layers, manager->allocator);
+    array_resize(&resolution.layers, layers);
+    return render_texture_manager_push_resolution(manager, resolution);
+}
+
+INTERNAL void _test_texture_manager_deinit(Render_Texture_Manager* manager)
+{
+    for(isize i = 0; i < manager->resolutions.len; i++)
+    {
+        array_deinit(&manager->resolutions.data[i].layers);
+        array_deinit(&manager->resolutions.data[i].free_layers);
+    }
+    array_deinit(&manager->resolutions);
+    array_deinit(&manager->atlases);
+    array_deinit(&manager->candidate_lists);
+    array_deinit(&manager->candidates);
+    hash_deinit(&manager->candidate_hash);
+    memset(manager, 0, sizeof *manager);
+}
+
+void test_texture_layers()
+{
+    LOG_INFO("TEST", "texture layers");
+    log_indent();
+
+    Render_Texture_Manager manager = {0};
+    render_texture_manager_init(&manager, allocator_get_default(), 0);
+    _test_texture_push_resolution(&manager, 64, 1000, 4);
+    _test_texture_push_resolution(&manager, 128, 100, 4);
+    _test_texture_push_resolution(&manager, 64, 70, 3);
+
+    //Layers are handed out in order from the best fitting resolution, then from the next best
+    Found_Type found_type = NOT_FOUND;
+    for(i32 i = 0; i < 1000; i++)
+    {
+        Render_Texture_Layer layer = render_texture_manager_alloc_layer(&manager, &found_type, 60, 64, PIXEL_TYPE_U8, 4, TEXTURE_BLOCK_NONE);
+        ASSERT(layer.resolution_index == 1 && layer.layer == i && found_type == FOUND_APPROXIMATE);
+    }
+    Render_Texture_Layer spilled = render_texture_manager_alloc_layer(&manager, &found_type, 64, 64, PIXEL_TYPE_U8, 4, TEXTURE_BLOCK_NONE);
+    ASSERT(spilled.resolution_index == 2 && spilled.layer == 0);
+    for(i32 i = 0; i < 70; i++)
+    {
+        Render_Texture_Layer layer = render_texture_manager_alloc_layer(&manager, &found_type, 64, 64, PIXEL_TYPE_U8, 3, TEXTURE_BLOCK_NONE);
+        ASSERT(layer.resolution_index == 3 && layer.layer == i && found_type == FOUND_EXACT);
+    }
+    //The 3 channel resolution is full so the 4 channel ones are used
+    Render_Texture_Layer wider = render_texture_manager_alloc_layer(&manager, &found_type, 64, 64, PIXEL_TYPE_U8, 3, TEXTURE_BLOCK_NONE);
+    ASSERT(wider.resolution_index == 2 && wider.layer == 1);
+    
+    //Freed layers are reused lowest first
+    for(i32 i = 0; i < 1000; i += 3)
+    {
+        Render_Texture_Layer layer = {i, 1};
+        render_texture_manager_free_layer(&manager, layer);
+    }
+    ASSERT(manager.resolutions.data[0].used_layers == 1000 - 334);
+    for(i32 i = 0; i < 1000; i += 3)
+    {
+        Render_Texture_Layer layer = render_texture_manager_alloc_layer(&manager, &found_type, 64, 64, PIXEL_TYPE_U8, 4, TEXTURE_BLOCK_NONE);
+        ASSERT(layer.resolution_index == 1 && layer.layer == i);
+    }
+    Render_Texture_Layer used = render_texture_manager_find(&manager, NULL, 64, 64, PIXEL_TYPE_U8, 4, TEXTURE_BLOCK_NONE, true);
+    ASSERT(used.resolution_index == 1 && used.layer == 0);
+    ASSERT(render_texture_manager_find(&manager, NULL, 256, 256, PIXEL_TYPE_U8, 4, TEXTURE_BLOCK_NONE, false).resolution_index == 0);
+    ASSERT(render_texture_manager_find(&manager, NULL, 64, 64, PIXEL_TYPE_F32, 4, TEXTURE_BLOCK_NONE, false).resolution_index == 0);
+
+    //Compressed textures go only to resolutions of the same block format and nothing else goes there
+    isize compressed_index = _test_texture_push_resolution(&manager, 64, 10, 4);
+    manager.resolutions.data[compressed_index].array.block_format = TEXTURE_BLOCK_BC7;
+    Render_Texture_Layer compressed = render_texture_manager_alloc_layer(&manager, &found_type, 64, 64, PIXEL_TYPE_U8, 4, TEXTURE_BLOCK_BC7);
+    ASSERT(compressed.resolution_index == compressed_index + 1 && found_type == FOUND_EXACT);
+    ASSERT(render_texture_manager_find(&manager, NULL, 64, 64, PIXEL_TYPE_U8, 4, TEXTURE_BLOCK_NONE, false).resolution_index == 2);
+    ASSERT(render_texture_manager_find(&manager, NULL, 64, 64, PIXEL_TYPE_U8, 2, TEXTURE_BLOCK_BC5, false).resolution_index == 0);
+    _test_texture_manager_deinit(&manager);
+
+    //Bulk loading. The time per texture should not grow with the texture count.
+    i32 counts[] = {1000, 10000, 100000};
+    for(isize c = 0; c < ARRAY_LEN(counts); c++)
+    {
+        i32 count = counts[c];
+        render_texture_manager_init(&manager, allocator_get_default(), 0);
+        i32 sizes[] = {32, 64, 128, 256, 512, 1024};
+        for(isize i = 0; i < ARRAY_LEN(sizes); i++)
+            for(i32 channels = 1; channels <= 4; channels++)
+                _test_texture_push_resolution(&manager, sizes[i], count, channels);
+
+        u64 state = 0x9E3779B97F4A7C15ULL + (u64) count;
+        f64 start = clock_s();
+        for(i32 i = 0; i < count; i++)
+        {
+            state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+            i32 width = 1 + (i32) ((state >> 8) % 1024);
+            i32 height = 1 + (i32) ((state >> 24) % 1024);
+            i32 channels = 1 + (i32) ((state >> 40) % 4);
+
+            Render_Texture_Layer layer = render_texture_manager_alloc_layer(&manager, NULL, width, height, PIXEL_TYPE_U8, channels, TEXTURE_BLOCK_NONE);
+            ASSERT(layer.resolution_index > 0);
+        }
+        f64 time = clock_s() - start;
+
+        LOG_INFO("TEST", "%6i textures: %.3lf ms total %.1lf ns per texture", count, time*1000, time*1e9 / count);
+        _test_texture_manager_deinit(&manager);
+    }
+
+    log_outdent();
+}
+
+typedef struct _Test_Stream_Load {
+    i64 due_frame;
+    i32 texture;
+    i32 mip;
+} _Test_Stream_Load;
+
+typedef Array(_Test_Stream_Load) _Test_Stream_Load_Array;
+
+typedef struct _Test_Stream_Result {
+    Texture_Stream_Stats stats;
+    isize reports;
+    isize blurry_reports; //resident mip coarser than wanted
+    isize blur_sum;       //sum of the differences
+} _Test_Stream_Result;
+
+INTERNAL void _test_texture_stream_complete(Texture_Stream* stream, _Test_Stream_Load_Array* pending, i64 frame)
+{
+    for(isize i = 0; i < pending->len; )
+    {
+        _Test_Stream_Load load = pending->data[i];
+        if(load.due_frame <= frame)
+        {
+            texture_stream_loaded(stream, load.texture, load.mip);
+            pending->data[i] = pending->data[pending->len - 1];
+            pending->len -= 1;
+        }
+        else
+            i += 1;
+    }
+}
+
+//Replays the trace with loads finishing after latency frames. Checks that the bookkeeping 
+// stays consistent and the budget is respected.
+INTERNAL _Test_Stream_Result _test_texture_stream_replay(const Texture_Stream_Trace* trace, isize budget, i64 latency)
+{
+    _Test_Stream_Result result = {0};
+    Allocator* alloc = allocator_get_default();
+    Texture_Stream stream = {0};
+    texture_stream_init(&stream, alloc, budget, 16);
+    Texture_Stream_Event_Array events = {alloc};
+    _Test_Stream_Load_Array pending = {alloc};
+    //Removals with loads in flight delay the reuse of indices so they can differ from the recording
+    i32_Array remap = {alloc};
+
+    i64 last_frame = trace->len > 0 ? trace->data[trace->len - 1].frame : 0;
+    isize e = 0;
+    for(i64 frame = 0; frame <= last_frame + latency; frame++)
+    {
+        _test_texture_stream_complete(&stream, &pending, frame);
+        for(; e < trace->len && trace->data[e].frame == frame; e++)
+        {
+            Texture_Stream_Trace_Entry entry = trace->data[e];
+            if(entry.type == TEXTURE_STREAM_TRACE_ADD)
+            {
+                if(remap.len <= entry.texture)
+                    array_resize(&remap, entry.texture + 1);
+                remap.data[entry.texture] = texture_stream_add(&stream, entry.width, entry.height, entry.mip_count, entry.bits_per_pixel);
+            }
+            else if(entry.type == TEXTURE_STREAM_TRACE_REMOVE)
+                texture_stream_remove(&stream, remap.data[entry.texture]);
+            else
+            {
+                i32 texture = remap.data[entry.texture];
+                texture_stream_report(&stream, texture, entry.footprint);
+                Texture_Stream_Texture* tex = &stream.textures.data[texture];
+                result.reports += 1;
+                result.blurry_reports += tex->resident_mip > tex->wanted_mip;
+                result.blur_sum += MAX(tex->resident_mip - tex->wanted_mip, 0);
+            }
+        }
+
+        array_clear(&events);
+        texture_stream_update(&stream, &events);
+        for(isize i = 0; i < events.len; i++)
+        {
+            Texture_Stream_Event event = events.data[i];
+            Texture_Stream_Texture* tex = &stream.textures.data[event.texture];
+            if(event.type == TEXTURE_STREAM_LOAD)
+            {
+                ASSERT(tex->loading_mip == event.mip && event.mip == tex->resident_mip - 1);
+                _Test_Stream_Load load = {frame + latency, event.texture, event.mip};
+                array_push(&pending, load);
+            }
+            else
+                ASSERT(event.mip < tex->resident_mip && event.mip < tex->tail_mip, "only mips above the tail can be evicted");
+        }
+        ASSERT(stream.loads_in_flight == pending.len && pending.len <= stream.max_loads_in_flight);
+        _test_texture_stream_complete(&stream, &pending, frame);
+
+        //Memory must match the resident and loading mips. 
+        //Only the tails which are added regardless of the budget can go over it.
+        isize tails = 0;
+        isize streamed = 0;
+        for(isize i = 0; i < stream.textures.len; i++)
+        {
+            Texture_Stream_Texture* tex = &stream.textures.data[i];
+            for(i32 mip = tex->resident_mip; mip < tex->mip_count; mip++)
+            {
+                if(mip < tex->tail_mip)
+                    streamed += texture_stream_mip_size(tex, mip);
+                else
+                    tails += texture_stream_mip_size(tex, mip);
+            }
+            if(tex->loading_mip != -1)
+                streamed += texture_stream_mip_size(tex, tex->loading_mip);
+        }
+        ASSERT(streamed + tails == stream.memory_used);
+        ASSERT(streamed <= budget);
+
+        texture_stream_begin_frame(&stream);
+    }
+
+    result.stats = stream.stats;
+    array_deinit(&remap);
+    array_deinit(&pending);
+    array_deinit(&events);
+    texture_stream_deinit(&stream);
+    return result;
+}
+
+//Records a trace of a camera flying along a row of textured objects and replays 
+// it under different budgets and load latencies.
+void test_texture_stream()
+{
+    LOG_INFO("TEST", "texture stream");
+    log_indent();
+
+    enum {TEXTURES = 256, FRAMES = 1000};
+    const f32 spacing = 4;
+    const f32 view_range = 80;
+    const f32 radius = 1.5f;
+    const f32 projection_scale = 2.4f;
+    Allocator* alloc = allocator_get_default();
+
+    //Recording with unlimited memory and instant loads
+    Texture_Stream_Trace trace = {alloc};
+    Texture_Stream stream = {0};
+    texture_stream_init(&stream, alloc, (isize) 1 << 40, 16);
+    stream.trace = &trace;
+    Texture_Stream_Event_Array events = {alloc};
+
+    i32 textures[TEXTURES] = {0};
+    for(i32 i = 0; i < TEXTURES; i++)
+    {
+        i32 size = 256 << (i % 4);
+        textures[i] = texture_stream_add(&stream, size, size, int_log2_lower_bound(size) + 1, 32);
+    }
+
+    for(i32 frame = 0; frame < FRAMES; frame++)
+    {
+        //Swap some textures for others half way through
+        if(frame == FRAMES/2)
+        {
+            for(i32 i = 0; i < TEXTURES; i += 16)
+            {
+                texture_stream_remove(&stream, textures[i]);
+                textures[i] = texture_stream_add(&stream, 4096, 2048, 13, 32);
+            }
+        }
+
+        f32 camera = -view_range + (f32) frame / FRAMES * (TEXTURES*spacing + 2*view_range);
+        for(i32 i = 0; i < TEXTURES; i++)
+        {
+            f32 dx = (f32) i*spacing - camera;
+            if(fabsf(dx) < view_range)
+            {
+                f32 distance = sqrtf(dx*dx + 4);
+                texture_stream_report(&stream, textures[i], radius*projection_scale/distance*RENDER_STREAM_SCREEN_HEIGHT);
+            }
+        }
+
+        array_clear(&events);
+        texture_stream_update(&stream, &events);
+        for(isize i = 0; i < events.len; i++)
+            if(events.data[i].type == TEXTURE_STREAM_LOAD)
+                texture_stream_loaded(&stream, events.data[i].texture, events.data[i].mip);
+
+        texture_stream_begin_frame(&stream);
+    }
+    Texture_Stream_Stats recorded = stream.stats;
+    ASSERT(recorded.evictions == 0 && recorded.waited_loads == 0);
+    texture_stream_deinit(&stream);
+    array_deinit(&events);
+
+    //A failed load leaves the mip non resident, returns its memory and is issued again
+    {
+        Texture_Stream failing = {0};
+        Texture_Stream_Event_Array failing_events = {alloc};
+        texture_stream_init(&failing, alloc, (isize) 1 << 40, 16);
+        i32 texture = texture_stream_add(&failing, 1024, 1024, 11, 32);
+        isize tail_memory = failing.memory_used;
+        i32 tail_mip = failing.textures.data[texture].tail_mip;
+
+        texture_stream_report(&failing, texture, 4096);
+        texture_stream_update(&failing, &failing_events);
+        ASSERT(failing_events.len == 1 && failing_events.data[0].type == TEXTURE_STREAM_LOAD && failing_events.data[0].mip == tail_mip - 1);
+        texture_stream_load_failed(&failing, texture, failing_events.data[0].mip);
+        ASSERT(failing.memory_used == tail_memory && failing.loads_in_flight == 0);
+        ASSERT(failing.textures.data[texture].resident_mip == tail_mip && failing.stats.failed_loads == 1);
+
+        texture_stream_begin_frame(&failing);
+        texture_stream_report(&failing, texture, 4096);
+        array_clear(&failing_events);
+        texture_stream_update(&failing, &failing_events);
+        ASSERT(failing_events.len == 1 && failing_events.data[0].mip == tail_mip - 1, "the failed mip is retried");
+
+        texture_stream_deinit(&failing);
+        array_deinit(&failing_events);
+    }
+
+    //Replaying under the same conditions makes the same decisions
+    _Test_Stream_Result same = _test_texture_stream_replay(&trace, (isize) 1 << 40, 0);
+    ASSERT(memcmp(&same.stats, &recorded, sizeof recorded) == 0);
+
+    //The tails alone take about 22MB here
+    isize budgets[] = {(isize) 1 << 40, 256*MB, 96*MB, 48*MB};
+    i64 latencies[] = {0, 4};
+    _Test_Stream_Result prev = {0};
+    for(isize l = 0; l < ARRAY_LEN(latencies); l++)
+    {
+        for(isize b = 0; b < ARRAY_LEN(budgets); b++)
+        {
+            _Test_Stream_Result result = _test_texture_stream_replay(&trace, budgets[b], latencies[l]);
+            _Test_Stream_Result again = _test_texture_stream_replay(&trace, budgets[b], latencies[l]);
+            ASSERT(memcmp(&result, &again, sizeof result) == 0, "replays must be deterministic");
+
+            //Less memory can only mean more blurry textures
+            if(b > 0)
+                ASSERT(result.blur_sum >= prev.blur_sum);
+            if(b == 0)
+                ASSERT(result.stats.evictions == 0);
+            else
+                ASSERT(result.stats.evictions > 0, "all budgets but the first are too small to keep everything");
+
+            LOG_INFO("TEST", "budget %8s latency %i: %5lli loads %5lli evictions %8s loaded %5lli waited. Blurry %5.2lf%% of reports by %.2lf mips on average", 
+                format_bytes(budgets[b]).data, (int) latencies[l], (lli) result.stats.loads, (lli) result.stats.evictions, 
+                format_bytes(result.stats.loaded_bytes).data, (lli) result.stats.waited_loads,
+                100.0 * result.blurry_reports / MAX(result.reports, 1), (f64) result.blur_sum / MAX(result.blurry_reports, 1));
+            prev = result;
+        }
+    }
+
+    array_deinit(&trace);
+    log_outdent();
+}
+
+INTERNAL f32 _test_mip_get(const Image* image, i32 x, i32 y, i32 channel)
+{
+    const u8* pixel = image->pixels + image_byte_stride(*image)*y + (isize) x*image->pixel_size;
+    if(image->type == PIXEL_TYPE_U8)
+        return (f32) pixel[channel] / 255;
+
+    if(image->type == PIXEL_TYPE_U16)
+    {
+        u16 value = 0;
+        memcpy(&value, pixel + channel*sizeof(u16), sizeof value);
+        return (f32) value / UINT16_MAX;
+    }
+
+    f32 value = 0;
+    memcpy(&value, pixel + channel*sizeof(f32), sizeof value);
+    return value;
+}
+
+INTERNAL void _test_mip_set(Image* image, i32 x, i32 y, i32 channel, f32 value)
+{
+    u8* pixel = image->pixels + image_byte_stride(*image)*y + (isize) x*image->pixel_size;
+    if(image->type == PIXEL_TYPE_U8)
+        pixel[channel] = (u8) (CLAMP(value, 0, 1)*255 + 0.5f);
+    else if(image->type == PIXEL_TYPE_U16)
+    {
+        u16 encoded = (u16) (CLAMP(value, 0, 1)*UINT16_MAX + 0.5f);
+        memcpy(pixel + channel*sizeof(u16), &encoded, sizeof encoded);
+    }
+    else
+        memcpy(pixel + channel*sizeof(f32), &value, sizeof value);
+}
+
+INTERNAL f32 _test_mip_random(u64* state)
+{
+    *state ^= *state << 13; *state ^= *state >> 7; *state ^= *state << 17;
+    return (f32) (*state >> 40) / (f32) (1 << 24);
+}
+
+INTERNAL void _test_mip_deinit(Image* mips, i32 mip_count)
+{
+    for(i32 i = 0; i < mip_count; i++)
+        image_deinit(&mips[i]);
+}
+
+void test_mip_chain()
+{
+    LOG_INFO("TEST", "mip chain");
+    log_indent();
+    Allocator* alloc = allocator_get_default();
+    Image mips[MIP_CHAIN_MAX_MIPS] = {0};
+
+    //Constant images stay constant for all types, channel counts and filters. Odd sizes included.
+    Pixel_Type types[] = {PIXEL_TYPE_U8, PIXEL_TYPE_U16, PIXEL_TYPE_F32};
+    for(isize t = 0; t < ARRAY_LEN(types); t++)
+        for(i32 channels = 1; channels <= 4; channels++)
+            for(i32 filter = MIP_FILTER_BOX; filter <= MIP_FILTER_KAISER; filter++)
+            {
+                Image image = {0};
+                image_init_sized(&image, alloc, 37, 20, channels*(i32) pixel_type_size(types[t]), types[t], NULL);
+                for(i32 y = 0; y < image.height; y++)
+                    for(i32 x = 0; x < image.width; x++)
+                        for(i32 c = 0; c < channels; c++)
+                            _test_mip_set(&image, x, y, c, 0.25f + 0.125f*c);
+
+                Mip_Options options = mip_options_from_map(MAP_TYPE_DIFFUSE, NULL, channels);
+                options.filter = (Mip_Filter) filter;
+                i32 mip_count = mip_chain_count(image.width, image.height);
+                mip_chain_generate(mips, mip_count, subimage_of(image), &options, alloc);
+                ASSERT(mip_count == 6 && mips[mip_count - 1].width == 1 && mips[mip_count - 1].height == 1);
+                for(i32 i = 0; i < mip_count; i++)
+                {
+                    ASSERT(mips[i].width == MAX(image.width >> i, 1) && mips[i].height == MAX(image.height >> i, 1));
+                    for(i32 y = 0; y < mips[i].height; y++)
+                        for(i32 x = 0; x < mips[i].width; x++)
+                            for(i32 c = 0; c < channels; c++)
+                                ASSERT(fabsf(_test_mip_get(&mips[i], x, y, c) - _test_mip_get(&image, 0, 0, c)) < 1e-5f);
+                }
+                _test_mip_deinit(mips, mip_count);
+                image_deinit(&image);
+            }
+
+    //A black and white checkerboard is 50% bright which is 188 in sRGB and not 128 as 
+    // averaging the encoded values (glGenerateMipmap) gives.
+    {
+        Image image = {0};
+        image_init_sized(&image, alloc, 64, 64, 3, PIXEL_TYPE_U8, NULL);
+        for(i32 y = 0; y < image.height; y++)
+            for(i32 x = 0; x < image.width; x++)
+                for(i32 c = 0; c < 3; c++)
+                    _test_mip_set(&image, x, y, c, (f32) ((x + y) % 2));
+
+        Mip_Options options = mip_options_from_map(MAP_TYPE_DIFFUSE, NULL, 3);
+        for(i32 filter = MIP_FILTER_BOX; filter <= MIP_FILTER_KAISER; filter++)
+        {
+            options.filter = (Mip_Filter) filter;
+            mip_chain_generate(mips, 4, subimage_of(image), &options, alloc);
+            //Kaiser is only checked away from the edges where the clamping breaks the pattern
+            i32 border = filter == MIP_FILTER_BOX ? 0 : 2;
+            for(i32 i = 1; i < 4; i++)
+                for(i32 y = border; y < mips[i].height - border; y++)
+                    for(i32 x = border; x < mips[i].width - border; x++)
+                        ASSERT(abs((int) mips[i].pixels[(y*mips[i].width + x)*3] - 188) <= 1);
+            _test_mip_deinit(mips, 4);
+        }
+        image_deinit(&image);
+    }
+
+    //Normal maps stay unit length
+    {
+        u64 random = 0x1234567;
+        Image image = {0};
+        image_init_sized(&image, alloc, 128, 128, 3, PIXEL_TYPE_U8, NULL);
+        for(i32 y = 0; y < image.height; y++)
+            for(i32 x = 0; x < image.width; x++)
+            {
+                Vec3 n = vec3(_test_mip_random(&random) - 0.5f, _test_mip_random(&random) - 0.5f, _test_mip_random(&random)*0.5f + 0.1f);
+                n = vec3_norm(n);
+                _test_mip_set(&image, x, y, 0, n.x*0.5f + 0.5f);
+                _test_mip_set(&image, x, y, 1, n.y*0.5f + 0.5f);
+                _test_mip_set(&image, x, y, 2, n.z*0.5f + 0.5f);
+            }
+
+        Mip_Options options = mip_options_from_map(MAP_TYPE_NORMAL, NULL, 3);
+        i32 mip_count = mip_chain_count(image.width, image.height);
+        mip_chain_generate(mips, mip_count, subimage_of(image), &options, alloc);
+        for(i32 i = 1; i < mip_count; i++)
+            for(i32 y = 0; y < mips[i].height; y++)
+                for(i32 x = 0; x < mips[i].width; x++)
+                {
+                    Vec3 n = vec3(_test_mip_get(&mips[i], x, y, 0)*2 - 1, _test_mip_get(&mips[i], x, y, 1)*2 - 1, _test_mip_get(&mips[i], x, y, 2)*2 - 1);
+                    ASSERT(fabsf(vec3_len(n) - 1) < 0.02f);
+                }
+        _test_mip_deinit(mips, mip_count);
+        image_deinit(&image);
+    }
+
+    //Alpha tested coverage is kept. Without it the mips would fade towards the average alpha of 1/3 which fails the test everywhere.
+    {
+        u64 random = 0x7654321;
+        Image image = {0};
+        image_init_sized(&image, alloc, 256, 256, 4, PIXEL_TYPE_U8, NULL);
+        for(i32 y = 0; y < image.height; y++)
+            for(i32 x = 0; x < image.width; x++)
+            {
+                f32 alpha = _test_mip_random(&random);
+                for(i32 c = 0; c < 3; c++)
+                    _test_mip_set(&image, x, y, c, 0.5f);
+                _test_mip_set(&image, x, y, 3, alpha*alpha);
+            }
+
+        Mip_Options options = mip_options_from_map(MAP_TYPE_DIFFUSE, NULL, 4);
+        ASSERT(options.alpha_channel == 3 && options.alpha_cutoff == 0.5f);
+        for(i32 preserve = 0; preserve <= 1; preserve++)
+        {
+            if(preserve == 0)
+                options.alpha_cutoff = 0;
+            else
+                options.alpha_cutoff = 0.5f;
+
+            i32 mip_count = mip_chain_count(image.width, image.height);
+            mip_chain_generate(mips, mip_count, subimage_of(image), &options, alloc);
+            f32 coverages[MIP_CHAIN_MAX_MIPS] = {0};
+            for(i32 i = 0; i < mip_count; i++)
+            {
+                isize passed = 0;
+                for(i32 y = 0; y < mips[i].height; y++)
+                    for(i32 x = 0; x < mips[i].width; x++)
+                        passed += _test_mip_get(&mips[i], x, y, 3) > 0.5f;
+                coverages[i] = (f32) passed / (f32) (mips[i].width*mips[i].height);
+            }
+
+            //Only check mips big enough to represent the coverage
+            for(i32 i = 1; i < mip_count - 4; i++)
+            {
+                if(preserve)
+                    ASSERT(fabsf(coverages[i] - coverages[0]) < 0.03f, "mip %i coverage %f wanted %f", i, coverages[i], coverages[0]);
+                else
+                    ASSERT(fabsf(coverages[i] - coverages[0]) > 0.1f || i < 2);
+            }
+            LOG_INFO("TEST", "alpha coverage %s: mip0 %.3f mip2 %.3f mip4 %.3f", preserve ? "preserved" : "not preserved", coverages[0], coverages[2], coverages[4]);
+            _test_mip_deinit(mips, mip_count);
+        }
+        image_deinit(&image);
+    }
+
+    //The cooked texture format gives back exactly the written chain and rejects corrupted data
+    {
+        u64 random = 0x5eed;
+        Image image = {0};
+        image_init_sized(&image, alloc, 37, 20, 3, PIXEL_TYPE_U8, NULL);
+        for(isize i = 0; i < (isize) image.width*image.height*3; i++)
+            image.pixels[i] = (u8) (_test_mip_random(&random)*255);
+
+        Mip_Options options = mip_options_from_map(MAP_TYPE_DIFFUSE, NULL, 3);
+        i32 mip_count = mip_chain_count(image.width, image.height);
+        mip_chain_generate(mips, mip_count, subimage_of(image), &options, alloc);
+
+        Format_Source_Info source = {1, 2, 3};
+        String_Builder cooked = {alloc};
+        u64 options_hash = format_texture_options_hash(&options, TEXTURE_BLOCK_NONE);
+        format_texture_write(&cooked, source, options_hash, TEXTURE_BLOCK_NONE, image.width, image.height, mips, mip_count, 3);
+
+        Format_Texture texture = {0};
+        ASSERT(format_texture_read(&texture, cooked.string));
+        ASSERT(texture.mip_count == mip_count && texture.header->options_hash == options_hash && texture.header->channel_count == 3);
+        ASSERT(options_hash != format_texture_options_hash(&options, TEXTURE_BLOCK_BC7));
+        for(i32 i = 0; i < mip_count; i++)
+        {
+            Subimage mip = texture.mips[i];
+            ASSERT(mip.width == mips[i].width && mip.height == mips[i].height && mip.pixel_size == 3);
+            ASSERT(memcmp(mip.pixels, mips[i].pixels, (size_t) image_byte_stride(mips[i])*mips[i].height) == 0);
+        }
+
+        ASSERT(format_texture_read(&texture, string_make(cooked.data, cooked.len - 1)) == false);
+        cooked.data[0] ^= 1;
+        ASSERT(format_texture_read(&texture, cooked.string) == false);
+
+        builder_deinit(&cooked);
+        _test_mip_deinit(mips, mip_count);
+        image_deinit(&image);
+    }
+
+    //Speed of a full chain
+    {
+        u64 random = 0xabcdef;
+        Image image = {0};
+        image_init_sized(&image, alloc, 2048, 2048, 4, PIXEL_TYPE_U8, NULL);
+        for(isize i = 0; i < (isize) image.width*image.height*4; i++)
+            image.pixels[i] = (u8) (_test_mip_random(&random)*255);
+
+        i32 mip_count = mip_chain_count(image.width, image.height);
+        for(i32 filter = MIP_FILTER_BOX; filter <= MIP_FILTER_KAISER; filter++)
+        {
+            Mip_Options options = mip_options_from_map(MAP_TYPE_DIFFUSE, NULL, 4);
+            options.filter = (Mip_Filter) filter;
+            f64 start = clock_s();
+            mip_chain_generate(mips, mip_count, subimage_of(image), &options, alloc);
+            f64 time = clock_s() - start;
+            LOG_INFO("TEST", "%s chain of 2048x2048 rgba8 sRGB: %.2lf ms (%.1lf MPix/s)", filter == MIP_FILTER_BOX ? "box" : "kaiser", time*1000, image.width*image.height/time/1e6);
+            _test_mip_deinit(mips, mip_count);
+        }
+
+        image_deinit(&image);
+    }
+
+    log_outdent();
+}
+
+//A somewhat natural test image: smooth gradients, a few hard edges and some noise.
+INTERNAL void _test_compress_image(Image* image, Allocator* alloc, i32 width, i32 height, i32 channels, u64 seed)
+{
+    image_init_sized(image, alloc, width, height, channels, PIXEL_TYPE_U8, NULL);
+    u64 random = seed;
+    for(i32 y = 0; y < height; y++)
+        for(i32 x = 0; x < width; x++)
+            for(i32 c = 0; c < channels; c++)
+            {
+                f32 smooth = 0.5f + 0.4f*sinf((f32) x*(0.03f + 0.01f*c) + (f32) y*0.02f);
+                f32 edge = ((x / 24 + y / 24 + c) % 3 == 0) ? 0.2f : 0;
+                f32 noise = (_test_mip_random(&random) - 0.5f)*0.08f;
+                f32 value = CLAMP(smooth - edge + noise, 0, 1);
+                image->pixels[((isize) y*width + x)*channels + c] = (u8) (value*255 + 0.5f);
+            }
+}
+
+void test_texture_compress()
+{
+    LOG_INFO("TEST", "texture compress");
+    log_indent();
+    Allocator* alloc = allocator_get_default();
+
+    //Quality of each format on the kind of map it is used for.
+    //The noise in the test image is independent per channel so no line fits it well. 
+    //Without it BC7 gets above 50 dB and BC1 around 43 dB.
+    {
+        typedef struct Test_Map {
+            const char* name;
+            Map_Type type;
+            i32 channels;
+            f64 min_psnr;
+        } Test_Map;
+
+        Test_Map maps[] = {
+            {"diffuse", MAP_TYPE_DIFFUSE, 3, 34},
+            {"albedo", MAP_TYPE_ALBEDO, 4, 34},
+            {"roughness", MAP_TYPE_ROUGNESS, 1, 45},
+            {"normal", MAP_TYPE_NORMAL, 3, 45},
+        };
+
+        for(isize i = 0; i < ARRAY_LEN(maps); i++)
+        {
+            Image image = {0};
+            _test_compress_image(&image, alloc, 256, 256, maps[i].channels, 0x1234 + (u64) i);
+            
+            Texture_Block_Format format = texture_block_format_from_map(maps[i].type, maps[i].channels);
+            Image blocks = {0};
+            Image decoded = {0};
+            texture_compress(&blocks, subimage_of(image), format, alloc);
+            texture_decompress(&decoded, subimage_of(blocks), image.width, image.height, format, alloc);
+
+            i32 compared = MIN(maps[i].channels, texture_block_channel_count(format));
+            f64 psnr = texture_psnr(subimage_of(image), subimage_of(decoded), compared);
+            LOG_INFO("TEST", "%-8s %i channels as %s: PSNR %.2lf dB", maps[i].name, maps[i].channels, texture_block_format_name(format), psnr);
+            ASSERT(psnr > maps[i].min_psnr);
+            ASSERT(blocks.width == 64 && blocks.height == 64 && blocks.pixel_size == texture_block_size(format));
+
+            image_deinit(&blocks);
+            image_deinit(&decoded);
+            image_deinit(&image);
+        }
+    }
+
+    //All formats on odd sizes. The blocks are extended to a bigger layer the same way uncompressed images are:
+    // the original blocks are kept as is and the rest repeats the last column and row.
+    for(i32 format = TEXTURE_BLOCK_BC1; format < TEXTURE_BLOCK_FORMAT_COUNT; format++)
+    {
+        Texture_Block_Format block_format = (Texture_Block_Format) format;
+        i32 channels = texture_block_channel_count(block_format);
+        Image image = {0};
+        _test_compress_image(&image, alloc, 37, 21, channels, 0x77);
+
+        Image blocks = {0};
+        Image decoded = {0};
+        Image extended_decoded = {0};
+        texture_compress(&blocks, subimage_of(image), block_format, alloc);
+        texture_decompress(&decoded, subimage_of(blocks), image.width, image.height, block_format, alloc);
+        f64 psnr = texture_psnr(subimage_of(image), subimage_of(decoded), channels);
+        ASSERT(psnr > 30, "%s PSNR %lf", texture_block_format_name(block_format), psnr);
+
+        //The cooked texture stores the blocks as they are
+        {
+            Format_Source_Info source = {0};
+            String_Builder cooked = {alloc};
+            format_texture_write(&cooked, source, 0, block_format, image.width, image.height, &blocks, 1, channels);
+
+            Format_Texture texture = {0};
+            ASSERT(format_texture_read(&texture, cooked.string));
+            ASSERT(texture.header->mips[0].width == image.width && texture.header->mips[0].height == image.height);
+            ASSERT(texture.mips[0].width == blocks.width && texture.mips[0].height == blocks.height && texture.mips[0].pixel_size == blocks.pixel_size);
+            ASSERT(memcmp(texture.mips[0].pixels, blocks.pixels, (size_t) texture_blocks_size(block_format, image.width, image.height)) == 0);
+            builder_deinit(&cooked);
+        }
+
+        Image extended = texture_blocks_extend(alloc, subimage_of(blocks), block_format, image.width, image.height, 64, 32);
+        ASSERT(extended.width == 16 && extended.height == 8);
+        texture_decompress(&extended_decoded, subimage_of(extended), 64, 32, block_format, alloc);
+
+        isize stride = image_byte_stride(extended_decoded);
+        i32 max_error = 0;
+        for(i32 y = 0; y < 32; y++)
+            for(i32 x = 0; x < 64; x++)
+                for(i32 c = 0; c < channels; c++)
+                {
+                    i32 from_x = MIN(x, image.width - 1);
+                    i32 from_y = MIN(y, image.height - 1);
+                    i32 expected = decoded.pixels[((isize) from_y*decoded.width + from_x)*channels + c];
+                    i32 got = extended_decoded.pixels[y*stride + x*channels + c];
+                    if(x < image.width && y < image.height)
+                        ASSERT(got == expected);
+                    else
+                        max_error = MAX(max_error, abs(got - expected));
+                }
+
+        //The extension is encoded again so it is only close
+        LOG_INFO("TEST", "%s extension max error %i", texture_block_format_name(block_format), max_error);
+        ASSERT(max_error <= 8);
+
+        image_deinit(&extended_decoded);
+        image_deinit(&extended);
+        image_deinit(&decoded);
+        image_deinit(&blocks);
+        image_deinit(&image);
+    }
+
+    //Throughput
+    {
+        Image image = {0};
+        _test_compress_image(&image, alloc, 1024, 1024, 4, 0x99);
+        for(i32 format = TEXTURE_BLOCK_BC1; format < TEXTURE_BLOCK_FORMAT_COUNT; format++)
+        {
+            Image blocks = {0};
+            f64 start = clock_s();
+            texture_compress(&blocks, subimage_of(image), (Texture_Block_Format) format, alloc);
+            f64 time = clock_s() - start;
+            LOG_INFO("TEST", "%s 1024x1024 on %lli threads: %.2lf ms (%.1lf MPix/s)", 
+                texture_block_format_name((Texture_Block_Format) format), (lli) parallel_thread_count(), time*1000, image.width*image.height/time/1e6);
+            image_deinit(&blocks);
+        }
+        image_deinit(&image);
+    }
+
+    log_outdent();
+}
+
+void run_test_func(void* context)
+{
+    PROFILE_SCOPE() 
+    {
+        if(0)
+        {
+            uint32_t futex = 1;
+
+            Perf_Benchmark bench_futex = {0};
+	        while(perf_benchmark_custom(&bench_futex, NULL, 0.3, 3, 4)) {
+                platform_futex_wake(&futex);
+                platform_futex_wake(&futex);
+                platform_futex_wake(&futex);
+                platform_futex_wake(&futex);
+	        }
+        
+            Perf_Benchmark protected_futex = {0};
+	        while(perf_benchmark_custom(&protected_futex, NULL, 0.3, 3, 4)) {
+                platform_futex_wake(&futex);
+                platform_futex_wake(&futex);
+                platform_futex_wake(&futex);
+                platform_futex_wake(&futex);
+	        }
+        }
+
+        if(0)
+            test_obj_parallel_read();
+
+        if(0)
+            test_obj_decimal_f32(20*1000*1000);
+
+        if(0)
+        {
+            String_Builder obj_source = builder_make(allocator_get_default(), 0);
+            benchmark_obj_generate(&obj_source, (isize) 1 << 30);
+            benchmark_obj_parsing(STRING("synthetic"), obj_source.string);
+            builder_deinit(&obj_source);
+        }
+
+        if(0)
+        {
+            String_Builder obj_source = builder_make(allocator_get_default(), 0);
+            if(file_read_entire(STRING("resources/falcon/falcon.obj"), &obj_source, log_error("BENCH")))
+                benchmark_obj_parsing(STRING("falcon"), obj_source.string);
+            builder_deinit(&obj_source);
+        }
+
+        if(0)
+            benchmark_render_sort();
+
+        if(0)
+            benchmark_frustum_cull();
+
+        if(0)
+            benchmark_bvh_cull();
+
+        if(0)
+            test_bvh_ray_pick();
+
+        if(0)
+            benchmark_buffer_diff();
+
+        if(0)
+            test_upload_ring();
+
+        if(0)
+            benchmark_render_build_batches();
+
+        if(0)
+            benchmark_render_build_materials();
+
+        if(0)
+            test_light_clusters();
+
+        if(0)
+            test_mesh_optimize();
+
+        if(0)
+            test_mesh_lod();
+
+        if(0)
+            test_atlas_packer();
+
+        if(0)
+            test_texture_layers();
+
+        if(0)
+            test_texture_stream();
+
+        if(0)
+            test_mip_chain();
+
+        if(0)
+            test_texture_compress();
 
         exit(0);
         (void) context;
@@ -0,0 +1,437 @@
+#ifndef LIB_MESH_LOD
+#define LIB_MESH_LOD
+
+// Level of detail chains for indexed triangle meshes.
+//
+// mesh_simplify reduces the triangle count by edge collapses ordered by the quadric error
+// metric (Garland & Heckbert "Surface Simplification Using Quadric Error Metrics"). Every vertex
+// gets a quadric - the sum of squared distances to the planes of its original triangles. The cost
+// of collapsing a vertex into its neighbour is the combined quadric evaluated at the neighbour.
+//
+// We only ever do half edge collapses (the vertex moves onto an existing vertex). This means
+// all lods can share the vertices of the original mesh and each lod is just another index range.
+// The planes are weighted by the triangle areas and the cost is divided by the total weight
+// so it is the mean squared distance to the merged planes.
+// Vertices on borders (edges with only one triangle) and on attribute seams (several vertices with
+// the same position) are locked so that the outline of the mesh and its uv/normal seams never
+// tear open. Meshes made entirely of seams (flat shaded cubes) thus do not simplify at all.
+//
+// Collapses are applied in passes. Each pass costs all edges, sorts them and applies the cheapest
+// ones whose neighbourhoods do not overlap, rejecting those that would flip a triangle.
+// The adjacency is then rebuilt and the next pass runs until the target is reached or nothing
+// can be collapsed.
+//
+// The error of a lod is the object space distance its surface may be away from the full mesh
+// (the square root of the largest collapse cost summed over the chain). mesh_lod_select uses it
+// to pick the coarsest lod whose error projected onto the screen stays under a threshold.
+
+#include "engine_types.h"
+
+#define MESH_LOD_MAX 8              //the most lods including the full mesh
+#define MESH_LOD_MIN_TRIANGLES 64   //no lods are made with less triangles than this
+#define MESH_LOD_MIN_REDUCTION 0.8f //lod with more than this fraction of the previous lods triangles is not worth it
+
+typedef struct Mesh_Lod {
+    i32 index_from;
+    i32 index_count;
+    f32 error; //object space distance from the full mesh. 0 for the full mesh.
+} Mesh_Lod;
+
+//Simplifies the triangles given by indices to at most target_index_count indices.
+//Writes the result to out_indices which must have space for index_count indices (can be the same as indices).
+//Returns the resulting index count. If error_or_null is not NULL it is set to the error of the result.
+EXTERNAL isize mesh_simplify(i32* out_indices, const i32* indices, isize index_count, const Vertex* vertices, isize vertex_count, isize target_index_count, f32* error_or_null);
+
+//Appends the indices of the full mesh followed by the indices of each coarser lod to out_indices.
+//Each lod has roughly half the triangles of the previous one. lods[0] is the full mesh.
+//The ranges are relative to the start of the appended indices. Returns the number of lods.
+EXTERNAL isize mesh_lod_build(i32_Array* out_indices, Mesh_Lod lods[MESH_LOD_MAX], const i32* indices, isize index_count, const Vertex* vertices, isize vertex_count);
+
+//Returns the index of the coarsest lod whose error projected to the screen is at most max_screen_error.
+//scale is the largest scale of the model transform, distance the distance of the camera from the mesh bounds
+// and projection_scale is the [1][1] element of the projection matrix (1/tan(fov/2)).
+//The screen error is in the units of half the screen height (ie. 2/screen_height is one pixel).
+EXTERNAL i32 mesh_lod_select(const Mesh_Lod* lods, isize lod_count, f32 scale, f32 distance, f32 projection_scale, f32 max_screen_error);
+
+#endif
+
+#if (defined(LIB_ALL_IMPL) || defined(LIB_MESH_LOD_IMPL)) && !defined(LIB_MESH_LOD_HAS_IMPL)
+#define LIB_MESH_LOD_HAS_IMPL
+
+#include <math.h>
+
+//Symmetric 4x4 matrix of the plane equations: a2 ab ac ad b2 bc bd c2 cd d2
+// and the sum of the weights (areas) of the planes
+typedef struct _Mesh_Quadric {
+    f64 q[10];
+    f64 weight;
+} _Mesh_Quadric;
+
+typedef struct _Mesh_Collapse {
+    f32 cost;
+    i32 from;
+    i32 to;
+} _Mesh_Collapse;
+
+typedef struct _Mesh_Position_Key {
+    f32 x;
+    f32 y;
+    f32 z;
+    i32 vertex;
+} _Mesh_Position_Key;
+
+typedef Array(_Mesh_Quadric) _Mesh_Quadric_Array;
+typedef Array(_Mesh_Collapse) _Mesh_Collapse_Array;
+typedef Array(_Mesh_Position_Key) _Mesh_Position_Key_Array;
+
+INTERNAL void _mesh_quadric_add_plane(_Mesh_Quadric* quadric, f64 a, f64 b, f64 c, f64 d, f64 weight)
+{
+    f64* q = quadric->q;
+    q[0] += weight*a*a; q[1] += weight*a*b; q[2] += weight*a*c; q[3] += weight*a*d;
+    q[4] += weight*b*b; q[5] += weight*b*c; q[6] += weight*b*d;
+    q[7] += weight*c*c; q[8] += weight*c*d;
+    q[9] += weight*d*d;
+    quadric->weight += weight;
+}
+
+INTERNAL f64 _mesh_quadric_eval(const _Mesh_Quadric* a, const _Mesh_Quadric* b, Vec3 p)
+{
+    f64 q[10] = {0};
+    for(isize i = 0; i < 10; i++)
+        q[i] = a->q[i] + b->q[i];
+
+    f64 x = p.x, y = p.y, z = p.z;
+    f64 error = q[0]*x*x + 2*q[1]*x*y + 2*q[2]*x*z + 2*q[3]*x
+              + q[4]*y*y + 2*q[5]*y*z + 2*q[6]*y
+              + q[7]*z*z + 2*q[8]*z
+              + q[9];
+
+    //The weighted mean so that the cost is a squared distance regardless of how many
+    // triangles were merged into the vertices. Can be slightly negative from rounding.
+    f64 weight = a->weight + b->weight;
+    if(weight <= 0)
+        return 0;
+    return MAX(error / weight, 0.0);
+}
+
+INTERNAL Vec3 _mesh_triangle_normal(Vec3 a, Vec3 b, Vec3 c)
+{
+    return vec3_cross(vec3_sub(b, a), vec3_sub(c, a));
+}
+
+INTERNAL int _mesh_collapse_compare(const void* a, const void* b)
+{
+    const _Mesh_Collapse* x = (const _Mesh_Collapse*) a;
+    const _Mesh_Collapse* y = (const _Mesh_Collapse*) b;
+    if(x->cost != y->cost)
+        return x->cost < y->cost ? -1 : 1;
+    if(x->from != y->from)
+        return x->from < y->from ? -1 : 1;
+    return (x->to > y->to) - (x->to < y->to);
+}
+
+INTERNAL int _mesh_position_compare(const void* a, const void* b)
+{
+    const _Mesh_Position_Key* x = (const _Mesh_Position_Key*) a;
+    const _Mesh_Position_Key* y = (const _Mesh_Position_Key*) b;
+    if(x->x != y->x) return x->x < y->x ? -1 : 1;
+    if(x->y != y->y) return x->y < y->y ? -1 : 1;
+    if(x->z != y->z) return x->z < y->z ? -1 : 1;
+    return (x->vertex > y->vertex) - (x->vertex < y->vertex);
+}
+
+INTERNAL int _mesh_edge_compare(const void* a, const void* b)
+{
+    u64 x = *(const u64*) a;
+    u64 y = *(const u64*) b;
+    return (x > y) - (x < y);
+}
+
+EXTERNAL isize mesh_simplify(i32* out_indices, const i32* indices, isize index_count, const Vertex* vertices, isize vertex_count, isize target_index_count, f32* error_or_null)
+{
+    ASSERT(index_count % 3 == 0);
+    if(out_indices != indices)
+        memmove(out_indices, indices, (size_t) index_count * sizeof(i32));
+
+    isize triangle_count = index_count / 3;
+    isize target_triangles = MAX(target_index_count / 3, 0);
+    f64 max_cost = 0;
+    if(triangle_count <= target_triangles)
+    {
+        if(error_or_null)
+            *error_or_null = 0;
+        return index_count;
+    }
+
+    PROFILE_SCOPE()
+    SCRATCH_ARENA(arena)
+    {
+        i32* tris = out_indices;
+        u8_Array locked = {arena.alloc};
+        u8_Array touched = {arena.alloc};
+        i32_Array remap = {arena.alloc};
+        _Mesh_Quadric_Array quadrics = {arena.alloc};
+        array_resize(&locked, vertex_count);
+        array_resize(&touched, vertex_count);
+        array_resize(&remap, vertex_count);
+        array_resize(&quadrics, vertex_count);
+        for(isize v = 0; v < vertex_count; v++)
+            remap.data[v] = (i32) v;
+
+        //Lock seams: vertices sharing position with another vertex
+        {
+            _Mesh_Position_Key_Array keys = {arena.alloc};
+            array_resize_for_overwrite(&keys, vertex_count);
+            for(isize v = 0; v < vertex_count; v++)
+            {
+                Vec3 pos = vertices[v].pos;
+                _Mesh_Position_Key key = {pos.x, pos.y, pos.z, (i32) v};
+                keys.data[v] = key;
+            }
+
+            qsort(keys.data, (size_t) keys.len, sizeof *keys.data, _mesh_position_compare);
+            for(isize i = 0; i + 1 < keys.len; i++)
+            {
+                _Mesh_Position_Key* a = &keys.data[i];
+                _Mesh_Position_Key* b = &keys.data[i + 1];
+                if(a->x == b->x && a->y == b->y && a->z == b->z)
+                {
+                    locked.data[a->vertex] = true;
+                    locked.data[b->vertex] = true;
+                }
+            }
+        }
+
+        //Lock borders: edges used by exactly one triangle.
+        //Edges are keyed by their smaller vertex in the high bits so that both directions match.
+        {
+            Array(u64) edges = {arena.alloc};
+            array_resize_for_overwrite(&edges, triangle_count*3);
+            for(isize i = 0; i < triangle_count*3; i++)
+            {
+                u64 a = (u32) tris[i];
+                u64 b = (u32) tris[i - i%3 + (i + 1)%3];
+                edges.data[i] = a < b ? a << 32 | b : b << 32 | a;
+            }
+
+            qsort(edges.data, (size_t) edges.len, sizeof *edges.data, _mesh_edge_compare);
+            for(isize i = 0; i < edges.len; )
+            {
+                isize run = 1;
+                while(i + run < edges.len && edges.data[i + run] == edges.data[i])
+                    run += 1;
+
+                if(run == 1)
+                {
+                    locked.data[edges.data[i] >> 32] = true;
+                    locked.data[edges.data[i] & 0xFFFFFFFF] = true;
+                }
+                i += run;
+            }
+        }
+
+        for(isize t = 0; t < triangle_count; t++)
+        {
+            Vec3 p0 = vertices[tris[t*3 + 0]].pos;
+            Vec3 p1 = vertices[tris[t*3 + 1]].pos;
+            Vec3 p2 = vertices[tris[t*3 + 2]].pos;
+            Vec3 normal = _mesh_triangle_normal(p0, p1, p2);
+            f32 len = vec3_len(normal);
+            if(len <= 0)
+                continue;
+
+            normal = vec3_scale(normal, 1.0f/len);
+            f64 d = -((f64) normal.x*p0.x + (f64) normal.y*p0.y + (f64) normal.z*p0.z);
+            for(isize k = 0; k < 3; k++)
+                _mesh_quadric_add_plane(&quadrics.data[tris[t*3 + k]], normal.x, normal.y, normal.z, d, len*0.5f);
+        }
+
+        i32_Array adjacency_from = {arena.alloc};
+        i32_Array adjacency_fill = {arena.alloc};
+        i32_Array adjacency = {arena.alloc};
+        _Mesh_Collapse_Array collapses = {arena.alloc};
+        array_resize(&adjacency_from, vertex_count + 1);
+        array_resize(&adjacency_fill, vertex_count);
+
+        while(triangle_count > target_triangles)
+        {
+            //Vertex -> triangles adjacency of the current triangles
+            memset(adjacency_from.data, 0, (size_t) array_byte_size(adjacency_from));
+            for(isize i = 0; i < triangle_count*3; i++)
+                adjacency_from.data[tris[i] + 1] += 1;
+            for(isize v = 0; v < vertex_count; v++)
+                adjacency_from.data[v + 1] += adjacency_from.data[v];
+
+            array_resize_for_overwrite(&adjacency, triangle_count*3);
+            memset(adjacency_fill.data, 0, (size_t) array_byte_size(adjacency_fill));
+            for(isize i = 0; i < triangle_count*3; i++)
+            {
+                i32 v = tris[i];
+                adjacency.data[adjacency_from.data[v] + adjacency_fill.data[v]++] = (i32) (i/3);
+            }
+            memset(touched.data, 0, (size_t) array_byte_size(touched));
+
+            //Cost every edge in both directions. Interior edges appear twice which is harmless.
+            array_clear(&collapses);
+            for(isize i = 0; i < triangle_count*3; i++)
+            {
+                i32 a = tris[i];
+                i32 b = tris[i - i%3 + (i + 1)%3];
+                if(locked.data[a] == false)
+                {
+                    _Mesh_Collapse collapse = {(f32) _mesh_quadric_eval(&quadrics.data[a], &quadrics.data[b], vertices[b].pos), a, b};
+                    array_push(&collapses, collapse);
+                }
+                if(locked.data[b] == false)
+                {
+                    _Mesh_Collapse collapse = {(f32) _mesh_quadric_eval(&quadrics.data[a], &quadrics.data[b], vertices[a].pos), b, a};
+                    array_push(&collapses, collapse);
+                }
+            }
+
+            qsort(collapses.data, (size_t) collapses.len, sizeof *collapses.data, _mesh_collapse_compare);
+
+            isize removed = 0;
+            isize to_remove = triangle_count - target_triangles;
+            for(isize c = 0; c < collapses.len && removed < to_remove; c++)
+            {
+                _Mesh_Collapse collapse = collapses.data[c];
+                if(touched.data[collapse.from] || touched.data[collapse.to])
+                    continue;
+
+                //Triangles containing both vertices disappear, the rest must not flip
+                isize degenerate = 0;
+                bool flips = false;
+                for(i32 a = adjacency_from.data[collapse.from]; a < adjacency_from.data[collapse.from + 1]; a++)
+                {
+                    i32* tri = tris + adjacency.data[a]*3;
+                    if(tri[0] == collapse.to || tri[1] == collapse.to || tri[2] == collapse.to)
+                    {
+                        degenerate += 1;
+                        continue;
+                    }
+
+                    Vec3 p[3] = {0};
+                    for(isize k = 0; k < 3; k++)
+                        p[k] = vertices[tri[k]].pos;
+                    Vec3 before = _mesh_triangle_normal(p[0], p[1], p[2]);
+                    for(isize k = 0; k < 3; k++)
+                        if(tri[k] == collapse.from)
+                            p[k] = vertices[collapse.to].pos;
+                    Vec3 after = _mesh_triangle_normal(p[0], p[1], p[2]);
+
+                    //Already degenerate triangles have no orientation to keep
+                    f32 before_len = vec3_len(before);
+                    f32 after_len = vec3_len(after);
+                    if(before_len > 0 && vec3_dot(before, after) <= 0.2f*before_len*after_len)
+                    {
+                        flips = true;
+                        break;
+                    }
+                }
+
+                if(flips || degenerate == 0)
+                    continue;
+
+                //Keep the collapses of a pass independent so that the checks above stay valid
+                for(i32 a = adjacency_from.data[collapse.from]; a < adjacency_from.data[collapse.from + 1]; a++)
+                {
+                    i32* tri = tris + adjacency.data[a]*3;
+                    touched.data[tri[0]] = true;
+                    touched.data[tri[1]] = true;
+                    touched.data[tri[2]] = true;
+                }
+
+                for(isize k = 0; k < 10; k++)
+                    quadrics.data[collapse.to].q[k] += quadrics.data[collapse.from].q[k];
+                quadrics.data[collapse.to].weight += quadrics.data[collapse.from].weight;
+
+                remap.data[collapse.from] = collapse.to;
+                max_cost = MAX(max_cost, (f64) collapse.cost);
+                removed += degenerate;
+            }
+
+            if(removed == 0)
+                break;
+
+            isize kept = 0;
+            for(isize t = 0; t < triangle_count; t++)
+            {
+                i32 a = remap.data[tris[t*3 + 0]];
+                i32 b = remap.data[tris[t*3 + 1]];
+                i32 c = remap.data[tris[t*3 + 2]];
+                if(a == b || b == c || a == c)
+                    continue;
+
+                tris[kept*3 + 0] = a;
+                tris[kept*3 + 1] = b;
+                tris[kept*3 + 2] = c;
+                kept += 1;
+            }
+
+            ASSERT(kept == triangle_count - removed);
+            triangle_count = kept;
+        }
+    }
+
+    if(error_or_null)
+        *error_or_null = (f32) sqrt(max_cost);
+    return triangle_count*3;
+}
+
+EXTERNAL isize mesh_lod_build(i32_Array* out_indices, Mesh_Lod lods[MESH_LOD_MAX], const i32* indices, isize index_count, const Vertex* vertices, isize vertex_count)
+{
+    isize lod_count = 0;
+    PROFILE_SCOPE()
+    {
+        isize base = out_indices->len;
+        array_append(out_indices, indices, index_count);
+
+        Mesh_Lod full = {0, (i32) index_count, 0};
+        lods[lod_count++] = full;
+        while(lod_count < MESH_LOD_MAX)
+        {
+            Mesh_Lod prev = lods[lod_count - 1];
+            isize target = prev.index_count/3/2*3;
+            if(target < MESH_LOD_MIN_TRIANGLES*3)
+                break;
+
+            //Simplify the previous lod in place at the end of the indices.
+            //The errors of each step add up which overestimates the true error a bit.
+            isize from = out_indices->len;
+            array_resize(out_indices, from + prev.index_count);
+            const i32* prev_indices = out_indices->data + base + prev.index_from;
+            f32 error = 0;
+            isize count = mesh_simplify(out_indices->data + from, prev_indices, prev.index_count, vertices, vertex_count, target, &error);
+
+            if(count > (isize) (prev.index_count*MESH_LOD_MIN_REDUCTION))
+            {
+                array_resize(out_indices, from);
+                break;
+            }
+
+            array_resize(out_indices, from + count);
+            Mesh_Lod lod = {(i32) (from - base), (i32) count, prev.error + error};
+            lods[lod_count++] = lod;
+        }
+    }
+    return lod_count;
+}
+
+EXTERNAL i32 mesh_lod_select(const Mesh_Lod* lods, isize lod_count, f32 scale, f32 distance, f32 projection_scale, f32 max_screen_error)
+{
+    i32 selected = 0;
+    if(distance > 0)
+    {
+        f32 to_screen = scale * projection_scale / distance;
+        for(isize i = 1; i < lod_count; i++)
+        {
+            if(lods[i].error * to_screen > max_screen_error)
+                break;
+            selected = (i32) i;
+        }
+    }
+    return selected;
+}
+
+#endif
@@ -0,0 +1,421 @@
+#ifndef LIB_MESH_OPTIMIZE
+#define LIB_MESH_OPTIMIZE
+
+// Reorders triangles and vertices of indexed meshes so that the GPU does less work drawing them.
+//
+// 1) mesh_optimize_vertex_cache reorders triangles using Tom Forsyth's "Linear-Speed Vertex
+//    Cache Optimisation". Each vertex gets a score based on its position in a simulated LRU
+//    cache and on how many not yet emitted triangles still use it. We greedily emit the
+//    triangle with the highest sum of scores and only rescore triangles touching the cache.
+//    The exact cache size of the hardware does not matter much, the result is good for all.
+// 2) mesh_optimize_vertex_fetch renumbers vertices in the order they are first used
+//    by the triangles so that the vertex fetch walks the vertex buffer roughly linearly.
+//
+// mesh_simulate_vertex_cache runs the index buffer through a FIFO post transform cache
+// (which is what most hardware has) and reports:
+//  ACMR - average cache miss ratio = transformed vertices / triangles.
+//         Is in [0.5, 3] where 3 is worst, ~0.6 is great for regular grids.
+//  ATVR - average transform to vertex ratio = transformed vertices / referenced vertices.
+//         Is 1 in the ideal case. Unlike ACMR does not depend on the mesh topology.
+//
+// shape_assembly_optimize applies both passes to a Shape_Assembly. Triangles never cross
+// group boundaries so the group triangle ranges stay valid.
+
+#include "shapes.h"
+#include "asset_descriptions.h"
+
+#define MESH_OPTIMIZE_CACHE_SIZE 32 //the LRU cache size used for scoring
+#define MESH_SIMULATE_CACHE_SIZE 16 //the FIFO cache size of the simulated hardware
+
+typedef struct Mesh_Cache_Stats {
+    isize triangles;
+    isize vertices;     //number of distinct vertices referenced
+    isize transforms;   //number of cache misses ie. vertex shader invocations
+    f32 acmr;
+    f32 atvr;
+} Mesh_Cache_Stats;
+
+typedef struct Mesh_Optimize_Stats {
+    Mesh_Cache_Stats before;
+    Mesh_Cache_Stats after;
+} Mesh_Optimize_Stats;
+
+EXTERNAL Mesh_Cache_Stats mesh_simulate_vertex_cache(const Triangle_Index* triangles, isize triangle_count, isize vertex_count, isize cache_size);
+
+//Reorders the triangles in place. All indices must be smaller than vertex_count.
+EXTERNAL void mesh_optimize_vertex_cache(Triangle_Index* triangles, isize triangle_count, isize vertex_count);
+
+//Reorders the vertices in place into the order of first use and rewrites the indices.
+//Vertices not used by any triangle are moved to the end keeping their order.
+EXTERNAL void mesh_optimize_vertex_fetch(Vertex* vertices, isize vertex_count, Triangle_Index* triangles, isize triangle_count);
+
+//Optimizes the vertex cache separately for each range delimited by the groups triangles_from/to
+// then reorders the vertex fetch of the entire assembly and rebuilds its vertices_hash.
+//If stats is not NULL fills it with the result of mesh_simulate_vertex_cache before and after.
+EXTERNAL void shape_assembly_optimize(Shape_Assembly* assembly, const Triangle_Mesh_Group_Description* groups, isize groups_count, Mesh_Optimize_Stats* stats_or_null);
+
+#endif
+
+#if (defined(LIB_ALL_IMPL) || defined(LIB_MESH_OPTIMIZE_IMPL)) && !defined(LIB_MESH_OPTIMIZE_HAS_IMPL)
+#define LIB_MESH_OPTIMIZE_HAS_IMPL
+
+#define _MESH_OPTIMIZE_MAX_VALENCE_SCORE 32
+
+typedef struct _Mesh_Optimize_Scores {
+    f32 cache[MESH_OPTIMIZE_CACHE_SIZE];
+    f32 valence[_MESH_OPTIMIZE_MAX_VALENCE_SCORE];
+} _Mesh_Optimize_Scores;
+
+INTERNAL _Mesh_Optimize_Scores _mesh_optimize_scores()
+{
+    //The constants from the original article
+    const f32 cache_decay_power = 1.5f;
+    const f32 last_triangle_score = 0.75f;
+    const f32 valence_boost_scale = 2.0f;
+    const f32 valence_boost_power = 0.5f;
+
+    _Mesh_Optimize_Scores scores = {0};
+    for(isize i = 0; i < MESH_OPTIMIZE_CACHE_SIZE; i++)
+    {
+        //The last triangle's vertices get a fixed score so that we dont favour
+        // going straight back to them and produce strips.
+        if(i < 3)
+            scores.cache[i] = last_triangle_score;
+        else
+        {
+            f32 scaler = 1.0f / (MESH_OPTIMIZE_CACHE_SIZE - 3);
+            scores.cache[i] = powf(1.0f - (f32) (i - 3)*scaler, cache_decay_power);
+        }
+    }
+
+    //Vertices with only few triangles left get a boost so that we dont leave lone triangles behind
+    for(isize i = 1; i < _MESH_OPTIMIZE_MAX_VALENCE_SCORE; i++)
+        scores.valence[i] = valence_boost_scale * powf((f32) i, -valence_boost_power);
+
+    return scores;
+}
+
+INTERNAL f32 _mesh_optimize_vertex_score(const _Mesh_Optimize_Scores* scores, i32 cache_position, i32 remaining_triangles)
+{
+    if(remaining_triangles <= 0)
+        return -1;
+
+    f32 score = 0;
+    if(cache_position >= 0)
+        score = scores->cache[cache_position];
+
+    if(remaining_triangles < _MESH_OPTIMIZE_MAX_VALENCE_SCORE)
+        score += scores->valence[remaining_triangles];
+    else
+        score += 2.0f * powf((f32) remaining_triangles, -0.5f);
+
+    return score;
+}
+
+//local_of has vertex_count entries which must all be -1. They are -1 again once this returns.
+//Only the entries of the referenced vertices are touched so calling this for many small ranges 
+// of a large mesh with the same local_of does not cost O(vertex_count) per range.
+INTERNAL void _mesh_optimize_vertex_cache(Triangle_Index* triangles, isize triangle_count, isize vertex_count, i32* local_of)
+{
+    if(triangle_count <= 1)
+        return;
+
+    PROFILE_SCOPE()
+    SCRATCH_ARENA(arena)
+    {
+        _Mesh_Optimize_Scores scores = _mesh_optimize_scores();
+
+        //Compact the referenced vertices into [0, local_count) so that the work and memory
+        // depend only on the size of the range not on the size of the entire vertex buffer.
+        i32_Array local_triangles = {arena.alloc};
+        array_resize(&local_triangles, triangle_count*3);
+
+        i32 local_count = 0;
+        for(isize i = 0; i < triangle_count*3; i++)
+        {
+            u32 vertex_i = triangles[i/3].vertex_i[i%3];
+            ASSERT_BOUNDS(vertex_i, vertex_count);
+            if(local_of[vertex_i] < 0)
+                local_of[vertex_i] = local_count++;
+            local_triangles.data[i] = local_of[vertex_i];
+        }
+
+        for(isize i = 0; i < triangle_count*3; i++)
+            local_of[triangles[i/3].vertex_i[i%3]] = -1;
+
+        //Vertex -> triangles adjacency. The first remaining[v] entries of each vertex
+        // are the triangles not yet emitted.
+        i32_Array remaining = {arena.alloc};
+        i32_Array adjacency_from = {arena.alloc};
+        i32_Array adjacency = {arena.alloc};
+        i32_Array cache_position = {arena.alloc};
+        Array(f32) vertex_score = {arena.alloc};
+        array_resize(&remaining, local_count);
+        array_resize(&adjacency_from, local_count + 1);
+        array_resize(&adjacency, triangle_count*3);
+        array_resize(&cache_position, local_count);
+        array_resize(&vertex_score, local_count);
+
+        for(isize i = 0; i < triangle_count*3; i++)
+            remaining.data[local_triangles.data[i]] += 1;
+
+        for(isize v = 0; v < local_count; v++)
+            adjacency_from.data[v + 1] = adjacency_from.data[v] + remaining.data[v];
+
+        memset(remaining.data, 0, (size_t) array_byte_size(remaining));
+        for(isize i = 0; i < triangle_count*3; i++)
+        {
+            i32 v = local_triangles.data[i];
+            adjacency.data[adjacency_from.data[v] + remaining.data[v]] = (i32) (i/3);
+            remaining.data[v] += 1;
+        }
+
+        for(isize v = 0; v < local_count; v++)
+        {
+            cache_position.data[v] = -1;
+            vertex_score.data[v] = _mesh_optimize_vertex_score(&scores, -1, remaining.data[v]);
+        }
+
+        Array(f32) triangle_score = {arena.alloc};
+        u8_Array triangle_added = {arena.alloc};
+        array_resize(&triangle_score, triangle_count);
+        array_resize(&triangle_added, triangle_count);
+
+        isize best_triangle = 0;
+        for(isize t = 0; t < triangle_count; t++)
+        {
+            i32* tri = local_triangles.data + t*3;
+            triangle_score.data[t] = vertex_score.data[tri[0]] + vertex_score.data[tri[1]] + vertex_score.data[tri[2]];
+            if(triangle_score.data[t] > triangle_score.data[best_triangle])
+                best_triangle = t;
+        }
+
+        //The cache holds MESH_OPTIMIZE_CACHE_SIZE vertices but while updating it
+        // temporarily contains the 3 new ones as well.
+        i32 cache[MESH_OPTIMIZE_CACHE_SIZE + 3] = {0};
+        i32 new_cache[MESH_OPTIMIZE_CACHE_SIZE + 3] = {0};
+        isize cache_len = 0;
+
+        Triangle_Index_Array emitted = {arena.alloc};
+        array_resize(&emitted, triangle_count);
+
+        isize scan_cursor = 0;
+        for(isize emitted_i = 0; emitted_i < triangle_count; emitted_i++)
+        {
+            //No triangle touching the cache is left. Take the next unemitted one.
+            if(best_triangle < 0)
+            {
+                while(triangle_added.data[scan_cursor])
+                    scan_cursor += 1;
+                best_triangle = scan_cursor;
+            }
+
+            i32* tri = local_triangles.data + best_triangle*3;
+            triangle_added.data[best_triangle] = true;
+            emitted.data[emitted_i] = triangles[best_triangle];
+
+            //Remove the triangle from the remaining lists of its vertices
+            for(isize k = 0; k < 3; k++)
+            {
+                i32 v = tri[k];
+                i32* adjacent = adjacency.data + adjacency_from.data[v];
+                i32 last = remaining.data[v] - 1;
+                for(i32 a = 0; a <= last; a++)
+                    if(adjacent[a] == (i32) best_triangle)
+                    {
+                        SWAP(&adjacent[a], &adjacent[last]);
+                        break;
+                    }
+                remaining.data[v] = last;
+            }
+
+            //Push the vertices to the front of the LRU cache
+            isize new_cache_len = 0;
+            for(isize k = 0; k < 3; k++)
+                new_cache[new_cache_len++] = tri[k];
+            for(isize c = 0; c < cache_len; c++)
+                if(cache[c] != tri[0] && cache[c] != tri[1] && cache[c] != tri[2])
+                    new_cache[new_cache_len++] = cache[c];
+
+            //Update the scores of all vertices in the cache including the ones that just fell out
+            for(isize c = 0; c < new_cache_len; c++)
+            {
+                i32 v = new_cache[c];
+                i32 position = c < MESH_OPTIMIZE_CACHE_SIZE ? (i32) c : -1;
+                cache_position.data[v] = position;
+                vertex_score.data[v] = _mesh_optimize_vertex_score(&scores, position, remaining.data[v]);
+            }
+
+            //Rescore their triangles and pick the best one
+            best_triangle = -1;
+            f32 best_score = -1;
+            for(isize c = 0; c < new_cache_len; c++)
+            {
+                i32 v = new_cache[c];
+                const i32* adjacent = adjacency.data + adjacency_from.data[v];
+                for(i32 a = 0; a < remaining.data[v]; a++)
+                {
+                    i32 t = adjacent[a];
+                    const i32* adjacent_tri = local_triangles.data + t*3;
+                    f32 score = vertex_score.data[adjacent_tri[0]] + vertex_score.data[adjacent_tri[1]] + vertex_score.data[adjacent_tri[2]];
+                    triangle_score.data[t] = score;
+                    if(score > best_score)
+                    {
+                        best_score = score;
+                        best_triangle = t;
+                    }
+                }
+            }
+
+            cache_len = MIN(new_cache_len, MESH_OPTIMIZE_CACHE_SIZE);
+            memcpy(cache, new_cache, (size_t) cache_len * sizeof(i32));
+        }
+
+        memcpy(triangles, emitted.data, (size_t) triangle_count * sizeof(Triangle_Index));
+    }
+}
+
+EXTERNAL void mesh_optimize_vertex_cache(Triangle_Index* triangles, isize triangle_count, isize vertex_count)
+{
+    SCRATCH_ARENA(arena)
+    {
+        i32_Array local_of = {arena.alloc};
+        array_resize(&local_of, vertex_count);
+        memset(local_of.data, -1, (size_t) array_byte_size(local_of));
+        _mesh_optimize_vertex_cache(triangles, triangle_count, vertex_count, local_of.data);
+    }
+}
+
+EXTERNAL void mesh_optimize_vertex_fetch(Vertex* vertices, isize vertex_count, Triangle_Index* triangles, isize triangle_count)
+{
+    PROFILE_SCOPE()
+    SCRATCH_ARENA(arena)
+    {
+        i32_Array remap = {arena.alloc};
+        array_resize(&remap, vertex_count);
+        memset(remap.data, -1, (size_t) array_byte_size(remap));
+
+        i32 next = 0;
+        for(isize t = 0; t < triangle_count; t++)
+            for(isize k = 0; k < 3; k++)
+            {
+                u32* vertex_i = &triangles[t].vertex_i[k];
+                ASSERT_BOUNDS(*vertex_i, vertex_count);
+                if(remap.data[*vertex_i] < 0)
+                    remap.data[*vertex_i] = next++;
+                *vertex_i = (u32) remap.data[*vertex_i];
+            }
+
+        for(isize v = 0; v < vertex_count; v++)
+            if(remap.data[v] < 0)
+                remap.data[v] = next++;
+
+        Vertex_Array reordered = {arena.alloc};
+        array_resize_for_overwrite(&reordered, vertex_count);
+        for(isize v = 0; v < vertex_count; v++)
+            reordered.data[remap.data[v]] = vertices[v];
+
+        memcpy(vertices, reordered.data, (size_t) vertex_count * sizeof(Vertex));
+    }
+}
+
+EXTERNAL Mesh_Cache_Stats mesh_simulate_vertex_cache(const Triangle_Index* triangles, isize triangle_count, isize vertex_count, isize cache_size)
+{
+    Mesh_Cache_Stats stats = {0};
+    stats.triangles = triangle_count;
+    cache_size = MAX(cache_size, 1);
+
+    PROFILE_SCOPE()
+    SCRATCH_ARENA(arena)
+    {
+        //A vertex is in the FIFO cache if it was transformed less than cache_size transforms ago.
+        //We store the time of the last transform for each vertex so the lookup is O(1).
+        isize_Array transformed_at = {arena.alloc};
+        array_resize(&transformed_at, vertex_count);
+        memset(transformed_at.data, -1, (size_t) array_byte_size(transformed_at));
+
+        isize transforms = 0;
+        for(isize t = 0; t < triangle_count; t++)
+            for(isize k = 0; k < 3; k++)
+            {
+                u32 vertex_i = triangles[t].vertex_i[k];
+                ASSERT_BOUNDS(vertex_i, vertex_count);
+                isize* at = &transformed_at.data[vertex_i];
+                if(*at < 0)
+                    stats.vertices += 1;
+
+                if(*at < 0 || transforms - *at >= cache_size)
+                {
+                    *at = transforms;
+                    transforms += 1;
+                }
+            }
+
+        stats.transforms = transforms;
+        stats.acmr = (f32) transforms / (f32) MAX(triangle_count, 1);
+        stats.atvr = (f32) transforms / (f32) MAX(stats.vertices, 1);
+    }
+
+    return stats;
+}
+
+INTERNAL int _mesh_optimize_compare_i32(const void* a, const void* b)
+{
+    i32 x = *(const i32*) a;
+    i32 y = *(const i32*) b;
+    return (x > y) - (x < y);
+}
+
+EXTERNAL void shape_assembly_optimize(Shape_Assembly* assembly, const Triangle_Mesh_Group_Description* groups, isize groups_count, Mesh_Optimize_Stats* stats_or_null)
+{
+    PROFILE_SCOPE()
+    SCRATCH_ARENA(arena)
+    {
+        Triangle_Index* triangles = assembly->triangles.data;
+        isize triangle_count = assembly->triangles.len;
+        isize vertex_count = assembly->vertices.len;
+
+        if(stats_or_null)
+            stats_or_null->before = mesh_simulate_vertex_cache(triangles, triangle_count, vertex_count, MESH_SIMULATE_CACHE_SIZE);
+
+        //Groups can nest and overlap so we split the triangles at every group boundary
+        // and optimize each piece separately. No triangle can then leave any group.
+        i32_Array boundaries = {arena.alloc};
+        array_push(&boundaries, 0);
+        array_push(&boundaries, (i32) triangle_count);
+        for(isize i = 0; i < groups_count; i++)
+        {
+            array_push(&boundaries, CLAMP(groups[i].triangles_from, 0, (i32) triangle_count));
+            array_push(&boundaries, CLAMP(groups[i].triangles_to, 0, (i32) triangle_count));
+        }
+
+        //Shared by all pieces. Each piece only resets the entries it used.
+        i32_Array local_of = {arena.alloc};
+        array_resize(&local_of, vertex_count);
+        memset(local_of.data, -1, (size_t) array_byte_size(local_of));
+
+        qsort(boundaries.data, (size_t) boundaries.len, sizeof(i32), _mesh_optimize_compare_i32);
+        for(isize i = 0; i + 1 < boundaries.len; i++)
+        {
+            i32 from = boundaries.data[i];
+            i32 to = boundaries.data[i + 1];
+            if(from < to)
+                _mesh_optimize_vertex_cache(triangles + from, to - from, vertex_count, local_of.data);
+        }
+
+        mesh_optimize_vertex_fetch(assembly->vertices.data, vertex_count, triangles, triangle_count);
+
+        //The vertices moved so the hash has to be rebuilt
+        Allocator* hash_allocator = assembly->vertices.allocator;
+        hash_deinit(&assembly->vertices_hash);
+        hash_init(&assembly->vertices_hash, hash_allocator);
+        hash_reserve(&assembly->vertices_hash, vertex_count);
+        for(isize v = 0; v < vertex_count; v++)
+            hash_insert(&assembly->vertices_hash, vertex_hash64(assembly->vertices.data[v], 0), (u64) v);
+
+        if(stats_or_null)
+            stats_or_null->after = mesh_simulate_vertex_cache(triangles, triangle_count, vertex_count, MESH_SIMULATE_CACHE_SIZE);
+    }
+}
+
+#endif
@@ -0,0 +1,554 @@
+#ifndef LIB_MIP_CHAIN
+#define LIB_MIP_CHAIN
+
+// Generation of texture mip chains on the cpu.
+//
+// Each mip is filtered from the previous one kept in f32 so that the rounding errors do not
+// pile up along the chain. The pixels are first decoded into linear space: sRGB encoded colors
+// are linearized (alpha never is) which keeps dark and bright regions from bleeding into
+// each other the way filtering the encoded values does (glGenerateMipmap does exactly that).
+//
+// Two filters are supported. Box averages 2x2 pixels. Kaiser is an 8 tap windowed sinc
+// (separable, 8x8 pixels per output) which keeps more detail without adding aliasing.
+// Its negative lobes can overshoot so the results are clamped for integer types.
+// Pixels past the edges are clamped to the edge (the same as GL_CLAMP_TO_EDGE).
+//
+// Normal maps have their vectors renormalized after each mip since the average of unit
+// vectors is shorter than one. Alpha tested textures keep the fraction of pixels passing
+// the alpha test of the first mip (Castano "Computing Alpha Mipmaps"). Otherwise thin
+// features like leaves or fences fade away in the distance.
+//
+// The filtering runs on SSE2 4 floats at a time over whole rows. The horizontal pass
+// of the Kaiser filter is vectorized for 4 channel images only.
+//
+// Nothing here touches opengl so it can be used and tested without a context.
+
+#include "lib/image.h"
+#include "asset_descriptions.h"
+
+#define MIP_CHAIN_MAX_MIPS 16
+
+typedef enum Mip_Filter {
+    MIP_FILTER_BOX = 0,
+    MIP_FILTER_KAISER = 1,
+} Mip_Filter;
+
+typedef struct Mip_Options {
+    Mip_Filter filter;
+    b32 is_srgb;        //all channels except alpha are sRGB encoded
+    b32 is_normal_map;  //the first three channels are a unit vector encoded as v*0.5 + 0.5
+    i32 alpha_channel;  //-1 if none
+    f32 alpha_cutoff;   //if > 0 the alpha test coverage at this cutoff is preserved
+    u32 _;
+} Mip_Options;
+
+typedef Array(f32) Mip_Chain_Buffer;
+
+//Chooses the options for a map of the given type (see process_mtl_map).
+//Gamma is taken from info if present. Otherwise defaults per map type.
+EXTERNAL Mip_Options mip_options_from_map(Map_Type type, const Map_Info* info_or_null, i32 channel_count);
+//Options which treat all channels as linear data.
+EXTERNAL Mip_Options mip_options_linear();
+
+//Returns the number of mips down to 1x1.
+EXTERNAL i32 mip_chain_count(i32 width, i32 height);
+
+//Fills mips[0, mip_count) with the mip chain of image. mips[0] is an exact copy of image and
+// mips[i] is max(width >> i, 1) x max(height >> i, 1). The mips are allocated from alloc.
+//Supports U8, U16 and F32 pixels with 1 to 4 channels.
+EXTERNAL void mip_chain_generate(Image* mips, i32 mip_count, Subimage image, const Mip_Options* options, Allocator* alloc);
+
+//Scalar transfer functions of sRGB.
+EXTERNAL f32 mip_srgb_to_linear(f32 value);
+EXTERNAL f32 mip_linear_to_srgb(f32 value);
+
+#endif
+
+#if (defined(LIB_ALL_IMPL) || defined(LIB_MIP_CHAIN_IMPL)) && !defined(LIB_MIP_CHAIN_HAS_IMPL)
+#define LIB_MIP_CHAIN_HAS_IMPL
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define MIP_CHAIN_SSE2
+    #include <emmintrin.h>
+#endif
+
+#include <math.h>
+
+#define _MIP_KAISER_TAPS 8
+
+EXTERNAL f32 mip_srgb_to_linear(f32 value)
+{
+    if(value <= 0.04045f)
+        return value / 12.92f;
+    return powf((value + 0.055f) / 1.055f, 2.4f);
+}
+
+EXTERNAL f32 mip_linear_to_srgb(f32 value)
+{
+    if(value <= 0.0031308f)
+        return MAX(value, 0) * 12.92f;
+    return 1.055f * powf(value, 1.0f / 2.4f) - 0.055f;
+}
+
+EXTERNAL Mip_Options mip_options_linear()
+{
+    Mip_Options options = {MIP_FILTER_KAISER};
+    options.alpha_channel = -1;
+    return options;
+}
+
+EXTERNAL Mip_Options mip_options_from_map(Map_Type type, const Map_Info* info_or_null, i32 channel_count)
+{
+    Mip_Options options = mip_options_linear();
+
+    bool is_color = type == MAP_TYPE_ALBEDO || type == MAP_TYPE_AMBIENT || type == MAP_TYPE_DIFFUSE
+        || type == MAP_TYPE_SPECULAR_COLOR || type == MAP_TYPE_REFLECTION;
+    bool is_mask = type == MAP_TYPE_ALPHA || type == MAP_TYPE_STENCIL;
+
+    if(info_or_null && info_or_null->gamma > 0)
+        options.is_srgb = info_or_null->gamma > 1;
+    else
+        options.is_srgb = is_color;
+
+    //stb_image order: grey, grey alpha, rgb, rgba
+    if(channel_count == 2 || channel_count == 4)
+        options.alpha_channel = channel_count - 1;
+    else if(is_mask && channel_count == 1)
+        options.alpha_channel = 0;
+
+    if(options.alpha_channel != -1 && (is_mask || type == MAP_TYPE_ALBEDO || type == MAP_TYPE_DIFFUSE))
+        options.alpha_cutoff = 0.5f;
+
+    options.is_normal_map = type == MAP_TYPE_NORMAL && channel_count >= 3;
+    if(options.is_normal_map)
+        options.is_srgb = false;
+
+    return options;
+}
+
+EXTERNAL i32 mip_chain_count(i32 width, i32 height)
+{
+    i32 count = 1;
+    for(i32 size = MAX(width, height); size > 1; size /= 2)
+        count += 1;
+    return count;
+}
+
+INTERNAL f64 _mip_bessel_i0(f64 x)
+{
+    f64 sum = 1;
+    f64 term = 1;
+    for(i32 k = 1; k < 32; k++)
+    {
+        term *= (x / (2*k)) * (x / (2*k));
+        sum += term;
+    }
+    return sum;
+}
+
+//Weights of the source pixels 2x - 3 ... 2x + 4 for the output pixel x.
+//The filter is the ideal low pass for halving the resolution windowed by Kaiser window with beta = 4.
+INTERNAL void _mip_kaiser_weights(f32 weights[_MIP_KAISER_TAPS])
+{
+    const f64 beta = 4;
+    const f64 radius = _MIP_KAISER_TAPS / 2;
+    const f64 pi = 3.14159265358979323846;
+    f64 sum = 0;
+    f64 w[_MIP_KAISER_TAPS] = {0};
+    for(i32 k = 0; k < _MIP_KAISER_TAPS; k++)
+    {
+        f64 t = k - (_MIP_KAISER_TAPS - 1) / 2.0;
+        f64 x = pi * t / 2;
+        f64 sinc = sin(x) / x;
+        f64 r = t / radius;
+        f64 window = _mip_bessel_i0(beta * sqrt(1 - r*r)) / _mip_bessel_i0(beta);
+        w[k] = sinc * window;
+        sum += w[k];
+    }
+
+    for(i32 k = 0; k < _MIP_KAISER_TAPS; k++)
+        weights[k] = (f32) (w[k] / sum);
+}
+
+#define _MIP_ENCODE_TABLE_SIZE 4096
+
+typedef struct _Mip_Decode {
+    f32 u8_table[2][256]; //[is_srgb][value]
+    f32 u8_thresholds[257]; //smallest linear value encoded as each u8 sRGB value. The last is infinity.
+    u8 u8_encode[_MIP_ENCODE_TABLE_SIZE]; //sRGB u8 of the start of each of the equally sized bins of [0, 1]
+} _Mip_Decode;
+
+INTERNAL void _mip_decode_init(_Mip_Decode* decode)
+{
+    for(i32 i = 0; i < 256; i++)
+    {
+        decode->u8_table[0][i] = (f32) i / 255;
+        decode->u8_table[1][i] = mip_srgb_to_linear((f32) i / 255);
+        decode->u8_thresholds[i] = i == 0 ? -INFINITY : mip_srgb_to_linear((i - 0.5f) / 255);
+    }
+    decode->u8_thresholds[256] = INFINITY;
+
+    i32 encoded = 0;
+    for(i32 i = 0; i < _MIP_ENCODE_TABLE_SIZE; i++)
+    {
+        f32 bin_start = (f32) i / _MIP_ENCODE_TABLE_SIZE;
+        while(decode->u8_thresholds[encoded + 1] <= bin_start)
+            encoded += 1;
+        decode->u8_encode[i] = (u8) encoded;
+    }
+}
+
+//Returns the largest i with thresholds[i] <= value which rounds exactly the same as the encode formula. 
+//The table gets within a step or two and the rest is walked.
+INTERNAL u8 _mip_encode_srgb_u8(const _Mip_Decode* decode, f32 value)
+{
+    i32 i = decode->u8_encode[(i32) (value * (_MIP_ENCODE_TABLE_SIZE - 1))];
+    while(decode->u8_thresholds[i + 1] <= value)
+        i += 1;
+    return (u8) i;
+}
+
+//Converts one row of the image into linear f32
+INTERNAL void _mip_decode_row(const _Mip_Decode* decode, f32* out, const u8* row, i32 width, i32 channels, Pixel_Type type, const Mip_Options* options)
+{
+    for(i32 c = 0; c < channels; c++)
+    {
+        bool is_srgb = options->is_srgb && c != options->alpha_channel;
+        if(type == PIXEL_TYPE_U8)
+        {
+            const f32* table = decode->u8_table[is_srgb];
+            for(i32 x = 0; x < width; x++)
+                out[x*channels + c] = table[row[x*channels + c]];
+        }
+        else if(type == PIXEL_TYPE_U16)
+        {
+            for(i32 x = 0; x < width; x++)
+            {
+                u16 value = 0;
+                memcpy(&value, row + (x*channels + c)*sizeof(u16), sizeof value);
+                f32 normalized = (f32) value / UINT16_MAX;
+                out[x*channels + c] = is_srgb ? mip_srgb_to_linear(normalized) : normalized;
+            }
+        }
+        else
+        {
+            for(i32 x = 0; x < width; x++)
+            {
+                f32 value = 0;
+                memcpy(&value, row + (x*channels + c)*sizeof(f32), sizeof value);
+                out[x*channels + c] = is_srgb ? mip_srgb_to_linear(value) : value;
+            }
+        }
+    }
+}
+
+//Converts one row of linear f32 back into the image type. The alpha channel is multiplied by alpha_scale.
+INTERNAL void _mip_encode_row(const _Mip_Decode* decode, u8* row, const f32* in, i32 width, i32 channels, Pixel_Type type, const Mip_Options* options, f32 alpha_scale)
+{
+    for(i32 c = 0; c < channels; c++)
+    {
+        bool is_alpha = c == options->alpha_channel;
+        bool is_srgb = options->is_srgb && is_alpha == false;
+        f32 scale = is_alpha ? alpha_scale : 1;
+        for(i32 x = 0; x < width; x++)
+        {
+            f32 value = in[x*channels + c] * scale;
+            isize at = x*channels + c;
+            if(type == PIXEL_TYPE_U8)
+            {
+                value = CLAMP(value, 0, 1);
+                row[at] = is_srgb ? _mip_encode_srgb_u8(decode, value) : (u8) (value*255 + 0.5f);
+            }
+            else if(type == PIXEL_TYPE_U16)
+            {
+                value = CLAMP(value, 0, 1);
+                if(is_srgb)
+                    value = mip_linear_to_srgb(value);
+                u16 encoded = (u16) (value*UINT16_MAX + 0.5f);
+                memcpy(row + at*sizeof(u16), &encoded, sizeof encoded);
+            }
+            else
+            {
+                if(is_srgb)
+                    value = mip_linear_to_srgb(value);
+                if(is_alpha)
+                    value = MIN(value, 1);
+                memcpy(row + at*sizeof(f32), &value, sizeof value);
+            }
+        }
+    }
+}
+
+//out[i] = a[i]*weight or out[i] += a[i]*weight if accumulate
+INTERNAL void _mip_row_mad(f32* out, const f32* a, f32 weight, isize count, bool accumulate)
+{
+    isize i = 0;
+    #ifdef MIP_CHAIN_SSE2
+    __m128 w = _mm_set1_ps(weight);
+    if(accumulate)
+        for(; i + 4 <= count; i += 4)
+            _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), _mm_mul_ps(_mm_loadu_ps(a + i), w)));
+    else
+        for(; i + 4 <= count; i += 4)
+            _mm_storeu_ps(out + i, _mm_mul_ps(_mm_loadu_ps(a + i), w));
+    #endif
+
+    if(accumulate)
+        for(; i < count; i++)
+            out[i] += a[i]*weight;
+    else
+        for(; i < count; i++)
+            out[i] = a[i]*weight;
+}
+
+//Halves the row (already summed vertically) horizontally: out[x] = (row[2x] + row[2x + 1]) * scale per channel.
+INTERNAL void _mip_box_row(f32* out, const f32* row, i32 width, i32 out_width, i32 channels, f32 scale)
+{
+    i32 x = 0;
+    #ifdef MIP_CHAIN_SSE2
+    if(width >= 2)
+    {
+        __m128 s = _mm_set1_ps(scale);
+        if(channels == 4)
+        {
+            for(; x < out_width; x++)
+            {
+                __m128 a = _mm_loadu_ps(row + 8*x);
+                __m128 b = _mm_loadu_ps(row + 8*x + 4);
+                _mm_storeu_ps(out + 4*x, _mm_mul_ps(_mm_add_ps(a, b), s));
+            }
+        }
+        else if(channels == 2)
+        {
+            for(; x + 2 <= out_width; x += 2)
+            {
+                __m128 a = _mm_loadu_ps(row + 4*x);
+                __m128 b = _mm_loadu_ps(row + 4*x + 4);
+                __m128 even = _mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 0, 1, 0));
+                __m128 odd = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 2, 3, 2));
+                _mm_storeu_ps(out + 2*x, _mm_mul_ps(_mm_add_ps(even, odd), s));
+            }
+        }
+        else if(channels == 1)
+        {
+            for(; x + 4 <= out_width; x += 4)
+            {
+                __m128 a = _mm_loadu_ps(row + 2*x);
+                __m128 b = _mm_loadu_ps(row + 2*x + 4);
+                __m128 even = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+                __m128 odd = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+                _mm_storeu_ps(out + x, _mm_mul_ps(_mm_add_ps(even, odd), s));
+            }
+        }
+    }
+    #endif
+
+    for(; x < out_width; x++)
+    {
+        i32 x0 = MIN(2*x, width - 1);
+        i32 x1 = MIN(2*x + 1, width - 1);
+        for(i32 c = 0; c < channels; c++)
+            out[x*channels + c] = (row[x0*channels + c] + row[x1*channels + c]) * scale;
+    }
+}
+
+INTERNAL void _mip_kaiser_row(f32* out, const f32* row, i32 width, i32 out_width, i32 channels, const f32 weights[_MIP_KAISER_TAPS])
+{
+    for(i32 x = 0; x < out_width; x++)
+    {
+        //Only the borders need clamping
+        i32 first = 2*x - _MIP_KAISER_TAPS/2 + 1;
+        bool is_inside = first >= 0 && first + _MIP_KAISER_TAPS <= width;
+
+        #ifdef MIP_CHAIN_SSE2
+        if(channels == 4)
+        {
+            __m128 sum = _mm_setzero_ps();
+            for(i32 k = 0; k < _MIP_KAISER_TAPS; k++)
+            {
+                i32 at = is_inside ? first + k : CLAMP(first + k, 0, width - 1);
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(row + 4*at), _mm_set1_ps(weights[k])));
+            }
+            _mm_storeu_ps(out + 4*x, sum);
+            continue;
+        }
+        #endif
+
+        for(i32 c = 0; c < channels; c++)
+        {
+            f32 sum = 0;
+            for(i32 k = 0; k < _MIP_KAISER_TAPS; k++)
+            {
+                i32 at = is_inside ? first + k : CLAMP(first + k, 0, width - 1);
+                sum += row[at*channels + c] * weights[k];
+            }
+            out[x*channels + c] = sum;
+        }
+    }
+}
+
+//Filters the linear image src of width x height into dst of half the size.
+INTERNAL void _mip_downsample(f32* dst, const f32* src, f32* temp, i32 width, i32 height, i32 channels, const Mip_Options* options, const f32 weights[_MIP_KAISER_TAPS])
+{
+    i32 out_width = MAX(width / 2, 1);
+    i32 out_height = MAX(height / 2, 1);
+    isize row_size = (isize) width * channels;
+    isize out_row_size = (isize) out_width * channels;
+    for(i32 y = 0; y < out_height; y++)
+    {
+        //Vertical pass into temp then horizontal into the output row
+        if(options->filter == MIP_FILTER_BOX)
+        {
+            i32 y0 = MIN(2*y, height - 1);
+            i32 y1 = MIN(2*y + 1, height - 1);
+            _mip_row_mad(temp, src + y0*row_size, 1, row_size, false);
+            _mip_row_mad(temp, src + y1*row_size, 1, row_size, true);
+            _mip_box_row(dst + y*out_row_size, temp, width, out_width, channels, 0.25f);
+        }
+        else
+        {
+            i32 first = 2*y - _MIP_KAISER_TAPS/2 + 1;
+            for(i32 k = 0; k < _MIP_KAISER_TAPS; k++)
+            {
+                i32 at = CLAMP(first + k, 0, height - 1);
+                _mip_row_mad(temp, src + at*row_size, weights[k], row_size, k > 0);
+            }
+            _mip_kaiser_row(dst + y*out_row_size, temp, width, out_width, channels, weights);
+        }
+    }
+}
+
+INTERNAL void _mip_renormalize(f32* pixels, isize pixel_count, i32 channels)
+{
+    for(isize i = 0; i < pixel_count; i++)
+    {
+        f32* p = pixels + i*channels;
+        f32 x = p[0]*2 - 1;
+        f32 y = p[1]*2 - 1;
+        f32 z = p[2]*2 - 1;
+        f32 len = sqrtf(x*x + y*y + z*z);
+        if(len > 1e-6f)
+        {
+            p[0] = x/len*0.5f + 0.5f;
+            p[1] = y/len*0.5f + 0.5f;
+            p[2] = z/len*0.5f + 0.5f;
+        }
+        else
+        {
+            p[0] = 0.5f;
+            p[1] = 0.5f;
+            p[2] = 1;
+        }
+    }
+}
+
+INTERNAL f32 _mip_alpha_coverage(const f32* pixels, isize pixel_count, i32 channels, i32 alpha_channel, f32 cutoff, f32 scale)
+{
+    isize passed = 0;
+    for(isize i = 0; i < pixel_count; i++)
+        passed += pixels[i*channels + alpha_channel] * scale > cutoff;
+    return (f32) passed / (f32) MAX(pixel_count, 1);
+}
+
+//Finds the scale of alpha whose coverage is closest to the wanted one and among those the one closest to 1.
+//Coverage only grows with the scale so we binary search for where it crosses the wanted one.
+INTERNAL f32 _mip_alpha_scale(const f32* pixels, isize pixel_count, i32 channels, const Mip_Options* options, f32 wanted_coverage)
+{
+    i32 alpha = options->alpha_channel;
+    f32 cutoff = options->alpha_cutoff;
+    f32 coverage = _mip_alpha_coverage(pixels, pixel_count, channels, alpha, cutoff, 1);
+    if(coverage == wanted_coverage)
+        return 1;
+
+    //Low is always below the wanted coverage (or at it when scaling down) and high is above (or at it when scaling up)
+    bool scale_up = coverage < wanted_coverage;
+    f32 low = scale_up ? 1 : 0;
+    f32 high = scale_up ? 4 : 1;
+    for(i32 i = 0; i < 16; i++)
+    {
+        f32 mid = (low + high) / 2;
+        f32 mid_coverage = _mip_alpha_coverage(pixels, pixel_count, channels, alpha, cutoff, mid);
+        if(scale_up ? mid_coverage < wanted_coverage : mid_coverage <= wanted_coverage)
+            low = mid;
+        else
+            high = mid;
+    }
+
+    f32 low_error = fabsf(_mip_alpha_coverage(pixels, pixel_count, channels, alpha, cutoff, low) - wanted_coverage);
+    f32 high_error = fabsf(_mip_alpha_coverage(pixels, pixel_count, channels, alpha, cutoff, high) - wanted_coverage);
+    if(low_error == high_error)
+        return scale_up ? low : high;
+    return low_error < high_error ? low : high;
+}
+
+EXTERNAL void mip_chain_generate(Image* mips, i32 mip_count, Subimage image, const Mip_Options* options, Allocator* alloc)
+{
+    PROFILE_SCOPE()
+    {
+        ASSERT(mip_count > 0 && mip_count <= MIP_CHAIN_MAX_MIPS);
+        ASSERT(image.type == PIXEL_TYPE_U8 || image.type == PIXEL_TYPE_U16 || image.type == PIXEL_TYPE_F32, "unsupported pixel type %s", pixel_type_name(image.type));
+        i32 channels = image.pixel_size / (i32) pixel_type_size(image.type);
+        ASSERT(1 <= channels && channels <= 4);
+        ASSERT(options->alpha_channel < channels && (options->is_normal_map == false || channels >= 3));
+
+        for(i32 i = 0; i < mip_count; i++)
+            image_init_sized(&mips[i], alloc, MAX(image.width >> i, 1), MAX(image.height >> i, 1), image.pixel_size, image.type, NULL);
+        image_copy(&mips[0], image, 0, 0);
+
+        if(mip_count > 1)
+        {
+            _Mip_Decode decode = {0};
+            _mip_decode_init(&decode);
+            f32 weights[_MIP_KAISER_TAPS] = {0};
+            _mip_kaiser_weights(weights);
+
+            //The linear images of the current and the next mip and one row of temp. 
+            //They take turns so the second one only needs to fit the second mip.
+            isize size = (isize) image.width * image.height * channels;
+            isize next_size = (isize) MAX(image.width / 2, 1) * MAX(image.height / 2, 1) * channels;
+            Mip_Chain_Buffer buffer = {alloc};
+            array_resize_for_overwrite(&buffer, size + next_size + (isize) image.width*channels);
+            f32* curr = buffer.data;
+            f32* next = buffer.data + size;
+            f32* temp = buffer.data + size + next_size;
+
+            isize stride = image_byte_stride(mips[0]);
+            for(i32 y = 0; y < image.height; y++)
+                _mip_decode_row(&decode, curr + (isize) y*image.width*channels, mips[0].pixels + y*stride, image.width, channels, image.type, options);
+
+            bool preserve_coverage = options->alpha_channel != -1 && options->alpha_cutoff > 0;
+            f32 coverage = 0;
+            if(preserve_coverage)
+                coverage = _mip_alpha_coverage(curr, (isize) image.width*image.height, channels, options->alpha_channel, options->alpha_cutoff, 1);
+
+            i32 width = image.width;
+            i32 height = image.height;
+            for(i32 i = 1; i < mip_count; i++)
+            {
+                _mip_downsample(next, curr, temp, width, height, channels, options, weights);
+                width = MAX(width / 2, 1);
+                height = MAX(height / 2, 1);
+                isize pixel_count = (isize) width*height;
+                if(options->is_normal_map)
+                    _mip_renormalize(next, pixel_count, channels);
+
+                //The scaled alpha is only stored. The next mip is filtered from the unscaled one.
+                f32 alpha_scale = 1;
+                if(preserve_coverage)
+                    alpha_scale = _mip_alpha_scale(next, pixel_count, channels, options, coverage);
+
+                isize out_stride = image_byte_stride(mips[i]);
+                for(i32 y = 0; y < height; y++)
+                    _mip_encode_row(&decode, mips[i].pixels + y*out_stride, next + (isize) y*width*channels, width, channels, image.type, options, alpha_scale);
+
+                f32* swap = curr;
+                curr = next;
+                next = swap;
+            }
+
+            array_deinit(&buffer);
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,225 @@
+#ifndef LIB_PARALLEL
+#define LIB_PARALLEL
+
+// A very simple fork-join "parallel for" over a range of indices.
+//
+// The range [0, count) is split into batches of batch_size items. The calling thread
+// together with a fixed set of persistent worker threads grabs batches by atomically
+// incrementing a shared cursor until none remain. The call returns only after all
+// batches were processed. Thus from the callers point of view parallel_for behaves
+// exactly like an ordinary for loop, just faster.
+//
+// We dont attempt anything fancy (work stealing, job graphs, priorities). The renderer and
+// the asset pipeline only ever need to spread one big homogeneous loop across cores
+// and then continue on the calling thread. This covers exactly that and nothing more.
+//
+// Each invocation of func also receives thread_index in range [0, parallel_thread_count())
+// which is unique among the threads running concurrently. This can be used to index into
+// per thread scratch storage without any synchronization. The calling thread always has index 0.
+//
+// If parallel_init was not called, or parallel_for is called from within another parallel_for
+// (or concurrently from two threads) it simply runs everything serially on the calling thread.
+
+#include "lib/platform.h"
+#include "lib/sync.h"
+#include "lib/assert.h"
+#include "lib/log.h"
+#include "lib/profile.h"
+
+typedef void (*Parallel_Func)(void* context, isize from, isize to, isize thread_index);
+
+//Launches the worker threads. If thread_count_or_minus_one is -1 uses the number of processors.
+//The count includes the calling thread so parallel_init(1) launches no workers.
+EXTERNAL void parallel_init(isize thread_count_or_minus_one);
+EXTERNAL isize parallel_thread_count();
+
+//Calls func on all batches covering [0, count) using all availible threads.
+//Returns once all batches are processed.
+EXTERNAL void parallel_for(isize count, isize batch_size, Parallel_Func func, void* context);
+
+//Returns a batch size that splits count into roughly batches_per_thread batches for each thread
+// but not into batches smaller than min_batch_size.
+EXTERNAL isize parallel_batch_size(isize count, isize batches_per_thread, isize min_batch_size);
+
+#endif
+
+#if (defined(LIB_ALL_IMPL) || defined(LIB_PARALLEL_IMPL)) && !defined(LIB_PARALLEL_HAS_IMPL)
+#define LIB_PARALLEL_HAS_IMPL
+
+#define PARALLEL_ATOMIC(T) _Atomic(T)
+#define PARALLEL_MAX_THREADS 256
+
+typedef struct _Parallel_Job {
+    Parallel_Func func;
+    void* context;
+    isize count;
+    isize batch_size;
+    PARALLEL_ATOMIC(isize) next_from;
+} _Parallel_Job;
+
+typedef struct _Parallel_Pool {
+    _Parallel_Job* job;
+    isize thread_count;
+
+    PARALLEL_ATOMIC(uint32_t) generation;   //incremented each time a new job is published
+    PARALLEL_ATOMIC(uint32_t) running;      //number of workers that have not yet finished the current job
+    PARALLEL_ATOMIC(uint32_t) busy;         //1 while some thread is inside parallel_for
+    PARALLEL_ATOMIC(uint32_t) launched;     //number of workers that are already running
+} _Parallel_Pool;
+
+static _Parallel_Pool _parallel_pool = {0};
+static _Thread_local bool _parallel_is_inside_job = false;
+static _Thread_local isize _parallel_thread_index = 0;
+
+INTERNAL void _parallel_job_execute(_Parallel_Job* job, isize thread_index)
+{
+    _parallel_is_inside_job = true;
+    for(;;)
+    {
+        isize from = atomic_fetch_add_explicit(&job->next_from, job->batch_size, memory_order_relaxed);
+        if(from >= job->count)
+            break;
+
+        isize to = MIN(from + job->batch_size, job->count);
+        job->func(job->context, from, to, thread_index);
+    }
+    _parallel_is_inside_job = false;
+}
+
+INTERNAL int _parallel_worker_func(void* context)
+{
+    _Parallel_Pool* pool = &_parallel_pool;
+    isize thread_index = (isize) context;
+    _parallel_thread_index = thread_index;
+    uint32_t seen_generation = atomic_load_explicit(&pool->generation, memory_order_acquire);
+    atomic_fetch_add_explicit(&pool->launched, 1, memory_order_release);
+    platform_futex_wake_all(&pool->launched);
+
+    for(;;)
+    {
+        //Wait for new job
+        uint32_t generation = 0;
+        for(;;)
+        {
+            generation = atomic_load_explicit(&pool->generation, memory_order_acquire);
+            if(generation != seen_generation)
+                break;
+            platform_futex_wait(&pool->generation, seen_generation, -1);
+        }
+        seen_generation = generation;
+
+        _parallel_job_execute(pool->job, thread_index);
+
+        //Last one out wakes up the thread waiting inside parallel_for
+        if(atomic_fetch_sub_explicit(&pool->running, 1, memory_order_acq_rel) == 1)
+            platform_futex_wake_all(&pool->running);
+    }
+
+    return 0;
+}
+
+EXTERNAL void parallel_init(isize thread_count_or_minus_one)
+{
+    _Parallel_Pool* pool = &_parallel_pool;
+    ASSERT(pool->thread_count == 0, "parallel_init must be called at most once!");
+
+    isize thread_count = thread_count_or_minus_one;
+    if(thread_count <= 0)
+        thread_count = platform_thread_get_proccessor_count();
+    thread_count = CLAMP(thread_count, 1, PARALLEL_MAX_THREADS);
+
+    //Workers are indexed from 1. The thread calling parallel_for is always 0.
+    isize launched = 1;
+    for(isize i = 1; i < thread_count; i++)
+    {
+        Platform_Thread thread = {0};
+        Platform_Error error = platform_thread_launch(&thread, 0, _parallel_worker_func, (void*) i);
+        if(error)
+        {
+            LOG_ERROR("parallel", "Failed to launch worker thread #%lli. Continuing with %lli threads.", (lli) i, (lli) launched);
+            break;
+        }
+
+        platform_thread_detach(&thread);
+        launched += 1;
+    }
+
+    //Wait for all workers to start so that they all observe the first generation
+    for(;;)
+    {
+        uint32_t running = atomic_load_explicit(&pool->launched, memory_order_acquire);
+        if(running == (uint32_t) launched - 1)
+            break;
+        platform_futex_wait(&pool->launched, running, -1);
+    }
+
+    pool->thread_count = launched;
+    LOG_INFO("parallel", "Initialized with %lli threads", (lli) launched);
+}
+
+EXTERNAL isize parallel_thread_count()
+{
+    return MAX(_parallel_pool.thread_count, 1);
+}
+
+EXTERNAL isize parallel_batch_size(isize count, isize batches_per_thread, isize min_batch_size)
+{
+    isize batch_count = parallel_thread_count() * MAX(batches_per_thread, 1);
+    isize batch_size = (count + batch_count - 1) / batch_count;
+    return MAX(batch_size, MAX(min_batch_size, 1));
+}
+
+EXTERNAL void parallel_for(isize count, isize batch_size, Parallel_Func func, void* context)
+{
+    if(count <= 0)
+        return;
+
+    ASSERT(func != NULL);
+    batch_size = MAX(batch_size, 1);
+
+    _Parallel_Pool* pool = &_parallel_pool;
+    uint32_t not_busy = 0;
+    bool go_serial = pool->thread_count <= 1
+        || count <= batch_size
+        || _parallel_is_inside_job
+        || atomic_compare_exchange_strong(&pool->busy, &not_busy, 1) == false;
+
+    if(go_serial)
+    {
+        //Keep the thread index of the enclosing job (if any) so that per thread storage stays exclusive
+        func(context, 0, count, _parallel_thread_index);
+        return;
+    }
+
+    PROFILE_SCOPE()
+    {
+        _Parallel_Job job = {0};
+        job.func = func;
+        job.context = context;
+        job.count = count;
+        job.batch_size = batch_size;
+        atomic_store_explicit(&job.next_from, 0, memory_order_relaxed);
+
+        //Publish the job and wake all workers
+        pool->job = &job;
+        atomic_store_explicit(&pool->running, (uint32_t) pool->thread_count - 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&pool->generation, 1, memory_order_release);
+        platform_futex_wake_all(&pool->generation);
+
+        _parallel_job_execute(&job, 0);
+
+        //Wait for all workers to finish. (They can still be processing their last batch.)
+        for(;;)
+        {
+            uint32_t running = atomic_load_explicit(&pool->running, memory_order_acquire);
+            if(running == 0)
+                break;
+            platform_futex_wait(&pool->running, running, -1);
+        }
+
+        pool->job = NULL;
+        atomic_store_explicit(&pool->busy, 0, memory_order_release);
+    }
+}
+
+#endif
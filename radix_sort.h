@@ -0,0 +1,214 @@
+#ifndef LIB_RADIX_SORT
+#define LIB_RADIX_SORT
+
+// Stable LSD radix sort of (key, index) pairs by the 64 bit key.
+//
+// The keys are sorted one byte at a time from the least significant. Each pass counts the
+// occurances of each byte value, turns the counts into offsets and scatters the items into
+// the other buffer. Passes over bytes that are the same for all keys are skipped entirely,
+// so keys that only use few of their bits (as is common for packed sort keys) sort
+// in proportionally fewer passes.
+//
+// The parallel version splits the items into blocks. Each block is histogrammed
+// on its own and the offsets are assigned in block order for each byte value, so the
+// scatter of each block can run independently and the sort stays stable.
+
+#include "parallel.h"
+
+typedef struct Radix_Sort_Pair {
+    u64 key;
+    isize index;
+} Radix_Sort_Pair;
+
+//Sorts items by key. temp must have space for count items. The result is in items.
+EXTERNAL void radix_sort_pairs(Radix_Sort_Pair* items, Radix_Sort_Pair* temp, isize count);
+
+//Same as radix_sort_pairs but uses all threads of parallel.h.
+//For small counts simply calls radix_sort_pairs.
+EXTERNAL void radix_sort_pairs_parallel(Radix_Sort_Pair* items, Radix_Sort_Pair* temp, isize count);
+
+#endif
+
+#if (defined(LIB_ALL_IMPL) || defined(LIB_RADIX_SORT_IMPL)) && !defined(LIB_RADIX_SORT_HAS_IMPL)
+#define LIB_RADIX_SORT_HAS_IMPL
+
+#define RADIX_SORT_PASSES 8
+#define RADIX_SORT_BUCKETS 256
+#define RADIX_SORT_PARALLEL_MIN_COUNT (64*1024)
+#define RADIX_SORT_PARALLEL_MIN_BLOCK (16*1024)
+
+//Returns true if all items share the same byte value so the pass would do nothing.
+INTERNAL bool _radix_sort_is_pass_trivial(const isize* histogram, isize count)
+{
+    for(isize i = 0; i < RADIX_SORT_BUCKETS; i++)
+        if(histogram[i] != 0)
+            return histogram[i] == count;
+
+    return true;
+}
+
+EXTERNAL void radix_sort_pairs(Radix_Sort_Pair* items, Radix_Sort_Pair* temp, isize count)
+{
+    PROFILE_SCOPE()
+    {
+        //Histograms of all passes at once in a single read of the data
+        isize histograms[RADIX_SORT_PASSES][RADIX_SORT_BUCKETS] = {0};
+        for(isize i = 0; i < count; i++)
+        {
+            u64 key = items[i].key;
+            for(isize pass = 0; pass < RADIX_SORT_PASSES; pass++)
+                histograms[pass][(key >> (pass*8)) & 0xFF] += 1;
+        }
+
+        Radix_Sort_Pair* from = items;
+        Radix_Sort_Pair* to = temp;
+        for(isize pass = 0; pass < RADIX_SORT_PASSES; pass++)
+        {
+            isize* histogram = histograms[pass];
+            if(_radix_sort_is_pass_trivial(histogram, count))
+                continue;
+
+            isize offsets[RADIX_SORT_BUCKETS] = {0};
+            for(isize i = 0, sum = 0; i < RADIX_SORT_BUCKETS; i++)
+            {
+                offsets[i] = sum;
+                sum += histogram[i];
+            }
+
+            u32 shift = (u32) pass*8;
+            for(isize i = 0; i < count; i++)
+            {
+                Radix_Sort_Pair item = from[i];
+                to[offsets[(item.key >> shift) & 0xFF]++] = item;
+            }
+
+            SWAP(&from, &to);
+        }
+
+        if(from != items)
+            memcpy(items, from, (size_t) count * sizeof *items);
+    }
+}
+
+typedef struct _Radix_Sort_Parallel_Context {
+    Radix_Sort_Pair* from;
+    Radix_Sort_Pair* to;
+    isize count;
+    isize block_size;
+    isize* block_histograms; //[block_count][RADIX_SORT_PASSES][RADIX_SORT_BUCKETS]
+    isize* block_offsets;    //[block_count][RADIX_SORT_BUCKETS]
+    u32 shift;
+    u32 _;
+} _Radix_Sort_Parallel_Context;
+
+INTERNAL void _radix_sort_parallel_histogram_all(void* context, isize block_from, isize block_to, isize thread_index)
+{
+    (void) thread_index;
+    _Radix_Sort_Parallel_Context* c = (_Radix_Sort_Parallel_Context*) context;
+    for(isize block = block_from; block < block_to; block++)
+    {
+        isize* histograms = c->block_histograms + block*RADIX_SORT_PASSES*RADIX_SORT_BUCKETS;
+        isize to = MIN((block + 1)*c->block_size, c->count);
+        for(isize i = block*c->block_size; i < to; i++)
+        {
+            u64 key = c->from[i].key;
+            for(isize pass = 0; pass < RADIX_SORT_PASSES; pass++)
+                histograms[pass*RADIX_SORT_BUCKETS + ((key >> (pass*8)) & 0xFF)] += 1;
+        }
+    }
+}
+
+INTERNAL void _radix_sort_parallel_histogram_pass(void* context, isize block_from, isize block_to, isize thread_index)
+{
+    (void) thread_index;
+    _Radix_Sort_Parallel_Context* c = (_Radix_Sort_Parallel_Context*) context;
+    for(isize block = block_from; block < block_to; block++)
+    {
+        isize* histogram = c->block_offsets + block*RADIX_SORT_BUCKETS;
+        memset(histogram, 0, RADIX_SORT_BUCKETS * sizeof *histogram);
+
+        isize to = MIN((block + 1)*c->block_size, c->count);
+        for(isize i = block*c->block_size; i < to; i++)
+            histogram[(c->from[i].key >> c->shift) & 0xFF] += 1;
+    }
+}
+
+INTERNAL void _radix_sort_parallel_scatter(void* context, isize block_from, isize block_to, isize thread_index)
+{
+    (void) thread_index;
+    _Radix_Sort_Parallel_Context* c = (_Radix_Sort_Parallel_Context*) context;
+    for(isize block = block_from; block < block_to; block++)
+    {
+        isize* offsets = c->block_offsets + block*RADIX_SORT_BUCKETS;
+        isize to = MIN((block + 1)*c->block_size, c->count);
+        for(isize i = block*c->block_size; i < to; i++)
+        {
+            Radix_Sort_Pair item = c->from[i];
+            c->to[offsets[(item.key >> c->shift) & 0xFF]++] = item;
+        }
+    }
+}
+
+EXTERNAL void radix_sort_pairs_parallel(Radix_Sort_Pair* items, Radix_Sort_Pair* temp, isize count)
+{
+    isize thread_count = parallel_thread_count();
+    if(thread_count <= 1 || count < RADIX_SORT_PARALLEL_MIN_COUNT)
+    {
+        radix_sort_pairs(items, temp, count);
+        return;
+    }
+
+    PROFILE_SCOPE()
+    SCRATCH_ARENA(arena)
+    {
+        _Radix_Sort_Parallel_Context c = {0};
+        c.from = items;
+        c.to = temp;
+        c.count = count;
+        c.block_size = parallel_batch_size(count, 2, RADIX_SORT_PARALLEL_MIN_BLOCK);
+        isize block_count = (count + c.block_size - 1) / c.block_size;
+
+        isize_Array block_histograms = {arena.alloc};
+        isize_Array block_offsets = {arena.alloc};
+        array_resize(&block_histograms, block_count*RADIX_SORT_PASSES*RADIX_SORT_BUCKETS);
+        array_resize(&block_offsets, block_count*RADIX_SORT_BUCKETS);
+        c.block_histograms = block_histograms.data;
+        c.block_offsets = block_offsets.data;
+
+        //Total histograms are only needed to know which passes to skip
+        parallel_for(block_count, 1, _radix_sort_parallel_histogram_all, &c);
+        isize histograms[RADIX_SORT_PASSES][RADIX_SORT_BUCKETS] = {0};
+        for(isize block = 0; block < block_count; block++)
+            for(isize i = 0; i < RADIX_SORT_PASSES*RADIX_SORT_BUCKETS; i++)
+                histograms[i / RADIX_SORT_BUCKETS][i % RADIX_SORT_BUCKETS] += block_histograms.data[block*RADIX_SORT_PASSES*RADIX_SORT_BUCKETS + i];
+
+        for(isize pass = 0; pass < RADIX_SORT_PASSES; pass++)
+        {
+            if(_radix_sort_is_pass_trivial(histograms[pass], count))
+                continue;
+
+            //The blocks are rearranged after every pass so the per block counts have to be redone
+            c.shift = (u32) pass*8;
+            parallel_for(block_count, 1, _radix_sort_parallel_histogram_pass, &c);
+
+            //Turn counts into offsets. For each byte value the blocks come one after another.
+            isize sum = 0;
+            for(isize bucket = 0; bucket < RADIX_SORT_BUCKETS; bucket++)
+                for(isize block = 0; block < block_count; block++)
+                {
+                    isize* slot = &block_offsets.data[block*RADIX_SORT_BUCKETS + bucket];
+                    isize block_bucket_count = *slot;
+                    *slot = sum;
+                    sum += block_bucket_count;
+                }
+
+            parallel_for(block_count, 1, _radix_sort_parallel_scatter, &c);
+            SWAP(&c.from, &c.to);
+        }
+
+        if(c.from != items)
+            memcpy(items, c.from, (size_t) count * sizeof *items);
+    }
+}
+
+#endif
@@ -22,6 +22,11 @@ layout(std140) uniform Environment {
     float gamma;
     int   lights_count;
 
+    //The light clusters: tiles_x, tiles_y, slices, unused
+    ivec4 cluster_size;
+    //near, far, viewport width, viewport height
+    vec4  cluster_depth_and_viewport;
+
     Light lights[MAX_LIGHTS];
 } env;
 
@@ -36,16 +41,28 @@ struct Params_Data {
     int map_specular; 
     int map_normal; 
     int map_ambient; 
+    int map_min_mips; //finest resident mip of each map, 8 bits each in the order above
 
-    //mat3x2 map_diffuse_transform;
-    //mat3x2 map_specular_transform;
-    //mat3x2 map_normal_transform;
+    //Where in the layer each map is: offset.xy, scale.zw
+    vec4 map_diffuse_uv;
+    vec4 map_specular_uv;
+    vec4 map_normal_uv;
+    vec4 map_ambient_uv;
 };
 
 layout(std430, binding = 0) buffer Params {
     Params_Data params[];  
 };
 
+//Offset and count into light_indices of each cluster. See light_cluster.h
+layout(std430, binding = 2) buffer Light_Ranges {
+    uvec2 light_ranges[];  
+};
+
+layout(std430, binding = 3) buffer Light_Indices {
+    uint light_indices[];  
+};
+
 uniform sampler2DArray u_map_resolutions[MAX_RESOULTIONS];
 
 struct Map {
@@ -71,16 +88,30 @@ Map map_decode(int map)
         flat int batch_index;
     } _in;
 
-    vec4 map_sample(Map map)
+    //The map can be only a part of the layer (atlas) so we wrap the uv ourselves. 
+    //The gradients are of the unwrapped uv so that there are no mip seams where it wraps.
+    //Mips finer than min_mip are not resident (streamed out) so the gradients are scaled up to never select them.
+    vec4 map_sample(Map map, vec4 uv_transform, int min_mip)
     {
-        return texture(u_map_resolutions[map.resolution - 1], vec3(_in.uv.xy, map.layer));
+        vec2 uv = fract(_in.uv.xy)*uv_transform.zw + uv_transform.xy;
+        vec2 uv_dx = dFdx(_in.uv.xy)*uv_transform.zw;
+        vec2 uv_dy = dFdy(_in.uv.xy)*uv_transform.zw;
+        if(min_mip > 0)
+        {
+            vec2 size = vec2(textureSize(u_map_resolutions[map.resolution - 1], 0).xy);
+            float lod = log2(max(length(uv_dx*size), length(uv_dy*size)));
+            float scale = exp2(max(float(min_mip) - lod, 0.0));
+            uv_dx *= scale;
+            uv_dy *= scale;
+        }
+        return textureGrad(u_map_resolutions[map.resolution - 1], vec3(uv, map.layer), uv_dx, uv_dy);
     }
 
-    vec4 map_sample_or(int map, vec4 if_not_found)
+    vec4 map_sample_or(int map, vec4 uv_transform, int min_mip, vec4 if_not_found)
     {
         Map map_ = map_decode(map);
         if(map_.resolution > 0)
-            return map_sample(map_);
+            return map_sample(map_, uv_transform, min_mip);
         else
             return if_not_found;
     }
@@ -98,9 +129,9 @@ Map map_decode(int map)
 
         Params_Data param = params[bi];
 
-        vec3  diffuse_color = map_sample_or(param.map_diffuse, param.diffuse_color).xyz;
-        vec3  specular_color = map_sample_or(param.map_specular, param.specular_color).xyz;
-        vec3  ambient_color = map_sample_or(param.map_ambient, param.ambient_color).xyz;
+        vec3  diffuse_color = map_sample_or(param.map_diffuse, param.map_diffuse_uv, param.map_min_mips & 0xFF, param.diffuse_color).xyz;
+        vec3  specular_color = map_sample_or(param.map_specular, param.map_specular_uv, (param.map_min_mips >> 8) & 0xFF, param.specular_color).xyz;
+        vec3  ambient_color = map_sample_or(param.map_ambient, param.map_ambient_uv, (param.map_min_mips >> 24) & 0xFF, param.ambient_color).xyz;
 
         float metallic = sqrt(param.metallic); //to better follow the intuitive linearity of this parameter
         float specular_exponent = param.specular_exponent;
@@ -115,8 +146,20 @@ Map map_decode(int map)
         vec3 normal = normalize(_in.norm);
         vec3 view_dir = normalize(env.view_pos.xyz - _in.frag_pos);
 
-        for(int i = 0; i < env.lights_count; i++)
+        //Only the lights assigned to the cluster of this pixel can reach it. 
+        //Same slicing as light_cluster_slice_of_depth()
+        float near = env.cluster_depth_and_viewport.x;
+        float far = env.cluster_depth_and_viewport.y;
+        float depth = -(env.view * vec4(_in.frag_pos, 1)).z;
+        float slice_f = log(max(depth, near) / near) / log(far / near) * float(env.cluster_size.z);
+        ivec2 tile = ivec2(gl_FragCoord.xy / env.cluster_depth_and_viewport.zw * vec2(env.cluster_size.xy));
+        tile = clamp(tile, ivec2(0), env.cluster_size.xy - 1);
+        int slice = clamp(int(slice_f), 0, env.cluster_size.z - 1);
+        uvec2 range = light_ranges[tile.x + env.cluster_size.x*(tile.y + env.cluster_size.y*slice)];
+
+        for(uint k = range.x; k < range.x + range.y; k++)
         {
+            int i = int(light_indices[k]);
             float light_range = env.lights[i].pos_and_range.w;
             vec3 light_pos = env.lights[i].pos_and_range.xyz;
             vec3 light_color = env.lights[i].color_and_radius.xyz;
@@ -171,6 +214,13 @@ Map map_decode(int map)
     layout (location = 2) in vec3 a_norm;
     layout (location = 3) in vec3 a_tan;
     layout (location = 4) in mat4 a_model;
+
+    //Set when the geometry uses Packed_Vertex. Then the normals and tangents
+    // are octahedral encoded in a_norm.xy and a_tan.xy.
+    uniform bool u_packed_vertices;
+
+    //Index of the first draw of this multi draw within the per draw buffer.
+    uniform int u_draw_offset;
     
     out VS_OUT { 
         vec3 frag_pos;
@@ -187,6 +237,16 @@ Map map_decode(int map)
             vec4(0.0, 0.0, 1.0, 0.0),
             vec4(delta, 1.0));
     }
+
+    vec3 oct_decode(vec2 e)
+    {
+        vec3 v = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+        float t = max(-v.z, 0.0);
+        v.x += v.x >= 0.0 ? -t : t;
+        v.y += v.y >= 0.0 ? -t : t;
+        return normalize(v);
+    }
+
     void main()
     {
         vec4 fragment_pos = a_model * vec4(a_pos, 1.0);
@@ -196,8 +256,8 @@ Map map_decode(int map)
         
         _out.frag_pos = fragment_pos.xyz;
         _out.uv = a_uv;
-        _out.norm = a_norm;
-        _out.batch_index = gl_DrawID;
+        _out.norm = u_packed_vertices ? oct_decode(a_norm.xy) : a_norm;
+        _out.batch_index = gl_DrawID + u_draw_offset;
 
         gl_Position = world_pos;
     } 
@@ -0,0 +1,945 @@
+#ifndef LIB_TEXTURE_COMPRESS
+#define LIB_TEXTURE_COMPRESS
+
+// Block compression of textures into BC1, BC3, BC4, BC5 and BC7 on the cpu.
+//
+// All of these formats split the image into 4x4 pixel blocks each compressed on its own into
+// a fixed number of bytes. The gpu decodes them when sampling so they stay compressed in
+// video memory: 4 bits per pixel for BC1 and BC4 and 8 bits for the rest, compared to 8 - 32
+// bits of uncompressed U8 textures. Each block stores two endpoints and for every pixel an index
+// of a point on the line between them:
+//  BC1 - RGB. Endpoints are 565 colors with 4 points on the line (2 bit indices).
+//  BC4 - a single channel. Endpoints are 8 bit with 8 points (3 bit indices).
+//  BC3 - BC1 for RGB followed by BC4 for alpha.
+//  BC5 - two BC4 blocks. Used for the X and Y of normal maps.
+//  BC7 - RGBA. We only emit mode 6: 7777 endpoints each with an extra shared low bit (p-bit)
+//        and 16 points (4 bit indices). The other modes split the block into several lines
+//        which helps blocks with many distinct colors but they are far more costly to search.
+//
+// The line is fit through the pixels of the block along their principal axis (power iteration
+// on the covariance) and its endpoints are then refined by least squares once the indices are
+// known. The error minimized is the plain sum of squared differences of the encoded values.
+//
+// Compressed mips are kept as Images of blocks: each "pixel" is one block (type U8 with
+// pixel_size of the block size in bytes) so they can be copied around with the usual image
+// functions. Partial blocks at the right and bottom edge are filled by clamping to the edge.
+//
+// Nothing here touches opengl so it can be used and tested without a context.
+
+#include "lib/image.h"
+#include "asset_descriptions.h"
+#include "parallel.h"
+
+//If 0 color maps use BC1 (or BC3 with alpha) which encodes ~10x faster at visibly lower quality.
+#ifndef TEXTURE_COMPRESS_COLOR_BC7
+    #define TEXTURE_COMPRESS_COLOR_BC7 1
+#endif
+
+typedef enum Texture_Block_Format {
+    TEXTURE_BLOCK_NONE = 0, //uncompressed
+    TEXTURE_BLOCK_BC1,
+    TEXTURE_BLOCK_BC3,
+    TEXTURE_BLOCK_BC4,
+    TEXTURE_BLOCK_BC5,
+    TEXTURE_BLOCK_BC7,
+    TEXTURE_BLOCK_FORMAT_COUNT,
+} Texture_Block_Format;
+
+//Size of a single 4x4 block in bytes. 0 for TEXTURE_BLOCK_NONE.
+EXTERNAL i32 texture_block_size(Texture_Block_Format format);
+//Number of channels the format stores (and the gpu returns).
+EXTERNAL i32 texture_block_channel_count(Texture_Block_Format format);
+EXTERNAL const char* texture_block_format_name(Texture_Block_Format format);
+//Size in bytes of a width x height image in the given format.
+EXTERNAL isize texture_blocks_size(Texture_Block_Format format, i32 width, i32 height);
+
+//Chooses the format for a map of the given type with channel_count channels.
+//Normal maps get BC5, scalar maps BC4 (of the first channel) and colors BC7 (or BC1/BC3).
+EXTERNAL Texture_Block_Format texture_block_format_from_map(Map_Type type, i32 channel_count);
+
+//Compresses a U8 image with 1 to 4 channels into an image of blocks allocated from alloc.
+//Missing color channels are read as 0 and missing alpha as 255. BC4 encodes the first channel
+// and BC5 the first two. The blocks are spread across the parallel.h threads.
+EXTERNAL void texture_compress(Image* blocks, Subimage image, Texture_Block_Format format, Allocator* alloc);
+
+//Decompresses blocks of a width x height image into a U8 image with texture_block_channel_count
+// channels allocated from alloc. Only the BC7 mode 6 is supported.
+EXTERNAL void texture_decompress(Image* image, Subimage blocks, i32 width, i32 height, Texture_Block_Format format, Allocator* alloc);
+
+//Returns the blocks of a width x height image extended to to_width x to_height pixels.
+//The remainder is filled by repeating the last pixel column and row the same way as render_image_extend
+// does for uncompressed images. Only the edge blocks are decoded and encoded again.
+EXTERNAL Image texture_blocks_extend(Allocator* alloc, Subimage blocks, Texture_Block_Format format, i32 width, i32 height, i32 to_width, i32 to_height);
+
+//Peak signal to noise ratio in dB between the first channel_count channels of two U8 images
+// of the same size. Infinite if they are equal.
+EXTERNAL f64 texture_psnr(Subimage a, Subimage b, i32 channel_count);
+
+#endif
+
+#if (defined(LIB_ALL_IMPL) || defined(LIB_TEXTURE_COMPRESS_IMPL)) && !defined(LIB_TEXTURE_COMPRESS_HAS_IMPL)
+#define LIB_TEXTURE_COMPRESS_HAS_IMPL
+
+EXTERNAL i32 texture_block_size(Texture_Block_Format format)
+{
+    switch(format)
+    {
+        case TEXTURE_BLOCK_BC1: return 8;
+        case TEXTURE_BLOCK_BC4: return 8;
+        case TEXTURE_BLOCK_BC3: return 16;
+        case TEXTURE_BLOCK_BC5: return 16;
+        case TEXTURE_BLOCK_BC7: return 16;
+        default: return 0;
+    }
+}
+
+EXTERNAL i32 texture_block_channel_count(Texture_Block_Format format)
+{
+    switch(format)
+    {
+        case TEXTURE_BLOCK_BC1: return 3;
+        case TEXTURE_BLOCK_BC4: return 1;
+        case TEXTURE_BLOCK_BC5: return 2;
+        case TEXTURE_BLOCK_BC3: return 4;
+        case TEXTURE_BLOCK_BC7: return 4;
+        default: return 0;
+    }
+}
+
+EXTERNAL const char* texture_block_format_name(Texture_Block_Format format)
+{
+    switch(format)
+    {
+        case TEXTURE_BLOCK_NONE: return "none";
+        case TEXTURE_BLOCK_BC1: return "BC1";
+        case TEXTURE_BLOCK_BC3: return "BC3";
+        case TEXTURE_BLOCK_BC4: return "BC4";
+        case TEXTURE_BLOCK_BC5: return "BC5";
+        case TEXTURE_BLOCK_BC7: return "BC7";
+        default: return "invalid";
+    }
+}
+
+EXTERNAL isize texture_blocks_size(Texture_Block_Format format, i32 width, i32 height)
+{
+    return (isize) ((width + 3) / 4) * ((height + 3) / 4) * texture_block_size(format);
+}
+
+EXTERNAL Texture_Block_Format texture_block_format_from_map(Map_Type type, i32 channel_count)
+{
+    switch(type)
+    {
+        case MAP_TYPE_NORMAL:
+            return channel_count >= 2 ? TEXTURE_BLOCK_BC5 : TEXTURE_BLOCK_BC4;
+
+        case MAP_TYPE_ROUGNESS:
+        case MAP_TYPE_AMBIENT_OCCLUSION:
+        case MAP_TYPE_METALLIC:
+        case MAP_TYPE_SPECULAR_HIGHLIGHT:
+        case MAP_TYPE_ALPHA:
+        case MAP_TYPE_BUMP:
+        case MAP_TYPE_DISPLACEMENT:
+        case MAP_TYPE_STENCIL:
+            return TEXTURE_BLOCK_BC4;
+
+        default: {
+            if(channel_count <= 1)
+                return TEXTURE_BLOCK_BC4;
+            if(channel_count == 2)
+                return TEXTURE_BLOCK_BC5;
+            if(TEXTURE_COMPRESS_COLOR_BC7)
+                return TEXTURE_BLOCK_BC7;
+            return channel_count == 4 ? TEXTURE_BLOCK_BC3 : TEXTURE_BLOCK_BC1;
+        }
+    }
+}
+
+//The pixels of a single block, always as RGBA.
+typedef u8 _Texture_Block_Pixels[16][4];
+
+INTERNAL i32 _texture_square(i32 x)
+{
+    return x*x;
+}
+
+//================================ BC4 ================================
+//Palette of the 8 values a BC4 block can represent. With a0 > a1 it has 6 points between
+// them. Otherwise only 4 and the extremes 0 and 255.
+INTERNAL void _bc4_palette(u8 palette[8], i32 a0, i32 a1)
+{
+    palette[0] = (u8) a0;
+    palette[1] = (u8) a1;
+    if(a0 > a1)
+    {
+        for(i32 i = 1; i <= 6; i++)
+            palette[i + 1] = (u8) (((7 - i)*a0 + i*a1 + 3) / 7);
+    }
+    else
+    {
+        for(i32 i = 1; i <= 4; i++)
+            palette[i + 1] = (u8) (((5 - i)*a0 + i*a1 + 2) / 5);
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+}
+
+//Picks the nearest palette entry for each value. Returns the squared error.
+INTERNAL i32 _bc4_indices(const u8 values[16], i32 a0, i32 a1, u8 indices[16])
+{
+    u8 palette[8] = {0};
+    _bc4_palette(palette, a0, a1);
+    i32 error = 0;
+    for(i32 i = 0; i < 16; i++)
+    {
+        i32 best = 0;
+        i32 best_error = INT32_MAX;
+        for(i32 k = 0; k < 8; k++)
+        {
+            i32 e = _texture_square((i32) values[i] - palette[k]);
+            if(e < best_error)
+            {
+                best_error = e;
+                best = k;
+            }
+        }
+        indices[i] = (u8) best;
+        error += best_error;
+    }
+    return error;
+}
+
+INTERNAL void _bc4_encode(const u8 values[16], u8 out[8])
+{
+    //Besides the full range we try the range without the extremes 0 and 255 which
+    // the second mode gives for free. Helps blocks of mostly mid values with some black or white.
+    i32 lo = 255, hi = 0, inner_lo = 255, inner_hi = 0;
+    for(i32 i = 0; i < 16; i++)
+    {
+        lo = MIN(lo, values[i]);
+        hi = MAX(hi, values[i]);
+        if(values[i] != 0 && values[i] != 255)
+        {
+            inner_lo = MIN(inner_lo, values[i]);
+            inner_hi = MAX(inner_hi, values[i]);
+        }
+    }
+
+    u8 indices[16] = {0};
+    i32 a0 = hi, a1 = lo;
+    i32 error = 0;
+    if(hi == lo)
+        memset(indices, 0, sizeof indices);
+    else
+    {
+        error = _bc4_indices(values, hi, lo, indices);
+        if(inner_lo <= inner_hi && (inner_lo != lo || inner_hi != hi))
+        {
+            u8 inner_indices[16] = {0};
+            i32 inner_error = _bc4_indices(values, inner_lo, inner_hi, inner_indices);
+            if(inner_error < error)
+            {
+                a0 = inner_lo;
+                a1 = inner_hi;
+                memcpy(indices, inner_indices, sizeof indices);
+            }
+        }
+    }
+
+    u64 bits = 0;
+    for(i32 i = 0; i < 16; i++)
+        bits |= (u64) indices[i] << (3*i);
+
+    out[0] = (u8) a0;
+    out[1] = (u8) a1;
+    for(i32 i = 0; i < 6; i++)
+        out[2 + i] = (u8) (bits >> (8*i));
+}
+
+INTERNAL void _bc4_decode(const u8 block[8], u8 values[16])
+{
+    u8 palette[8] = {0};
+    _bc4_palette(palette, block[0], block[1]);
+    u64 bits = 0;
+    for(i32 i = 0; i < 6; i++)
+        bits |= (u64) block[2 + i] << (8*i);
+    for(i32 i = 0; i < 16; i++)
+        values[i] = palette[(bits >> (3*i)) & 7];
+}
+
+//============================ Line fitting ============================
+//Fits a line through the points along their principal axis.
+//Returns the points with the lowest and highest projection onto it as the endpoints.
+INTERNAL void _texture_fit_line(const f32 points[16][4], i32 channels, f32 e0[4], f32 e1[4])
+{
+    f32 mean[4] = {0};
+    for(i32 i = 0; i < 16; i++)
+        for(i32 c = 0; c < channels; c++)
+            mean[c] += points[i][c] / 16;
+
+    f32 covariance[4][4] = {0};
+    for(i32 i = 0; i < 16; i++)
+        for(i32 a = 0; a < channels; a++)
+            for(i32 b = 0; b < channels; b++)
+                covariance[a][b] += (points[i][a] - mean[a]) * (points[i][b] - mean[b]);
+
+    //Power iteration. Starting from the diagonal of the bounding box converges quickly for the
+    // usual blocks and never starts orthogonal to a single dominant channel.
+    f32 axis[4] = {0};
+    for(i32 c = 0; c < channels; c++)
+    {
+        f32 lo = points[0][c], hi = points[0][c];
+        for(i32 i = 1; i < 16; i++)
+        {
+            lo = MIN(lo, points[i][c]);
+            hi = MAX(hi, points[i][c]);
+        }
+        axis[c] = hi - lo + 1e-3f;
+    }
+
+    for(i32 iter = 0; iter < 8; iter++)
+    {
+        f32 next[4] = {0};
+        f32 len = 0;
+        for(i32 a = 0; a < channels; a++)
+        {
+            for(i32 b = 0; b < channels; b++)
+                next[a] += covariance[a][b] * axis[b];
+            len = MAX(len, fabsf(next[a]));
+        }
+
+        if(len < 1e-6f)
+            break;
+        for(i32 c = 0; c < channels; c++)
+            axis[c] = next[c] / len;
+    }
+
+    i32 min_i = 0, max_i = 0;
+    f32 min_t = INFINITY, max_t = -INFINITY;
+    for(i32 i = 0; i < 16; i++)
+    {
+        f32 t = 0;
+        for(i32 c = 0; c < channels; c++)
+            t += (points[i][c] - mean[c]) * axis[c];
+        if(t < min_t) { min_t = t; min_i = i; }
+        if(t > max_t) { max_t = t; max_i = i; }
+    }
+
+    for(i32 c = 0; c < 4; c++)
+    {
+        e0[c] = points[min_i][c];
+        e1[c] = points[max_i][c];
+    }
+}
+
+//Least squares endpoints for points[i] = e0*(1 - weights[i]) + e1*weights[i].
+//Returns false if all weights are the same and the endpoints cannot be determined.
+INTERNAL bool _texture_fit_endpoints(const f32 points[16][4], const f32 weights[16], i32 channels, f32 e0[4], f32 e1[4])
+{
+    f32 a00 = 0, a01 = 0, a11 = 0;
+    f32 b0[4] = {0};
+    f32 b1[4] = {0};
+    for(i32 i = 0; i < 16; i++)
+    {
+        f32 beta = weights[i];
+        f32 alpha = 1 - beta;
+        a00 += alpha*alpha;
+        a01 += alpha*beta;
+        a11 += beta*beta;
+        for(i32 c = 0; c < channels; c++)
+        {
+            b0[c] += alpha*points[i][c];
+            b1[c] += beta*points[i][c];
+        }
+    }
+
+    f32 det = a00*a11 - a01*a01;
+    if(fabsf(det) < 1e-6f)
+        return false;
+
+    for(i32 c = 0; c < channels; c++)
+    {
+        e0[c] = (a11*b0[c] - a01*b1[c]) / det;
+        e1[c] = (a00*b1[c] - a01*b0[c]) / det;
+    }
+    return true;
+}
+
+INTERNAL f32 _texture_clamp(f32 value, f32 lo, f32 hi)
+{
+    return value < lo ? lo : value > hi ? hi : value;
+}
+
+//================================ BC1 ================================
+INTERNAL u16 _bc1_pack565(const f32 color[4])
+{
+    u32 r = (u32) (_texture_clamp(color[0], 0, 255) * 31 / 255 + 0.5f);
+    u32 g = (u32) (_texture_clamp(color[1], 0, 255) * 63 / 255 + 0.5f);
+    u32 b = (u32) (_texture_clamp(color[2], 0, 255) * 31 / 255 + 0.5f);
+    return (u16) (r << 11 | g << 5 | b);
+}
+
+INTERNAL void _bc1_unpack565(u16 packed, i32 color[3])
+{
+    i32 r = packed >> 11 & 31;
+    i32 g = packed >> 5 & 63;
+    i32 b = packed & 31;
+    color[0] = r << 3 | r >> 2;
+    color[1] = g << 2 | g >> 4;
+    color[2] = b << 3 | b >> 2;
+}
+
+INTERNAL void _bc1_palette(u16 c0, u16 c1, bool allow_three_color, i32 palette[4][4])
+{
+    _bc1_unpack565(c0, palette[0]);
+    _bc1_unpack565(c1, palette[1]);
+    for(i32 c = 0; c < 3; c++)
+    {
+        if(c0 > c1 || allow_three_color == false)
+        {
+            palette[2][c] = (2*palette[0][c] + palette[1][c] + 1) / 3;
+            palette[3][c] = (palette[0][c] + 2*palette[1][c] + 1) / 3;
+        }
+        else
+        {
+            palette[2][c] = (palette[0][c] + palette[1][c] + 1) / 2;
+            palette[3][c] = 0;
+        }
+    }
+
+    for(i32 i = 0; i < 4; i++)
+        palette[i][3] = 255;
+    if(c0 <= c1 && allow_three_color)
+        palette[3][3] = 0;
+}
+
+//Always the 4 color mode. The 3 color one would make BC1 alpha punch through which we dont want.
+INTERNAL i32 _bc1_indices(const f32 points[16][4], u16 c0, u16 c1, u8 indices[16])
+{
+    i32 palette[4][4] = {0};
+    _bc1_palette(c0, c1, false, palette);
+    i32 error = 0;
+    for(i32 i = 0; i < 16; i++)
+    {
+        i32 best = 0;
+        i32 best_error = INT32_MAX;
+        for(i32 k = 0; k < 4; k++)
+        {
+            i32 e = 0;
+            for(i32 c = 0; c < 3; c++)
+                e += _texture_square((i32) points[i][c] - palette[k][c]);
+            if(e < best_error)
+            {
+                best_error = e;
+                best = k;
+            }
+        }
+        indices[i] = (u8) best;
+        error += best_error;
+    }
+    return error;
+}
+
+INTERNAL void _bc1_encode(const _Texture_Block_Pixels pixels, u8 out[8])
+{
+    f32 points[16][4] = {0};
+    for(i32 i = 0; i < 16; i++)
+        for(i32 c = 0; c < 4; c++)
+            points[i][c] = pixels[i][c];
+
+    f32 e0[4] = {0};
+    f32 e1[4] = {0};
+    _texture_fit_line(points, 3, e0, e1);
+
+    //Point k of the palette lies at this fraction from c0 to c1
+    const f32 index_weights[4] = {0, 1, 1.0f/3, 2.0f/3};
+    u16 best_c0 = _bc1_pack565(e1);
+    u16 best_c1 = _bc1_pack565(e0);
+    u8 best_indices[16] = {0};
+    i32 best_error = _bc1_indices(points, best_c0, best_c1, best_indices);
+    for(i32 iter = 0; iter < 2 && best_error > 0; iter++)
+    {
+        f32 weights[16] = {0};
+        for(i32 i = 0; i < 16; i++)
+            weights[i] = index_weights[best_indices[i]];
+
+        f32 f0[4] = {0};
+        f32 f1[4] = {0};
+        if(_texture_fit_endpoints(points, weights, 3, f0, f1) == false)
+            break;
+
+        u8 indices[16] = {0};
+        u16 c0 = _bc1_pack565(f0);
+        u16 c1 = _bc1_pack565(f1);
+        i32 error = _bc1_indices(points, c0, c1, indices);
+        if(error >= best_error)
+            break;
+
+        best_error = error;
+        best_c0 = c0;
+        best_c1 = c1;
+        memcpy(best_indices, indices, sizeof indices);
+    }
+
+    //The 4 color mode needs c0 > c1. Swapping the endpoints swaps the points 0 <-> 1 and 2 <-> 3.
+    //If they are equal all pixels are c0 which is the same in both modes.
+    if(best_c0 < best_c1)
+    {
+        u16 temp = best_c0;
+        best_c0 = best_c1;
+        best_c1 = temp;
+        for(i32 i = 0; i < 16; i++)
+            best_indices[i] ^= 1;
+    }
+    else if(best_c0 == best_c1)
+        memset(best_indices, 0, sizeof best_indices);
+
+    u32 bits = 0;
+    for(i32 i = 0; i < 16; i++)
+        bits |= (u32) best_indices[i] << (2*i);
+
+    out[0] = (u8) best_c0;
+    out[1] = (u8) (best_c0 >> 8);
+    out[2] = (u8) best_c1;
+    out[3] = (u8) (best_c1 >> 8);
+    for(i32 i = 0; i < 4; i++)
+        out[4 + i] = (u8) (bits >> (8*i));
+}
+
+INTERNAL void _bc1_decode(const u8 block[8], bool allow_three_color, _Texture_Block_Pixels pixels)
+{
+    u16 c0 = (u16) (block[0] | block[1] << 8);
+    u16 c1 = (u16) (block[2] | block[3] << 8);
+    u32 bits = (u32) block[4] | (u32) block[5] << 8 | (u32) block[6] << 16 | (u32) block[7] << 24;
+
+    i32 palette[4][4] = {0};
+    _bc1_palette(c0, c1, allow_three_color, palette);
+    for(i32 i = 0; i < 16; i++)
+        for(i32 c = 0; c < 4; c++)
+            pixels[i][c] = (u8) palette[(bits >> (2*i)) & 3][c];
+}
+
+//================================ BC7 ================================
+//Only mode 6: 1 subset, RGBA 7 bit endpoints + 1 p-bit each, 4 bit indices.
+static const i32 _bc7_weights[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+typedef struct _BC7_Endpoint {
+    u8 values[4]; //7 bits each
+    u8 p_bit;
+} _BC7_Endpoint;
+
+INTERNAL void _bc7_endpoint_color(_BC7_Endpoint endpoint, i32 color[4])
+{
+    for(i32 c = 0; c < 4; c++)
+        color[c] = endpoint.values[c] << 1 | endpoint.p_bit;
+}
+
+//Quantizes with the p-bit that gives the lower error.
+INTERNAL _BC7_Endpoint _bc7_quantize(const f32 color[4])
+{
+    _BC7_Endpoint best = {0};
+    f32 best_error = INFINITY;
+    for(u8 p = 0; p < 2; p++)
+    {
+        _BC7_Endpoint endpoint = {0};
+        endpoint.p_bit = p;
+        f32 error = 0;
+        for(i32 c = 0; c < 4; c++)
+        {
+            f32 q = floorf((_texture_clamp(color[c], 0, 255) - p) / 2 + 0.5f);
+            endpoint.values[c] = (u8) _texture_clamp(q, 0, 127);
+            f32 diff = (f32) (endpoint.values[c] << 1 | p) - color[c];
+            error += diff*diff;
+        }
+
+        if(error < best_error)
+        {
+            best_error = error;
+            best = endpoint;
+        }
+    }
+    return best;
+}
+
+INTERNAL i32 _bc7_indices(const f32 points[16][4], _BC7_Endpoint e0, _BC7_Endpoint e1, u8 indices[16])
+{
+    i32 c0[4] = {0};
+    i32 c1[4] = {0};
+    _bc7_endpoint_color(e0, c0);
+    _bc7_endpoint_color(e1, c1);
+
+    i32 palette[16][4] = {0};
+    for(i32 k = 0; k < 16; k++)
+        for(i32 c = 0; c < 4; c++)
+            palette[k][c] = ((64 - _bc7_weights[k])*c0[c] + _bc7_weights[k]*c1[c] + 32) >> 6;
+
+    //Project onto the line to guess the index, then check the neighbours exactly
+    f32 dir[4] = {0};
+    f32 dir_len2 = 0;
+    for(i32 c = 0; c < 4; c++)
+    {
+        dir[c] = (f32) (c1[c] - c0[c]);
+        dir_len2 += dir[c]*dir[c];
+    }
+
+    i32 error = 0;
+    for(i32 i = 0; i < 16; i++)
+    {
+        i32 guess = 0;
+        if(dir_len2 > 0)
+        {
+            f32 t = 0;
+            for(i32 c = 0; c < 4; c++)
+                t += (points[i][c] - (f32) c0[c]) * dir[c];
+            t = _texture_clamp(t / dir_len2, 0, 1);
+            guess = (i32) (t*15 + 0.5f);
+        }
+
+        i32 best = guess;
+        i32 best_error = INT32_MAX;
+        for(i32 k = MAX(guess - 1, 0); k <= MIN(guess + 1, 15); k++)
+        {
+            i32 e = 0;
+            for(i32 c = 0; c < 4; c++)
+                e += _texture_square((i32) points[i][c] - palette[k][c]);
+            if(e < best_error)
+            {
+                best_error = e;
+                best = k;
+            }
+        }
+        indices[i] = (u8) best;
+        error += best_error;
+    }
+    return error;
+}
+
+typedef struct _BC7_Bit_Writer {
+    u64 words[2];
+    i32 at;
+    u32 _;
+} _BC7_Bit_Writer;
+
+INTERNAL void _bc7_write(_BC7_Bit_Writer* writer, u32 value, i32 bits)
+{
+    for(i32 i = 0; i < bits; i++, writer->at++)
+        writer->words[writer->at / 64] |= (u64) (value >> i & 1) << (writer->at % 64);
+}
+
+INTERNAL u32 _bc7_read(const u8 block[16], i32* at, i32 bits)
+{
+    u32 value = 0;
+    for(i32 i = 0; i < bits; i++, *at += 1)
+        value |= (u32) (block[*at / 8] >> (*at % 8) & 1) << i;
+    return value;
+}
+
+INTERNAL void _bc7_encode(const _Texture_Block_Pixels pixels, u8 out[16])
+{
+    f32 points[16][4] = {0};
+    for(i32 i = 0; i < 16; i++)
+        for(i32 c = 0; c < 4; c++)
+            points[i][c] = pixels[i][c];
+
+    f32 f0[4] = {0};
+    f32 f1[4] = {0};
+    _texture_fit_line(points, 4, f0, f1);
+
+    _BC7_Endpoint best_e0 = _bc7_quantize(f0);
+    _BC7_Endpoint best_e1 = _bc7_quantize(f1);
+    u8 best_indices[16] = {0};
+    i32 best_error = _bc7_indices(points, best_e0, best_e1, best_indices);
+    for(i32 iter = 0; iter < 2 && best_error > 0; iter++)
+    {
+        f32 weights[16] = {0};
+        for(i32 i = 0; i < 16; i++)
+            weights[i] = (f32) _bc7_weights[best_indices[i]] / 64;
+
+        if(_texture_fit_endpoints(points, weights, 4, f0, f1) == false)
+            break;
+
+        u8 indices[16] = {0};
+        _BC7_Endpoint e0 = _bc7_quantize(f0);
+        _BC7_Endpoint e1 = _bc7_quantize(f1);
+        i32 error = _bc7_indices(points, e0, e1, indices);
+        if(error >= best_error)
+            break;
+
+        best_error = error;
+        best_e0 = e0;
+        best_e1 = e1;
+        memcpy(best_indices, indices, sizeof indices);
+    }
+
+    //The highest bit of the first index is implied zero. Swapping the endpoints flips the indices.
+    if(best_indices[0] & 8)
+    {
+        _BC7_Endpoint temp = best_e0;
+        best_e0 = best_e1;
+        best_e1 = temp;
+        for(i32 i = 0; i < 16; i++)
+            best_indices[i] = (u8) (15 - best_indices[i]);
+    }
+
+    _BC7_Bit_Writer writer = {0};
+    _bc7_write(&writer, 1 << 6, 7); //mode 6
+    for(i32 c = 0; c < 4; c++)
+    {
+        _bc7_write(&writer, best_e0.values[c], 7);
+        _bc7_write(&writer, best_e1.values[c], 7);
+    }
+    _bc7_write(&writer, best_e0.p_bit, 1);
+    _bc7_write(&writer, best_e1.p_bit, 1);
+    for(i32 i = 0; i < 16; i++)
+        _bc7_write(&writer, best_indices[i], i == 0 ? 3 : 4);
+
+    ASSERT(writer.at == 128);
+    for(i32 i = 0; i < 16; i++)
+        out[i] = (u8) (writer.words[i / 8] >> (8*(i % 8)));
+}
+
+INTERNAL void _bc7_decode(const u8 block[16], _Texture_Block_Pixels pixels)
+{
+    i32 at = 0;
+    u32 mode = _bc7_read(block, &at, 7);
+    ASSERT(mode == 1 << 6, "only BC7 mode 6 is supported");
+
+    _BC7_Endpoint e0 = {0};
+    _BC7_Endpoint e1 = {0};
+    for(i32 c = 0; c < 4; c++)
+    {
+        e0.values[c] = (u8) _bc7_read(block, &at, 7);
+        e1.values[c] = (u8) _bc7_read(block, &at, 7);
+    }
+    e0.p_bit = (u8) _bc7_read(block, &at, 1);
+    e1.p_bit = (u8) _bc7_read(block, &at, 1);
+
+    i32 c0[4] = {0};
+    i32 c1[4] = {0};
+    _bc7_endpoint_color(e0, c0);
+    _bc7_endpoint_color(e1, c1);
+    for(i32 i = 0; i < 16; i++)
+    {
+        i32 w = _bc7_weights[_bc7_read(block, &at, i == 0 ? 3 : 4)];
+        for(i32 c = 0; c < 4; c++)
+            pixels[i][c] = (u8) (((64 - w)*c0[c] + w*c1[c] + 32) >> 6);
+    }
+}
+
+//============================== Blocks ==============================
+INTERNAL void _texture_encode_block(Texture_Block_Format format, const _Texture_Block_Pixels pixels, u8* out)
+{
+    u8 channel[2][16] = {0};
+    for(i32 i = 0; i < 16; i++)
+    {
+        channel[0][i] = pixels[i][0];
+        channel[1][i] = pixels[i][1];
+    }
+
+    u8 alpha[16] = {0};
+    for(i32 i = 0; i < 16; i++)
+        alpha[i] = pixels[i][3];
+
+    switch(format)
+    {
+        case TEXTURE_BLOCK_BC1: _bc1_encode(pixels, out); break;
+        case TEXTURE_BLOCK_BC3: _bc4_encode(alpha, out); _bc1_encode(pixels, out + 8); break;
+        case TEXTURE_BLOCK_BC4: _bc4_encode(channel[0], out); break;
+        case TEXTURE_BLOCK_BC5: _bc4_encode(channel[0], out); _bc4_encode(channel[1], out + 8); break;
+        case TEXTURE_BLOCK_BC7: _bc7_encode(pixels, out); break;
+        default: ASSERT(false, "invalid format %i", (int) format); break;
+    }
+}
+
+//Decodes into RGBA. Channels the format does not store are 0 (alpha 255).
+INTERNAL void _texture_decode_block(Texture_Block_Format format, const u8* block, _Texture_Block_Pixels pixels)
+{
+    memset(pixels, 0, sizeof(_Texture_Block_Pixels));
+    for(i32 i = 0; i < 16; i++)
+        pixels[i][3] = 255;
+
+    u8 values[16] = {0};
+    switch(format)
+    {
+        case TEXTURE_BLOCK_BC1: _bc1_decode(block, true, pixels); break;
+        case TEXTURE_BLOCK_BC3: {
+            _bc1_decode(block + 8, false, pixels);
+            _bc4_decode(block, values);
+            for(i32 i = 0; i < 16; i++)
+                pixels[i][3] = values[i];
+        } break;
+        case TEXTURE_BLOCK_BC4: {
+            _bc4_decode(block, values);
+            for(i32 i = 0; i < 16; i++)
+                pixels[i][0] = values[i];
+        } break;
+        case TEXTURE_BLOCK_BC5: {
+            _bc4_decode(block, values);
+            for(i32 i = 0; i < 16; i++)
+                pixels[i][0] = values[i];
+            _bc4_decode(block + 8, values);
+            for(i32 i = 0; i < 16; i++)
+                pixels[i][1] = values[i];
+        } break;
+        case TEXTURE_BLOCK_BC7: _bc7_decode(block, pixels); break;
+        default: ASSERT(false, "invalid format %i", (int) format); break;
+    }
+}
+
+typedef struct _Texture_Compress_Context {
+    const Image* image;
+    Image* blocks;
+    Texture_Block_Format format;
+    i32 channels;
+} _Texture_Compress_Context;
+
+INTERNAL void _texture_compress_rows(void* context, isize from, isize to, isize thread_index)
+{
+    (void) thread_index;
+    _Texture_Compress_Context* c = (_Texture_Compress_Context*) context;
+    const Image* image = c->image;
+    isize stride = image_byte_stride(*image);
+    isize block_stride = image_byte_stride(*c->blocks);
+    i32 block_size = c->blocks->pixel_size;
+    for(isize by = from; by < to; by++)
+    {
+        for(i32 bx = 0; bx < c->blocks->width; bx++)
+        {
+            _Texture_Block_Pixels pixels = {0};
+            for(i32 i = 0; i < 16; i++)
+            {
+                i32 x = MIN(bx*4 + i % 4, image->width - 1);
+                i32 y = MIN((i32) by*4 + i / 4, image->height - 1);
+                const u8* pixel = image->pixels + y*stride + (isize) x*c->channels;
+                for(i32 k = 0; k < c->channels; k++)
+                    pixels[i][k] = pixel[k];
+                if(c->channels < 4)
+                    pixels[i][3] = 255;
+            }
+
+            _texture_encode_block(c->format, (const u8 (*)[4]) pixels, c->blocks->pixels + by*block_stride + (isize) bx*block_size);
+        }
+    }
+}
+
+EXTERNAL void texture_compress(Image* blocks, Subimage image, Texture_Block_Format format, Allocator* alloc)
+{
+    PROFILE_SCOPE()
+    {
+        ASSERT(image.type == PIXEL_TYPE_U8, "unsupported pixel type %s", pixel_type_name(image.type));
+        ASSERT(1 <= image.pixel_size && image.pixel_size <= 4);
+        ASSERT(texture_block_size(format) > 0);
+
+        Image contiguous = image_from_subimage(image, alloc);
+        image_init_sized(blocks, alloc, (image.width + 3) / 4, (image.height + 3) / 4, texture_block_size(format), PIXEL_TYPE_U8, NULL);
+
+        _Texture_Compress_Context context = {&contiguous, blocks, format, image.pixel_size};
+        parallel_for(blocks->height, parallel_batch_size(blocks->height, 8, 1), _texture_compress_rows, &context);
+        image_deinit(&contiguous);
+    }
+}
+
+EXTERNAL void texture_decompress(Image* image, Subimage blocks, i32 width, i32 height, Texture_Block_Format format, Allocator* alloc)
+{
+    ASSERT(blocks.width == (width + 3) / 4 && blocks.height == (height + 3) / 4 && blocks.pixel_size == texture_block_size(format));
+    i32 channels = texture_block_channel_count(format);
+    Image contiguous = image_from_subimage(blocks, alloc);
+    image_init_sized(image, alloc, width, height, channels, PIXEL_TYPE_U8, NULL);
+
+    isize stride = image_byte_stride(*image);
+    isize block_stride = image_byte_stride(contiguous);
+    for(i32 by = 0; by < contiguous.height; by++)
+        for(i32 bx = 0; bx < contiguous.width; bx++)
+        {
+            _Texture_Block_Pixels pixels = {0};
+            _texture_decode_block(format, contiguous.pixels + by*block_stride + (isize) bx*contiguous.pixel_size, pixels);
+            for(i32 i = 0; i < 16; i++)
+            {
+                i32 x = bx*4 + i % 4;
+                i32 y = by*4 + i / 4;
+                if(x < width && y < height)
+                    memcpy(image->pixels + y*stride + (isize) x*channels, pixels[i], (size_t) channels);
+            }
+        }
+
+    image_deinit(&contiguous);
+}
+
+EXTERNAL Image texture_blocks_extend(Allocator* alloc, Subimage blocks, Texture_Block_Format format, i32 width, i32 height, i32 to_width, i32 to_height)
+{
+    ASSERT(0 < width && width <= to_width && 0 < height && height <= to_height);
+    ASSERT(blocks.width == (width + 3) / 4 && blocks.height == (height + 3) / 4 && blocks.pixel_size == texture_block_size(format));
+
+    Image out = {0};
+    image_init_sized(&out, alloc, (to_width + 3) / 4, (to_height + 3) / 4, blocks.pixel_size, PIXEL_TYPE_U8, NULL);
+    image_copy(&out, blocks, 0, 0);
+
+    isize stride = image_byte_stride(out);
+    i32 block_size = out.pixel_size;
+    i32 last_x = (width - 1) % 4;
+    i32 last_y = (height - 1) % 4;
+
+    //Extend sideways. The partial edge blocks were already clamped when compressing so only
+    // whole blocks are added. All of them in one block row are the same.
+    if(out.width > blocks.width)
+        for(i32 by = 0; by < blocks.height; by++)
+        {
+            u8* row = out.pixels + by*stride;
+            _Texture_Block_Pixels edge = {0};
+            _Texture_Block_Pixels extended = {0};
+            _texture_decode_block(format, row + (isize) (blocks.width - 1)*block_size, edge);
+            for(i32 i = 0; i < 16; i++)
+                memcpy(extended[i], edge[i / 4 * 4 + last_x], 4);
+
+            u8* first = row + (isize) blocks.width*block_size;
+            _texture_encode_block(format, (const u8 (*)[4]) extended, first);
+            for(i32 bx = blocks.width + 1; bx < out.width; bx++)
+                memcpy(row + (isize) bx*block_size, first, (size_t) block_size);
+        }
+
+    //Extend downwards including the corner
+    if(out.height > blocks.height)
+    {
+        u8* last_row = out.pixels + (blocks.height - 1)*stride;
+        u8* first_row = out.pixels + blocks.height*stride;
+        for(i32 bx = 0; bx < out.width; bx++)
+        {
+            _Texture_Block_Pixels edge = {0};
+            _Texture_Block_Pixels extended = {0};
+            _texture_decode_block(format, last_row + (isize) bx*block_size, edge);
+            for(i32 i = 0; i < 16; i++)
+                memcpy(extended[i], edge[last_y*4 + i % 4], 4);
+            _texture_encode_block(format, (const u8 (*)[4]) extended, first_row + (isize) bx*block_size);
+        }
+
+        for(i32 by = blocks.height + 1; by < out.height; by++)
+            memcpy(out.pixels + by*stride, first_row, (size_t) stride);
+    }
+
+    return out;
+}
+
+EXTERNAL f64 texture_psnr(Subimage a, Subimage b, i32 channel_count)
+{
+    ASSERT(a.width == b.width && a.height == b.height && a.type == PIXEL_TYPE_U8 && b.type == PIXEL_TYPE_U8);
+    ASSERT(channel_count <= a.pixel_size && channel_count <= b.pixel_size);
+
+    f64 error = 0;
+    SCRATCH_ARENA(arena)
+    {
+        Image ca = image_from_subimage(a, arena.alloc);
+        Image cb = image_from_subimage(b, arena.alloc);
+        for(i32 y = 0; y < ca.height; y++)
+        {
+            const u8* row_a = ca.pixels + y*image_byte_stride(ca);
+            const u8* row_b = cb.pixels + y*image_byte_stride(cb);
+            for(i32 x = 0; x < ca.width; x++)
+                for(i32 c = 0; c < channel_count; c++)
+                    error += _texture_square((i32) row_a[x*ca.pixel_size + c] - row_b[x*cb.pixel_size + c]);
+        }
+    }
+
+    f64 mse = error / ((f64) a.width * a.height * channel_count);
+    return mse == 0 ? INFINITY : 10 * log10(255.0*255.0 / mse);
+}
+
+#endif
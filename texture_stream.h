@@ -0,0 +1,410 @@
+#ifndef LIB_TEXTURE_STREAM
+#define LIB_TEXTURE_STREAM
+
+// Decides which mips of each texture are resident under a memory budget (texture streaming).
+//
+// The mips of a texture are numbered from 0 (full resolution) to mip_count - 1. The resident mips
+// are always the contiguous range [resident_mip, mip_count) so there is always something to sample.
+// The tail - mips whose larger dimension is at most TEXTURE_STREAM_TAIL_DIM - is resident from the
+// start and never evicted. It is small and is all that distant textures need.
+//
+// Each frame the renderer reports the footprint of every texture it draws, that is the size in
+// pixels the texture covers on screen. The wanted mip is the one with about one texel per pixel.
+// texture_stream_update then issues loads for textures whose wanted mip is finer than the resident
+// one. Loads go one mip at a time from coarse to fine, the blurriest textures first. The memory of
+// a load is counted as soon as it is issued so the budget holds even with loads in flight.
+// When a load does not fit into the budget mips are evicted: first mips finer than wanted and then
+// the finest mips of the least recently used textures. Nothing drawn this frame is evicted below
+// its wanted mip. If there is still no space the load waits.
+//
+// Nothing here does io or touches gl. The caller carries out the events and calls texture_stream_loaded
+// once a load is done, possibly many frames later. Thus the policy can be tested in isolation by
+// replaying recorded traces of what the renderer did (see Texture_Stream_Trace).
+
+#include "lib/array.h"
+
+#define TEXTURE_STREAM_TAIL_DIM 128
+
+typedef struct Texture_Stream_Texture {
+    i32 width;
+    i32 height;
+    i32 mip_count;
+    i32 bits_per_pixel;     //4 for some compressed formats so not bytes
+    i32 tail_mip;           //the first mip of the always resident tail
+    i32 resident_mip;       //the finest resident mip
+    i32 loading_mip;        //-1 if not loading
+    i32 wanted_mip;         //as of last_used_frame
+    f32 footprint;          //the largest footprint reported in last_used_frame
+    b32 is_alive;
+    i64 last_used_frame;    //-1 if never used
+} Texture_Stream_Texture;
+
+typedef enum Texture_Stream_Event_Type {
+    TEXTURE_STREAM_LOAD = 1,   //load the mip. Call texture_stream_loaded once done
+    TEXTURE_STREAM_EVICT = 2,  //the mip is no longer resident and must not be sampled
+} Texture_Stream_Event_Type;
+
+typedef struct Texture_Stream_Event {
+    i32 type;
+    i32 texture;
+    i32 mip;
+} Texture_Stream_Event;
+
+typedef enum Texture_Stream_Trace_Type {
+    TEXTURE_STREAM_TRACE_ADD = 1,
+    TEXTURE_STREAM_TRACE_REMOVE = 2,
+    TEXTURE_STREAM_TRACE_REPORT = 3,
+} Texture_Stream_Trace_Type;
+
+//One call made to the stream. Replaying these reproduces the same decisions.
+typedef struct Texture_Stream_Trace_Entry {
+    i64 frame;
+    i32 type;
+    i32 texture;
+    i32 width;
+    i32 height;
+    i32 mip_count;
+    i32 bits_per_pixel;
+    f32 footprint;
+    u32 _;
+} Texture_Stream_Trace_Entry;
+
+typedef struct Texture_Stream_Stats {
+    isize loads;
+    isize evictions;
+    isize loaded_bytes;
+    isize evicted_bytes;
+    isize waited_loads; //loads postponed because no memory could be freed
+    isize failed_loads;
+    isize max_memory_used;
+} Texture_Stream_Stats;
+
+typedef struct _Texture_Stream_Candidate {
+    i32 texture;
+    i32 priority;
+    f32 footprint;
+    u32 _;
+    i64 last_used_frame;
+} _Texture_Stream_Candidate;
+
+typedef Array(Texture_Stream_Texture) Texture_Stream_Texture_Array;
+typedef Array(Texture_Stream_Event) Texture_Stream_Event_Array;
+typedef Array(Texture_Stream_Trace_Entry) Texture_Stream_Trace;
+typedef Array(_Texture_Stream_Candidate) _Texture_Stream_Candidate_Array;
+
+typedef struct Texture_Stream {
+    Texture_Stream_Texture_Array textures;
+    i32_Array free_slots;
+    _Texture_Stream_Candidate_Array loads;
+    _Texture_Stream_Candidate_Array victims;
+    Texture_Stream_Trace* trace; //if not NULL all calls are recorded into it
+
+    isize memory_budget;
+    isize memory_used;  //resident and loading mips
+    isize loads_in_flight;
+    isize max_loads_in_flight;
+    i64 frame;
+    Texture_Stream_Stats stats;
+} Texture_Stream;
+
+EXTERNAL void texture_stream_init(Texture_Stream* stream, Allocator* allocator, isize memory_budget, isize max_loads_in_flight);
+EXTERNAL void texture_stream_deinit(Texture_Stream* stream);
+
+//Adds a texture with only its tail resident. Returns its index.
+//The tails are counted into memory_used but are not limited by the budget.
+EXTERNAL i32 texture_stream_add(Texture_Stream* stream, i32 width, i32 height, i32 mip_count, i32 bits_per_pixel);
+//Releases all memory of the texture. If it is loading the index is reused only after texture_stream_loaded.
+EXTERNAL void texture_stream_remove(Texture_Stream* stream, i32 texture);
+
+//Starts a new frame. Reports from now on belong to it.
+EXTERNAL void texture_stream_begin_frame(Texture_Stream* stream);
+//The texture is drawn this frame covering footprint pixels on screen (along its larger dimension).
+EXTERNAL void texture_stream_report(Texture_Stream* stream, i32 texture, f32 footprint);
+//Appends the loads and evictions that should happen this frame to events.
+EXTERNAL void texture_stream_update(Texture_Stream* stream, Texture_Stream_Event_Array* events);
+//The mip issued by TEXTURE_STREAM_LOAD is ready.
+EXTERNAL void texture_stream_loaded(Texture_Stream* stream, i32 texture, i32 mip);
+//The mip issued by TEXTURE_STREAM_LOAD could not be loaded. It stays non resident and its memory 
+// is released so the load is issued again once it is wanted and fits.
+EXTERNAL void texture_stream_load_failed(Texture_Stream* stream, i32 texture, i32 mip);
+
+EXTERNAL isize texture_stream_mip_size(const Texture_Stream_Texture* texture, i32 mip);
+EXTERNAL i32 texture_stream_wanted_mip(const Texture_Stream_Texture* texture, f32 footprint);
+EXTERNAL i32 texture_stream_tail_mip(i32 width, i32 height, i32 mip_count);
+
+#endif
+
+#if (defined(LIB_ALL_IMPL) || defined(LIB_TEXTURE_STREAM_IMPL)) && !defined(LIB_TEXTURE_STREAM_HAS_IMPL)
+#define LIB_TEXTURE_STREAM_HAS_IMPL
+
+#include <stdlib.h>
+#include <math.h>
+
+EXTERNAL void texture_stream_init(Texture_Stream* stream, Allocator* allocator, isize memory_budget, isize max_loads_in_flight)
+{
+    memset(stream, 0, sizeof *stream);
+    array_init(&stream->textures, allocator);
+    array_init(&stream->free_slots, allocator);
+    array_init(&stream->loads, allocator);
+    array_init(&stream->victims, allocator);
+    stream->memory_budget = memory_budget;
+    stream->max_loads_in_flight = MAX(max_loads_in_flight, 1);
+}
+
+EXTERNAL void texture_stream_deinit(Texture_Stream* stream)
+{
+    array_deinit(&stream->textures);
+    array_deinit(&stream->free_slots);
+    array_deinit(&stream->loads);
+    array_deinit(&stream->victims);
+    memset(stream, 0, sizeof *stream);
+}
+
+EXTERNAL isize texture_stream_mip_size(const Texture_Stream_Texture* texture, i32 mip)
+{
+    isize width = MAX(texture->width >> mip, 1);
+    isize height = MAX(texture->height >> mip, 1);
+    return (width * height * texture->bits_per_pixel + 7) / 8;
+}
+
+EXTERNAL i32 texture_stream_tail_mip(i32 width, i32 height, i32 mip_count)
+{
+    i32 mip = 0;
+    while(mip < mip_count - 1 && MAX(width, height) >> mip > TEXTURE_STREAM_TAIL_DIM)
+        mip += 1;
+    return mip;
+}
+
+EXTERNAL i32 texture_stream_wanted_mip(const Texture_Stream_Texture* texture, f32 footprint)
+{
+    //The finest mip with at most one texel per pixel rounded to the sharper one
+    if(footprint < 1)
+        return texture->tail_mip;
+
+    f32 texels_per_pixel = (f32) MAX(texture->width, texture->height) / footprint;
+    i32 mip = texels_per_pixel > 1 ? (i32) floorf(log2f(texels_per_pixel)) : 0;
+    return CLAMP(mip, 0, texture->tail_mip);
+}
+
+INTERNAL void _texture_stream_record(Texture_Stream* stream, Texture_Stream_Trace_Type type, i32 texture, f32 footprint)
+{
+    if(stream->trace)
+    {
+        const Texture_Stream_Texture* tex = &stream->textures.data[texture];
+        Texture_Stream_Trace_Entry entry = {stream->frame, type, texture, tex->width, tex->height, tex->mip_count, tex->bits_per_pixel, footprint};
+        array_push(stream->trace, entry);
+    }
+}
+
+INTERNAL void _texture_stream_memory_add(Texture_Stream* stream, isize size)
+{
+    stream->memory_used += size;
+    stream->stats.max_memory_used = MAX(stream->stats.max_memory_used, stream->memory_used);
+}
+
+EXTERNAL i32 texture_stream_add(Texture_Stream* stream, i32 width, i32 height, i32 mip_count, i32 bits_per_pixel)
+{
+    ASSERT(width > 0 && height > 0 && mip_count > 0 && bits_per_pixel > 0);
+    Texture_Stream_Texture texture = {0};
+    texture.width = width;
+    texture.height = height;
+    texture.mip_count = mip_count;
+    texture.bits_per_pixel = bits_per_pixel;
+    texture.loading_mip = -1;
+    texture.is_alive = true;
+    texture.last_used_frame = -1;
+
+    texture.tail_mip = texture_stream_tail_mip(width, height, mip_count);
+    texture.resident_mip = texture.tail_mip;
+    texture.wanted_mip = texture.tail_mip;
+
+    for(i32 mip = texture.tail_mip; mip < mip_count; mip++)
+        _texture_stream_memory_add(stream, texture_stream_mip_size(&texture, mip));
+
+    i32 index = 0;
+    if(stream->free_slots.len > 0)
+    {
+        index = stream->free_slots.data[stream->free_slots.len - 1];
+        stream->free_slots.len -= 1;
+        stream->textures.data[index] = texture;
+    }
+    else
+    {
+        index = (i32) stream->textures.len;
+        array_push(&stream->textures, texture);
+    }
+
+    _texture_stream_record(stream, TEXTURE_STREAM_TRACE_ADD, index, 0);
+    return index;
+}
+
+EXTERNAL void texture_stream_remove(Texture_Stream* stream, i32 texture)
+{
+    ASSERT_BOUNDS(texture, stream->textures.len);
+    Texture_Stream_Texture* tex = &stream->textures.data[texture];
+    ASSERT(tex->is_alive);
+    _texture_stream_record(stream, TEXTURE_STREAM_TRACE_REMOVE, texture, 0);
+
+    for(i32 mip = tex->resident_mip; mip < tex->mip_count; mip++)
+        stream->memory_used -= texture_stream_mip_size(tex, mip);
+
+    tex->is_alive = false;
+    tex->resident_mip = tex->mip_count;
+    if(tex->loading_mip == -1)
+        array_push(&stream->free_slots, texture);
+}
+
+EXTERNAL void texture_stream_begin_frame(Texture_Stream* stream)
+{
+    stream->frame += 1;
+}
+
+EXTERNAL void texture_stream_report(Texture_Stream* stream, i32 texture, f32 footprint)
+{
+    ASSERT_BOUNDS(texture, stream->textures.len);
+    Texture_Stream_Texture* tex = &stream->textures.data[texture];
+    ASSERT(tex->is_alive);
+    _texture_stream_record(stream, TEXTURE_STREAM_TRACE_REPORT, texture, footprint);
+
+    if(tex->last_used_frame != stream->frame)
+    {
+        tex->last_used_frame = stream->frame;
+        tex->footprint = 0;
+    }
+
+    tex->footprint = MAX(tex->footprint, footprint);
+    tex->wanted_mip = texture_stream_wanted_mip(tex, tex->footprint);
+}
+
+EXTERNAL void texture_stream_loaded(Texture_Stream* stream, i32 texture, i32 mip)
+{
+    ASSERT_BOUNDS(texture, stream->textures.len);
+    Texture_Stream_Texture* tex = &stream->textures.data[texture];
+    ASSERT(tex->loading_mip == mip, "only the issued mip can be loaded");
+
+    tex->loading_mip = -1;
+    stream->loads_in_flight -= 1;
+    if(tex->is_alive)
+        tex->resident_mip = mip;
+    else
+    {
+        stream->memory_used -= texture_stream_mip_size(tex, mip);
+        array_push(&stream->free_slots, texture);
+    }
+}
+
+EXTERNAL void texture_stream_load_failed(Texture_Stream* stream, i32 texture, i32 mip)
+{
+    ASSERT_BOUNDS(texture, stream->textures.len);
+    Texture_Stream_Texture* tex = &stream->textures.data[texture];
+    ASSERT(tex->loading_mip == mip, "only the issued mip can fail");
+
+    tex->loading_mip = -1;
+    stream->loads_in_flight -= 1;
+    stream->memory_used -= texture_stream_mip_size(tex, mip);
+    stream->stats.failed_loads += 1;
+    if(tex->is_alive == false)
+        array_push(&stream->free_slots, texture);
+}
+
+//Loads: the blurriest first then the largest on screen
+INTERNAL int _texture_stream_load_compare(const void* a_, const void* b_)
+{
+    const _Texture_Stream_Candidate* a = (const _Texture_Stream_Candidate*) a_;
+    const _Texture_Stream_Candidate* b = (const _Texture_Stream_Candidate*) b_;
+    if(a->priority != b->priority)
+        return a->priority > b->priority ? -1 : 1;
+    if(a->footprint != b->footprint)
+        return a->footprint > b->footprint ? -1 : 1;
+    return (a->texture > b->texture) - (a->texture < b->texture);
+}
+
+//Victims: the ones with mips finer than wanted first then the least recently used
+INTERNAL int _texture_stream_victim_compare(const void* a_, const void* b_)
+{
+    const _Texture_Stream_Candidate* a = (const _Texture_Stream_Candidate*) a_;
+    const _Texture_Stream_Candidate* b = (const _Texture_Stream_Candidate*) b_;
+    if(a->priority != b->priority)
+        return a->priority < b->priority ? -1 : 1;
+    if(a->last_used_frame != b->last_used_frame)
+        return a->last_used_frame < b->last_used_frame ? -1 : 1;
+    return (a->texture > b->texture) - (a->texture < b->texture);
+}
+
+INTERNAL bool _texture_stream_is_evictable(const Texture_Stream* stream, const Texture_Stream_Texture* tex)
+{
+    if(tex->is_alive == false || tex->loading_mip != -1 || tex->resident_mip >= tex->tail_mip)
+        return false;
+
+    return tex->last_used_frame != stream->frame || tex->resident_mip < tex->wanted_mip;
+}
+
+EXTERNAL void texture_stream_update(Texture_Stream* stream, Texture_Stream_Event_Array* events)
+{
+    array_clear(&stream->loads);
+    array_clear(&stream->victims);
+    for(isize i = 0; i < stream->textures.len; i++)
+    {
+        const Texture_Stream_Texture* tex = &stream->textures.data[i];
+        if(tex->is_alive && tex->last_used_frame == stream->frame && tex->loading_mip == -1 && tex->wanted_mip < tex->resident_mip)
+        {
+            _Texture_Stream_Candidate load = {(i32) i, tex->resident_mip - tex->wanted_mip, tex->footprint, 0, tex->last_used_frame};
+            array_push(&stream->loads, load);
+        }
+
+        if(_texture_stream_is_evictable(stream, tex))
+        {
+            _Texture_Stream_Candidate victim = {(i32) i, tex->resident_mip < tex->wanted_mip ? 0 : 1, tex->footprint, 0, tex->last_used_frame};
+            array_push(&stream->victims, victim);
+        }
+    }
+
+    qsort(stream->loads.data, (size_t) stream->loads.len, sizeof *stream->loads.data, _texture_stream_load_compare);
+    qsort(stream->victims.data, (size_t) stream->victims.len, sizeof *stream->victims.data, _texture_stream_victim_compare);
+
+    isize victim_i = 0;
+    for(isize i = 0; i < stream->loads.len && stream->loads_in_flight < stream->max_loads_in_flight; i++)
+    {
+        Texture_Stream_Texture* tex = &stream->textures.data[stream->loads.data[i].texture];
+        i32 mip = tex->resident_mip - 1;
+        isize size = texture_stream_mip_size(tex, mip);
+
+        //Evict until the load fits. Each victim is drained as far as it goes before moving on.
+        while(stream->memory_used + size > stream->memory_budget && victim_i < stream->victims.len)
+        {
+            i32 victim_index = stream->victims.data[victim_i].texture;
+            Texture_Stream_Texture* victim = &stream->textures.data[victim_index];
+            if(_texture_stream_is_evictable(stream, victim) == false)
+            {
+                victim_i += 1;
+                continue;
+            }
+
+            Texture_Stream_Event evict = {TEXTURE_STREAM_EVICT, victim_index, victim->resident_mip};
+            array_push(events, evict);
+
+            isize evicted_size = texture_stream_mip_size(victim, victim->resident_mip);
+            stream->memory_used -= evicted_size;
+            stream->stats.evicted_bytes += evicted_size;
+            stream->stats.evictions += 1;
+            victim->resident_mip += 1;
+        }
+
+        if(stream->memory_used + size > stream->memory_budget)
+        {
+            stream->stats.waited_loads += stream->loads.len - i;
+            break;
+        }
+
+        Texture_Stream_Event load = {TEXTURE_STREAM_LOAD, stream->loads.data[i].texture, mip};
+        array_push(events, load);
+
+        tex->loading_mip = mip;
+        stream->loads_in_flight += 1;
+        stream->stats.loads += 1;
+        stream->stats.loaded_bytes += size;
+        _texture_stream_memory_add(stream, size);
+    }
+}
+
+#endif
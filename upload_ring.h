@@ -0,0 +1,142 @@
+#ifndef LIB_UPLOAD_RING
+#define LIB_UPLOAD_RING
+
+// Ring of memory for uploading per frame data to the gpu.
+//
+// The memory is split into UPLOAD_RING_FRAMES equally sized parts, one per frame in flight.
+// Each frame allocates linearly from its part. When the frame ends a fence is inserted
+// and the part is reused only after the fence is signaled, ie. once the gpu has consumed
+// everything that was written into it UPLOAD_RING_FRAMES frames ago. Thus the cpu never
+// overwrites data the gpu might still be reading and usually never waits either.
+//
+// The memory itself and the fences are supplied from outside. For rendering the memory is
+// a persistently mapped gpu buffer and the fences are gl sync objects. For testing plain
+// memory with no (or counting) fences works just the same.
+
+#include "lib/assert.h"
+#include <string.h>
+
+#define UPLOAD_RING_FRAMES 3
+
+//Fences of the gpu work using the ring.
+//When the functions are NULL all work is considered done immediately.
+typedef struct Upload_Ring_Sync {
+    void* context;
+    //Returns a fence that is signaled once all the work issued so far is done.
+    u64 (*fence_insert)(void* context);
+    //Blocks until the fence is signaled and releases it.
+    void (*fence_wait)(void* context, u64 fence);
+} Upload_Ring_Sync;
+
+typedef struct Upload_Ring_Slice {
+    u8* data; //where to write. NULL if the allocation failed
+    isize offset; //offset of data from the start of the ring memory (for binding)
+} Upload_Ring_Slice;
+
+typedef struct Upload_Ring {
+    u8* memory;
+    isize capacity;
+    isize frame_size;
+
+    Upload_Ring_Sync sync;
+    u64 fences[UPLOAD_RING_FRAMES]; //0 means no fence
+
+    isize frame; //number of frames begun so far
+    isize frame_used; //bytes used in the current frame
+    b32 is_frame_begun;
+    u32 _;
+
+    //stats
+    isize waited_fences;
+    isize failed_allocations;
+} Upload_Ring;
+
+//Memory must be valid for capacity bytes and stay valid until deinit. Does not take ownership.
+EXTERNAL void upload_ring_init(Upload_Ring* ring, void* memory, isize capacity, Upload_Ring_Sync sync);
+//Waits for all fences.
+EXTERNAL void upload_ring_deinit(Upload_Ring* ring);
+
+//Moves to the next part of the ring waiting for its fence if the gpu is not done with it yet.
+EXTERNAL void upload_ring_begin_frame(Upload_Ring* ring);
+//Inserts the fence guarding the current part.
+EXTERNAL void upload_ring_end_frame(Upload_Ring* ring);
+
+//Allocates size bytes with align (power of two) offset. Fails with data == NULL if the frame is out of space.
+EXTERNAL Upload_Ring_Slice upload_ring_alloc(Upload_Ring* ring, isize size, isize align);
+
+#endif
+
+#if (defined(LIB_ALL_IMPL) || defined(LIB_UPLOAD_RING_IMPL)) && !defined(LIB_UPLOAD_RING_HAS_IMPL)
+#define LIB_UPLOAD_RING_HAS_IMPL
+
+EXTERNAL void upload_ring_init(Upload_Ring* ring, void* memory, isize capacity, Upload_Ring_Sync sync)
+{
+    memset(ring, 0, sizeof *ring);
+    ring->memory = (u8*) memory;
+    ring->capacity = capacity;
+    ring->frame_size = capacity / UPLOAD_RING_FRAMES;
+    ring->sync = sync;
+}
+
+INTERNAL void _upload_ring_wait(Upload_Ring* ring, isize part)
+{
+    u64 fence = ring->fences[part];
+    if(fence != 0)
+    {
+        if(ring->sync.fence_wait)
+            ring->sync.fence_wait(ring->sync.context, fence);
+        ring->fences[part] = 0;
+        ring->waited_fences += 1;
+    }
+}
+
+EXTERNAL void upload_ring_deinit(Upload_Ring* ring)
+{
+    //Oldest first
+    for(isize i = 0; i < UPLOAD_RING_FRAMES; i++)
+        _upload_ring_wait(ring, (ring->frame + i) % UPLOAD_RING_FRAMES);
+
+    memset(ring, 0, sizeof *ring);
+}
+
+EXTERNAL void upload_ring_begin_frame(Upload_Ring* ring)
+{
+    ASSERT(ring->is_frame_begun == false, "upload_ring_end_frame must be called before beginning a new frame");
+    _upload_ring_wait(ring, ring->frame % UPLOAD_RING_FRAMES);
+    ring->frame_used = 0;
+    ring->is_frame_begun = true;
+}
+
+EXTERNAL void upload_ring_end_frame(Upload_Ring* ring)
+{
+    ASSERT(ring->is_frame_begun);
+    isize part = ring->frame % UPLOAD_RING_FRAMES;
+    ASSERT(ring->fences[part] == 0);
+    if(ring->sync.fence_insert)
+        ring->fences[part] = ring->sync.fence_insert(ring->sync.context);
+
+    ring->frame += 1;
+    ring->is_frame_begun = false;
+}
+
+EXTERNAL Upload_Ring_Slice upload_ring_alloc(Upload_Ring* ring, isize size, isize align)
+{
+    ASSERT(ring->is_frame_begun, "allocations must happen between upload_ring_begin_frame and upload_ring_end_frame");
+    ASSERT(size >= 0 && align > 0 && (align & (align - 1)) == 0);
+
+    Upload_Ring_Slice slice = {0};
+    isize frame_start = (ring->frame % UPLOAD_RING_FRAMES) * ring->frame_size;
+    isize offset = (frame_start + ring->frame_used + align - 1) & ~(align - 1);
+    if(offset + size > frame_start + ring->frame_size)
+    {
+        ring->failed_allocations += 1;
+        return slice;
+    }
+
+    slice.data = ring->memory + offset;
+    slice.offset = offset;
+    ring->frame_used = offset + size - frame_start;
+    return slice;
+}
+
+#endif
@@ -0,0 +1,324 @@
+#ifndef LIB_VERTEX_PACK
+#define LIB_VERTEX_PACK
+
+// A compact 20 byte alternative to the 44 byte Vertex for storing geometry on the gpu.
+//
+// pos  - 3x unorm16 relative to the AABB of the geometry. The gpu reads them as [0, 1]
+//        and the renderer folds bounds.min + pos*(bounds.max - bounds.min) into the model matrix.
+// uv   - 2x half float.
+// norm - octahedral encoded into 2x snorm16. The shader decodes it.
+// tan  - same as norm.
+//
+// With 16 bits the position error is at most 1/131070 of the extent of the bounds along each
+// axis. Normals have error below 0.03 degrees. vertex_pack_error measures the exact errors
+// for the given data.
+
+#include "engine_types.h"
+
+typedef struct Packed_Vertex {
+    u16 pos[3];
+    u16 _;
+    u16 uv[2];
+    i16 norm[2];
+    i16 tan[2];
+} Packed_Vertex;
+
+typedef Array(Packed_Vertex) Packed_Vertex_Array;
+
+//Maximum and mean errors introduced by packing.
+//Position errors are in the model units, normal and tangent errors are angles in degrees.
+typedef struct Vertex_Pack_Error {
+    f32 max_pos;
+    f32 max_uv;
+    f32 max_norm;
+    f32 max_tan;
+
+    f32 mean_pos;
+    f32 mean_uv;
+    f32 mean_norm;
+    f32 mean_tan;
+} Vertex_Pack_Error;
+
+EXTERNAL AABB vertex_pack_bounds(const Vertex* vertices, isize vertex_count);
+EXTERNAL void vertex_pack(Packed_Vertex* out, const Vertex* vertices, isize vertex_count, AABB bounds);
+EXTERNAL void vertex_unpack(Vertex* out, const Packed_Vertex* vertices, isize vertex_count, AABB bounds);
+EXTERNAL Vertex_Pack_Error vertex_pack_error(const Vertex* vertices, isize vertex_count, AABB bounds);
+
+EXTERNAL u16 f32_to_f16(f32 value);
+EXTERNAL f32 f16_to_f32(u16 value);
+
+#endif
+
+#if (defined(LIB_ALL_IMPL) || defined(LIB_VERTEX_PACK_IMPL)) && !defined(LIB_VERTEX_PACK_HAS_IMPL)
+#define LIB_VERTEX_PACK_HAS_IMPL
+
+INTERNAL u32 _vertex_pack_f32_bits(f32 value)
+{
+    u32 bits = 0;
+    memcpy(&bits, &value, sizeof bits);
+    return bits;
+}
+
+INTERNAL f32 _vertex_pack_f32_from_bits(u32 bits)
+{
+    f32 value = 0;
+    memcpy(&value, &bits, sizeof bits);
+    return value;
+}
+
+//Rounds to nearest even. Overflows to infinity. (Based on the well known branchy version by F. Giesen)
+EXTERNAL u16 f32_to_f16(f32 value)
+{
+    const u32 f16_max = (127 + 16) << 23;       //smallest float that is too big for half
+    const u32 f16_min_normal = (127 - 14) << 23;
+    const u32 denorm_magic = ((127 - 15) + (23 - 10) + 1) << 23;
+
+    u32 bits = _vertex_pack_f32_bits(value);
+    u32 sign = (bits >> 16) & 0x8000;
+    u32 abs = bits & 0x7FFFFFFF;
+    u32 out = 0;
+
+    if(abs >= f16_max)
+        out = abs > 0x7F800000 ? 0x7E00 : 0x7C00; //NaN stays NaN, rest is infinity
+    else if(abs < f16_min_normal)
+    {
+        //Let the fpu do the rounding of the denormal by adding a number whose
+        // ulp is exactly the smallest half denormal
+        f32 shifted = _vertex_pack_f32_from_bits(abs) + _vertex_pack_f32_from_bits(denorm_magic);
+        out = _vertex_pack_f32_bits(shifted) - denorm_magic;
+    }
+    else
+    {
+        u32 mantissa_odd = (abs >> 13) & 1;
+        abs += ((u32) (15 - 127) << 23) + 0xFFF;
+        abs += mantissa_odd;
+        out = abs >> 13;
+    }
+
+    return (u16) (out | sign);
+}
+
+EXTERNAL f32 f16_to_f32(u16 value)
+{
+    const u32 shifted_exponent = 0x7C00 << 13;
+    u32 out = (u32) (value & 0x7FFF) << 13;
+    u32 exponent = out & shifted_exponent;
+    out += (127 - 15) << 23;
+
+    if(exponent == shifted_exponent)
+        out += (128 - 16) << 23;    //Inf or NaN
+    else if(exponent == 0)
+    {
+        //Denormal. Renormalize using the fpu.
+        out += 1 << 23;
+        out = _vertex_pack_f32_bits(_vertex_pack_f32_from_bits(out) - _vertex_pack_f32_from_bits(113 << 23));
+    }
+
+    return _vertex_pack_f32_from_bits(out | (u32) (value & 0x8000) << 16);
+}
+
+INTERNAL f32 _vertex_pack_sign(f32 value)
+{
+    return value >= 0 ? 1.0f : -1.0f;
+}
+
+INTERNAL Vec3 _vertex_pack_oct_decode(i16 x, i16 y)
+{
+    Vec3 out = {0};
+    out.x = MAX((f32) x / 32767.0f, -1.0f);
+    out.y = MAX((f32) y / 32767.0f, -1.0f);
+    out.z = 1.0f - fabsf(out.x) - fabsf(out.y);
+    if(out.z < 0)
+    {
+        f32 folded_x = (1.0f - fabsf(out.y)) * _vertex_pack_sign(out.x);
+        f32 folded_y = (1.0f - fabsf(out.x)) * _vertex_pack_sign(out.y);
+        out.x = folded_x;
+        out.y = folded_y;
+    }
+
+    f32 len = sqrtf(out.x*out.x + out.y*out.y + out.z*out.z);
+    out.x /= len;
+    out.y /= len;
+    out.z /= len;
+    return out;
+}
+
+//Projects onto the octahedron, unfolds the lower half and quantizes. Because the plain rounding
+// is not always the closest to the original direction we also try the neighbouring values.
+INTERNAL void _vertex_pack_oct_encode(i16 out[2], Vec3 dir)
+{
+    f32 l1 = fabsf(dir.x) + fabsf(dir.y) + fabsf(dir.z);
+    if(l1 <= 0)
+    {
+        out[0] = 0;
+        out[1] = 0;
+        return;
+    }
+
+    f32 x = dir.x / l1;
+    f32 y = dir.y / l1;
+    if(dir.z < 0)
+    {
+        f32 folded_x = (1.0f - fabsf(y)) * _vertex_pack_sign(x);
+        f32 folded_y = (1.0f - fabsf(x)) * _vertex_pack_sign(y);
+        x = folded_x;
+        y = folded_y;
+    }
+
+    f32 dir_len = sqrtf(dir.x*dir.x + dir.y*dir.y + dir.z*dir.z);
+    f32 qx = floorf(CLAMP(x, -1.0f, 1.0f) * 32767.0f);
+    f32 qy = floorf(CLAMP(y, -1.0f, 1.0f) * 32767.0f);
+
+    f32 best_dot = -2;
+    for(i32 dx = 0; dx <= 1; dx++)
+        for(i32 dy = 0; dy <= 1; dy++)
+        {
+            i16 cx = (i16) CLAMP(qx + (f32) dx, -32767.0f, 32767.0f);
+            i16 cy = (i16) CLAMP(qy + (f32) dy, -32767.0f, 32767.0f);
+            Vec3 decoded = _vertex_pack_oct_decode(cx, cy);
+            f32 dot = (decoded.x*dir.x + decoded.y*dir.y + decoded.z*dir.z) / dir_len;
+            if(dot > best_dot)
+            {
+                best_dot = dot;
+                out[0] = cx;
+                out[1] = cy;
+            }
+        }
+}
+
+INTERNAL u16 _vertex_pack_unorm16(f32 value, f32 min, f32 inv_extent)
+{
+    f32 normalized = (value - min) * inv_extent;
+    return (u16) (CLAMP(normalized, 0.0f, 1.0f) * 65535.0f + 0.5f);
+}
+
+EXTERNAL AABB vertex_pack_bounds(const Vertex* vertices, isize vertex_count)
+{
+    AABB bounds = {0};
+    if(vertex_count > 0)
+    {
+        bounds.min = vertices[0].pos;
+        bounds.max = vertices[0].pos;
+    }
+
+    for(isize i = 1; i < vertex_count; i++)
+    {
+        Vec3 pos = vertices[i].pos;
+        bounds.min.x = MIN(bounds.min.x, pos.x);
+        bounds.min.y = MIN(bounds.min.y, pos.y);
+        bounds.min.z = MIN(bounds.min.z, pos.z);
+        bounds.max.x = MAX(bounds.max.x, pos.x);
+        bounds.max.y = MAX(bounds.max.y, pos.y);
+        bounds.max.z = MAX(bounds.max.z, pos.z);
+    }
+
+    return bounds;
+}
+
+EXTERNAL void vertex_pack(Packed_Vertex* out, const Vertex* vertices, isize vertex_count, AABB bounds)
+{
+    PROFILE_SCOPE()
+    {
+        //Flat axes get zero extent. Their inv_extent is zero so everything packs to 0 = bounds.min.
+        Vec3 extent = vec3_sub(bounds.max, bounds.min);
+        f32 inv_x = extent.x > 0 ? 1.0f / extent.x : 0;
+        f32 inv_y = extent.y > 0 ? 1.0f / extent.y : 0;
+        f32 inv_z = extent.z > 0 ? 1.0f / extent.z : 0;
+
+        for(isize i = 0; i < vertex_count; i++)
+        {
+            const Vertex* in = &vertices[i];
+            Packed_Vertex packed = {0};
+            packed.pos[0] = _vertex_pack_unorm16(in->pos.x, bounds.min.x, inv_x);
+            packed.pos[1] = _vertex_pack_unorm16(in->pos.y, bounds.min.y, inv_y);
+            packed.pos[2] = _vertex_pack_unorm16(in->pos.z, bounds.min.z, inv_z);
+            packed.uv[0] = f32_to_f16(in->uv.x);
+            packed.uv[1] = f32_to_f16(in->uv.y);
+            _vertex_pack_oct_encode(packed.norm, in->norm);
+            _vertex_pack_oct_encode(packed.tan, in->tan);
+            out[i] = packed;
+        }
+    }
+}
+
+EXTERNAL void vertex_unpack(Vertex* out, const Packed_Vertex* vertices, isize vertex_count, AABB bounds)
+{
+    PROFILE_SCOPE()
+    {
+        Vec3 extent = vec3_sub(bounds.max, bounds.min);
+        for(isize i = 0; i < vertex_count; i++)
+        {
+            const Packed_Vertex* in = &vertices[i];
+            Vertex vertex = {0};
+            vertex.pos.x = bounds.min.x + (f32) in->pos[0] / 65535.0f * extent.x;
+            vertex.pos.y = bounds.min.y + (f32) in->pos[1] / 65535.0f * extent.y;
+            vertex.pos.z = bounds.min.z + (f32) in->pos[2] / 65535.0f * extent.z;
+            vertex.uv.x = f16_to_f32(in->uv[0]);
+            vertex.uv.y = f16_to_f32(in->uv[1]);
+            vertex.norm = _vertex_pack_oct_decode(in->norm[0], in->norm[1]);
+            vertex.tan = _vertex_pack_oct_decode(in->tan[0], in->tan[1]);
+            out[i] = vertex;
+        }
+    }
+}
+
+INTERNAL f32 _vertex_pack_angle_error(Vec3 original, Vec3 decoded)
+{
+    f32 len = vec3_len(original);
+    if(len <= 0)
+        return 0;
+
+    f32 cos_angle = vec3_dot(original, decoded) / len;
+    return acosf(CLAMP(cos_angle, -1.0f, 1.0f)) * (360.0f / (f32) TAU);
+}
+
+EXTERNAL Vertex_Pack_Error vertex_pack_error(const Vertex* vertices, isize vertex_count, AABB bounds)
+{
+    Vertex_Pack_Error error = {0};
+    PROFILE_SCOPE()
+    {
+        //Measures in blocks so that we dont need any extra memory
+        enum {BLOCK = 256};
+        Packed_Vertex packed[BLOCK];
+        Vertex unpacked[BLOCK];
+
+        f64 sum_pos = 0;
+        f64 sum_uv = 0;
+        f64 sum_norm = 0;
+        f64 sum_tan = 0;
+        for(isize from = 0; from < vertex_count; from += BLOCK)
+        {
+            isize count = MIN(vertex_count - from, BLOCK);
+            vertex_pack(packed, vertices + from, count, bounds);
+            vertex_unpack(unpacked, packed, count, bounds);
+
+            for(isize i = 0; i < count; i++)
+            {
+                const Vertex* original = &vertices[from + i];
+                const Vertex* decoded = &unpacked[i];
+                f32 pos = vec3_len(vec3_sub(original->pos, decoded->pos));
+                f32 uv = MAX(fabsf(original->uv.x - decoded->uv.x), fabsf(original->uv.y - decoded->uv.y));
+                f32 norm = _vertex_pack_angle_error(original->norm, decoded->norm);
+                f32 tan = _vertex_pack_angle_error(original->tan, decoded->tan);
+
+                error.max_pos = MAX(error.max_pos, pos);
+                error.max_uv = MAX(error.max_uv, uv);
+                error.max_norm = MAX(error.max_norm, norm);
+                error.max_tan = MAX(error.max_tan, tan);
+                sum_pos += pos;
+                sum_uv += uv;
+                sum_norm += norm;
+                sum_tan += tan;
+            }
+        }
+
+        f64 count = (f64) MAX(vertex_count, 1);
+        error.mean_pos = (f32) (sum_pos / count);
+        error.mean_uv = (f32) (sum_uv / count);
+        error.mean_norm = (f32) (sum_norm / count);
+        error.mean_tan = (f32) (sum_tan / count);
+    }
+    return error;
+}
+
+#endif